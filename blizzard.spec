@@ -6,7 +6,7 @@ License: 	BSD
 Source: 	blizzard-%{version}.tar.gz
 Group:		Networking/Daemons
 BuildRoot: 	%{_tmppath}/%{name}-%{version}-%{release}-root-%(%{__id_u} -n)
-BuildRequires:	libev-devel cmake gcc-c++
+BuildRequires:	libev-devel zlib-devel cmake gcc-c++
 
 %package devel
 Summary:	Header files and development documentation for %{name}
@@ -40,6 +40,8 @@ rm -rf %{buildroot}
 %files
 %defattr(-,root,root,-)
 %{_bindir}/blizzard
+%{_bindir}/blizzard-bench
+%{_bindir}/blizzard-plugin-bench
 %{_prefix}/etc/blizzard/config.xml
 %{_prefix}/etc/blzmod_example/config.xml
 %{_prefix}/etc/blzmod_example/config_module.xml
@@ -48,6 +50,8 @@ rm -rf %{buildroot}
 %files devel
 %defattr(-,root,root,-)
 %{_includedir}/blizzard
+%{_includedir}/blizzard-mock
+%{_libdir}/libblizzard-mock.a
 
 %changelog
 * Sun Jul 27 2014 Alexander Pankov <pianist@usrsrc.ru> - 0.3.4-0
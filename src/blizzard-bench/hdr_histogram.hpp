@@ -0,0 +1,127 @@
+#ifndef __BLIZZARD_BENCH_HDR_HISTOGRAM_HPP__
+#define __BLIZZARD_BENCH_HDR_HISTOGRAM_HPP__
+
+#include <stdint.h>
+#include <vector>
+
+namespace blizzard {
+namespace bench {
+
+/* HDR histogram of latencies in microseconds: every power of two is split into SUB_BUCKETS,
+ * so values are kept with 2 significant digits (error < 1%) up to 2^MAX_EXPONENT usec.
+ * One per worker thread, merged by add() at the end. */
+
+class hdr_histogram
+{
+public:
+	enum {SUB_BITS = 7};
+	enum {SUB_BUCKETS = 1 << SUB_BITS};
+	enum {MAX_EXPONENT = 40};
+	enum {BUCKETS = SUB_BUCKETS + (MAX_EXPONENT - SUB_BITS + 1) * SUB_BUCKETS};
+
+private:
+	std::vector<uint64_t> counts;
+	uint64_t total;
+	uint64_t sum;
+	uint64_t min_value;
+	uint64_t max_value;
+
+	static int bucket(uint64_t v)
+	{
+		if (v < SUB_BUCKETS)
+		{
+			return (int) v;
+		}
+
+		int e = 63 - __builtin_clzll(v);
+
+		if (e > MAX_EXPONENT)
+		{
+			return BUCKETS - 1;
+		}
+
+		return SUB_BUCKETS + (e - SUB_BITS) * SUB_BUCKETS + (int) ((v >> (e - SUB_BITS)) & (SUB_BUCKETS - 1));
+	}
+
+	/* the greatest value counted in the bucket */
+	static uint64_t bucket_max(int idx)
+	{
+		if (idx < SUB_BUCKETS)
+		{
+			return idx;
+		}
+
+		int e = SUB_BITS + (idx - SUB_BUCKETS) / SUB_BUCKETS;
+		uint64_t m = SUB_BUCKETS + (idx - SUB_BUCKETS) % SUB_BUCKETS;
+
+		return ((m + 1) << (e - SUB_BITS)) - 1;
+	}
+
+public:
+	hdr_histogram()
+		: counts(BUCKETS, 0)
+		, total(0)
+		, sum(0)
+		, min_value(UINT64_MAX)
+		, max_value(0)
+	{}
+
+	void record(uint64_t v)
+	{
+		counts[bucket(v)]++;
+		total++;
+		sum += v;
+
+		if (v < min_value) min_value = v;
+		if (v > max_value) max_value = v;
+	}
+
+	void add(const hdr_histogram &h)
+	{
+		for (int i = 0; i < BUCKETS; i++) counts[i] += h.counts[i];
+
+		total += h.total;
+		sum += h.sum;
+
+		if (h.min_value < min_value) min_value = h.min_value;
+		if (h.max_value > max_value) max_value = h.max_value;
+	}
+
+	uint64_t count() const { return total; }
+	uint64_t min() const { return total ? min_value : 0; }
+	uint64_t max() const { return max_value; }
+	double mean() const { return total ? sum / (double) total : 0; }
+
+	/* q is in [0, 1], e.g. 0.999 for p99.9 */
+	uint64_t percentile(double q) const
+	{
+		if (0 == total)
+		{
+			return 0;
+		}
+
+		uint64_t rank = (uint64_t) (q * total + 0.5);
+
+		if (rank < 1) rank = 1;
+		if (rank > total) rank = total;
+
+		uint64_t seen = 0;
+
+		for (int i = 0; i < BUCKETS; i++)
+		{
+			seen += counts[i];
+
+			if (seen >= rank)
+			{
+				/* the exact maximum is known, it is better than the bucket bound */
+				return bucket_max(i) < max_value ? bucket_max(i) : max_value;
+			}
+		}
+
+		return max_value;
+	}
+};
+
+}}
+
+#endif /* __BLIZZARD_BENCH_HDR_HISTOGRAM_HPP__ */
@@ -0,0 +1,508 @@
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <coda/error.hpp>
+#include <blizzard/histogram.hpp>
+#include "worker.hpp"
+
+using namespace blizzard::bench;
+
+enum {REPLAY_DEADLINE = 10}; /* seconds after the last captured request to wait for answers */
+
+static const double percentiles[] = {0.5, 0.75, 0.9, 0.99, 0.999, 0.9999};
+static const char *percentile_names[] = {"p50", "p75", "p90", "p99", "p99.9", "p99.99"};
+enum {PERCENTILES = sizeof(percentiles) / sizeof(percentiles[0])};
+
+struct thread_arg
+{
+	worker *w;
+	uint64_t start;
+	uint64_t warmup_end;
+	uint64_t end;
+};
+
+static void *worker_function(void *ptr)
+{
+	thread_arg *arg = (thread_arg *) ptr;
+	arg->w->run(arg->start, arg->warmup_end, arg->end);
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -H, --host=HOST        - server address (127.0.0.1)\n"
+		"  -p, --port=PORT        - server port (19999)\n"
+		"  -t, --threads=N        - threads of the bench (2)\n"
+		"  -c, --connections=N    - connections of all threads (16)\n"
+		"  -d, --duration=SEC     - measured time (10)\n"
+		"  -w, --warmup=SEC       - time before measuring (1)\n"
+		"  -r, --rate=RPS         - open loop at constant rate of all threads,\n"
+		"                           closed loop if 0 (default)\n"
+		"  -k, --keep-alive       - send more than one request per connection\n"
+		"  -P, --pipeline=N       - requests in flight per connection, needs -k (1)\n"
+		"  -X, --rpc              - binary RPC of <rpc_port> instead of HTTP, keep-alive\n"
+		"  -u, --uri=URI          - request URI (/100)\n"
+		"  -m, --method=METHOD    - request method (GET)\n"
+		"  -b, --body=FILE        - request body, e.g. for POST\n"
+		"  -f, --templates=FILE   - requests from templates file instead of -u, -m, -b\n"
+		"  -l, --latency          - print latency percentiles distribution\n"
+		"  -R, --replay=FILE      - send requests of a capture file of the server at their\n"
+		"                           captured times instead of -d, -r and templates\n"
+		"  -s, --speed=X          - replay X times faster than captured (1)\n"
+		"  -o, --output=FILE      - write the summary as json, e.g. for --baseline\n"
+		"  -B, --baseline=FILE    - compare with the json summary of an earlier run\n"
+		"  -L, --label=LABEL      - label of the run in json, e.g. build or plugin version\n"
+		, name);
+}
+
+static void load_body(const char *file_name, std::string &body)
+{
+	std::ifstream in(file_name, std::ios::binary);
+
+	if (!in)
+	{
+		throw coda_error("can't open body file %s", file_name);
+	}
+
+	std::ostringstream s;
+	s << in.rdbuf();
+	body = s.str();
+}
+
+static void resolve(const char *host, const char *port, struct sockaddr_in &addr)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	struct addrinfo *ai = 0;
+	int r = getaddrinfo(host, port, &hints, &ai);
+
+	if (0 != r)
+	{
+		throw coda_error("can't resolve %s:%s: %s", host, port, gai_strerror(r));
+	}
+
+	memcpy(&addr, ai->ai_addr, sizeof(addr));
+	freeaddrinfo(ai);
+}
+
+/* spectrum of percentiles like HdrHistogram prints: 5 steps in every halving of the rest */
+static void print_distribution(const hdr_histogram &h)
+{
+	enum {TICKS = 5};
+
+	printf("\n%12s %14s %12s %12s\n", "Value(usec)", "Percentile", "TotalCount", "1/(1-Percentile)");
+
+	uint64_t total = h.count();
+
+	for (int level = 0; total; level++)
+	{
+		double rest = 1.0 / (1ULL << level);
+
+		for (int t = 0; t < TICKS; t++)
+		{
+			double q = 1.0 - rest * (1.0 - t / (2.0 * TICKS));
+			uint64_t count = (uint64_t) (q * total + 0.5);
+
+			printf("%12llu %14.12f %12llu %12.2f\n", (unsigned long long) h.percentile(q), q, (unsigned long long) count, 1 / (1 - q));
+		}
+
+		if (rest * total < 1)
+		{
+			break;
+		}
+	}
+
+	printf("%12llu %14.12f %12llu %12s\n", (unsigned long long) h.max(), 1.0, (unsigned long long) total, "inf");
+}
+
+static uint64_t errors(const bench_result &r)
+{
+	return r.status[0] + r.status[5] + r.connect_errors + r.read_errors;
+}
+
+static void print_result(const bench_result &r, double seconds, bool distribution)
+{
+	const hdr_histogram &h = r.latency;
+
+	printf("requests:    %llu, %.1f/s, read %.1f KB/s\n"
+		, (unsigned long long) r.requests
+		, r.requests / seconds
+		, r.bytes_read / 1024.0 / seconds);
+
+	printf("responses:   1xx %llu, 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, malformed %llu\n"
+		, (unsigned long long) r.status[1]
+		, (unsigned long long) r.status[2]
+		, (unsigned long long) r.status[3]
+		, (unsigned long long) r.status[4]
+		, (unsigned long long) r.status[5]
+		, (unsigned long long) r.status[0]);
+
+	printf("connections: %llu opened, %llu failed to connect, %llu broken\n"
+		, (unsigned long long) r.connects
+		, (unsigned long long) r.connect_errors
+		, (unsigned long long) r.read_errors);
+
+	printf("requests:    %llu retried on a new connection, %llu unfinished\n"
+		, (unsigned long long) r.retries
+		, (unsigned long long) r.unfinished);
+
+	printf("latency (usec):\n");
+	printf("  min %llu, mean %.1f, max %llu\n", (unsigned long long) h.min(), h.mean(), (unsigned long long) h.max());
+
+	for (int i = 0; i < PERCENTILES; i++)
+	{
+		printf("  %-7s %llu\n", percentile_names[i], (unsigned long long) h.percentile(percentiles[i]));
+	}
+
+	if (distribution)
+	{
+		print_distribution(h);
+	}
+}
+
+static void json_string(FILE *f, const std::string &s)
+{
+	fputc('"', f);
+
+	for (size_t i = 0; i < s.size(); i++)
+	{
+		unsigned char c = s[i];
+
+		if ('"' == c || '\\' == c) fprintf(f, "\\%c", c);
+		else if (c < 0x20) fprintf(f, "\\u%04x", c);
+		else fputc(c, f);
+	}
+
+	fputc('"', f);
+}
+
+static void write_json(const char *file_name, const std::string &label, const char *mode, const bench_result &r, double seconds)
+{
+	FILE *f = fopen(file_name, "w");
+
+	if (!f)
+	{
+		throw coda_error("can't create %s: %s", file_name, strerror(errno));
+	}
+
+	const hdr_histogram &h = r.latency;
+
+	fprintf(f, "{\n  \"label\": ");
+	json_string(f, label);
+	fprintf(f, ",\n  \"mode\": \"%s\",\n  \"seconds\": %.3f,\n  \"requests\": %llu,\n  \"requests_per_sec\": %.1f,\n"
+		, mode, seconds, (unsigned long long) r.requests, r.requests / seconds);
+	fprintf(f, "  \"errors\": %llu,\n  \"unfinished\": %llu,\n  \"latency_usec\": {\"min\": %llu, \"mean\": %.1f"
+		, (unsigned long long) errors(r), (unsigned long long) r.unfinished, (unsigned long long) h.min(), h.mean());
+
+	for (int i = 0; i < PERCENTILES; i++)
+	{
+		fprintf(f, ", \"%s\": %llu", percentile_names[i], (unsigned long long) h.percentile(percentiles[i]));
+	}
+
+	fprintf(f, ", \"max\": %llu}\n}\n", (unsigned long long) h.max());
+
+	if (0 != fclose(f))
+	{
+		throw coda_error("can't write %s: %s", file_name, strerror(errno));
+	}
+}
+
+/* the summary is written by write_json(), keys are unique, so no real parser is needed */
+static double json_number(const std::string &json, const char *key, const char *file_name)
+{
+	std::string k = std::string("\"") + key + "\":";
+	size_t pos = json.find(k);
+
+	if (std::string::npos == pos)
+	{
+		throw coda_error("no \"%s\" in baseline %s", key, file_name);
+	}
+
+	return strtod(json.c_str() + pos + k.size(), NULL);
+}
+
+static void print_change(const char *name, double was, double now)
+{
+	printf("  %-16s %14.1f %14.1f", name, was, now);
+
+	if (was > 0)
+	{
+		printf(" %+9.1f%%\n", 100.0 * (now - was) / was);
+	}
+	else
+	{
+		printf(" %10s\n", "-");
+	}
+}
+
+static void print_comparison(const char *file_name, const bench_result &r, double seconds)
+{
+	std::string json;
+	load_body(file_name, json);
+
+	std::string label;
+	size_t pos = json.find("\"label\": \"");
+
+	if (std::string::npos != pos)
+	{
+		pos += 10;
+		label.assign(json, pos, json.find('"', pos) - pos);
+	}
+
+	const hdr_histogram &h = r.latency;
+
+	printf("\nchange against %s%s%s%s:\n", file_name, label.empty() ? "" : " (", label.c_str(), label.empty() ? "" : ")");
+	printf("  %-16s %14s %14s %10s\n", "", "baseline", "this run", "change");
+
+	print_change("requests/s", json_number(json, "requests_per_sec", file_name), r.requests / seconds);
+	print_change("errors", json_number(json, "errors", file_name), errors(r));
+	print_change("latency mean", json_number(json, "mean", file_name), h.mean());
+
+	for (int i = 0; i < PERCENTILES; i++)
+	{
+		std::string name = std::string("latency ") + percentile_names[i];
+		print_change(name.c_str(), json_number(json, percentile_names[i], file_name), h.percentile(percentiles[i]));
+	}
+
+	print_change("latency max", json_number(json, "max", file_name), h.max());
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] =
+	{
+		{"host",        required_argument, 0, 'H'},
+		{"port",        required_argument, 0, 'p'},
+		{"threads",     required_argument, 0, 't'},
+		{"connections", required_argument, 0, 'c'},
+		{"duration",    required_argument, 0, 'd'},
+		{"warmup",      required_argument, 0, 'w'},
+		{"rate",        required_argument, 0, 'r'},
+		{"keep-alive",  no_argument,       0, 'k'},
+		{"pipeline",    required_argument, 0, 'P'},
+		{"rpc",         no_argument,       0, 'X'},
+		{"uri",         required_argument, 0, 'u'},
+		{"method",      required_argument, 0, 'm'},
+		{"body",        required_argument, 0, 'b'},
+		{"templates",   required_argument, 0, 'f'},
+		{"latency",     no_argument,       0, 'l'},
+		{"replay",      required_argument, 0, 'R'},
+		{"speed",       required_argument, 0, 's'},
+		{"output",      required_argument, 0, 'o'},
+		{"baseline",    required_argument, 0, 'B'},
+		{"label",       required_argument, 0, 'L'},
+		{"help",        no_argument,       0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	bench_config cfg;
+
+	std::string host = "127.0.0.1";
+	std::string port = "19999";
+	const char *templates_file = 0;
+	const char *body_file = 0;
+	const char *replay_file = 0;
+	const char *output_file = 0;
+	const char *baseline_file = 0;
+	std::string label;
+	bool distribution = false;
+
+	request_template t;
+	t.method = "GET";
+	t.uri = "/100";
+
+	int opt;
+
+	while (-1 != (opt = getopt_long(argc, argv, "H:p:t:c:d:w:r:kP:Xu:m:b:f:lR:s:o:B:L:h", options, 0)))
+	{
+		switch (opt)
+		{
+		case 'H': host = optarg; break;
+		case 'p': port = optarg; break;
+		case 't': cfg.threads = atoi(optarg); break;
+		case 'c': cfg.connections = atoi(optarg); break;
+		case 'd': cfg.duration = atoi(optarg); break;
+		case 'w': cfg.warmup = atoi(optarg); break;
+		case 'r': cfg.rate = atof(optarg); break;
+		case 'k': cfg.keep_alive = true; break;
+		case 'P': cfg.depth = atoi(optarg); break;
+		case 'X': cfg.rpc = true; cfg.keep_alive = true; break;
+		case 'u': t.uri = optarg; break;
+		case 'm': t.method = optarg; break;
+		case 'b': body_file = optarg; break;
+		case 'f': templates_file = optarg; break;
+		case 'l': distribution = true; break;
+		case 'R': replay_file = optarg; break;
+		case 's': cfg.speed = atof(optarg); break;
+		case 'o': output_file = optarg; break;
+		case 'B': baseline_file = optarg; break;
+		case 'L': label = optarg; break;
+		default:
+			usage(argv[0]);
+			return 'h' == opt ? 0 : 1;
+		}
+	}
+
+	try
+	{
+		if (0 >= cfg.threads || 0 >= cfg.connections || 0 >= cfg.duration || 0 > cfg.warmup || 0 > cfg.rate || 0 >= cfg.depth || 0 >= cfg.speed)
+		{
+			throw coda_error("threads, connections, duration, pipeline and speed must be positive, warmup and rate must not be negative");
+		}
+
+		if (1 < cfg.depth && !cfg.keep_alive)
+		{
+			throw coda_error("pipelining needs keep-alive (-k)");
+		}
+
+		if (cfg.threads > cfg.connections)
+		{
+			cfg.threads = cfg.connections;
+		}
+
+		resolve(host.c_str(), port.c_str(), cfg.addr);
+
+		replay_info replay;
+
+		if (replay_file)
+		{
+			load_capture(replay_file, cfg.templates, cfg.replay, replay);
+
+			cfg.warmup = 0;
+			cfg.rate = 0;
+		}
+		else if (templates_file)
+		{
+			load_templates(templates_file, cfg.templates);
+		}
+		else
+		{
+			if (body_file)
+			{
+				load_body(body_file, t.body);
+			}
+
+			cfg.templates.push_back(t);
+		}
+
+		for (size_t i = 0; i < cfg.templates.size(); i++)
+		{
+			if (cfg.rpc)
+			{
+				cfg.templates[i].build_rpc();
+			}
+			else
+			{
+				cfg.templates[i].build(host + ":" + port, cfg.keep_alive);
+			}
+		}
+
+		cfg.chooser.init(cfg.templates);
+
+		uint64_t run_time = (cfg.warmup + cfg.duration) * 1000000ULL;
+
+		if (replay_file)
+		{
+			run_time = (uint64_t) (replay.span / cfg.speed) + REPLAY_DEADLINE * 1000000ULL;
+
+			printf("blizzard-bench: %s:%s, %d threads, %d connections, replay, %s, pipeline %d\n"
+				, host.c_str(), port.c_str(), cfg.threads, cfg.connections
+				, cfg.rpc ? "rpc" : (cfg.keep_alive ? "keep-alive" : "connection per request")
+				, cfg.depth);
+
+			printf("replay:      %u requests of %.3f s captured (1 of %u sampled), speed %gx, latency is measured from the scheduled time\n"
+				, (unsigned) cfg.replay.size(), replay.span / 1e6, replay.sample, cfg.speed);
+
+			if (replay.skipped || replay.truncated)
+			{
+				printf("replay:      %llu records are not requests%s\n", (unsigned long long) replay.skipped, replay.truncated ? ", the last one is truncated" : "");
+			}
+		}
+		else
+		{
+			printf("blizzard-bench: %s:%s, %d threads, %d connections, %s, %s, pipeline %d, %d s (+%d s warm-up)\n"
+				, host.c_str(), port.c_str(), cfg.threads, cfg.connections
+				, cfg.rate > 0 ? "open loop" : "closed loop"
+				, cfg.rpc ? "rpc" : (cfg.keep_alive ? "keep-alive" : "connection per request")
+				, cfg.depth, cfg.duration, cfg.warmup);
+		}
+
+		if (cfg.rate > 0)
+		{
+			printf("rate:        %.1f/s, latency is measured from the scheduled time\n", cfg.rate);
+		}
+
+		std::vector<worker *> workers;
+		std::vector<thread_arg> args(cfg.threads);
+		std::vector<pthread_t> threads(cfg.threads);
+
+		for (int i = 0; i < cfg.threads; i++)
+		{
+			int n = cfg.connections / cfg.threads + (i < cfg.connections % cfg.threads ? 1 : 0);
+			workers.push_back(new worker(cfg, n, i));
+		}
+
+		uint64_t start = blizzard::monotonic_usec();
+
+		for (int i = 0; i < cfg.threads; i++)
+		{
+			args[i].w = workers[i];
+			args[i].start = start;
+			args[i].warmup_end = start + cfg.warmup * 1000000ULL;
+			args[i].end = start + run_time;
+
+			int r = pthread_create(&threads[i], NULL, &worker_function, &args[i]);
+
+			if (0 != r)
+			{
+				throw coda_error("error creating thread: %s", strerror(r));
+			}
+		}
+
+		bench_result total;
+
+		for (int i = 0; i < cfg.threads; i++)
+		{
+			pthread_join(threads[i], NULL);
+
+			total.add(workers[i]->result());
+			delete workers[i];
+		}
+
+		/* replay is over when all the requests are answered */
+		double seconds = replay_file ? (blizzard::monotonic_usec() - start) / 1e6 : cfg.duration;
+
+		print_result(total, seconds, distribution);
+
+		if (output_file)
+		{
+			write_json(output_file, label, replay_file ? "replay" : (cfg.rate > 0 ? "open" : "closed"), total, seconds);
+		}
+
+		if (baseline_file)
+		{
+			print_comparison(baseline_file, total, seconds);
+		}
+	}
+	catch (const std::exception &e)
+	{
+		fprintf(stderr, "blizzard-bench: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
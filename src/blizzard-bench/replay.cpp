@@ -0,0 +1,142 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <fstream>
+#include <coda/error.hpp>
+#include <blizzard/capture.hpp>
+#include "replay.hpp"
+
+static bool is_replaced_header(const std::string &line)
+{
+	static const char *names[] = {"Connection:", "Keep-Alive:", "Content-Length:"};
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		if (0 == strncasecmp(line.c_str(), names[i], strlen(names[i])))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* false if the request is not parsable */
+static bool parse_request(const std::string &raw, blizzard::bench::request_template &t)
+{
+	size_t eol = raw.find("\r\n");
+	size_t headers_end = raw.find("\r\n\r\n");
+
+	if (std::string::npos == eol || std::string::npos == headers_end)
+	{
+		return false;
+	}
+
+	std::string title(raw, 0, eol);
+
+	size_t sp1 = title.find(' ');
+	size_t sp2 = title.rfind(' ');
+
+	if (std::string::npos == sp1 || sp1 == sp2)
+	{
+		return false;
+	}
+
+	t.method.assign(title, 0, sp1);
+	t.uri.assign(title, sp1 + 1, sp2 - sp1 - 1);
+
+	for (size_t pos = eol + 2; pos < headers_end + 2; )
+	{
+		size_t next = raw.find("\r\n", pos);
+		std::string line(raw, pos, next - pos);
+
+		if (!is_replaced_header(line))
+		{
+			t.headers.push_back(line);
+		}
+
+		pos = next + 2;
+	}
+
+	t.body.assign(raw, headers_end + 4, std::string::npos);
+
+	return true;
+}
+
+void blizzard::bench::load_capture(const char *file_name, std::vector<request_template> &templates, std::vector<replay_item> &items, replay_info &info)
+{
+	std::ifstream in(file_name, std::ios::binary);
+
+	if (!in)
+	{
+		throw coda_error("can't open capture file %s: %s", file_name, strerror(errno));
+	}
+
+	uint64_t first = 0;
+	uint64_t offset = 0;
+
+	std::string raw;
+
+	for (;;)
+	{
+		capture_record rec;
+
+		in.read((char *) &rec, sizeof(rec));
+
+		if (0 == in.gcount())
+		{
+			break;
+		}
+
+		if (sizeof(rec) != (size_t) in.gcount())
+		{
+			info.truncated = true;
+			break;
+		}
+
+		if (capture_record::MAGIC != rec.magic)
+		{
+			throw coda_error("%s is not a capture file or is corrupted at offset %llu", file_name, (unsigned long long) offset);
+		}
+
+		raw.resize(rec.length);
+		in.read(&raw[0], rec.length);
+
+		if (rec.length != (size_t) in.gcount())
+		{
+			info.truncated = true;
+			break;
+		}
+
+		offset += sizeof(rec) + rec.length;
+
+		request_template t;
+
+		if (!parse_request(raw, t))
+		{
+			info.skipped++;
+			continue;
+		}
+
+		if (items.empty())
+		{
+			first = rec.time;
+		}
+
+		replay_item item;
+		item.tmpl = templates.size();
+		item.offset = rec.time > first ? rec.time - first : 0;
+
+		templates.push_back(t);
+		items.push_back(item);
+
+		info.sample = rec.sample;
+		info.span = item.offset;
+	}
+
+	if (items.empty())
+	{
+		throw coda_error("no requests in capture file %s", file_name);
+	}
+}
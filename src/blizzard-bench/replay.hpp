@@ -0,0 +1,36 @@
+#ifndef __BLIZZARD_BENCH_REPLAY_HPP__
+#define __BLIZZARD_BENCH_REPLAY_HPP__
+
+#include <stdint.h>
+#include <vector>
+#include "request_template.hpp"
+
+namespace blizzard {
+namespace bench {
+
+/* a captured request sent at offset usec from the first one */
+struct replay_item
+{
+	int tmpl;
+	uint64_t offset;
+};
+
+struct replay_info
+{
+	uint64_t span;      /* usec from the first request to the last one */
+	uint32_t sample;    /* one of sample requests was captured */
+	uint64_t skipped;   /* records which are not HTTP requests */
+	bool truncated;     /* the last record is cut, e.g. the server was killed */
+
+	replay_info() : span(0), sample(1), skipped(0), truncated(false) {}
+};
+
+/* Reads a capture file of the server (see <capture> in the config), every request becomes
+ * a template: Connection, Keep-Alive and Content-Length are replaced by the bench, the rest
+ * is sent as captured. Throws coda_error. */
+
+void load_capture(const char *file_name, std::vector<request_template> &templates, std::vector<replay_item> &items, replay_info &info);
+
+}}
+
+#endif /* __BLIZZARD_BENCH_REPLAY_HPP__ */
@@ -0,0 +1,232 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <fstream>
+#include <coda/error.hpp>
+#include <blizzard/plugin.hpp>
+#include "request_template.hpp"
+
+void blizzard::bench::request_template::build(const std::string &host, bool keep_alive)
+{
+	bytes = method + " " + uri + " HTTP/1.1\r\n";
+
+	bool has_host = false;
+
+	for (size_t i = 0; i < headers.size(); i++)
+	{
+		bytes += headers[i] + "\r\n";
+		has_host = has_host || 0 == strncasecmp(headers[i].c_str(), "Host:", 5);
+	}
+
+	if (!has_host)
+	{
+		bytes += "Host: " + host + "\r\n";
+	}
+
+	bytes += keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+
+	if (!body.empty() || "POST" == method)
+	{
+		char buf [64];
+		snprintf(buf, sizeof(buf), "Content-Length: %d\r\n", (int) body.size());
+		bytes += buf;
+	}
+
+	bytes += "\r\n";
+	bytes += body;
+}
+
+void blizzard::bench::request_template::build_rpc()
+{
+	static const char *methods[] = {"GET", "POST", "HEAD", "OPTIONS"};
+
+	int m = BLZ_METHOD_UNDEF;
+
+	for (int i = 0; i < 4; i++)
+	{
+		if (methods[i] == method)
+		{
+			m = BLZ_METHOD_GET + i;
+		}
+	}
+
+	size_t q = uri.find('?');
+	std::string path = uri.substr(0, q);
+	std::string params = std::string::npos == q ? "" : uri.substr(q + 1);
+
+	std::string lines;
+
+	for (size_t i = 0; i < headers.size(); i++)
+	{
+		lines += headers[i] + "\r\n";
+	}
+
+	if (0xffff < path.size() || 0xffff < params.size() || 0xffff < lines.size())
+	{
+		throw coda_error("request %s %s is too long for RPC", method.c_str(), uri.c_str());
+	}
+
+	/* size:u32 id:u32 method:u8 flags:u8 path_len:u16 params_len:u16 headers_len:u16 */
+	uint32_t size = 12 + path.size() + params.size() + lines.size() + body.size();
+
+	unsigned char h [16] =
+	{
+		(unsigned char) (size >> 24), (unsigned char) (size >> 16), (unsigned char) (size >> 8), (unsigned char) size,
+		0, 0, 0, 0,
+		(unsigned char) m, 0,
+		(unsigned char) (path.size() >> 8), (unsigned char) path.size(),
+		(unsigned char) (params.size() >> 8), (unsigned char) params.size(),
+		(unsigned char) (lines.size() >> 8), (unsigned char) lines.size()
+	};
+
+	bytes.assign((const char *) h, sizeof(h));
+	bytes += path + params + lines + body;
+}
+
+static void strip_cr(std::string &line)
+{
+	if (!line.empty() && '\r' == line[line.size() - 1])
+	{
+		line.erase(line.size() - 1);
+	}
+}
+
+static void finish_template(std::vector<blizzard::bench::request_template> &res, blizzard::bench::request_template &t, bool in_body)
+{
+	if (t.method.empty())
+	{
+		return;
+	}
+
+	/* the newline before "---" is not a part of the body */
+	if (in_body && !t.body.empty() && '\n' == t.body[t.body.size() - 1])
+	{
+		t.body.erase(t.body.size() - 1);
+	}
+
+	res.push_back(t);
+	t = blizzard::bench::request_template();
+}
+
+void blizzard::bench::load_templates(const char *file_name, std::vector<request_template> &res)
+{
+	std::ifstream in(file_name);
+
+	if (!in)
+	{
+		throw coda_error("can't open templates file %s: %s", file_name, strerror(errno));
+	}
+
+	request_template t;
+	bool in_body = false;
+	int line_no = 0;
+
+	std::string line;
+
+	while (std::getline(in, line))
+	{
+		line_no++;
+
+		if (in_body)
+		{
+			if ("---" == line || "---\r" == line)
+			{
+				finish_template(res, t, in_body);
+				in_body = false;
+			}
+			else
+			{
+				t.body += line + "\n";
+			}
+
+			continue;
+		}
+
+		strip_cr(line);
+
+		if ("---" == line)
+		{
+			finish_template(res, t, in_body);
+			continue;
+		}
+
+		if (!line.empty() && '#' == line[0])
+		{
+			continue;
+		}
+
+		if (t.method.empty())
+		{
+			if (line.empty())
+			{
+				continue;
+			}
+
+			char method [32], uri [4096];
+			int weight = 1;
+
+			if (2 > sscanf(line.c_str(), "%31s %4095s %d", method, uri, &weight))
+			{
+				throw coda_error("%s:%d: \"METHOD URI [WEIGHT]\" expected", file_name, line_no);
+			}
+
+			if (0 >= weight)
+			{
+				throw coda_error("%s:%d: weight is not positive", file_name, line_no);
+			}
+
+			t.method = method;
+			t.uri = uri;
+			t.weight = weight;
+		}
+		else if (line.empty())
+		{
+			in_body = true;
+		}
+		else
+		{
+			if (std::string::npos == line.find(':'))
+			{
+				throw coda_error("%s:%d: header \"Name: value\" expected", file_name, line_no);
+			}
+
+			t.headers.push_back(line);
+		}
+	}
+
+	finish_template(res, t, in_body);
+
+	if (res.empty())
+	{
+		throw coda_error("no requests in templates file %s", file_name);
+	}
+}
+
+void blizzard::bench::template_chooser::init(const std::vector<request_template> &t)
+{
+	cumulative.clear();
+
+	int sum = 0;
+
+	for (size_t i = 0; i < t.size(); i++)
+	{
+		sum += t[i].weight;
+		cumulative.push_back(sum);
+	}
+}
+
+int blizzard::bench::template_chooser::choose(unsigned r) const
+{
+	if (1 == cumulative.size())
+	{
+		return 0;
+	}
+
+	int v = r % cumulative.back();
+
+	return std::upper_bound(cumulative.begin(), cumulative.end(), v) - cumulative.begin();
+}
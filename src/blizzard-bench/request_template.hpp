@@ -0,0 +1,61 @@
+#ifndef __BLIZZARD_BENCH_REQUEST_TEMPLATE_HPP__
+#define __BLIZZARD_BENCH_REQUEST_TEMPLATE_HPP__
+
+#include <string>
+#include <vector>
+
+namespace blizzard {
+namespace bench {
+
+/* A request sent by the bench: bytes are built once, Connection and Content-Length are
+ * added automatically, Host too unless the request has its own. */
+
+struct request_template
+{
+	std::string method;
+	std::string uri;
+	std::vector<std::string> headers;
+	std::string body;
+	int weight;
+
+	std::string bytes;
+
+	request_template() : weight(1) {}
+
+	bool is_head() const { return "HEAD" == method; }
+
+	void build(const std::string &host, bool keep_alive);
+
+	/* a frame of the binary RPC of <rpc_port> (src/blizzard/rpc.hpp) with the id 0, the
+	 * worker sets the id of every request it sends */
+	void build_rpc();
+};
+
+/* Templates file: requests separated by lines "---", lines starting with '#' are comments.
+ * The first line of a request is "METHOD URI [WEIGHT]", then header lines, then an optional
+ * body after an empty line:
+ *
+ *   GET /100
+ *   ---
+ *   POST /search 3
+ *   Content-Type: application/json
+ *
+ *   {"query": "blizzard"}
+ *
+ * Requests are chosen randomly according to their weights. Throws coda_error. */
+
+void load_templates(const char *file_name, std::vector<request_template> &res);
+
+/* picks an index by weights, r is a random number */
+class template_chooser
+{
+	std::vector<int> cumulative;
+
+public:
+	void init(const std::vector<request_template> &t);
+	int choose(unsigned r) const;
+};
+
+}}
+
+#endif /* __BLIZZARD_BENCH_REQUEST_TEMPLATE_HPP__ */
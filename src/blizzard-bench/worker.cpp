@@ -0,0 +1,694 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <coda/error.hpp>
+#include <blizzard/histogram.hpp>
+#include "worker.hpp"
+
+enum {RECONNECT_DELAY = 10000}; /* usec after a failed connect */
+enum {MAX_EVENTS = 256};
+enum {READ_BUF = 65536};
+enum {TIMER_ID = 0xffffffff};
+
+blizzard::bench::bench_config::bench_config()
+	: threads(2)
+	, connections(16)
+	, duration(10)
+	, warmup(1)
+	, rate(0)
+	, keep_alive(false)
+	, depth(1)
+	, rpc(false)
+	, speed(1)
+{
+	memset(&addr, 0, sizeof(addr));
+}
+
+blizzard::bench::bench_result::bench_result()
+	: requests(0)
+	, bytes_read(0)
+	, connects(0)
+	, connect_errors(0)
+	, read_errors(0)
+	, retries(0)
+	, unfinished(0)
+{
+	memset(status, 0, sizeof(status));
+}
+
+void blizzard::bench::bench_result::add(const bench_result &r)
+{
+	latency.add(r.latency);
+
+	requests += r.requests;
+	for (int i = 0; i < 6; i++) status[i] += r.status[i];
+	bytes_read += r.bytes_read;
+	connects += r.connects;
+	connect_errors += r.connect_errors;
+	read_errors += r.read_errors;
+	retries += r.retries;
+	unfinished += r.unfinished;
+}
+
+blizzard::bench::worker::worker(const bench_config &cfg_, int connections_num_, int id)
+	: cfg(cfg_)
+	, connections_num(connections_num_)
+	, interval(0)
+	, open_loop(false)
+	, replay_pos(id)
+	, replay_start(0)
+	, epfd(-1)
+	, timerfd(-1)
+	, seed((unsigned) time(NULL) * 7919 + id)
+	, warmup_end(0)
+	, end(0)
+	, next_send(0)
+{
+	if (cfg.rate > 0)
+	{
+		interval = 1000000.0 * cfg.threads / cfg.rate;
+	}
+
+	open_loop = interval || !cfg.replay.empty();
+
+	epfd = epoll_create(connections_num);
+
+	if (-1 == epfd)
+	{
+		throw coda_error("epoll_create failed: %s", strerror(errno));
+	}
+
+	/* epoll_wait() timeouts are in ms, the schedule needs better precision */
+	if (open_loop)
+	{
+		timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+		if (-1 == timerfd)
+		{
+			throw coda_error("timerfd_create failed: %s", strerror(errno));
+		}
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u32 = TIMER_ID;
+
+		epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &ev);
+	}
+
+	connection c;
+	c.fd = -1;
+	c.connected = false;
+	c.want_write = false;
+	c.retry_at = 0;
+	c.out_pos = 0;
+	c.sent = 0;
+	c.answered = 0;
+	c.next_id = 0;
+
+	conns.resize(connections_num, c);
+}
+
+blizzard::bench::worker::~worker()
+{
+	for (size_t i = 0; i < conns.size(); i++)
+	{
+		if (-1 != conns[i].fd)
+		{
+			close(conns[i].fd);
+		}
+	}
+
+	if (-1 != timerfd)
+	{
+		close(timerfd);
+	}
+
+	close(epfd);
+}
+
+void blizzard::bench::worker::watch(connection &c, bool want_write)
+{
+	if (c.want_write == want_write)
+	{
+		return;
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+	ev.data.u32 = &c - &conns[0];
+
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+	c.want_write = want_write;
+}
+
+void blizzard::bench::worker::open_connection(connection &c, uint64_t now)
+{
+	res.connects++;
+
+	c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+	if (-1 == c.fd)
+	{
+		res.connect_errors++;
+		c.retry_at = now + RECONNECT_DELAY;
+		return;
+	}
+
+	int one = 1;
+	setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	c.connected = false;
+	c.out.clear();
+	c.out_pos = 0;
+	c.in.clear();
+	c.sent = 0;
+	c.answered = 0;
+	c.next_id = 0;
+
+	if (0 == connect(c.fd, (const struct sockaddr *) &cfg.addr, sizeof(cfg.addr)))
+	{
+		c.connected = true;
+	}
+	else if (EINPROGRESS != errno)
+	{
+		res.connect_errors++;
+
+		close(c.fd);
+		c.fd = -1;
+		c.retry_at = now + RECONNECT_DELAY;
+		return;
+	}
+
+	/* connect is finished when the socket is writable */
+	c.want_write = !c.connected;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | (c.want_write ? EPOLLOUT : 0);
+	ev.data.u32 = &c - &conns[0];
+
+	epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+}
+
+void blizzard::bench::worker::close_connection(connection &c, uint64_t now, bool failed)
+{
+	close(c.fd);
+	c.fd = -1;
+	c.connected = false;
+
+	/* requests without responses are sent again keeping their start time */
+	res.retries += c.inflight.size();
+
+	while (!c.inflight.empty())
+	{
+		backlog.push_front(c.inflight.back());
+		c.inflight.pop_back();
+	}
+
+	c.retry_at = failed ? now + RECONNECT_DELAY : now;
+}
+
+void blizzard::bench::worker::schedule(uint64_t now)
+{
+	while (next_send <= now && next_send < end)
+	{
+		pending p;
+		p.tmpl = cfg.chooser.choose(rand_r(&seed));
+		p.start = (uint64_t) next_send;
+
+		backlog.push_back(p);
+		next_send += interval;
+	}
+}
+
+void blizzard::bench::worker::schedule_replay(uint64_t now)
+{
+	while (replay_pos < cfg.replay.size() && next_send <= now)
+	{
+		pending p;
+		p.tmpl = cfg.replay[replay_pos].tmpl;
+		p.start = (uint64_t) next_send;
+
+		backlog.push_back(p);
+		replay_pos += cfg.threads;
+
+		next_send = replay_pos < cfg.replay.size() ? replay_start + cfg.replay[replay_pos].offset / cfg.speed : end;
+	}
+}
+
+/* all the requests of the thread are sent and answered */
+bool blizzard::bench::worker::replayed() const
+{
+	if (replay_pos < cfg.replay.size() || !backlog.empty())
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < conns.size(); i++)
+	{
+		if (!conns[i].inflight.empty())
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void blizzard::bench::worker::fill(connection &c, uint64_t now)
+{
+	while (c.inflight.size() < (size_t) cfg.depth)
+	{
+		/* without keep-alive a connection is used for one request */
+		if (!cfg.keep_alive && c.sent)
+		{
+			break;
+		}
+
+		pending p;
+
+		if (!backlog.empty())
+		{
+			p = backlog.front();
+			backlog.pop_front();
+		}
+		else if (open_loop)
+		{
+			break;
+		}
+		else
+		{
+			p.tmpl = cfg.chooser.choose(rand_r(&seed));
+			p.start = now;
+		}
+
+		const std::string &bytes = cfg.templates[p.tmpl].bytes;
+		c.out += bytes;
+
+		/* the id of an RPC request follows its size */
+		p.id = c.next_id++;
+
+		if (cfg.rpc)
+		{
+			size_t at = c.out.size() - bytes.size() + 4;
+
+			c.out[at] = (char) (p.id >> 24);
+			c.out[at + 1] = (char) (p.id >> 16);
+			c.out[at + 2] = (char) (p.id >> 8);
+			c.out[at + 3] = (char) p.id;
+		}
+
+		c.inflight.push_back(p);
+		c.sent++;
+	}
+}
+
+bool blizzard::bench::worker::flush(connection &c)
+{
+	while (c.out_pos < c.out.size())
+	{
+		ssize_t n = send(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos, MSG_NOSIGNAL);
+
+		if (0 > n)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+
+			if (EAGAIN == errno)
+			{
+				watch(c, true);
+				return true;
+			}
+
+			res.read_errors++;
+			close_connection(c, monotonic_usec(), true);
+			return false;
+		}
+
+		c.out_pos += n;
+	}
+
+	c.out.clear();
+	c.out_pos = 0;
+
+	watch(c, false);
+
+	return true;
+}
+
+/* > 0 is the status of a complete response, 0 if more data is needed, -1 if it is malformed */
+int blizzard::bench::worker::parse_response(connection &c, bool eof, bool &close_after)
+{
+	size_t headers_end = c.in.find("\r\n\r\n");
+
+	if (std::string::npos == headers_end)
+	{
+		return eof && !c.in.empty() ? -1 : 0;
+	}
+
+	headers_end += 4;
+
+	int major = 0, minor = 0, status = 0;
+
+	if (3 != sscanf(c.in.c_str(), "HTTP/%d.%d %d", &major, &minor, &status))
+	{
+		return -1;
+	}
+
+	close_after = 1 == major && 0 == minor;
+
+	long content_length = -1;
+
+	size_t pos = c.in.find("\r\n") + 2;
+
+	while (pos < headers_end - 2)
+	{
+		size_t eol = c.in.find("\r\n", pos);
+		const char *line = c.in.c_str() + pos;
+
+		if (0 == strncasecmp(line, "Content-Length:", 15))
+		{
+			content_length = strtol(line + 15, NULL, 10);
+		}
+		else if (0 == strncasecmp(line, "Connection:", 11))
+		{
+			const char *v = line + 11;
+			while (' ' == *v) v++;
+
+			close_after = 0 == strncasecmp(v, "close", 5);
+		}
+
+		pos = eol + 2;
+	}
+
+	size_t total;
+
+	if (cfg.templates[c.inflight.front().tmpl].is_head() || status < 200 || 204 == status || 304 == status)
+	{
+		total = headers_end;
+	}
+	else if (0 <= content_length)
+	{
+		total = headers_end + content_length;
+	}
+	else if (eof)
+	{
+		/* the body lasts until the connection is closed */
+		total = c.in.size();
+		close_after = true;
+	}
+	else
+	{
+		return 0;
+	}
+
+	if (c.in.size() < total)
+	{
+		return eof ? -1 : 0;
+	}
+
+	c.in.erase(0, total);
+
+	return status;
+}
+
+/* the same for RPC, idx is the request of the response in inflight */
+int blizzard::bench::worker::parse_rpc_response(connection &c, bool eof, size_t &idx)
+{
+	idx = 0;
+
+	if (c.in.size() < 12)
+	{
+		return eof && !c.in.empty() ? -1 : 0;
+	}
+
+	const unsigned char *p = (const unsigned char *) c.in.data();
+
+	/* size:u32 id:u32 status:u16 headers_len:u16 headers body */
+	size_t size = ((size_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	uint32_t id = ((uint32_t) p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+	int status = (p[8] << 8) | p[9];
+
+	if (size < 8)
+	{
+		return -1;
+	}
+
+	if (c.in.size() < 4 + size)
+	{
+		return eof ? -1 : 0;
+	}
+
+	size_t k = 0;
+
+	while (k < c.inflight.size() && c.inflight[k].id != id)
+	{
+		k++;
+	}
+
+	if (k == c.inflight.size() || 0 >= status)
+	{
+		return -1;
+	}
+
+	c.in.erase(0, 4 + size);
+	idx = k;
+
+	return status;
+}
+
+void blizzard::bench::worker::complete(connection &c, size_t idx, int status, uint64_t now)
+{
+	pending p = c.inflight[idx];
+	c.inflight.erase(c.inflight.begin() + idx);
+	c.answered++;
+
+	if (p.start < warmup_end)
+	{
+		return;
+	}
+
+	res.requests++;
+	res.status[0 < status && status < 600 ? status / 100 : 0]++;
+	res.latency.record(now - p.start);
+}
+
+/* false if the connection is closed */
+bool blizzard::bench::worker::read_responses(connection &c, uint64_t now)
+{
+	char buf [READ_BUF];
+
+	ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+
+	if (0 > n)
+	{
+		if (EAGAIN == errno || EINTR == errno)
+		{
+			return true;
+		}
+
+		res.read_errors++;
+		close_connection(c, now, true);
+		return false;
+	}
+
+	bool eof = 0 == n;
+
+	c.in.append(buf, n);
+
+	if (now >= warmup_end)
+	{
+		res.bytes_read += n;
+	}
+
+	while (!c.inflight.empty())
+	{
+		bool close_after = false;
+		size_t idx = 0;
+		int status = cfg.rpc ? parse_rpc_response(c, eof, idx) : parse_response(c, eof, close_after);
+
+		if (0 == status)
+		{
+			break;
+		}
+
+		complete(c, idx, status, now);
+
+		if (0 > status || close_after || !cfg.keep_alive)
+		{
+			close_connection(c, now, 0 > status);
+			return false;
+		}
+	}
+
+	if (eof)
+	{
+		/* closed without any response: reset or the server is overloaded */
+		if (0 == c.answered && !c.inflight.empty())
+		{
+			res.read_errors++;
+		}
+
+		close_connection(c, now, 0 == c.answered);
+		return false;
+	}
+
+	return true;
+}
+
+void blizzard::bench::worker::run(uint64_t start, uint64_t warmup_end_, uint64_t end_)
+{
+	warmup_end = warmup_end_;
+	end = end_;
+	next_send = start;
+
+	if (!cfg.replay.empty())
+	{
+		replay_start = start;
+		next_send = replay_pos < cfg.replay.size() ? start + cfg.replay[replay_pos].offset / cfg.speed : end;
+	}
+
+	struct epoll_event events [MAX_EVENTS];
+
+	for (;;)
+	{
+		uint64_t now = monotonic_usec();
+
+		if (now >= end)
+		{
+			break;
+		}
+
+		if (!cfg.replay.empty())
+		{
+			if (replayed())
+			{
+				break;
+			}
+
+			schedule_replay(now);
+		}
+		else if (interval)
+		{
+			schedule(now);
+		}
+
+		int timeout = 100;
+
+		for (size_t i = 0; i < conns.size(); i++)
+		{
+			connection &c = conns[i];
+
+			if (-1 == c.fd)
+			{
+				if (c.retry_at > now)
+				{
+					timeout = 1 + (c.retry_at - now) / 1000 < (uint64_t) timeout ? 1 + (c.retry_at - now) / 1000 : timeout;
+					continue;
+				}
+
+				open_connection(c, now);
+			}
+
+			if (-1 != c.fd && c.connected && c.out.empty())
+			{
+				fill(c, now);
+				flush(c);
+			}
+		}
+
+		if (open_loop && next_send < end)
+		{
+			/* monotonic_usec() is CLOCK_MONOTONIC, so the time is absolute */
+			struct itimerspec ts;
+			memset(&ts, 0, sizeof(ts));
+			ts.it_value.tv_sec = (uint64_t) next_send / 1000000;
+			ts.it_value.tv_nsec = (uint64_t) next_send % 1000000 * 1000;
+
+			timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &ts, NULL);
+		}
+
+		int n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+
+		now = monotonic_usec();
+
+		for (int i = 0; i < n; i++)
+		{
+			if (TIMER_ID == events[i].data.u32)
+			{
+				uint64_t expirations;
+				while (0 < read(timerfd, &expirations, sizeof(expirations)));
+
+				continue;
+			}
+
+			connection &c = conns[events[i].data.u32];
+
+			if (-1 == c.fd)
+			{
+				continue;
+			}
+
+			if (!c.connected)
+			{
+				int err = 0;
+				socklen_t len = sizeof(err);
+				getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+
+				if (err)
+				{
+					res.connect_errors++;
+					close_connection(c, now, true);
+					continue;
+				}
+
+				c.connected = true;
+				watch(c, false);
+
+				fill(c, now);
+				flush(c);
+				continue;
+			}
+
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			{
+				if (!read_responses(c, now))
+				{
+					continue;
+				}
+			}
+
+			if (events[i].events & EPOLLOUT)
+			{
+				flush(c);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < conns.size(); i++)
+	{
+		for (size_t j = 0; j < conns[i].inflight.size(); j++)
+		{
+			if (conns[i].inflight[j].start >= warmup_end) res.unfinished++;
+		}
+	}
+
+	for (size_t j = 0; j < backlog.size(); j++)
+	{
+		if (backlog[j].start >= warmup_end) res.unfinished++;
+	}
+
+	for (size_t j = replay_pos; j < cfg.replay.size(); j += cfg.threads)
+	{
+		res.unfinished++;
+	}
+}
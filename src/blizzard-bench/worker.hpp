@@ -0,0 +1,134 @@
+#ifndef __BLIZZARD_BENCH_WORKER_HPP__
+#define __BLIZZARD_BENCH_WORKER_HPP__
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "hdr_histogram.hpp"
+#include "replay.hpp"
+#include "request_template.hpp"
+
+namespace blizzard {
+namespace bench {
+
+struct bench_config
+{
+	struct sockaddr_in addr;
+
+	int threads;
+	int connections;
+	int duration;        /* seconds */
+	int warmup;          /* seconds, not counted */
+	double rate;         /* requests per second of all threads, 0 for closed loop */
+	bool keep_alive;
+	int depth;           /* pipelined requests in flight per connection */
+	bool rpc;            /* binary RPC of <rpc_port>, responses come in any order */
+
+	std::vector<request_template> templates;
+	template_chooser chooser;
+
+	/* captured requests sent at their times divided by speed instead of the rate */
+	std::vector<replay_item> replay;
+	double speed;
+
+	bench_config();
+};
+
+struct bench_result
+{
+	hdr_histogram latency;
+
+	uint64_t requests;
+	uint64_t status[6];    /* by class, 0 is for unparsable responses */
+	uint64_t bytes_read;
+	uint64_t connects;
+	uint64_t connect_errors;
+	uint64_t read_errors;
+	uint64_t retries;      /* sent again because the connection was closed before the response */
+	uint64_t unfinished;   /* scheduled, but not answered at the end */
+
+	bench_result();
+	void add(const bench_result &r);
+};
+
+/* One thread of the load: its own epoll and connections. In closed loop every connection
+ * keeps `depth` requests in flight and latency is measured from sending. In open loop
+ * requests are scheduled at the constant rate and latency is measured from the scheduled
+ * time, so stalls of the server are not hidden by the bench waiting for them (coordinated
+ * omission). Replay is open loop too: the thread takes every threads-th captured request
+ * and schedules it at its captured time, the run ends when all of them are answered. */
+
+class worker
+{
+	struct pending
+	{
+		int tmpl;
+		uint64_t start;
+		uint32_t id;
+	};
+
+	struct connection
+	{
+		int fd;
+		bool connected;
+		bool want_write;
+		uint64_t retry_at;
+
+		std::string out;
+		size_t out_pos;
+		std::string in;
+
+		std::deque<pending> inflight;
+		int sent;
+		int answered;
+		uint32_t next_id;
+	};
+
+	const bench_config &cfg;
+	int connections_num;
+	double interval;  /* usec between scheduled requests, 0 for closed loop */
+	bool open_loop;
+	size_t replay_pos;
+	uint64_t replay_start;
+
+	int epfd;
+	int timerfd;
+	std::vector<connection> conns;
+	std::deque<pending> backlog;
+	unsigned seed;
+
+	uint64_t warmup_end;
+	uint64_t end;
+	double next_send;
+
+	bench_result res;
+
+	void open_connection(connection &c, uint64_t now);
+	void close_connection(connection &c, uint64_t now, bool failed);
+
+	void schedule(uint64_t now);
+	void schedule_replay(uint64_t now);
+	bool replayed() const;
+	void fill(connection &c, uint64_t now);
+	bool flush(connection &c);
+	bool read_responses(connection &c, uint64_t now);
+	int parse_response(connection &c, bool eof, bool &close_after);
+	int parse_rpc_response(connection &c, bool eof, size_t &idx);
+	void complete(connection &c, size_t idx, int status, uint64_t now);
+
+	void watch(connection &c, bool want_write);
+
+public:
+	worker(const bench_config &cfg, int connections_num, int id);
+	~worker();
+
+	void run(uint64_t start, uint64_t warmup_end, uint64_t end);
+
+	const bench_result &result() const { return res; }
+};
+
+}}
+
+#endif /* __BLIZZARD_BENCH_WORKER_HPP__ */
@@ -0,0 +1,175 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <coda/logger.h>
+#include "microbench.hpp"
+
+using namespace blizzard::microbench;
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [options] [filter...]\n"
+		"  -f, --format=FORMAT    - text (default) or json\n"
+		"  -t, --time=SEC         - minimal time of one run (0.2)\n"
+		"  -r, --repeats=N        - runs of every benchmark, the median is reported (5)\n"
+		"  -T, --threads=N        - maximal producer and consumer threads of queues (4)\n"
+		"  -l, --label=LABEL      - label of the build in json, e.g. git revision\n"
+		"  filter                 - run only benchmarks whose names contain it\n"
+		, name);
+}
+
+static void json_string(const std::string &s)
+{
+	putchar('"');
+
+	for (size_t i = 0; i < s.size(); i++)
+	{
+		unsigned char c = s[i];
+
+		if ('"' == c || '\\' == c) printf("\\%c", c);
+		else if (c < 0x20) printf("\\u%04x", c);
+		else putchar(c);
+	}
+
+	putchar('"');
+}
+
+static void print_json(const std::vector<bench_result> &res, const std::string &label, double min_time)
+{
+	char host [256] = "";
+	gethostname(host, sizeof(host) - 1);
+
+	char date [64];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	printf("{\n  \"context\": {\"label\": ");
+	json_string(label);
+	printf(", \"date\": \"%s\", \"host\": ", date);
+	json_string(host);
+	printf(", \"cpus\": %ld, \"compiler\": ", sysconf(_SC_NPROCESSORS_ONLN));
+	json_string(__VERSION__);
+	printf(", \"min_time\": %.3f},\n  \"benchmarks\": [", min_time);
+
+	for (size_t i = 0; i < res.size(); i++)
+	{
+		const bench_result &r = res[i];
+
+		printf("%s\n    {\"name\": ", i ? "," : "");
+		json_string(r.name);
+		printf(", \"iterations\": %llu, \"repeats\": %d, \"ns_per_op\": %.2f, \"ns_per_op_min\": %.2f, \"ns_per_op_max\": %.2f, \"ops_per_sec\": %.0f"
+			, (unsigned long long) r.iterations, r.repeats, r.ns_per_op, r.ns_per_op_min, r.ns_per_op_max, r.ops_per_sec);
+
+		if (r.mb_per_sec > 0)
+		{
+			printf(", \"mb_per_sec\": %.1f", r.mb_per_sec);
+		}
+
+		printf("}");
+	}
+
+	printf("\n  ]\n}\n");
+}
+
+static void print_text(const std::vector<bench_result> &res)
+{
+	printf("%-36s %12s %12s %12s %14s %10s\n", "benchmark", "ns/op", "min", "max", "ops/s", "MB/s");
+
+	for (size_t i = 0; i < res.size(); i++)
+	{
+		const bench_result &r = res[i];
+
+		printf("%-36s %12.1f %12.1f %12.1f %14.0f ", r.name.c_str(), r.ns_per_op, r.ns_per_op_min, r.ns_per_op_max, r.ops_per_sec);
+
+		if (r.mb_per_sec > 0)
+		{
+			printf("%10.1f\n", r.mb_per_sec);
+		}
+		else
+		{
+			printf("%10s\n", "-");
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] =
+	{
+		{"format",  required_argument, 0, 'f'},
+		{"time",    required_argument, 0, 't'},
+		{"repeats", required_argument, 0, 'r'},
+		{"threads", required_argument, 0, 'T'},
+		{"label",   required_argument, 0, 'l'},
+		{"help",    no_argument,       0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	std::string format = "text";
+	std::string label;
+	double min_time = 0.2;
+	int repeats = 5;
+	int max_threads = 4;
+
+	int opt;
+
+	while (-1 != (opt = getopt_long(argc, argv, "f:t:r:T:l:h", options, 0)))
+	{
+		switch (opt)
+		{
+		case 'f': format = optarg; break;
+		case 't': min_time = atof(optarg); break;
+		case 'r': repeats = atoi(optarg); break;
+		case 'T': max_threads = atoi(optarg); break;
+		case 'l': label = optarg; break;
+		default:
+			usage(argv[0]);
+			return 'h' == opt ? 0 : 1;
+		}
+	}
+
+	if (("text" != format && "json" != format) || 0 >= min_time || 0 >= repeats || 0 >= max_threads)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* the server code logs to stderr otherwise */
+	log_level = log_levels("error");
+
+	runner r(min_time, repeats);
+
+	for (int i = optind; i < argc; i++)
+	{
+		r.add_filter(argv[i]);
+	}
+
+	try
+	{
+		bench_parser(r);
+		bench_mem_chunk(r);
+		bench_pool(r);
+		bench_queues(r, max_threads);
+	}
+	catch (const std::exception &e)
+	{
+		fprintf(stderr, "blizzard-microbench: %s\n", e.what());
+		return 1;
+	}
+
+	if ("json" == format)
+	{
+		print_json(r.get_results(), label, min_time);
+	}
+	else
+	{
+		print_text(r.get_results());
+	}
+
+	return 0;
+}
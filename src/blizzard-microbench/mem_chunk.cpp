@@ -0,0 +1,138 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <coda/error.hpp>
+#include <blizzard/mem_chunk.hpp>
+#include "microbench.hpp"
+
+using namespace blizzard::microbench;
+
+namespace {
+
+enum {BODY_PAGE = 32768};  /* as http::WRITE_BODY_SZ */
+enum {APPENDS_PER_RESET = 64};
+
+/* append_data of pieces of the given size into an expanding chunk, as responses are built */
+class append_case : public bench_case
+{
+	std::string piece;
+	blizzard::mem_chunk<BODY_PAGE> *chunk;
+
+public:
+	explicit append_case(size_t size)
+		: piece(size, 'a')
+		, chunk(0)
+	{}
+
+	void setup()
+	{
+		chunk = new blizzard::mem_chunk<BODY_PAGE>;
+	}
+
+	uint64_t run(uint64_t iterations)
+	{
+		uint64_t start = monotonic_nsec();
+
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			if (0 == i % APPENDS_PER_RESET)
+			{
+				chunk->reset();
+				chunk->set_expand(true);
+			}
+
+			chunk->append_data(piece.data(), piece.size());
+		}
+
+		return monotonic_nsec() - start;
+	}
+
+	void teardown()
+	{
+		delete chunk;
+		chunk = 0;
+	}
+
+	uint64_t bytes_per_op() const
+	{
+		return piece.size();
+	}
+};
+
+/* a response body of the given size is built and written to /dev/null */
+class write_case : public bench_case
+{
+	std::string body;
+	blizzard::mem_chunk<BODY_PAGE> *chunk;
+	int fd;
+
+public:
+	explicit write_case(size_t size)
+		: body(size, 'w')
+		, chunk(0)
+		, fd(-1)
+	{}
+
+	void setup()
+	{
+		fd = open("/dev/null", O_WRONLY);
+
+		if (-1 == fd)
+		{
+			throw coda_error("can't open /dev/null: %s", strerror(errno));
+		}
+
+		chunk = new blizzard::mem_chunk<BODY_PAGE>;
+	}
+
+	uint64_t run(uint64_t iterations)
+	{
+		uint64_t start = monotonic_nsec();
+
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			chunk->reset();
+			chunk->set_expand(true);
+			chunk->append_data(body.data(), body.size());
+
+			bool can_write = true, want_write = true, wreof = false;
+			chunk->write_to_fd(fd, can_write, want_write, wreof);
+		}
+
+		return monotonic_nsec() - start;
+	}
+
+	void teardown()
+	{
+		delete chunk;
+		chunk = 0;
+
+		close(fd);
+	}
+
+	uint64_t bytes_per_op() const
+	{
+		return body.size();
+	}
+};
+
+}
+
+void blizzard::microbench::bench_mem_chunk(runner &r)
+{
+	append_case a16(16);
+	r.measure("mem_chunk/append_16", a16, 1000);
+
+	append_case a1k(1024);
+	r.measure("mem_chunk/append_1k", a1k, 1000);
+
+	append_case a64k(65536);
+	r.measure("mem_chunk/append_64k", a64k, 100);
+
+	write_case w1k(1024);
+	r.measure("mem_chunk/write_devnull_1k", w1k, 1000);
+
+	write_case w256k(262144);
+	r.measure("mem_chunk/write_devnull_256k", w256k, 100);
+}
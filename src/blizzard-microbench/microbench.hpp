@@ -0,0 +1,72 @@
+#ifndef __BLIZZARD_MICROBENCH_HPP__
+#define __BLIZZARD_MICROBENCH_HPP__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <blizzard/histogram.hpp>
+
+namespace blizzard {
+namespace microbench {
+
+using blizzard::monotonic_nsec;
+
+/* A measured piece of code: run() does `iterations` operations and returns the time they
+ * took in nanoseconds, so that setup inside run() could be left out of the measurement. */
+
+struct bench_case
+{
+	virtual ~bench_case() {}
+
+	virtual void setup() {}
+	virtual uint64_t run(uint64_t iterations) = 0;
+	virtual void teardown() {}
+
+	/* bytes processed by one operation, 0 if throughput makes no sense */
+	virtual uint64_t bytes_per_op() const { return 0; }
+};
+
+struct bench_result
+{
+	std::string name;
+	uint64_t iterations;
+	int repeats;
+
+	double ns_per_op;      /* median of repeats */
+	double ns_per_op_min;
+	double ns_per_op_max;
+	double ops_per_sec;
+	double mb_per_sec;
+};
+
+/* Runs every case: the number of iterations is doubled until one run takes min_time,
+ * then the case is repeated and the median is reported. */
+
+class runner
+{
+	double min_time;
+	int repeats;
+	std::vector<std::string> filters;
+
+	std::vector<bench_result> results;
+
+public:
+	runner(double min_time, int repeats);
+
+	void add_filter(const std::string &f);
+	bool enabled(const std::string &name) const;
+
+	void measure(const std::string &name, bench_case &c, uint64_t min_iterations = 1);
+
+	const std::vector<bench_result> &get_results() const { return results; }
+};
+
+/* benchmarks of each part, names are prefixed with the part: "parse/", "mem_chunk/", ... */
+void bench_parser(runner &r);
+void bench_mem_chunk(runner &r);
+void bench_pool(runner &r);
+void bench_queues(runner &r, int max_threads);
+
+}}
+
+#endif /* __BLIZZARD_MICROBENCH_HPP__ */
@@ -0,0 +1,153 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <coda/error.hpp>
+#include <blizzard/http.hpp>
+#include "microbench.hpp"
+
+using namespace blizzard::microbench;
+
+namespace {
+
+/* parses a request from a socket without owning it */
+struct bench_http : public blizzard::http
+{
+	void detach()
+	{
+		fd = -1;
+	}
+};
+
+const char small_get[] =
+	"GET /search?q=blizzard HTTP/1.1\r\n"
+	"Host: localhost\r\n"
+	"\r\n";
+
+const char browser_get[] =
+	"GET /api/v1/items/12345?fields=name,price&lang=en HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"Connection: keep-alive\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Accept-Language: en-US,en;q=0.9,ru;q=0.8\r\n"
+	"Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; tracking=off\r\n"
+	"Referer: https://www.example.com/catalog?page=2\r\n"
+	"If-None-Match: \"5d8c72a5edda8d6a\"\r\n"
+	"X-Forwarded-For: 10.1.2.3, 192.168.0.1\r\n"
+	"X-Request-Id: 7f3e1c2a-9b4d-4e6f-8a1b-2c3d4e5f6a7b\r\n"
+	"\r\n";
+
+class parse_case : public bench_case
+{
+	std::string request;
+	bool parse;
+
+	int sv[2];
+	bench_http *con;
+
+public:
+	parse_case(const std::string &req, bool parse_)
+		: request(req)
+		, parse(parse_)
+		, con(0)
+	{
+		sv[0] = sv[1] = -1;
+	}
+
+	void setup()
+	{
+		if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+		{
+			throw coda_error("socketpair failed: %s", strerror(errno));
+		}
+
+		fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+
+		int sz = 1 << 20;
+		setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+		setsockopt(sv[0], SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+
+		con = new bench_http;
+	}
+
+	uint64_t run(uint64_t iterations)
+	{
+		struct in_addr ip;
+		ip.s_addr = htonl(0x7f000001);
+
+		char buf [65536];
+
+		uint64_t start = monotonic_nsec();
+
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			if ((ssize_t) request.size() != write(sv[1], request.data(), request.size()))
+			{
+				throw coda_error("write to socketpair failed: %s", strerror(errno));
+			}
+
+			if (!parse)
+			{
+				/* the same syscalls as the parser does: read until EAGAIN */
+				while (0 < read(sv[0], buf, sizeof(buf)));
+				continue;
+			}
+
+			con->init(sv[0], ip);
+			con->allow_read();
+			con->process();
+
+			if (blizzard::http::sReadyToHandle != con->state())
+			{
+				throw coda_error("request is not parsed, state %d", (int) con->state());
+			}
+
+			con->detach();
+		}
+
+		return monotonic_nsec() - start;
+	}
+
+	void teardown()
+	{
+		delete con;
+		con = 0;
+
+		close(sv[0]);
+		close(sv[1]);
+	}
+
+	uint64_t bytes_per_op() const
+	{
+		return request.size();
+	}
+};
+
+}
+
+void blizzard::microbench::bench_parser(runner &r)
+{
+	std::string post =
+		"POST /api/v1/search HTTP/1.1\r\n"
+		"Host: www.example.com\r\n"
+		"Content-Type: application/json\r\n"
+		"Content-Length: 4096\r\n"
+		"\r\n";
+	post += std::string(4096, 'p');
+
+	parse_case syscalls(browser_get, false);
+	r.measure("parse/browser_get_syscalls_only", syscalls, 1000);
+
+	parse_case small(small_get, true);
+	r.measure("parse/small_get", small, 1000);
+
+	parse_case browser(browser_get, true);
+	r.measure("parse/browser_get", browser, 1000);
+
+	parse_case body(post, true);
+	r.measure("parse/post_4k", body, 1000);
+}
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include <blizzard/pool.hpp>
+#include "microbench.hpp"
+
+using namespace blizzard::microbench;
+
+namespace {
+
+struct object
+{
+	char data[256];
+};
+
+enum {OBJECTS_PER_PAGE = 5000};  /* as http_pool of the server */
+
+typedef pool_ns::pool<object, OBJECTS_PER_PAGE> object_pool;
+
+/* one operation is allocate() and free() of one object, objects are allocated in batches
+ * and freed in the same order (fifo), in reverse (lifo) or shuffled */
+
+class pool_case : public bench_case
+{
+public:
+	enum order {LIFO, FIFO, RANDOM};
+
+private:
+	size_t batch;
+	order free_order;
+
+	object_pool *p;
+	std::vector<object*> objects;
+	std::vector<size_t> shuffled;
+
+public:
+	pool_case(size_t batch_, order o)
+		: batch(batch_)
+		, free_order(o)
+		, p(0)
+	{}
+
+	void setup()
+	{
+		p = new object_pool;
+		objects.resize(batch);
+
+		shuffled.resize(batch);
+		for (size_t i = 0; i < batch; i++) shuffled[i] = i;
+
+		srand(1);
+		std::random_shuffle(shuffled.begin(), shuffled.end());
+	}
+
+	uint64_t run(uint64_t iterations)
+	{
+		uint64_t start = monotonic_nsec();
+
+		for (uint64_t done = 0; done < iterations; done += batch)
+		{
+			for (size_t i = 0; i < batch; i++)
+			{
+				objects[i] = p->allocate();
+			}
+
+			for (size_t i = 0; i < batch; i++)
+			{
+				switch (free_order)
+				{
+				case LIFO: p->free(objects[batch - 1 - i]); break;
+				case FIFO: p->free(objects[i]); break;
+				case RANDOM: p->free(objects[shuffled[i]]); break;
+				}
+			}
+		}
+
+		return monotonic_nsec() - start;
+	}
+
+	void teardown()
+	{
+		delete p;
+		p = 0;
+	}
+};
+
+}
+
+void blizzard::microbench::bench_pool(runner &r)
+{
+	pool_case single(1, pool_case::LIFO);
+	r.measure("pool/alloc_free_1", single, 1000);
+
+	pool_case lifo(1000, pool_case::LIFO);
+	r.measure("pool/batch_1000_lifo", lifo, 1000);
+
+	pool_case fifo(1000, pool_case::FIFO);
+	r.measure("pool/batch_1000_fifo", fifo, 1000);
+
+	pool_case random(1000, pool_case::RANDOM);
+	r.measure("pool/batch_1000_random", random, 1000);
+
+	/* more than a page: the pool grows on the first run and keeps the pages */
+	pool_case big(20000, pool_case::RANDOM);
+	r.measure("pool/batch_20000_random", big, 20000);
+}
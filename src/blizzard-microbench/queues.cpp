@@ -0,0 +1,271 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <coda/error.hpp>
+#include <blizzard/server.hpp>
+#include "microbench.hpp"
+
+using namespace blizzard::microbench;
+
+namespace {
+
+enum {WINDOW = 32}; /* requests in flight per producer, like connections of the event thread */
+
+struct bench_http : public blizzard::http
+{
+	int owner;
+};
+
+/* free requests of a producer, returned by the done queue reader */
+struct producer
+{
+	pthread_mutex_t mutex;
+	std::vector<bench_http*> free;
+	uint64_t to_push;
+};
+
+/* Producers push into the easy queue like the event thread, consumers take requests out like
+ * easy threads and push them to the done queue, the main thread reads the done queue like
+ * the event thread and gives requests back to their producers. One operation is one request
+ * passing both queues. */
+
+class queues_case : public bench_case
+{
+	int producers_num;
+	int consumers_num;
+
+	blizzard::server *srv;
+	blizzard::service *svc;
+	std::vector<producer> producers;
+	std::vector<bench_http*> requests;
+
+	volatile bool stop;
+	volatile int consumers_running;
+
+	static void *producer_function(void *ptr);
+	static void *consumer_function(void *ptr);
+
+	struct thread_arg
+	{
+		queues_case *self;
+		int idx;
+	};
+
+	void produce(int idx);
+	void consume();
+
+public:
+	queues_case(int producers_num_, int consumers_num_)
+		: producers_num(producers_num_)
+		, consumers_num(consumers_num_)
+		, srv(0)
+		, svc(0)
+		, stop(false)
+		, consumers_running(0)
+	{}
+
+	void setup();
+	uint64_t run(uint64_t iterations);
+	void teardown();
+};
+
+void *queues_case::producer_function(void *ptr)
+{
+	thread_arg *arg = (thread_arg *) ptr;
+	arg->self->produce(arg->idx);
+
+	return 0;
+}
+
+void *queues_case::consumer_function(void *ptr)
+{
+	thread_arg *arg = (thread_arg *) ptr;
+	arg->self->consume();
+
+	return 0;
+}
+
+void queues_case::setup()
+{
+	srv = new blizzard::server;
+
+	/* push_done() wakes the event thread up with a byte, nobody listens here */
+	srv->wakeup_osock = open("/dev/null", O_WRONLY);
+
+	if (-1 == srv->wakeup_osock)
+	{
+		throw coda_error("can't open /dev/null: %s", strerror(errno));
+	}
+
+	srv->loop = ev_default_loop(0);
+
+	/* the queues of a <plugin> section with the default limits, deleted by the server */
+	svc = new blizzard::service(srv, 0, blz_config::BLZ::PLUGIN());
+	srv->services.push_back(svc);
+
+	producers.resize(producers_num);
+
+	for (int i = 0; i < producers_num; i++)
+	{
+		pthread_mutex_init(&producers[i].mutex, 0);
+
+		for (int j = 0; j < WINDOW; j++)
+		{
+			bench_http *con = new bench_http;
+			con->owner = i;
+
+			requests.push_back(con);
+			producers[i].free.push_back(con);
+		}
+	}
+}
+
+void queues_case::produce(int idx)
+{
+	producer &p = producers[idx];
+
+	while (p.to_push)
+	{
+		bench_http *con = 0;
+
+		pthread_mutex_lock(&p.mutex);
+
+		if (!p.free.empty())
+		{
+			con = p.free.back();
+			p.free.pop_back();
+		}
+
+		pthread_mutex_unlock(&p.mutex);
+
+		if (0 == con)
+		{
+			sched_yield();
+			continue;
+		}
+
+		svc->push_easy(con);
+		p.to_push--;
+	}
+}
+
+void queues_case::consume()
+{
+	while (!stop)
+	{
+		blizzard::http *con = 0;
+
+		if (svc->pop_easy_or_wait(&con, 0))
+		{
+			srv->push_done(con);
+		}
+	}
+
+	__sync_fetch_and_sub(&consumers_running, 1);
+}
+
+uint64_t queues_case::run(uint64_t iterations)
+{
+	stop = false;
+	consumers_running = consumers_num;
+
+	for (int i = 0; i < producers_num; i++)
+	{
+		producers[i].to_push = iterations / producers_num + (i < (int) (iterations % producers_num) ? 1 : 0);
+	}
+
+	std::vector<thread_arg> args(producers_num + consumers_num);
+	std::vector<pthread_t> threads(producers_num + consumers_num);
+
+	uint64_t start = monotonic_nsec();
+
+	for (int i = 0; i < producers_num + consumers_num; i++)
+	{
+		args[i].self = this;
+		args[i].idx = i;
+
+		pthread_create(&threads[i], NULL, i < producers_num ? producer_function : consumer_function, &args[i]);
+	}
+
+	for (uint64_t received = 0; received < iterations; )
+	{
+		blizzard::http *con = 0;
+
+		if (!srv->pop_done(&con))
+		{
+			sched_yield();
+			continue;
+		}
+
+		producer &p = producers[((bench_http *) con)->owner];
+
+		pthread_mutex_lock(&p.mutex);
+		p.free.push_back((bench_http *) con);
+		pthread_mutex_unlock(&p.mutex);
+
+		received++;
+	}
+
+	uint64_t elapsed = monotonic_nsec() - start;
+
+	stop = true;
+
+	/* a consumer could miss a broadcast while it is not waiting yet */
+	while (consumers_running)
+	{
+		srv->fire_all_threads();
+		usleep(100);
+	}
+
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	return elapsed;
+}
+
+void queues_case::teardown()
+{
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		delete requests[i];
+	}
+
+	requests.clear();
+
+	for (int i = 0; i < producers_num; i++)
+	{
+		pthread_mutex_destroy(&producers[i].mutex);
+	}
+
+	producers.clear();
+
+	close(srv->wakeup_osock);
+	srv->wakeup_osock = -1;
+
+	delete srv;
+	srv = 0;
+	svc = 0;
+}
+
+}
+
+void blizzard::microbench::bench_queues(runner &r, int max_threads)
+{
+	for (int producers = 1; producers <= max_threads; producers *= 2)
+	{
+		for (int consumers = 1; consumers <= max_threads; consumers *= 2)
+		{
+			char name [64];
+			snprintf(name, sizeof(name), "queues/easy_done_%dp_%dc", producers, consumers);
+
+			queues_case c(producers, consumers);
+			r.measure(name, c, 10000);
+		}
+	}
+}
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <algorithm>
+#include "microbench.hpp"
+
+blizzard::microbench::runner::runner(double min_time_, int repeats_)
+	: min_time(min_time_)
+	, repeats(repeats_)
+{}
+
+void blizzard::microbench::runner::add_filter(const std::string &f)
+{
+	filters.push_back(f);
+}
+
+bool blizzard::microbench::runner::enabled(const std::string &name) const
+{
+	if (filters.empty())
+	{
+		return true;
+	}
+
+	for (size_t i = 0; i < filters.size(); i++)
+	{
+		if (std::string::npos != name.find(filters[i]))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void blizzard::microbench::runner::measure(const std::string &name, bench_case &c, uint64_t min_iterations)
+{
+	if (!enabled(name))
+	{
+		return;
+	}
+
+	fprintf(stderr, "%s...\n", name.c_str());
+
+	c.setup();
+
+	/* the first runs also warm caches up */
+	uint64_t iterations = min_iterations;
+	uint64_t min_ns = (uint64_t) (min_time * 1e9);
+
+	while (c.run(iterations) < min_ns)
+	{
+		iterations *= 2;
+	}
+
+	std::vector<double> ns;
+
+	for (int i = 0; i < repeats; i++)
+	{
+		ns.push_back(c.run(iterations) / (double) iterations);
+	}
+
+	c.teardown();
+
+	std::sort(ns.begin(), ns.end());
+
+	bench_result res;
+	res.name = name;
+	res.iterations = iterations;
+	res.repeats = repeats;
+	res.ns_per_op = ns[ns.size() / 2];
+	res.ns_per_op_min = ns.front();
+	res.ns_per_op_max = ns.back();
+	res.ops_per_sec = 1e9 / res.ns_per_op;
+	res.mb_per_sec = c.bytes_per_op() * res.ops_per_sec / (1024 * 1024);
+
+	results.push_back(res);
+}
@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "mock_task.hpp"
+
+blizzard::mock_request::mock_request()
+	: method(BLZ_METHOD_GET)
+	, version_major(1)
+	, version_minor(1)
+{
+	ip.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+/* the same rules as the parser of the server */
+static int parse_method(const std::string& m)
+{
+	switch (m.empty() ? 0 : m[0])
+	{
+	case 'g':
+	case 'G':
+		return BLZ_METHOD_GET;
+	case 'h':
+	case 'H':
+		return BLZ_METHOD_HEAD;
+	case 'p':
+	case 'P':
+		return 1 < m.size() && ('o' == m[1] || 'O' == m[1]) ? BLZ_METHOD_POST : BLZ_METHOD_UNDEF;
+	case 'o':
+	case 'O':
+		return BLZ_METHOD_OPTIONS;
+	}
+
+	return BLZ_METHOD_UNDEF;
+}
+
+bool blizzard::mock_request::parse(const std::string& raw)
+{
+	size_t eol = raw.find("\r\n");
+	size_t headers_end = raw.find("\r\n\r\n");
+
+	if (std::string::npos == eol || std::string::npos == headers_end)
+	{
+		return false;
+	}
+
+	std::string title(raw, 0, eol);
+
+	size_t sp1 = title.find(' ');
+	size_t sp2 = title.rfind(' ');
+
+	if (std::string::npos == sp1 || sp1 == sp2 || 0 != strncasecmp(title.c_str() + sp2 + 1, "HTTP/", 5))
+	{
+		return false;
+	}
+
+	method = parse_method(title.substr(0, sp1));
+
+	if (BLZ_METHOD_UNDEF == method)
+	{
+		return false;
+	}
+
+	std::string uri(title, sp1 + 1, sp2 - sp1 - 1);
+	size_t q = uri.find('?');
+
+	path = uri.substr(0, q);
+	params = std::string::npos == q ? "" : uri.substr(q + 1);
+
+	const char* version = title.c_str() + sp2 + 6;
+	const char* dot = strchr(version, '.');
+
+	version_major = atoi(version);
+	version_minor = dot ? atoi(dot + 1) : 0;
+
+	headers.clear();
+
+	for (size_t pos = eol + 2; pos < headers_end + 2; )
+	{
+		size_t next = raw.find("\r\n", pos);
+		size_t colon = raw.find(':', pos);
+
+		if (colon >= next)
+		{
+			return false;
+		}
+
+		size_t val = colon + 1;
+		while (val < next && ' ' == raw[val]) val++;
+
+		headers.push_back(std::make_pair(raw.substr(pos, colon - pos), raw.substr(val, next - val)));
+
+		pos = next + 2;
+	}
+
+	body.assign(raw, headers_end + 4, std::string::npos);
+
+	return true;
+}
+
+blizzard::mock_task::mock_task()
+	: req(0)
+	, now(0)
+	, cache(false)
+	, status(0)
+	, cache_ttl(-1)
+	, block_idx(0)
+	, offset(0)
+{
+}
+
+blizzard::mock_task::~mock_task()
+{
+	for (size_t i = 0; i < blocks.size(); i++)
+	{
+		free(blocks[i].data);
+	}
+}
+
+void blizzard::mock_task::reset(const mock_request* r, double now_)
+{
+	req = r;
+	now = now_;
+
+	cache = false;
+	status = 0;
+	cache_ttl = -1;
+	etag.clear();
+
+	headers.clear();
+	body.clear();
+
+	block_idx = 0;
+	offset = 0;
+}
+
+int blizzard::mock_task::get_request_method() const
+{
+	return req->method;
+}
+
+int blizzard::mock_task::get_version_major() const
+{
+	return req->version_major;
+}
+
+int blizzard::mock_task::get_version_minor() const
+{
+	return req->version_minor;
+}
+
+bool blizzard::mock_task::get_cache() const
+{
+	return cache;
+}
+
+struct in_addr blizzard::mock_task::get_request_ip() const
+{
+	return req->ip;
+}
+
+const char* blizzard::mock_task::get_request_uri_path() const
+{
+	return req->path.c_str();
+}
+
+const char* blizzard::mock_task::get_request_uri_params() const
+{
+	return req->params.c_str();
+}
+
+size_t blizzard::mock_task::get_request_body_len() const
+{
+	return req->body.size();
+}
+
+const uint8_t* blizzard::mock_task::get_request_body() const
+{
+	return (const uint8_t*) req->body.data();
+}
+
+const char* blizzard::mock_task::get_request_header(const char* name) const
+{
+	for (size_t i = 0; i < req->headers.size(); i++)
+	{
+		if (!strcasecmp(req->headers[i].first.c_str(), name))
+		{
+			return req->headers[i].second.c_str();
+		}
+	}
+
+	return 0;
+}
+
+size_t blizzard::mock_task::get_request_headers_num() const
+{
+	return req->headers.size();
+}
+
+const char* blizzard::mock_task::get_request_header_key(int idx) const
+{
+	return req->headers[idx].first.c_str();
+}
+
+const char* blizzard::mock_task::get_request_header_value(int idx) const
+{
+	return req->headers[idx].second.c_str();
+}
+
+double blizzard::mock_task::get_current_server_time() const
+{
+	return now;
+}
+
+void blizzard::mock_task::set_cache(bool c)
+{
+	cache = c;
+}
+
+void blizzard::mock_task::set_response_status(int s)
+{
+	status = s;
+}
+
+void blizzard::mock_task::add_response_header(const char* name, const char* data)
+{
+	headers += name;
+	headers += ": ";
+	headers += data;
+	headers += "\r\n";
+}
+
+void blizzard::mock_task::add_response_buffer(const char* data, size_t sz)
+{
+	body.append(data, sz);
+}
+
+void* blizzard::mock_task::alloc(size_t sz, size_t align)
+{
+	for (; block_idx < blocks.size(); block_idx++, offset = 0)
+	{
+		block& b = blocks[block_idx];
+
+		size_t pos = offset + ((-(uintptr_t) (b.data + offset)) & (align - 1));
+
+		if (pos + sz <= b.capacity)
+		{
+			offset = pos + sz;
+			return b.data + pos;
+		}
+	}
+
+	/* blocks are kept by reset(), so the next calls don't allocate */
+	block b;
+	b.capacity = sz + align > BLOCK_SIZE ? sz + align : BLOCK_SIZE;
+	b.data = (char*) malloc(b.capacity);
+
+	if (0 == b.data)
+	{
+		return 0;
+	}
+
+	blocks.push_back(b);
+
+	size_t pos = (-(uintptr_t) b.data) & (align - 1);
+	offset = pos + sz;
+
+	return b.data + pos;
+}
+
+void blizzard::mock_task::set_cache_ttl(int ttl_ms)
+{
+	cache_ttl = ttl_ms < 0 ? -1 : ttl_ms;
+}
+
+void blizzard::mock_task::set_response_etag(const char* tag)
+{
+	etag = tag;
+}
@@ -0,0 +1,108 @@
+#ifndef __BLIZZARD_MOCK_TASK_HPP__
+#define __BLIZZARD_MOCK_TASK_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include <blizzard/plugin.hpp>
+
+namespace blizzard {
+
+/* A request as the server would give it to a plugin, e.g. a fixture of plugin's tests.
+ * It is read-only for tasks, so one request could be shared by tasks of many threads. */
+
+struct mock_request
+{
+	int method;
+	int version_major;
+	int version_minor;
+	struct in_addr ip;
+
+	std::string path;
+	std::string params;
+	std::vector<std::pair<std::string, std::string> > headers;
+	std::string body;
+
+	mock_request();
+
+	/* parses raw HTTP request bytes ("GET /path?params HTTP/1.1\r\n..."), false if malformed */
+	bool parse(const std::string& raw);
+};
+
+/* In-memory blz_task: the request is taken from a mock_request, the response is kept
+ * for checks. reset() prepares the task for the next call keeping all the memory,
+ * so after the first calls the task itself doesn't allocate. Not thread-safe: a task
+ * per thread. */
+
+class mock_task : public blz_task
+{
+	enum {BLOCK_SIZE = 65536};
+
+	struct block
+	{
+		char* data;
+		size_t capacity;
+	};
+
+	const mock_request* req;
+	double now;
+
+	bool cache;
+	int status;
+	int cache_ttl;
+	std::string etag;
+
+	/* "Name: value\r\n" lines */
+	std::string headers;
+	std::string body;
+
+	std::vector<block> blocks;
+	size_t block_idx;
+	size_t offset;
+
+public:
+	mock_task();
+	~mock_task();
+
+	/* starts a new call with the request, now is returned by get_current_server_time() */
+	void reset(const mock_request* r, double now);
+
+	int get_response_status() const { return status; }
+	const std::string& get_response_headers() const { return headers; }
+	const std::string& get_response_body() const { return body; }
+	const std::string& get_response_etag() const { return etag; }
+	int get_cache_ttl() const { return cache_ttl; }
+
+	/* blz_task */
+
+	int              get_request_method() const;
+	int              get_version_major() const;
+	int              get_version_minor() const;
+	bool             get_cache() const;
+	struct in_addr   get_request_ip() const;
+	const char*      get_request_uri_path() const;
+	const char*      get_request_uri_params() const;
+	size_t           get_request_body_len() const;
+	const uint8_t*   get_request_body() const;
+	const char*      get_request_header(const char* name) const;
+	size_t           get_request_headers_num() const;
+	const char*      get_request_header_key(int idx) const;
+	const char*      get_request_header_value(int idx) const;
+	double           get_current_server_time() const;
+
+	void             set_cache(bool);
+	void             set_response_status(int);
+	void             add_response_header(const char* name, const char* data);
+	void             add_response_buffer(const char* data, size_t sz);
+
+	void*            alloc(size_t sz, size_t align = sizeof(void*));
+
+	void             set_cache_ttl(int ttl_ms);
+	void             set_response_etag(const char* etag);
+};
+
+}
+
+#endif /* __BLIZZARD_MOCK_TASK_HPP__ */
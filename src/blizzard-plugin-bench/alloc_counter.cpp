@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include <new>
+#include "alloc_counter.hpp"
+
+static __thread uint64_t alloc_calls = 0;
+static __thread uint64_t alloc_bytes = 0;
+
+blizzard::plugin_bench::alloc_counters blizzard::plugin_bench::thread_alloc_counters()
+{
+	alloc_counters c;
+	c.calls = alloc_calls;
+	c.bytes = alloc_bytes;
+
+	return c;
+}
+
+static void *counted_alloc(size_t sz)
+{
+	alloc_calls++;
+	alloc_bytes += sz;
+
+	return malloc(sz ? sz : 1);
+}
+
+void *operator new(size_t sz) _GLIBCXX_THROW(std::bad_alloc)
+{
+	void *p = counted_alloc(sz);
+	if (0 == p) throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t sz) _GLIBCXX_THROW(std::bad_alloc)
+{
+	void *p = counted_alloc(sz);
+	if (0 == p) throw std::bad_alloc();
+	return p;
+}
+
+void *operator new(size_t sz, const std::nothrow_t&) _GLIBCXX_USE_NOEXCEPT
+{
+	return counted_alloc(sz);
+}
+
+void *operator new[](size_t sz, const std::nothrow_t&) _GLIBCXX_USE_NOEXCEPT
+{
+	return counted_alloc(sz);
+}
+
+void operator delete(void *p) _GLIBCXX_USE_NOEXCEPT
+{
+	free(p);
+}
+
+void operator delete[](void *p) _GLIBCXX_USE_NOEXCEPT
+{
+	free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) _GLIBCXX_USE_NOEXCEPT
+{
+	free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t&) _GLIBCXX_USE_NOEXCEPT
+{
+	free(p);
+}
@@ -0,0 +1,23 @@
+#ifndef __BLIZZARD_PLUGIN_BENCH_ALLOC_COUNTER_HPP__
+#define __BLIZZARD_PLUGIN_BENCH_ALLOC_COUNTER_HPP__
+
+#include <stdint.h>
+
+namespace blizzard {
+namespace plugin_bench {
+
+/* Global operator new and delete of the program count allocations of the calling thread.
+ * The program is linked with -rdynamic, so a plugin loaded by dlopen() gets these operators
+ * too; plain malloc() of the plugin is not counted. */
+
+struct alloc_counters
+{
+	uint64_t calls;
+	uint64_t bytes;
+};
+
+alloc_counters thread_alloc_counters();
+
+}}
+
+#endif /* __BLIZZARD_PLUGIN_BENCH_ALLOC_COUNTER_HPP__ */
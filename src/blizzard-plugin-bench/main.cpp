@@ -0,0 +1,393 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <stdexcept>
+#include <coda/error.hpp>
+#include <coda/logger.h>
+#include <blizzard/config.hpp>
+#include <blizzard/histogram.hpp>
+#include <blizzard/plugin_factory.hpp>
+#include <blizzard-bench/hdr_histogram.hpp>
+#include <blizzard-bench/replay.hpp>
+#include <blizzard-bench/request_template.hpp>
+#include <blizzard-mock/mock_task.hpp>
+#include "alloc_counter.hpp"
+
+using namespace blizzard::plugin_bench;
+using blizzard::bench::hdr_histogram;
+
+/* calls of one handler by one thread, latency is in nanoseconds */
+struct handler_stats
+{
+	hdr_histogram latency;
+
+	uint64_t calls;
+	uint64_t results[3];  /* BLZ_OK, BLZ_ERROR, BLZ_AGAIN */
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+
+	handler_stats()
+		: calls(0)
+		, allocs(0)
+		, alloc_bytes(0)
+	{
+		memset(results, 0, sizeof(results));
+	}
+
+	void add(const handler_stats &s)
+	{
+		latency.add(s.latency);
+
+		calls += s.calls;
+		for (int i = 0; i < 3; i++) results[i] += s.results[i];
+		allocs += s.allocs;
+		alloc_bytes += s.alloc_bytes;
+	}
+};
+
+struct bench_thread
+{
+	int id;
+	int threads;
+
+	blizzard::plugin_instance *inst;
+	bool per_thread;
+	const std::vector<blizzard::mock_request> *requests;
+
+	uint64_t warmup_end;
+	uint64_t end;
+
+	handler_stats easy;
+	handler_stats hard;
+	uint64_t status[6];
+};
+
+static double wall_time()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int call(int (blz_plugin::*handler)(blz_task *), blz_plugin *plugin, blizzard::mock_task &task, handler_stats &s, bool measured)
+{
+	alloc_counters a0 = thread_alloc_counters();
+	uint64_t t0 = blizzard::monotonic_nsec();
+
+	int res = (plugin->*handler)(&task);
+
+	uint64_t t1 = blizzard::monotonic_nsec();
+	alloc_counters a1 = thread_alloc_counters();
+
+	if (measured)
+	{
+		s.calls++;
+		s.results[BLZ_OK <= res && res <= BLZ_AGAIN ? res : BLZ_ERROR]++;
+		s.allocs += a1.calls - a0.calls;
+		s.alloc_bytes += a1.bytes - a0.bytes;
+		s.latency.record(t1 - t0);
+	}
+
+	return res;
+}
+
+/* every thread takes the requests round-robin starting from its own, as easy threads would */
+static void *thread_function(void *ptr)
+{
+	bench_thread *t = (bench_thread *) ptr;
+
+	memset(t->status, 0, sizeof(t->status));
+
+	/* thread_init() and, with <plugin:per_thread>, an own instance as in the server */
+	blizzard::thread_plugin tp(t->per_thread);
+	blz_plugin *plugin = tp.get(t->inst);
+
+	if (NULL == plugin)
+	{
+		return 0;
+	}
+
+	blizzard::mock_task task;
+	size_t idx = t->id % t->requests->size();
+
+	for (;;)
+	{
+		uint64_t now = blizzard::monotonic_usec();
+
+		if (now >= t->end)
+		{
+			break;
+		}
+
+		bool measured = now >= t->warmup_end;
+
+		task.reset(&(*t->requests)[idx], wall_time());
+
+		int res = call(&blz_plugin::easy, plugin, task, t->easy, measured);
+
+		if (BLZ_AGAIN == res)
+		{
+			res = call(&blz_plugin::hard, plugin, task, t->hard, measured);
+		}
+
+		if (measured)
+		{
+			int status = BLZ_OK == res ? task.get_response_status() : 503;
+			t->status[0 < status && status < 600 ? status / 100 : 0]++;
+		}
+
+		idx = (idx + t->threads) % t->requests->size();
+	}
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [options] [-c CONFIG | -m LIBRARY]\n"
+		"  -c, --config=FILE      - blizzard config, the plugin is loaded as by the server\n"
+		"  -m, --module=LIBRARY   - plugin library instead of <plugin:library> of config\n"
+		"  -a, --params=PARAMS    - params of load() instead of <plugin:params> of config\n"
+		"  -f, --templates=FILE   - requests in blizzard-bench templates format (GET /)\n"
+		"  -R, --replay=FILE      - requests of a capture file of the server\n"
+		"  -t, --threads=N        - threads calling the plugin (1)\n"
+		"  -p, --per-thread       - an instance of the plugin per thread (<plugin:per_thread>)\n"
+		"  -d, --duration=SEC     - measured time (5)\n"
+		"  -w, --warmup=SEC       - time before measuring (1)\n"
+		, name);
+}
+
+static void print_handler(const char *name, const handler_stats &s, double seconds)
+{
+	const hdr_histogram &h = s.latency;
+
+	if (0 == s.calls)
+	{
+		printf("%-5s  not called\n", name);
+		return;
+	}
+
+	printf("%-5s %12llu %12.0f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %10.2f %10.1f\n"
+		, name
+		, (unsigned long long) s.calls
+		, s.calls / seconds
+		, h.mean() / 1000
+		, h.percentile(0.5) / 1000.0
+		, h.percentile(0.9) / 1000.0
+		, h.percentile(0.99) / 1000.0
+		, h.percentile(0.999) / 1000.0
+		, h.max() / 1000.0
+		, s.allocs / (double) s.calls
+		, s.alloc_bytes / (double) s.calls);
+}
+
+static void print_results(const char *name, const handler_stats &s)
+{
+	if (s.calls)
+	{
+		printf("%-5s  BLZ_OK %llu, BLZ_ERROR %llu, BLZ_AGAIN %llu\n"
+			, name
+			, (unsigned long long) s.results[BLZ_OK]
+			, (unsigned long long) s.results[BLZ_ERROR]
+			, (unsigned long long) s.results[BLZ_AGAIN]);
+	}
+}
+
+static void load_requests(const char *templates_file, const char *replay_file, std::vector<blizzard::mock_request> &res)
+{
+	std::vector<blizzard::bench::request_template> templates;
+
+	if (replay_file)
+	{
+		std::vector<blizzard::bench::replay_item> items;
+		blizzard::bench::replay_info info;
+
+		blizzard::bench::load_capture(replay_file, templates, items, info);
+	}
+	else if (templates_file)
+	{
+		blizzard::bench::load_templates(templates_file, templates);
+	}
+	else
+	{
+		blizzard::bench::request_template t;
+		t.method = "GET";
+		t.uri = "/";
+
+		templates.push_back(t);
+	}
+
+	for (size_t i = 0; i < templates.size(); i++)
+	{
+		/* weights of templates are kept by repeating */
+		templates[i].build("localhost", false);
+
+		blizzard::mock_request r;
+
+		if (!r.parse(templates[i].bytes))
+		{
+			throw coda_error("request %s %s is not supported by the server", templates[i].method.c_str(), templates[i].uri.c_str());
+		}
+
+		for (int w = 0; w < templates[i].weight; w++)
+		{
+			res.push_back(r);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] =
+	{
+		{"config",    required_argument, 0, 'c'},
+		{"module",    required_argument, 0, 'm'},
+		{"params",    required_argument, 0, 'a'},
+		{"templates", required_argument, 0, 'f'},
+		{"replay",    required_argument, 0, 'R'},
+		{"threads",   required_argument, 0, 't'},
+		{"per-thread", no_argument,      0, 'p'},
+		{"duration",  required_argument, 0, 'd'},
+		{"warmup",    required_argument, 0, 'w'},
+		{"help",      no_argument,       0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	const char *config_file = 0;
+	const char *module = 0;
+	const char *params = 0;
+	const char *templates_file = 0;
+	const char *replay_file = 0;
+	int threads_num = 1;
+	bool per_thread = false;
+	int duration = 5;
+	int warmup = 1;
+
+	int opt;
+
+	while (-1 != (opt = getopt_long(argc, argv, "c:m:a:f:R:t:pd:w:h", options, 0)))
+	{
+		switch (opt)
+		{
+		case 'c': config_file = optarg; break;
+		case 'm': module = optarg; break;
+		case 'a': params = optarg; break;
+		case 'f': templates_file = optarg; break;
+		case 'R': replay_file = optarg; break;
+		case 't': threads_num = atoi(optarg); break;
+		case 'p': per_thread = true; break;
+		case 'd': duration = atoi(optarg); break;
+		case 'w': warmup = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 'h' == opt ? 0 : 1;
+		}
+	}
+
+	if ((!config_file && !module) || 0 >= threads_num || 0 >= duration || 0 > warmup)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	try
+	{
+		blz_config config;
+		blz_config::BLZ::PLUGIN pd;
+
+		if (config_file)
+		{
+			config.load_from_file(config_file);
+			config.check();
+
+			log_level = log_levels(config.blz.log_level.c_str());
+			pd = config.blz.plugin[0];
+		}
+
+		if (module) pd.library = module;
+		if (params) pd.params = params;
+		if (per_thread) pd.per_thread = 1;
+
+		std::vector<blizzard::mock_request> requests;
+		load_requests(templates_file, replay_file, requests);
+
+		blizzard::plugin_factory factory;
+		factory.load_module(pd);
+
+		blizzard::plugin_instance *inst = factory.acquire();
+
+		printf("blizzard-plugin-bench: %s, %d threads%s, %d requests, %d s (+%d s warm-up)\n"
+			, pd.library.c_str(), threads_num, pd.per_thread ? " (per-thread instances)" : "", (int) requests.size(), duration, warmup);
+
+		std::vector<bench_thread> bt(threads_num);
+		std::vector<pthread_t> threads(threads_num);
+
+		uint64_t start = blizzard::monotonic_usec();
+
+		for (int i = 0; i < threads_num; i++)
+		{
+			bt[i].id = i;
+			bt[i].threads = threads_num;
+			bt[i].inst = inst;
+			bt[i].per_thread = 0 != pd.per_thread;
+			bt[i].requests = &requests;
+			bt[i].warmup_end = start + warmup * 1000000ULL;
+			bt[i].end = bt[i].warmup_end + duration * 1000000ULL;
+
+			int r = pthread_create(&threads[i], NULL, &thread_function, &bt[i]);
+
+			if (0 != r)
+			{
+				throw coda_error("error creating thread: %s", strerror(r));
+			}
+		}
+
+		handler_stats easy, hard;
+		uint64_t status[6] = {0, 0, 0, 0, 0, 0};
+
+		for (int i = 0; i < threads_num; i++)
+		{
+			pthread_join(threads[i], NULL);
+
+			easy.add(bt[i].easy);
+			hard.add(bt[i].hard);
+
+			for (int j = 0; j < 6; j++) status[j] += bt[i].status[j];
+		}
+
+		printf("%-5s %12s %12s %9s %9s %9s %9s %9s %9s %10s %10s\n"
+			, "", "calls", "calls/s", "mean", "p50", "p90", "p99", "p99.9", "max", "allocs", "bytes");
+		printf("%-5s %12s %12s %9s %9s %9s %9s %9s %9s %10s %10s\n"
+			, "", "", "", "usec", "usec", "usec", "usec", "usec", "usec", "per call", "per call");
+
+		print_handler("easy", easy, duration);
+		print_handler("hard", hard, duration);
+
+		printf("\n");
+		print_results("easy", easy);
+		print_results("hard", hard);
+
+		printf("responses: 1xx %llu, 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, no status %llu\n"
+			, (unsigned long long) status[1]
+			, (unsigned long long) status[2]
+			, (unsigned long long) status[3]
+			, (unsigned long long) status[4]
+			, (unsigned long long) status[5]
+			, (unsigned long long) status[0]);
+
+		blizzard::plugin_factory::release(inst);
+		factory.stop_module();
+	}
+	catch (const std::exception &e)
+	{
+		fprintf(stderr, "blizzard-plugin-bench: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
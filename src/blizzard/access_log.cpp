@@ -0,0 +1,253 @@
+#include <string.h>
+#include <arpa/inet.h>
+#include <coda/error.hpp>
+#include <coda/string.hpp>
+#include "access_log.hpp"
+#include "http.hpp"
+
+const char *blizzard::access_log_format::DEFAULT = "$remote_addr [$time_local] \"$request_method $request_uri\" $status $bytes_sent $request_time \"$http_referer\" \"$http_user_agent\"";
+
+const blizzard::access_log_format::variable_name blizzard::access_log_format::variable_names [] =
+{
+	{"remote_addr", VAR_REMOTE_ADDR},
+	{"time_local", VAR_TIME_LOCAL},
+	{"time_iso8601", VAR_TIME_ISO8601},
+	{"msec", VAR_MSEC},
+	{"request_method", VAR_REQUEST_METHOD},
+	{"uri", VAR_URI},
+	{"args", VAR_ARGS},
+	{"request_uri", VAR_REQUEST_URI},
+	{"status", VAR_STATUS},
+	{"bytes_sent", VAR_BYTES_SENT},
+	{"request_length", VAR_REQUEST_LENGTH},
+	{"request_time", VAR_REQUEST_TIME},
+	{"request_time_us", VAR_REQUEST_TIME_US},
+	{"handler", VAR_HANDLER},
+	{0, VAR_TEXT}
+};
+
+static bool is_name_char(char c)
+{
+	return ('a' <= c && c <= 'z') || ('0' <= c && c <= '9') || '_' == c;
+}
+
+/* values from the client are escaped like nginx does, a line can't be broken by them */
+static void append_escaped(std::string &out, const char *s)
+{
+	if (0 == s || 0 == *s)
+	{
+		out += '-';
+		return;
+	}
+
+	for (; *s; s++)
+	{
+		unsigned char c = *s;
+
+		if (c < 0x20 || c >= 0x7f || '"' == c || '\\' == c)
+		{
+			coda_strappend(out, "\\x%02X", c);
+		}
+		else
+		{
+			out += c;
+		}
+	}
+}
+
+blizzard::access_log_format::access_log_format()
+	: cached_time(0)
+{
+	time_local[0] = 0;
+	time_iso8601[0] = 0;
+}
+
+void blizzard::access_log_format::parse(const std::string &fmt)
+{
+	std::vector<item> res;
+	item it;
+
+	size_t i = 0;
+
+	while (i < fmt.size())
+	{
+		size_t dollar = fmt.find('$', i);
+
+		if (dollar != i)
+		{
+			it.var = VAR_TEXT;
+			it.text = fmt.substr(i, std::string::npos == dollar ? std::string::npos : dollar - i);
+			res.push_back(it);
+
+			if (std::string::npos == dollar)
+			{
+				break;
+			}
+		}
+
+		size_t end = dollar + 1;
+
+		while (end < fmt.size() && is_name_char(fmt[end]))
+		{
+			end++;
+		}
+
+		std::string name = fmt.substr(dollar + 1, end - dollar - 1);
+
+		if (name.empty())
+		{
+			throw coda_error("access log format: '$' without variable name at %d", (int) dollar);
+		}
+
+		if (0 == name.compare(0, 5, "http_") && name.size() > 5)
+		{
+			/* $http_user_agent is User-Agent header */
+			it.var = VAR_HTTP_HEADER;
+			it.text = name.substr(5);
+
+			for (size_t j = 0; j < it.text.size(); j++)
+			{
+				if ('_' == it.text[j]) it.text[j] = '-';
+			}
+		}
+		else
+		{
+			int j = 0;
+
+			while (variable_names[j].name && name != variable_names[j].name)
+			{
+				j++;
+			}
+
+			if (0 == variable_names[j].name)
+			{
+				throw coda_error("access log format: unknown variable $%s", name.c_str());
+			}
+
+			it.var = variable_names[j].var;
+			it.text.clear();
+		}
+
+		res.push_back(it);
+		i = end;
+	}
+
+	items.swap(res);
+}
+
+void blizzard::access_log_format::update_time(time_t now)
+{
+	if (now == cached_time)
+	{
+		return;
+	}
+
+	struct tm tm;
+	localtime_r(&now, &tm);
+
+	strftime(time_local, sizeof(time_local), "%d/%b/%Y:%H:%M:%S %z", &tm);
+	strftime(time_iso8601, sizeof(time_iso8601), "%Y-%m-%dT%H:%M:%S%z", &tm);
+
+	cached_time = now;
+}
+
+void blizzard::access_log_format::format(std::string &out, http *con, double now)
+{
+	static const char *methods[] = {"-", "GET", "POST", "HEAD", "OPTIONS"};
+
+	const http::stage_times& t = con->times;
+
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const item &it = items[i];
+
+		switch (it.var)
+		{
+		case VAR_TEXT:
+			out += it.text;
+			break;
+
+		case VAR_REMOTE_ADDR:
+		{
+			char ip [INET_ADDRSTRLEN];
+			struct in_addr in_ip = con->get_request_ip();
+			out += inet_ntop(AF_INET, &in_ip, ip, sizeof(ip)) ? ip : "-";
+			break;
+		}
+
+		case VAR_TIME_LOCAL:
+			update_time((time_t) now);
+			out += time_local;
+			break;
+
+		case VAR_TIME_ISO8601:
+			update_time((time_t) now);
+			out += time_iso8601;
+			break;
+
+		case VAR_MSEC:
+			coda_strappend(out, "%.3f", now);
+			break;
+
+		case VAR_REQUEST_METHOD:
+		{
+			int method = con->get_request_method();
+			out += (0 <= method && method <= BLZ_METHOD_OPTIONS) ? methods[method] : methods[0];
+			break;
+		}
+
+		case VAR_URI:
+			append_escaped(out, con->get_request_uri_path());
+			break;
+
+		case VAR_ARGS:
+			append_escaped(out, con->get_request_uri_params());
+			break;
+
+		case VAR_REQUEST_URI:
+		{
+			const char *params = con->get_request_uri_params();
+
+			append_escaped(out, con->get_request_uri_path());
+
+			if (params && *params)
+			{
+				out += '?';
+				append_escaped(out, params);
+			}
+
+			break;
+		}
+
+		case VAR_STATUS:
+			coda_strappend(out, "%d", con->get_response_status());
+			break;
+
+		case VAR_BYTES_SENT:
+			coda_strappend(out, "%llu", (unsigned long long) con->get_response_size());
+			break;
+
+		case VAR_REQUEST_LENGTH:
+			coda_strappend(out, "%llu", (unsigned long long) con->get_request_size());
+			break;
+
+		case VAR_REQUEST_TIME:
+			coda_strappend(out, "%.3f", t.written > t.accepted ? (t.written - t.accepted) / 1000000.0 : 0.0);
+			break;
+
+		case VAR_REQUEST_TIME_US:
+			coda_strappend(out, "%llu", (unsigned long long) (t.written > t.accepted ? t.written - t.accepted : 0));
+			break;
+
+		case VAR_HANDLER:
+			out += t.hard_push ? "hard" : (t.easy_push ? "easy" : "event");
+			break;
+
+		case VAR_HTTP_HEADER:
+			append_escaped(out, con->get_request_header(it.text.c_str()));
+			break;
+		}
+	}
+
+	out += '\n';
+}
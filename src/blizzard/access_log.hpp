@@ -0,0 +1,73 @@
+#ifndef __BLIZZARD_ACCESS_LOG_HPP__
+#define __BLIZZARD_ACCESS_LOG_HPP__
+
+#include <time.h>
+#include <string>
+#include <vector>
+
+namespace blizzard {
+
+class http;
+
+/* Format of access log lines, nginx-like: text with $variables, compiled once by parse().
+ * Not thread-safe, the cached time strings belong to the thread which formats. */
+
+class access_log_format
+{
+	enum variable
+	{
+		VAR_TEXT,
+		VAR_REMOTE_ADDR,
+		VAR_TIME_LOCAL,
+		VAR_TIME_ISO8601,
+		VAR_MSEC,
+		VAR_REQUEST_METHOD,
+		VAR_URI,
+		VAR_ARGS,
+		VAR_REQUEST_URI,
+		VAR_STATUS,
+		VAR_BYTES_SENT,
+		VAR_REQUEST_LENGTH,
+		VAR_REQUEST_TIME,
+		VAR_REQUEST_TIME_US,
+		VAR_HANDLER,
+		VAR_HTTP_HEADER
+	};
+
+	struct variable_name
+	{
+		const char *name;
+		variable var;
+	};
+
+	static const variable_name variable_names [];
+
+	struct item
+	{
+		variable var;
+		std::string text; /* text or header name */
+	};
+
+	std::vector<item> items;
+
+	time_t cached_time;
+	char time_local [64];
+	char time_iso8601 [64];
+
+	void update_time(time_t now);
+
+public:
+	static const char *DEFAULT;
+
+	access_log_format();
+
+	/* throws coda_error on unknown variable */
+	void parse(const std::string &fmt);
+
+	/* appends the line of a finished request with '\n' */
+	void format(std::string &out, http *con, double now);
+};
+
+}
+
+#endif /* __BLIZZARD_ACCESS_LOG_HPP__ */
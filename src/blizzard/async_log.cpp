@@ -0,0 +1,375 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <coda/error.hpp>
+#include <coda/logger.h>
+#include "async_log.hpp"
+
+blizzard::async_log::async_log()
+	: fd(-1)
+	, rings_num(0)
+	, ring_size(0)
+	, written(0)
+	, drops(0)
+	, sampled_out(0)
+	, reported_losses(0)
+	, running(false)
+	, reopen_requested(0)
+{
+	memset(rings, 0, sizeof(rings));
+	pthread_mutex_init(&rings_mutex, 0);
+}
+
+blizzard::async_log::~async_log()
+{
+	close();
+	pthread_mutex_destroy(&rings_mutex);
+}
+
+void blizzard::async_log::open(const std::string &name, size_t buffer_size)
+{
+	close();
+
+	/* capacity is a power of two to wrap positions with a mask */
+	ring_size = 4096;
+
+	while (ring_size < buffer_size)
+	{
+		ring_size <<= 1;
+	}
+
+	file_name = name;
+	written = 0;
+	drops = 0;
+	sampled_out = 0;
+	reported_losses = 0;
+	reopen_requested = 0;
+
+	open_file();
+
+	if (-1 == fd)
+	{
+		throw coda_error("async_log: can't open %s: %s", name.c_str(), coda_strerror(errno));
+	}
+
+	/* a new key on every open, so threads which wrote before close() get new rings */
+	pthread_key_create(&ring_key, release_ring);
+
+	running = true;
+
+	int r = pthread_create(&writer_th, NULL, &writer_function, this);
+
+	if (0 != r)
+	{
+		running = false;
+		pthread_key_delete(ring_key);
+
+		::close(fd);
+		fd = -1;
+
+		throw coda_error("async_log: error creating writer thread for %s: %s", name.c_str(), coda_strerror(r));
+	}
+}
+
+void blizzard::async_log::close()
+{
+	if (!running)
+	{
+		return;
+	}
+
+	running = false;
+	pthread_join(writer_th, NULL);
+
+	pthread_key_delete(ring_key);
+
+	for (int i = 0; i < rings_num; i++)
+	{
+		free(rings[i]->data);
+		delete rings[i];
+		rings[i] = 0;
+	}
+
+	rings_num = 0;
+
+	if (-1 != fd)
+	{
+		::close(fd);
+		fd = -1;
+	}
+}
+
+bool blizzard::async_log::is_open() const
+{
+	return running;
+}
+
+void blizzard::async_log::open_file()
+{
+	fd = ::open(file_name.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+}
+
+void blizzard::async_log::release_ring(void *ptr)
+{
+	/* the writer still drains what is left, the next thread takes the ring over */
+	__sync_synchronize();
+	((ring *) ptr)->owned = false;
+}
+
+blizzard::async_log::ring *blizzard::async_log::get_ring()
+{
+	ring *r = (ring *) pthread_getspecific(ring_key);
+
+	if (r)
+	{
+		return r;
+	}
+
+	pthread_mutex_lock(&rings_mutex);
+
+	for (int i = 0; i < rings_num; i++)
+	{
+		if (!rings[i]->owned)
+		{
+			r = rings[i];
+			break;
+		}
+	}
+
+	if (0 == r && rings_num < MAX_RINGS)
+	{
+		char *data = (char *) malloc(ring_size);
+
+		if (data)
+		{
+			r = new ring;
+			r->data = data;
+			r->capacity = ring_size;
+			r->head = 0;
+			r->tail = 0;
+			r->seq = 0;
+
+			rings[rings_num] = r;
+			__sync_synchronize();
+			rings_num++;
+		}
+	}
+
+	if (r)
+	{
+		r->owned = true;
+		pthread_setspecific(ring_key, r);
+	}
+
+	pthread_mutex_unlock(&rings_mutex);
+
+	return r;
+}
+
+bool blizzard::async_log::write(const char *data, size_t len)
+{
+	if (!running)
+	{
+		return false;
+	}
+
+	ring *r = get_ring();
+
+	if (0 == r)
+	{
+		__sync_fetch_and_add(&drops, 1);
+		return false;
+	}
+
+	uint64_t h = r->head;
+	size_t used = h - r->tail;
+
+	if (r->capacity - used < len)
+	{
+		__sync_fetch_and_add(&drops, 1);
+		return false;
+	}
+
+	/* the writer falls behind: keep a sample instead of filling the ring up */
+	if (used > r->capacity / 4 * 3 && 0 != r->seq++ % SAMPLE_RATE)
+	{
+		__sync_fetch_and_add(&sampled_out, 1);
+		return false;
+	}
+
+	size_t pos = h & (r->capacity - 1);
+	size_t first = r->capacity - pos < len ? r->capacity - pos : len;
+
+	memcpy(r->data + pos, data, first);
+	memcpy(r->data, data + first, len - first);
+
+	/* data must be in the ring before the writer sees the new head */
+	__sync_synchronize();
+	r->head = h + len;
+
+	__sync_fetch_and_add(&written, 1);
+
+	return true;
+}
+
+void blizzard::async_log::reopen()
+{
+	reopen_requested = 1;
+}
+
+uint64_t blizzard::async_log::get_written() const
+{
+	return written;
+}
+
+uint64_t blizzard::async_log::get_drops() const
+{
+	return drops;
+}
+
+uint64_t blizzard::async_log::get_sampled_out() const
+{
+	return sampled_out;
+}
+
+void *blizzard::async_log::writer_function(void *ptr)
+{
+	((async_log *) ptr)->writer_loop();
+	return 0;
+}
+
+/* gathers everything buffered into one writev(), false if there was nothing */
+bool blizzard::async_log::flush()
+{
+	struct iovec iov [2 * MAX_RINGS];
+	uint64_t heads [MAX_RINGS];
+
+	int iov_num = 0;
+	size_t total = 0;
+
+	int num = rings_num;
+
+	for (int i = 0; i < num; i++)
+	{
+		ring *r = rings[i];
+
+		uint64_t t = r->tail;
+		uint64_t h = r->head;
+
+		__sync_synchronize();
+
+		heads[i] = h;
+
+		if (t == h)
+		{
+			continue;
+		}
+
+		size_t pos = t & (r->capacity - 1);
+		size_t len = h - t;
+		size_t first = r->capacity - pos < len ? r->capacity - pos : len;
+
+		iov[iov_num].iov_base = r->data + pos;
+		iov[iov_num].iov_len = first;
+		iov_num++;
+
+		if (len > first)
+		{
+			iov[iov_num].iov_base = r->data;
+			iov[iov_num].iov_len = len - first;
+			iov_num++;
+		}
+
+		total += len;
+	}
+
+	if (0 == total)
+	{
+		return false;
+	}
+
+	struct iovec *cur = iov;
+	int cur_num = iov_num;
+
+	while (cur_num)
+	{
+		ssize_t res = ::writev(fd, cur, cur_num < IOV_MAX ? cur_num : IOV_MAX);
+
+		if (0 > res)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+
+			log_error("async_log: write to %s failed: %s", file_name.c_str(), coda_strerror(errno));
+			break;
+		}
+
+		while (cur_num && (size_t) res >= cur->iov_len)
+		{
+			res -= cur->iov_len;
+			cur++;
+			cur_num--;
+		}
+
+		if (cur_num)
+		{
+			cur->iov_base = (char *) cur->iov_base + res;
+			cur->iov_len -= res;
+		}
+	}
+
+	/* what failed to be written is lost, producers need the space */
+	__sync_synchronize();
+
+	for (int i = 0; i < num; i++)
+	{
+		rings[i]->tail = heads[i];
+	}
+
+	return true;
+}
+
+void blizzard::async_log::writer_loop()
+{
+	while (running)
+	{
+		if (!flush())
+		{
+			usleep(FLUSH_INTERVAL_MS * 1000);
+		}
+
+		if (reopen_requested)
+		{
+			reopen_requested = 0;
+
+			int old_fd = fd;
+			open_file();
+
+			if (-1 == fd)
+			{
+				log_error("async_log: can't reopen %s: %s", file_name.c_str(), coda_strerror(errno));
+				fd = old_fd;
+			}
+			else
+			{
+				::close(old_fd);
+			}
+		}
+
+		uint64_t losses = drops + sampled_out;
+
+		if (losses != reported_losses)
+		{
+			log_warn("async_log: %llu lines lost in %s, the writer falls behind", (unsigned long long) (losses - reported_losses), file_name.c_str());
+			reported_losses = losses;
+		}
+	}
+
+	flush();
+}
@@ -0,0 +1,84 @@
+#ifndef __BLIZZARD_ASYNC_LOG_HPP__
+#define __BLIZZARD_ASYNC_LOG_HPP__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace blizzard {
+
+/* Log file written by a background thread: every producer thread copies lines into its own
+ * lock-free ring buffer and never blocks on disk, the writer gathers all the rings into one
+ * writev(). When a ring is filled by 3/4, only every SAMPLE_RATE-th line is taken; lines
+ * which don't fit are dropped. Both losses are counted. */
+
+class async_log
+{
+	enum {FLUSH_INTERVAL_MS = 50};
+	enum {MAX_RINGS = 256};
+	enum {SAMPLE_RATE = 8};
+
+	struct ring
+	{
+		char *data;
+		size_t capacity;
+
+		volatile uint64_t head;
+		volatile uint64_t tail;
+
+		uint32_t seq;
+		bool owned;
+	};
+
+	std::string file_name;
+	int fd;
+
+	ring *rings [MAX_RINGS];
+	volatile int rings_num;
+	size_t ring_size;
+	pthread_mutex_t rings_mutex;
+	pthread_key_t ring_key;
+
+	volatile uint64_t written;
+	volatile uint64_t drops;
+	volatile uint64_t sampled_out;
+	uint64_t reported_losses;
+
+	volatile bool running;
+	volatile int reopen_requested;
+	pthread_t writer_th;
+
+	static void *writer_function(void *ptr);
+	static void release_ring(void *ptr);
+
+	ring *get_ring();
+
+	void writer_loop();
+	bool flush();
+	void open_file();
+
+public:
+	async_log();
+	~async_log();
+
+	/* buffer_size is the size of the ring of each writing thread */
+	void open(const std::string &name, size_t buffer_size);
+	void close();
+
+	bool is_open() const;
+
+	/* false if the line is dropped or sampled out */
+	bool write(const char *data, size_t len);
+
+	/* the file is reopened by the writer thread, e.g. after rotation */
+	void reopen();
+
+	uint64_t get_written() const;
+	uint64_t get_drops() const;
+	uint64_t get_sampled_out() const;
+};
+
+}
+
+#endif /* __BLIZZARD_ASYNC_LOG_HPP__ */
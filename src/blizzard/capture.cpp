@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string.h>
+#include "capture.hpp"
+#include "http.hpp"
+
+static const char *method_name(int method)
+{
+	switch (method)
+	{
+	case BLZ_METHOD_GET: return "GET";
+	case BLZ_METHOD_POST: return "POST";
+	case BLZ_METHOD_HEAD: return "HEAD";
+	case BLZ_METHOD_OPTIONS: return "OPTIONS";
+	}
+
+	return "GET";
+}
+
+void blizzard::capture_request(std::string& out, const http *con, uint32_t sample)
+{
+	size_t start = out.size();
+	out.resize(start + sizeof(capture_record));
+
+	const char *path = con->get_request_uri_path();
+	const char *params = con->get_request_uri_params();
+
+	out += method_name(con->get_request_method());
+	out += ' ';
+	out += path ? path : "/";
+
+	if (params && *params)
+	{
+		out += '?';
+		out += params;
+	}
+
+	char version [32];
+	snprintf(version, sizeof(version), " HTTP/%d.%d\r\n", con->get_version_major(), con->get_version_minor());
+	out += version;
+
+	for (size_t i = 0; i < con->get_request_headers_num(); i++)
+	{
+		out += con->get_request_header_key(i);
+		out += ": ";
+		out += con->get_request_header_value(i);
+		out += "\r\n";
+	}
+
+	out += "\r\n";
+
+	if (con->get_request_body_len())
+	{
+		out.append((const char *) con->get_request_body(), con->get_request_body_len());
+	}
+
+	capture_record rec;
+
+	rec.magic = capture_record::MAGIC;
+	rec.length = out.size() - start - sizeof(capture_record);
+	rec.ip = con->get_request_ip().s_addr;
+	rec.sample = sample;
+	rec.time = con->times.accepted;
+
+	memcpy(&out[start], &rec, sizeof(rec));
+}
@@ -0,0 +1,32 @@
+#ifndef __BLIZZARD_CAPTURE_HPP__
+#define __BLIZZARD_CAPTURE_HPP__
+
+#include <stdint.h>
+#include <string>
+
+namespace blizzard {
+
+class http;
+
+/* Capture file: a sequence of records, every one is the header below in host byte order
+ * followed by length bytes of the request as it came from the client (rebuilt from the parsed
+ * request: title, headers in the original order and body). time is the monotonic time
+ * of accept in usec, only the differences between records make sense. */
+
+struct capture_record
+{
+	enum {MAGIC = 0x50414342}; /* "BCAP" */
+
+	uint32_t magic;
+	uint32_t length;
+	uint32_t ip;      /* network byte order */
+	uint32_t sample;  /* one of sample requests was captured */
+	uint64_t time;
+};
+
+/* appends the record of a parsed request to out */
+void capture_request(std::string& out, const http *con, uint32_t sample);
+
+}
+
+#endif /* __BLIZZARD_CAPTURE_HPP__ */
@@ -0,0 +1,387 @@
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <zlib.h>
+#ifdef BLZ_WITH_ZSTD
+#include <zstd.h>
+#endif
+#include "compressor.hpp"
+
+struct blizzard::compressor::contexts
+{
+	z_stream gzip;
+	z_stream deflate;
+
+	bool gzip_ready;
+	bool deflate_ready;
+
+#ifdef BLZ_WITH_ZSTD
+	ZSTD_CCtx* zstd;
+#endif
+
+	contexts() : gzip_ready(false), deflate_ready(false)
+	{
+		memset(&gzip, 0, sizeof(gzip));
+		memset(&deflate, 0, sizeof(deflate));
+#ifdef BLZ_WITH_ZSTD
+		zstd = 0;
+#endif
+	}
+
+	~contexts()
+	{
+		if (gzip_ready) deflateEnd(&gzip);
+		if (deflate_ready) deflateEnd(&deflate);
+#ifdef BLZ_WITH_ZSTD
+		if (zstd) ZSTD_freeCCtx(zstd);
+#endif
+	}
+};
+
+static const char* encoding_names[blizzard::compressor::ENCODINGS_NUM] = {
+	"identity",
+	"gzip",
+	"deflate",
+	"zstd"
+};
+
+blizzard::compressor::compressor()
+	: min_size(0)
+	, level(Z_DEFAULT_COMPRESSION)
+{
+	pthread_key_create(&contexts_key, free_contexts);
+}
+
+blizzard::compressor::~compressor()
+{
+	pthread_key_delete(contexts_key);
+}
+
+void blizzard::compressor::free_contexts(void* ptr)
+{
+	delete (contexts*) ptr;
+}
+
+blizzard::compressor::contexts* blizzard::compressor::get_contexts()
+{
+	contexts* ctx = (contexts*) pthread_getspecific(contexts_key);
+
+	if (0 == ctx)
+	{
+		ctx = new contexts;
+		pthread_setspecific(contexts_key, ctx);
+	}
+
+	return ctx;
+}
+
+void blizzard::compressor::init(const blz_config::BLZ::COMPRESSION& cfg)
+{
+	preferred.clear();
+
+	min_size = cfg.min_size;
+	level = cfg.level;
+
+	const char *delims = " \t,;";
+	const char *p = cfg.encodings.c_str();
+
+	while (*p)
+	{
+		p += strspn(p, delims);
+		size_t len = strcspn(p, delims);
+
+		if (0 == len)
+		{
+			break;
+		}
+
+		int enc = ENCODING_IDENTITY;
+
+		for (int i = ENCODING_IDENTITY + 1; i < ENCODINGS_NUM; i++)
+		{
+			if (len == strlen(encoding_names[i]) && 0 == strncasecmp(p, encoding_names[i], len))
+			{
+				enc = i;
+			}
+		}
+
+		if (ENCODING_IDENTITY == enc)
+		{
+			throw coda_error("unknown encoding '%.*s' in <compression:encodings>", (int) len, p);
+		}
+
+#ifndef BLZ_WITH_ZSTD
+		if (ENCODING_ZSTD == enc)
+		{
+			log_warn("blizzard is built without zstd, '%s' is ignored in <compression:encodings>", encoding_names[enc]);
+			p += len;
+			continue;
+		}
+#endif
+
+		preferred.push_back(enc);
+		p += len;
+	}
+}
+
+bool blizzard::compressor::enabled() const
+{
+	return !preferred.empty();
+}
+
+size_t blizzard::compressor::get_min_size() const
+{
+	return min_size;
+}
+
+const char* blizzard::compressor::encoding_name(int enc)
+{
+	return (0 <= enc && enc < ENCODINGS_NUM) ? encoding_names[enc] : encoding_names[ENCODING_IDENTITY];
+}
+
+int blizzard::compressor::negotiate(const char* accept_encoding) const
+{
+	if (!enabled() || 0 == accept_encoding)
+	{
+		return ENCODING_IDENTITY;
+	}
+
+	double q_enc [ENCODINGS_NUM];
+	double q_any = -1;
+
+	for (int i = 0; i < ENCODINGS_NUM; i++)
+	{
+		q_enc[i] = -1;
+	}
+
+	const char *p = accept_encoding;
+
+	while (*p)
+	{
+		p += strspn(p, " \t,");
+		size_t len = strcspn(p, " \t,;");
+
+		if (0 == len)
+		{
+			break;
+		}
+
+		const char *token = p;
+		p += len;
+
+		double q = 1;
+
+		const char *params_end = p + strcspn(p, ",");
+		const char *qp = strstr(p, "q=");
+
+		if (qp && qp < params_end)
+		{
+			q = atof(qp + 2);
+		}
+
+		p = params_end;
+
+		if (1 == len && '*' == *token)
+		{
+			q_any = q;
+			continue;
+		}
+
+		for (int i = ENCODING_IDENTITY + 1; i < ENCODINGS_NUM; i++)
+		{
+			if (len == strlen(encoding_names[i]) && 0 == strncasecmp(token, encoding_names[i], len))
+			{
+				q_enc[i] = q;
+			}
+		}
+
+		if (len == 6 && 0 == strncasecmp(token, "x-gzip", len))
+		{
+			q_enc[ENCODING_GZIP] = q;
+		}
+	}
+
+	for (size_t i = 0; i < preferred.size(); i++)
+	{
+		int enc = preferred[i];
+		double q = 0 <= q_enc[enc] ? q_enc[enc] : q_any;
+
+		if (0 < q)
+		{
+			return enc;
+		}
+	}
+
+	return ENCODING_IDENTITY;
+}
+
+bool blizzard::compressor::deflate_parts(int window_bits, const struct iovec* parts, size_t parts_num, std::string& out)
+{
+	contexts* ctx = get_contexts();
+
+	bool gzip = window_bits > MAX_WBITS;
+	z_stream* zs = gzip ? &ctx->gzip : &ctx->deflate;
+	bool& ready = gzip ? ctx->gzip_ready : ctx->deflate_ready;
+
+	if (!ready)
+	{
+		int lvl = level < 0 ? Z_DEFAULT_COMPRESSION : (level > 9 ? 9 : level);
+
+		if (Z_OK != deflateInit2(zs, lvl, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY))
+		{
+			log_error("compressor: deflateInit2 failed");
+			return false;
+		}
+
+		ready = true;
+	}
+	else
+	{
+		deflateReset(zs);
+	}
+
+	size_t total = 0;
+
+	for (size_t i = 0; i < parts_num; i++)
+	{
+		total += parts[i].iov_len;
+	}
+
+	out.resize(deflateBound(zs, total));
+
+	zs->next_out = (Bytef*) &out[0];
+	zs->avail_out = out.size();
+
+	for (size_t i = 0; i < parts_num; i++)
+	{
+		int flush = (i + 1 == parts_num) ? Z_FINISH : Z_NO_FLUSH;
+
+		zs->next_in = (Bytef*) parts[i].iov_base;
+		zs->avail_in = parts[i].iov_len;
+
+		while (true)
+		{
+			int ret = ::deflate(zs, flush);
+
+			if (Z_STREAM_END == ret)
+			{
+				break;
+			}
+
+			if (Z_OK != ret && Z_BUF_ERROR != ret)
+			{
+				log_error("compressor: deflate failed: %d", ret);
+				return false;
+			}
+
+			if (0 == zs->avail_in && Z_NO_FLUSH == flush)
+			{
+				break;
+			}
+
+			if (0 == zs->avail_out)
+			{
+				size_t done = out.size();
+				out.resize(2 * done);
+
+				zs->next_out = (Bytef*) &out[done];
+				zs->avail_out = out.size() - done;
+			}
+		}
+	}
+
+	out.resize(zs->total_out);
+
+	return true;
+}
+
+bool blizzard::compressor::zstd_parts(const struct iovec* parts, size_t parts_num, std::string& out)
+{
+#ifdef BLZ_WITH_ZSTD
+	contexts* ctx = get_contexts();
+
+	if (0 == ctx->zstd)
+	{
+		ctx->zstd = ZSTD_createCCtx();
+
+		if (0 == ctx->zstd)
+		{
+			log_error("compressor: ZSTD_createCCtx failed");
+			return false;
+		}
+	}
+
+	ZSTD_CCtx_reset(ctx->zstd, ZSTD_reset_session_and_parameters);
+	ZSTD_CCtx_setParameter(ctx->zstd, ZSTD_c_compressionLevel, level < 0 ? 3 : (level > ZSTD_maxCLevel() ? ZSTD_maxCLevel() : level));
+
+	size_t total = 0;
+
+	for (size_t i = 0; i < parts_num; i++)
+	{
+		total += parts[i].iov_len;
+	}
+
+	out.resize(ZSTD_compressBound(total));
+
+	ZSTD_outBuffer ob = {&out[0], out.size(), 0};
+
+	for (size_t i = 0; i < parts_num; i++)
+	{
+		ZSTD_EndDirective mode = (i + 1 == parts_num) ? ZSTD_e_end : ZSTD_e_continue;
+		ZSTD_inBuffer ib = {parts[i].iov_base, parts[i].iov_len, 0};
+
+		while (true)
+		{
+			size_t ret = ZSTD_compressStream2(ctx->zstd, &ob, &ib, mode);
+
+			if (ZSTD_isError(ret))
+			{
+				log_error("compressor: zstd failed: %s", ZSTD_getErrorName(ret));
+				return false;
+			}
+
+			if (ZSTD_e_end == mode ? 0 == ret : ib.pos == ib.size)
+			{
+				break;
+			}
+
+			if (ob.pos == ob.size)
+			{
+				out.resize(2 * out.size());
+
+				ob.dst = &out[0];
+				ob.size = out.size();
+			}
+		}
+	}
+
+	out.resize(ob.pos);
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool blizzard::compressor::compress(int enc, const struct iovec* parts, size_t parts_num, std::string& out)
+{
+	if (0 == parts_num)
+	{
+		return false;
+	}
+
+	switch (enc)
+	{
+	case ENCODING_GZIP:
+		return deflate_parts(MAX_WBITS + 16, parts, parts_num, out);
+
+	case ENCODING_DEFLATE:
+		return deflate_parts(MAX_WBITS, parts, parts_num, out);
+
+	case ENCODING_ZSTD:
+		return zstd_parts(parts, parts_num, out);
+
+	default:
+		return false;
+	}
+}
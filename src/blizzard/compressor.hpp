@@ -0,0 +1,61 @@
+#ifndef __BLIZZARD_COMPRESSOR_HPP__
+#define __BLIZZARD_COMPRESSOR_HPP__
+
+#include <pthread.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include "config.hpp"
+
+namespace blizzard {
+
+/* Response body compression: encoding is negotiated on the event thread,
+ * bodies are compressed in worker threads with per-thread compression contexts */
+
+class compressor
+{
+public:
+	enum encoding
+	{
+		ENCODING_IDENTITY = 0,
+		ENCODING_GZIP,
+		ENCODING_DEFLATE,
+		ENCODING_ZSTD,
+		ENCODINGS_NUM
+	};
+
+private:
+	std::vector<int> preferred;
+
+	size_t min_size;
+	int level;
+
+	pthread_key_t contexts_key;
+
+	struct contexts;
+	static void free_contexts(void* ptr);
+
+	contexts* get_contexts();
+
+	bool deflate_parts(int window_bits, const struct iovec* parts, size_t parts_num, std::string& out);
+	bool zstd_parts(const struct iovec* parts, size_t parts_num, std::string& out);
+
+public:
+	compressor();
+	~compressor();
+
+	void init(const blz_config::BLZ::COMPRESSION& cfg);
+
+	bool enabled() const;
+	size_t get_min_size() const;
+
+	int negotiate(const char* accept_encoding) const;
+
+	bool compress(int enc, const struct iovec* parts, size_t parts_num, std::string& out);
+
+	static const char* encoding_name(int enc);
+};
+
+}
+
+#endif /* __BLIZZARD_COMPRESSOR_HPP__ */
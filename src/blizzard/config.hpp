@@ -2,6 +2,7 @@
 #define __BLIZZARD_CONFIG_HPP__
 
 #include <string>
+#include <vector>
 #include <inttypes.h>
 #include <coda/error.hpp>
 #include <coda/logger.h>
@@ -17,20 +18,34 @@ struct blz_config : public coda::txml_determination_object
 		std::string log_file_name;
 		std::string log_level;
 
+		/* what SIGHUP does: "restart" (default) restarts the server, "hot" reloads the plugin only */
+		std::string reload;
+
+		/* ms to finish the requests in progress on SIGTERM or restart, 0 to stop at once */
+		int shutdown_timeout;
+
+		int etag;
+
 		struct STATS : public coda::txml_determination_object
 		{
 			std::string uri;
+			std::string windows;
+			std::string routes;
 
-			STATS() {}
+			STATS() : windows("10 60") {}
 
 			void determine(coda::txml_parser* p)
 			{
 				txml_member(p, uri);
+				txml_member(p, windows);
+				txml_member(p, routes);
 			}
 
 			void clear()
 			{
 				uri.clear();
+				windows = "10 60";
+				routes.clear();
 			}
 
 			void check(const char *par, const char *ns)
@@ -42,10 +57,329 @@ struct blz_config : public coda::txml_determination_object
 			}
 		};
 
+		struct HEALTH : public coda::txml_determination_object
+		{
+			std::string uri;
+			int max_easy_queue;
+			int max_hard_queue;
+
+			HEALTH()
+				: max_easy_queue(0)
+				, max_hard_queue(0)
+			{}
+
+			void determine(coda::txml_parser* p)
+			{
+				txml_member(p, uri);
+				txml_member(p, max_easy_queue);
+				txml_member(p, max_hard_queue);
+			}
+
+			void clear()
+			{
+				uri.clear();
+				max_easy_queue = 0;
+				max_hard_queue = 0;
+			}
+
+			void check(const char *par, const char *ns)
+			{
+				char curns [SRV_BUF];
+				snprintf(curns, SRV_BUF, "%s:%s", par, ns);
+
+				if (0 > max_easy_queue) throw coda_error("<%s:max_easy_queue> is negative", curns);
+				if (0 > max_hard_queue) throw coda_error("<%s:max_hard_queue> is negative", curns);
+			}
+		};
+
+		struct SLOW_LOG : public coda::txml_determination_object
+		{
+			std::string file_name;
+			int threshold;
+			int buffer_size;
+
+			SLOW_LOG()
+				: threshold(1000)
+				, buffer_size(1)
+			{}
+
+			void determine(coda::txml_parser* p)
+			{
+				txml_member(p, file_name);
+				txml_member(p, threshold);
+				txml_member(p, buffer_size);
+			}
+
+			void clear()
+			{
+				file_name.clear();
+				threshold = 1000;
+				buffer_size = 1;
+			}
+
+			void check(const char *par, const char *ns)
+			{
+				char curns [SRV_BUF];
+				snprintf(curns, SRV_BUF, "%s:%s", par, ns);
+
+				if (0 > threshold) throw coda_error("<%s:threshold> is negative", curns);
+				if (0 >= buffer_size) throw coda_error("<%s:buffer_size> is not positive", curns);
+			}
+		};
+
+		struct ACCESS_LOG : public coda::txml_determination_object
+		{
+			std::string file_name;
+			std::string format;
+			int buffer_size;
+
+			ACCESS_LOG()
+				: buffer_size(1)
+			{}
+
+			void determine(coda::txml_parser* p)
+			{
+				txml_member(p, file_name);
+				txml_member(p, format);
+				txml_member(p, buffer_size);
+			}
+
+			void clear()
+			{
+				file_name.clear();
+				format.clear();
+				buffer_size = 1;
+			}
+
+			void check(const char *par, const char *ns)
+			{
+				char curns [SRV_BUF];
+				snprintf(curns, SRV_BUF, "%s:%s", par, ns);
+
+				if (0 >= buffer_size) throw coda_error("<%s:buffer_size> is not positive", curns);
+			}
+		};
+
+		struct CAPTURE : public coda::txml_determination_object
+		{
+			std::string file_name;
+			int sample;
+			int buffer_size;
+
+			CAPTURE()
+				: sample(1)
+				, buffer_size(4)
+			{}
+
+			void determine(coda::txml_parser* p)
+			{
+				txml_member(p, file_name);
+				txml_member(p, sample);
+				txml_member(p, buffer_size);
+			}
+
+			void clear()
+			{
+				file_name.clear();
+				sample = 1;
+				buffer_size = 4;
+			}
+
+			void check(const char *par, const char *ns)
+			{
+				char curns [SRV_BUF];
+				snprintf(curns, SRV_BUF, "%s:%s", par, ns);
+
+				if (0 >= sample) throw coda_error("<%s:sample> is not positive", curns);
+				if (0 >= buffer_size) throw coda_error("<%s:buffer_size> is not positive", curns);
+			}
+		};
+
+		struct CACHE : public coda::txml_determination_object
+		{
+			int max_size;
+			int ttl;
+			std::string headers;
+
+			CACHE()
+				: max_size(0)
+				, ttl(1000)
+			{}
+
+			void determine(coda::txml_parser* p)
+			{
+				txml_member(p, max_size);
+				txml_member(p, ttl);
+				txml_member(p, headers);
+			}
+
+			void clear()
+			{
+				max_size = 0;
+				ttl = 1000;
+				headers.clear();
+			}
+
+			void check(const char *par, const char *ns)
+			{
+				char curns [SRV_BUF];
+				snprintf(curns, SRV_BUF, "%s:%s", par, ns);
+
+				if (0 > max_size) throw coda_error("<%s:max_size> is negative", curns);
+				if (0 >= ttl) throw coda_error("<%s:ttl> is not positive", curns);
+			}
+		};
+
+		struct COMPRESSION : public coda::txml_determination_object
+		{
+			std::string encodings;
+			int min_size;
+			int level;
+
+			COMPRESSION()
+				: min_size(1024)
+				, level(6)
+			{}
+
+			void determine(coda::txml_parser* p)
+			{
+				txml_member(p, encodings);
+				txml_member(p, min_size);
+				txml_member(p, level);
+			}
+
+			void clear()
+			{
+				encodings.clear();
+				min_size = 1024;
+				level = 6;
+			}
+
+			void check(const char *par, const char *ns)
+			{
+				char curns [SRV_BUF];
+				snprintf(curns, SRV_BUF, "%s:%s", par, ns);
+
+				if (0 > min_size) throw coda_error("<%s:min_size> is negative", curns);
+			}
+		};
+
+		struct HTTP2 : public coda::txml_determination_object
+		{
+			int enabled;
+			int max_streams;
+			int window;
+			int max_body_size;
+
+			HTTP2()
+				: enabled(0)
+				, max_streams(100)
+				, window(65535)
+				, max_body_size(1 << 20)
+			{}
+
+			void determine(coda::txml_parser* p)
+			{
+				txml_member(p, enabled);
+				txml_member(p, max_streams);
+				txml_member(p, window);
+				txml_member(p, max_body_size);
+			}
+
+			void clear()
+			{
+				enabled = 0;
+				max_streams = 100;
+				window = 65535;
+				max_body_size = 1 << 20;
+			}
+
+			void check(const char *par, const char *ns)
+			{
+				char curns [SRV_BUF];
+				snprintf(curns, SRV_BUF, "%s:%s", par, ns);
+
+				if (0 >= max_streams) throw coda_error("<%s:max_streams> is not positive", curns);
+				if (0 >= window) throw coda_error("<%s:window> is not positive", curns);
+				if (0 > max_body_size) throw coda_error("<%s:max_body_size> is negative", curns);
+			}
+		};
+
+		struct RPC : public coda::txml_determination_object
+		{
+			int max_requests;
+			int max_request_size;
+
+			RPC()
+				: max_requests(100)
+				, max_request_size(1 << 20)
+			{}
+
+			void determine(coda::txml_parser* p)
+			{
+				txml_member(p, max_requests);
+				txml_member(p, max_request_size);
+			}
+
+			void clear()
+			{
+				max_requests = 100;
+				max_request_size = 1 << 20;
+			}
+
+			void check(const char *par, const char *ns)
+			{
+				char curns [SRV_BUF];
+				snprintf(curns, SRV_BUF, "%s:%s", par, ns);
+
+				if (0 >= max_requests) throw coda_error("<%s:max_requests> is not positive", curns);
+				if (0 >= max_request_size) throw coda_error("<%s:max_request_size> is not positive", curns);
+			}
+		};
+
+		struct WORKERS : public coda::txml_determination_object
+		{
+			int count;
+			std::string cpus;
+			int restart_delay;
+
+			WORKERS()
+				: count(0)
+				, restart_delay(1000)
+			{}
+
+			void determine(coda::txml_parser* p)
+			{
+				txml_member(p, count);
+				txml_member(p, cpus);
+				txml_member(p, restart_delay);
+			}
+
+			void clear()
+			{
+				count = 0;
+				cpus.clear();
+				restart_delay = 1000;
+			}
+
+			void check(const char *par, const char *ns)
+			{
+				char curns [SRV_BUF];
+				snprintf(curns, SRV_BUF, "%s:%s", par, ns);
+
+				if (0 > count) throw coda_error("<%s:count> is negative", curns);
+				if (0 > restart_delay) throw coda_error("<%s:restart_delay> is negative", curns);
+			}
+		};
+
 		struct PLUGIN : public coda::txml_determination_object
 		{
+			std::string name;
 			std::string ip;
 			std::string port;
+			/* port of the binary RPC listener on <ip>, empty if there is none */
+			std::string rpc_port;
+			std::string prefix;
 			int connection_timeout;
 			int idle_timeout;
 
@@ -58,6 +392,16 @@ struct blz_config : public coda::txml_determination_object
 			int easy_queue_limit;
 			int hard_queue_limit;
 
+			int hard_coalescing;
+
+			/* load() runs in every easy and hard thread besides the shared instance: memory
+			 * of the plugin is taken easy_threads + hard_threads + 1 times */
+			int per_thread;
+
+			/* capture file replayed through the plugin before it serves */
+			std::string warmup_file;
+			int warmup_repeat;
+
 			PLUGIN()
 				: connection_timeout(0)
 				, idle_timeout(-1)
@@ -65,12 +409,18 @@ struct blz_config : public coda::txml_determination_object
 				, hard_threads(0)
 				, easy_queue_limit(0)
 				, hard_queue_limit(0)
+				, hard_coalescing(0)
+				, per_thread(0)
+				, warmup_repeat(1)
 			{}
 
 			void determine(coda::txml_parser* p)
 			{
+				txml_member(p, name);
 				txml_member(p, ip);
 				txml_member(p, port);
+				txml_member(p, rpc_port);
+				txml_member(p, prefix);
 				txml_member(p, connection_timeout);
 				txml_member(p, idle_timeout);
 				txml_member(p, library);
@@ -79,12 +429,19 @@ struct blz_config : public coda::txml_determination_object
 				txml_member(p, hard_threads);
 				txml_member(p, easy_queue_limit);
 				txml_member(p, hard_queue_limit);
+				txml_member(p, hard_coalescing);
+				txml_member(p, per_thread);
+				txml_member(p, warmup_file);
+				txml_member(p, warmup_repeat);
 			}
 
 			void clear()
 			{
+				name.clear();
 				ip.clear();
 				port.clear();
+				rpc_port.clear();
+				prefix.clear();
 				connection_timeout = 0;
 				idle_timeout = -1;
 
@@ -96,6 +453,12 @@ struct blz_config : public coda::txml_determination_object
 
 				easy_queue_limit = 0;
 				hard_queue_limit = 0;
+
+				hard_coalescing = 0;
+				per_thread = 0;
+
+				warmup_file.clear();
+				warmup_repeat = 1;
 			}
 
 			void check(const char *par, const char *ns)
@@ -106,21 +469,51 @@ struct blz_config : public coda::txml_determination_object
 				if (ip     .empty()) throw coda_error ("<%s:ip> is empty in config", curns);
 				if (port   .empty()) throw coda_error ("<%s:port> is empty in config", curns);
 				if (library.empty()) throw coda_error ("<%s:library> is empty in config", curns);
+				if (rpc_port == port) throw coda_error ("<%s:rpc_port> is the same as <port>", curns);
 
 				if (0 == connection_timeout) throw coda_error ("<%s:connection_timeout> is not set or set to 0", curns);
 				if (0 == easy_threads) throw coda_error ("<%s:easy_threads> is set to 0", curns);
+				if (!prefix.empty() && '/' != prefix[0]) throw coda_error ("<%s:prefix> doesn't start with /", curns);
+				if (0 >= warmup_repeat) throw coda_error ("<%s:warmup_repeat> must be positive", curns);
 			}
 		};
 
 		STATS stats;
-		PLUGIN plugin;
+		HEALTH health;
+		SLOW_LOG slow_log;
+		ACCESS_LOG access_log;
+		CAPTURE capture;
+		CACHE cache;
+		COMPRESSION compression;
+		HTTP2 http2;
+		RPC rpc;
+		WORKERS workers;
+		/* several sections are told apart by address or <prefix> */
+		std::vector<PLUGIN> plugin;
+
+		BLZ()
+			: shutdown_timeout(5000)
+			, etag(0)
+		{}
 
 		void determine(coda::txml_parser* p)
 		{
 			txml_member(p, pid_file_name);
 			txml_member(p, log_file_name);
 			txml_member(p, log_level);
+			txml_member(p, reload);
+			txml_member(p, shutdown_timeout);
+			txml_member(p, etag);
 			txml_member(p, stats);
+			txml_member(p, health);
+			txml_member(p, slow_log);
+			txml_member(p, access_log);
+			txml_member(p, capture);
+			txml_member(p, cache);
+			txml_member(p, compression);
+			txml_member(p, http2);
+			txml_member(p, rpc);
+			txml_member(p, workers);
 			txml_member(p, plugin);
 		}
 
@@ -129,7 +522,19 @@ struct blz_config : public coda::txml_determination_object
 			pid_file_name.clear();
 			log_file_name.clear();
 			log_level.clear();
+			reload.clear();
+			shutdown_timeout = 5000;
+			etag = 0;
 			stats.clear();
+			health.clear();
+			slow_log.clear();
+			access_log.clear();
+			capture.clear();
+			cache.clear();
+			compression.clear();
+			http2.clear();
+			rpc.clear();
+			workers.clear();
 			plugin.clear();
 		}
 
@@ -139,8 +544,71 @@ struct blz_config : public coda::txml_determination_object
 
 			if (log_level.empty()) throw coda_error ("<%s:log_level> is empty in config", curns);
 
+			if (!reload.empty() && "restart" != reload && "hot" != reload)
+			{
+				throw coda_error ("<%s:reload> is \"%s\", \"restart\" or \"hot\" expected", curns, reload.c_str());
+			}
+
+			if (0 > shutdown_timeout) throw coda_error ("<%s:shutdown_timeout> is negative", curns);
+
 			stats .check(curns, "stats");
-			plugin.check(curns, "plugin");
+			health.check(curns, "health");
+			slow_log.check(curns, "slow_log");
+			access_log.check(curns, "access_log");
+			capture.check(curns, "capture");
+			cache .check(curns, "cache");
+			compression.check(curns, "compression");
+			http2.check(curns, "http2");
+			rpc.check(curns, "rpc");
+			workers.check(curns, "workers");
+			if (plugin.empty()) throw coda_error ("<%s:plugin> is not set in config", curns);
+
+			for (size_t i = 0; i < plugin.size(); i++)
+			{
+				PLUGIN& pd = plugin[i];
+
+				/* the other sections listen on the address of the first one unless they have their own */
+				if (0 < i)
+				{
+					if (pd.ip.empty()) pd.ip = plugin[0].ip;
+					if (pd.port.empty()) pd.port = plugin[0].port;
+					if (0 == pd.connection_timeout) pd.connection_timeout = plugin[0].connection_timeout;
+				}
+
+				if (pd.name.empty())
+				{
+					size_t slash = pd.library.rfind('/');
+					pd.name = pd.library.substr(std::string::npos == slash ? 0 : slash + 1);
+				}
+
+				std::string ns = 1 == plugin.size() ? "plugin" : "plugin[" + pd.name + "]";
+
+				pd.check(curns, ns.c_str());
+
+				for (size_t j = 0; j < i; j++)
+				{
+					if (plugin[j].name == pd.name)
+					{
+						throw coda_error ("<%s:plugin> name \"%s\" is used twice, <name> is needed", curns, pd.name.c_str());
+					}
+
+					if (plugin[j].ip == pd.ip && plugin[j].port == pd.port && plugin[j].prefix == pd.prefix)
+					{
+						throw coda_error ("<%s:plugin> \"%s\" and \"%s\" have the same address and prefix", curns, plugin[j].name.c_str(), pd.name.c_str());
+					}
+
+					if (!pd.rpc_port.empty() && plugin[j].ip == pd.ip && plugin[j].rpc_port == pd.rpc_port && plugin[j].prefix == pd.prefix)
+					{
+						throw coda_error ("<%s:plugin> \"%s\" and \"%s\" have the same RPC address and prefix", curns, plugin[j].name.c_str(), pd.name.c_str());
+					}
+
+					/* a listener speaks either HTTP or RPC */
+					if (plugin[j].ip == pd.ip && ((!pd.rpc_port.empty() && plugin[j].port == pd.rpc_port) || (!plugin[j].rpc_port.empty() && plugin[j].rpc_port == pd.port)))
+					{
+						throw coda_error ("<%s:plugin> \"%s\" and \"%s\" use the same port for HTTP and RPC", curns, plugin[j].name.c_str(), pd.name.c_str());
+					}
+				}
+			}
 		}
 	};
 
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "etag.hpp"
+
+namespace {
+
+/* murmur3-like 64-bit hash over a stream of parts, word at a time */
+
+inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t mix_word(uint64_t h, uint64_t k)
+{
+	k *= 0x87c37b91114253d5ULL;
+	k = rotl64(k, 31);
+	k *= 0x4cf5ad432745937fULL;
+
+	h ^= k;
+	h = rotl64(h, 27) * 5 + 0x52dce729;
+
+	return h;
+}
+
+inline uint64_t fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+
+	return k;
+}
+
+/* opaque part of entity tag: without W/ and quotes */
+void etag_opaque(const char* tag, size_t len, const char*& opaque, size_t& opaque_len)
+{
+	if (len >= 2 && ('W' == tag[0] || 'w' == tag[0]) && '/' == tag[1])
+	{
+		tag += 2;
+		len -= 2;
+	}
+
+	if (len >= 2 && '"' == tag[0] && '"' == tag[len - 1])
+	{
+		tag++;
+		len -= 2;
+	}
+
+	opaque = tag;
+	opaque_len = len;
+}
+
+}
+
+void blizzard::etag_make(std::string& etag, const struct iovec* parts, size_t parts_num)
+{
+	uint64_t h = 0x9e3779b97f4a7c15ULL;
+	uint64_t tail = 0;
+	size_t tail_len = 0;
+	uint64_t total = 0;
+
+	for (size_t i = 0; i < parts_num; i++)
+	{
+		const uint8_t* p = (const uint8_t*) parts[i].iov_base;
+		size_t len = parts[i].iov_len;
+
+		total += len;
+
+		while (len && tail_len)
+		{
+			tail |= (uint64_t) *p++ << (8 * tail_len++);
+			len--;
+
+			if (8 == tail_len)
+			{
+				h = mix_word(h, tail);
+				tail = 0;
+				tail_len = 0;
+			}
+		}
+
+		while (len >= 8)
+		{
+			uint64_t k;
+			memcpy(&k, p, 8);
+
+			h = mix_word(h, k);
+
+			p += 8;
+			len -= 8;
+		}
+
+		while (len)
+		{
+			tail |= (uint64_t) *p++ << (8 * tail_len++);
+			len--;
+		}
+	}
+
+	if (tail_len)
+	{
+		h = mix_word(h, tail);
+	}
+
+	h = fmix64(h ^ total);
+
+	char buf[32];
+	snprintf(buf, sizeof(buf), "\"%016llx\"", (unsigned long long) h);
+
+	etag = buf;
+}
+
+void blizzard::etag_quote(std::string& etag, const char* value, const char* suffix)
+{
+	size_t len = strlen(value);
+
+	if (len >= 2 && '"' == value[len - 1] && ('"' == value[0] || ('/' == value[1] && len >= 4)))
+	{
+		etag.assign(value, len - 1);
+	}
+	else
+	{
+		etag = "\"";
+		etag.append(value, len);
+	}
+
+	etag += suffix;
+	etag += '"';
+}
+
+bool blizzard::etag_matches(const char* if_none_match, const std::string& etag)
+{
+	if (0 == if_none_match || etag.empty())
+	{
+		return false;
+	}
+
+	const char* opaque;
+	size_t opaque_len;
+	etag_opaque(etag.data(), etag.size(), opaque, opaque_len);
+
+	const char* p = if_none_match;
+
+	while (*p)
+	{
+		p += strspn(p, " \t,");
+		size_t len = strcspn(p, " \t,");
+
+		if (0 == len)
+		{
+			break;
+		}
+
+		if (1 == len && '*' == *p)
+		{
+			return true;
+		}
+
+		const char* o;
+		size_t o_len;
+		etag_opaque(p, len, o, o_len);
+
+		if (o_len == opaque_len && 0 == memcmp(o, opaque, o_len))
+		{
+			return true;
+		}
+
+		p += len;
+	}
+
+	return false;
+}
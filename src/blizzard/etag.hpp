@@ -0,0 +1,20 @@
+#ifndef __BLIZZARD_ETAG_HPP__
+#define __BLIZZARD_ETAG_HPP__
+
+#include <sys/uio.h>
+#include <string>
+
+namespace blizzard {
+
+/* strong ETag made of a 64-bit hash of the body, e.g. "5f0c2a3b9e8d7c61" */
+void etag_make(std::string& etag, const struct iovec* parts, size_t parts_num);
+
+/* make plugin-provided tag a quoted entity tag, add suffix (e.g. encoding) inside quotes */
+void etag_quote(std::string& etag, const char* value, const char* suffix);
+
+/* weak comparison of If-None-Match header value with the tag (RFC 7232, 3.2) */
+bool etag_matches(const char* if_none_match, const std::string& etag);
+
+}
+
+#endif /* __BLIZZARD_ETAG_HPP__ */
@@ -0,0 +1,1315 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <coda/logger.h>
+#include "h2.hpp"
+#include "http.hpp"
+#include "server.hpp"
+
+static const char preface_text[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static const char *method_names[] = {"", "GET", "POST", "HEAD", "OPTIONS"};
+
+enum
+{
+	SETTINGS_ENABLE_PUSH = 2,
+	SETTINGS_MAX_CONCURRENT_STREAMS = 3,
+	SETTINGS_INITIAL_WINDOW_SIZE = 4,
+	SETTINGS_MAX_FRAME_SIZE = 5
+};
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* HTTP2-Settings is base64url without padding */
+static bool decode_base64url(const char *in, std::string& out)
+{
+	uint32_t acc = 0;
+	int bits = 0;
+
+	for (; *in && '=' != *in; in++)
+	{
+		int v;
+		char c = *in;
+
+		if ('A' <= c && c <= 'Z') v = c - 'A';
+		else if ('a' <= c && c <= 'z') v = c - 'a' + 26;
+		else if ('0' <= c && c <= '9') v = c - '0' + 52;
+		else if ('-' == c || '+' == c) v = 62;
+		else if ('_' == c || '/' == c) v = 63;
+		else return false;
+
+		acc = (acc << 6) | v;
+		bits += 6;
+
+		if (8 <= bits)
+		{
+			bits -= 8;
+			out += (char) (acc >> bits);
+		}
+	}
+
+	return true;
+}
+
+blizzard::h2_session::stream::stream()
+	: task(0)
+	, state(sReceiving)
+	, recv_window(0)
+	, send_window(0)
+	, part(0)
+	, offset(0)
+	, left(0)
+	, queued(false)
+	, reset(false)
+{
+}
+
+blizzard::h2_session::h2_session(server *s, http *c)
+	: srv(s)
+	, con(c)
+	, fd(c->get_fd())
+	, out_pos(0)
+	, handling(0)
+	, last_stream(0)
+	, max_streams(s->config.blz.http2.max_streams)
+	, window(s->config.blz.http2.window)
+	, max_body_size(s->config.blz.http2.max_body_size)
+	, recv_window(DEFAULT_WINDOW)
+	, header_stream(0)
+	, header_end_stream(false)
+	, send_window(DEFAULT_WINDOW)
+	, peer_window(DEFAULT_WINDOW)
+	, peer_frame_sz(DEFAULT_FRAME_SZ)
+	, goaway_sent(false)
+	, closed(false)
+{
+}
+
+void blizzard::h2_session::start()
+{
+	/* the title line is parsed, the rest of the buffer is "\r\nSM\r\n\r\n" and the frames */
+	const char *data = (const char *) con->in_headers.get_data();
+	size_t marker = con->in_headers.marker();
+
+	preface.assign(preface_text + strlen("PRI * HTTP/2.0\r\n"));
+	in.assign(data + marker, con->in_headers.get_data_size() - marker);
+
+	con->in_headers.reset();
+	con->header_items_num = 0;
+
+	write_settings();
+
+	stats.report_h2_connection(false);
+}
+
+bool blizzard::h2_session::upgrade(const char *settings)
+{
+	std::string payload;
+
+	if (!decode_base64url(settings, payload) || 0 != payload.size() % 6)
+	{
+		return false;
+	}
+
+	const char m[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+	out.append(m, sizeof(m) - 1);
+
+	write_settings();
+
+	for (size_t i = 0; i < payload.size(); i += 6)
+	{
+		const uint8_t *p = (const uint8_t *) payload.data() + i;
+
+		if (!apply_setting((p[0] << 8) | p[1], get_u32(p + 2)))
+		{
+			return false;
+		}
+	}
+
+	preface = preface_text;
+
+	/* the request goes on as stream 1 without the headers of the upgrade */
+	std::vector<hpack_header> headers;
+
+	std::string path = con->uri_path;
+
+	if (*con->uri_params)
+	{
+		path += '?';
+		path += con->uri_params;
+	}
+
+	int method = con->method;
+
+	headers.push_back(hpack_header(":method", 0 < method && method <= BLZ_METHOD_OPTIONS ? method_names[method] : "UNDEF"));
+	headers.push_back(hpack_header(":path", path));
+
+	for (int i = 0; i < con->header_items_num; i++)
+	{
+		const char *key = con->header_items[i].key;
+
+		if (strcasecmp(key, "Connection") && strcasecmp(key, "Upgrade") && strcasecmp(key, "HTTP2-Settings"))
+		{
+			headers.push_back(hpack_header(key, con->header_items[i].value));
+		}
+	}
+
+	last_stream = 1;
+
+	stream *s = open_stream(1);
+
+	if (!set_request(s->task, headers))
+	{
+		close_stream(1, false);
+		return false;
+	}
+
+	s->body.assign((const char *) con->in_post.get_data(), con->in_post.size());
+
+	/* the preface could follow a request without a body */
+	if (BLZ_METHOD_POST != method)
+	{
+		size_t marker = con->in_headers.marker();
+		in.assign((const char *) con->in_headers.get_data() + marker, con->in_headers.get_data_size() - marker);
+	}
+
+	con->in_headers.reset();
+	con->in_post.reset();
+	con->header_items_num = 0;
+	con->state_ = http::sH2;
+
+	stats.report_h2_connection(true);
+
+	dispatch(1, *s);
+
+	return true;
+}
+
+void blizzard::h2_session::write_frame(int type, int flags, uint32_t id, const void *payload, size_t len)
+{
+	uint8_t h[FRAME_HEADER_SZ];
+
+	h[0] = len >> 16;
+	h[1] = len >> 8;
+	h[2] = len;
+	h[3] = type;
+	h[4] = flags;
+	put_u32(h + 5, id);
+
+	out.append((const char *) h, sizeof(h));
+	out.append((const char *) payload, len);
+}
+
+void blizzard::h2_session::write_settings()
+{
+	uint8_t p[12];
+
+	p[0] = 0;
+	p[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+	put_u32(p + 2, max_streams);
+
+	p[6] = 0;
+	p[7] = SETTINGS_INITIAL_WINDOW_SIZE;
+	put_u32(p + 8, window);
+
+	write_frame(SETTINGS, 0, 0, p, sizeof(p));
+
+	/* the window of the connection is changed by WINDOW_UPDATE only */
+	if (window > DEFAULT_WINDOW)
+	{
+		write_window_update(0, window - DEFAULT_WINDOW);
+		recv_window = window;
+	}
+}
+
+void blizzard::h2_session::write_window_update(uint32_t id, uint32_t inc)
+{
+	uint8_t p[4];
+	put_u32(p, inc);
+
+	write_frame(WINDOW_UPDATE, 0, id, p, sizeof(p));
+}
+
+void blizzard::h2_session::write_rst(uint32_t id, uint32_t code)
+{
+	uint8_t p[4];
+	put_u32(p, code);
+
+	write_frame(RST_STREAM, 0, id, p, sizeof(p));
+
+	stats.report_h2_reset();
+}
+
+void blizzard::h2_session::write_goaway(uint32_t code)
+{
+	uint8_t p[8];
+	put_u32(p, last_stream);
+	put_u32(p + 4, code);
+
+	write_frame(GOAWAY, 0, 0, p, sizeof(p));
+
+	goaway_sent = true;
+}
+
+bool blizzard::h2_session::fail(uint32_t code, const char *what)
+{
+	log_warn("h2: %s on fd %d, closing the connection", what, fd);
+
+	write_goaway(code);
+
+	return false;
+}
+
+bool blizzard::h2_session::read_input()
+{
+	char buf[DEFAULT_FRAME_SZ];
+	bool got = false;
+
+	while (true)
+	{
+		ssize_t rd = read(fd, buf, sizeof(buf));
+
+		if (0 < rd)
+		{
+			in.append(buf, rd);
+			got = true;
+			continue;
+		}
+
+		if (0 == rd)
+		{
+			return false;
+		}
+
+		if (EINTR == errno)
+		{
+			continue;
+		}
+
+		if (EAGAIN != errno && EWOULDBLOCK != errno)
+		{
+			return false;
+		}
+
+		break;
+	}
+
+	/* an HTTP/2 connection is closed after <connection_timeout> of silence */
+	if (got)
+	{
+		ev_timer_again(srv->loop, &con->e.watcher_timeout);
+	}
+
+	return true;
+}
+
+bool blizzard::h2_session::handle_frames()
+{
+	if (!preface.empty())
+	{
+		size_t n = std::min(preface.size(), in.size());
+
+		if (0 != in.compare(0, n, preface, 0, n))
+		{
+			log_warn("h2: no client preface on fd %d, closing the connection", fd);
+			return false;
+		}
+
+		in.erase(0, n);
+		preface.erase(0, n);
+
+		if (!preface.empty())
+		{
+			return true;
+		}
+	}
+
+	size_t pos = 0;
+	bool ok = true;
+
+	while (ok && in.size() - pos >= FRAME_HEADER_SZ)
+	{
+		const uint8_t *h = (const uint8_t *) in.data() + pos;
+
+		size_t len = (h[0] << 16) | (h[1] << 8) | h[2];
+
+		if (len > DEFAULT_FRAME_SZ)
+		{
+			ok = fail(FRAME_SIZE_ERROR, "frame is too long");
+			break;
+		}
+
+		if (in.size() - pos < FRAME_HEADER_SZ + len)
+		{
+			break;
+		}
+
+		ok = handle_frame(h[3], h[4], get_u32(h + 5) & 0x7fffffff, h + FRAME_HEADER_SZ, len);
+
+		pos += FRAME_HEADER_SZ + len;
+	}
+
+	in.erase(0, pos);
+
+	return ok;
+}
+
+bool blizzard::h2_session::handle_frame(int type, int flags, uint32_t id, const uint8_t *p, size_t len)
+{
+	if (header_stream && CONTINUATION != type)
+	{
+		return fail(PROTOCOL_ERROR, "header block is interrupted");
+	}
+
+	switch (type)
+	{
+	case DATA:
+		return handle_data(flags, id, p, len);
+
+	case HEADERS:
+		return handle_headers(flags, id, p, len);
+
+	case PRIORITY:
+		if (0 == id || 5 != len)
+		{
+			return fail(PROTOCOL_ERROR, "bad PRIORITY");
+		}
+		return true;
+
+	case RST_STREAM:
+		if (0 == id || 4 != len)
+		{
+			return fail(PROTOCOL_ERROR, "bad RST_STREAM");
+		}
+		handle_rst(id);
+		return true;
+
+	case SETTINGS:
+		return handle_settings(flags, p, len);
+
+	case PUSH_PROMISE:
+		return fail(PROTOCOL_ERROR, "PUSH_PROMISE from the client");
+
+	case PING:
+		if (0 != id || 8 != len)
+		{
+			return fail(PROTOCOL_ERROR, "bad PING");
+		}
+		if (0 == (flags & FLAG_ACK))
+		{
+			write_frame(PING, FLAG_ACK, 0, p, len);
+		}
+		return true;
+
+	case GOAWAY:
+		/* the client opens no more streams, the connection is closed after the last one */
+		go_away();
+		return true;
+
+	case WINDOW_UPDATE:
+		return handle_window_update(id, p, len);
+
+	case CONTINUATION:
+		if (0 == header_stream || id != header_stream)
+		{
+			return fail(PROTOCOL_ERROR, "unexpected CONTINUATION");
+		}
+
+		if (header_block.size() + len > MAX_HEADER_BLOCK_SZ)
+		{
+			return fail(ENHANCE_YOUR_CALM, "header block is too long");
+		}
+
+		header_block.append((const char *) p, len);
+
+		return (flags & FLAG_END_HEADERS) ? handle_header_block() : true;
+
+	default:
+		/* unknown types are ignored */
+		return true;
+	}
+}
+
+bool blizzard::h2_session::handle_data(int flags, uint32_t id, const uint8_t *p, size_t len)
+{
+	if (0 == id)
+	{
+		return fail(PROTOCOL_ERROR, "DATA on stream 0");
+	}
+
+	size_t flow = len;
+
+	if (flags & FLAG_PADDED)
+	{
+		if (0 == len || p[0] >= len)
+		{
+			return fail(PROTOCOL_ERROR, "bad padding");
+		}
+
+		len -= p[0] + 1;
+		p++;
+	}
+
+	if ((int64_t) flow > recv_window)
+	{
+		return fail(FLOW_CONTROL_ERROR, "DATA above the window of the connection");
+	}
+
+	/* the window of the connection is given back at once, the bodies are limited by the windows
+	 * of their streams */
+	if (flow)
+	{
+		write_window_update(0, flow);
+	}
+
+	streams_t::iterator it = streams.find(id);
+
+	if (streams.end() == it)
+	{
+		return id <= last_stream ? true : fail(PROTOCOL_ERROR, "DATA on idle stream");
+	}
+
+	stream& s = it->second;
+
+	if (stream::sReceiving != s.state)
+	{
+		write_rst(id, STREAM_CLOSED);
+		reset_stream(id);
+
+		return true;
+	}
+
+	if ((int64_t) flow > s.recv_window)
+	{
+		write_rst(id, FLOW_CONTROL_ERROR);
+		reset_stream(id);
+
+		return true;
+	}
+
+	s.recv_window -= flow;
+
+	if (s.body.size() + len > max_body_size)
+	{
+		refuse_body(id, s);
+		return true;
+	}
+
+	s.body.append((const char *) p, len);
+
+	if (flags & FLAG_END_STREAM)
+	{
+		dispatch(id, s);
+		return true;
+	}
+
+	/* the window is given back as the body is stored, up to a byte above <max_body_size> so that
+	 * a longer body is refused instead of waiting for the window */
+	int64_t room = std::min<int64_t>(window, max_body_size + 1 - s.body.size());
+
+	if (room > s.recv_window)
+	{
+		write_window_update(id, room - s.recv_window);
+		s.recv_window = room;
+	}
+
+	return true;
+}
+
+/* 413 and RST_STREAM without error: the client stops sending the body (RFC 7540, 8.1) */
+void blizzard::h2_session::refuse_body(uint32_t id, stream& s)
+{
+	http *task = s.task;
+
+	log_debug("h2: body of stream %u on fd %d is longer than %zu bytes", id, fd, max_body_size);
+
+	std::string().swap(s.body);
+
+	task->state_ = http::sReadyToHandle;
+	task->set_response_status(413);
+	task->times.done_pop = monotonic_usec();
+
+	s.state = stream::sHandling;
+	handling++;
+
+	respond(task);
+
+	write_rst(id, NO_ERROR);
+}
+
+bool blizzard::h2_session::handle_headers(int flags, uint32_t id, const uint8_t *p, size_t len)
+{
+	if (0 == id || 0 == (id & 1))
+	{
+		return fail(PROTOCOL_ERROR, "bad stream id of HEADERS");
+	}
+
+	const uint8_t *end = p + len;
+
+	if (flags & FLAG_PADDED)
+	{
+		if (0 == len || p[0] >= len)
+		{
+			return fail(PROTOCOL_ERROR, "bad padding");
+		}
+
+		end -= p[0];
+		p++;
+	}
+
+	if (flags & FLAG_PRIORITY)
+	{
+		if (end - p < 5)
+		{
+			return fail(PROTOCOL_ERROR, "bad priority of HEADERS");
+		}
+
+		p += 5;
+	}
+
+	header_block.assign((const char *) p, end - p);
+	header_stream = id;
+	header_end_stream = flags & FLAG_END_STREAM;
+
+	return (flags & FLAG_END_HEADERS) ? handle_header_block() : true;
+}
+
+bool blizzard::h2_session::handle_header_block()
+{
+	uint32_t id = header_stream;
+	header_stream = 0;
+
+	/* every block changes the state of the decoder, the refused ones too */
+	std::vector<hpack_header> headers;
+
+	if (!decoder.decode((const uint8_t *) header_block.data(), header_block.size(), headers))
+	{
+		return fail(COMPRESSION_ERROR, "can't decode header block");
+	}
+
+	header_block.clear();
+
+	streams_t::iterator it = streams.find(id);
+
+	/* trailers are dropped, they end the body */
+	if (streams.end() != it)
+	{
+		stream& s = it->second;
+
+		if (stream::sReceiving != s.state || !header_end_stream)
+		{
+			write_rst(id, stream::sReceiving != s.state ? STREAM_CLOSED : PROTOCOL_ERROR);
+			reset_stream(id);
+		}
+		else
+		{
+			dispatch(id, s);
+		}
+
+		return true;
+	}
+
+	if (id <= last_stream)
+	{
+		return fail(STREAM_CLOSED, "HEADERS on closed stream");
+	}
+
+	last_stream = id;
+
+	if (goaway_sent || streams.size() >= max_streams)
+	{
+		write_rst(id, REFUSED_STREAM);
+		return true;
+	}
+
+	stream *s = open_stream(id);
+
+	if (!set_request(s->task, headers))
+	{
+		write_rst(id, PROTOCOL_ERROR);
+		close_stream(id, false);
+
+		return true;
+	}
+
+	if (header_end_stream)
+	{
+		dispatch(id, *s);
+	}
+
+	return true;
+}
+
+bool blizzard::h2_session::handle_settings(int flags, const uint8_t *p, size_t len)
+{
+	if (flags & FLAG_ACK)
+	{
+		return 0 == len ? true : fail(FRAME_SIZE_ERROR, "bad SETTINGS ack");
+	}
+
+	if (0 != len % 6)
+	{
+		return fail(FRAME_SIZE_ERROR, "bad SETTINGS");
+	}
+
+	for (size_t i = 0; i < len; i += 6)
+	{
+		if (!apply_setting((p[i] << 8) | p[i + 1], get_u32(p + i + 2)))
+		{
+			return false;
+		}
+	}
+
+	write_frame(SETTINGS, FLAG_ACK, 0, 0, 0);
+
+	return true;
+}
+
+bool blizzard::h2_session::apply_setting(uint16_t key, uint32_t value)
+{
+	switch (key)
+	{
+	case SETTINGS_ENABLE_PUSH:
+		return 1 >= value ? true : fail(PROTOCOL_ERROR, "bad SETTINGS_ENABLE_PUSH");
+
+	case SETTINGS_INITIAL_WINDOW_SIZE:
+		if (value > MAX_WINDOW)
+		{
+			return fail(FLOW_CONTROL_ERROR, "bad SETTINGS_INITIAL_WINDOW_SIZE");
+		}
+
+		/* the change applies to the windows of the open streams */
+		for (streams_t::iterator it = streams.begin(); it != streams.end(); ++it)
+		{
+			it->second.send_window += (int64_t) value - peer_window;
+			queue_stream(it->first, it->second);
+		}
+
+		peer_window = value;
+		return true;
+
+	case SETTINGS_MAX_FRAME_SIZE:
+		if (value < DEFAULT_FRAME_SZ || value > 0xffffff)
+		{
+			return fail(PROTOCOL_ERROR, "bad SETTINGS_MAX_FRAME_SIZE");
+		}
+
+		peer_frame_sz = value;
+		return true;
+
+	default:
+		/* the encoder doesn't index, the table size of the peer doesn't matter */
+		return true;
+	}
+}
+
+bool blizzard::h2_session::handle_window_update(uint32_t id, const uint8_t *p, size_t len)
+{
+	if (4 != len)
+	{
+		return fail(FRAME_SIZE_ERROR, "bad WINDOW_UPDATE");
+	}
+
+	uint32_t inc = get_u32(p) & 0x7fffffff;
+
+	if (0 == id)
+	{
+		send_window += inc;
+
+		if (0 == inc || send_window > MAX_WINDOW)
+		{
+			return fail(0 == inc ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR, "bad WINDOW_UPDATE of the connection");
+		}
+
+		return true;
+	}
+
+	streams_t::iterator it = streams.find(id);
+
+	if (streams.end() == it)
+	{
+		return true;
+	}
+
+	stream& s = it->second;
+
+	s.send_window += inc;
+
+	if (0 == inc || s.send_window > MAX_WINDOW)
+	{
+		write_rst(id, 0 == inc ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+		reset_stream(id);
+
+		return true;
+	}
+
+	queue_stream(id, s);
+
+	return true;
+}
+
+void blizzard::h2_session::handle_rst(uint32_t id)
+{
+	if (streams.count(id))
+	{
+		stats.report_h2_reset();
+		reset_stream(id);
+	}
+}
+
+blizzard::h2_session::stream* blizzard::h2_session::open_stream(uint32_t id)
+{
+	stream& s = streams[id];
+
+	http *task = srv->http_pool.allocate();
+	task->init(-1, con->in_ip);
+
+	task->listener = con->listener;
+	task->session_conn = con;
+	task->stream_id = id;
+	task->server_loop = srv->loop;
+	task->response_time = ev_now(srv->loop);
+	task->protocol_major = 2;
+	task->protocol_minor = 0;
+	task->times.accepted = monotonic_usec();
+
+	s.task = task;
+	s.recv_window = window;
+	s.send_window = peer_window;
+
+	stats.report_h2_stream();
+
+	return &s;
+}
+
+bool blizzard::h2_session::set_request(http *task, const std::vector<hpack_header>& headers)
+{
+	const char *method = 0;
+	const char *path = 0;
+	const char *authority = 0;
+	bool has_host = false;
+	std::string cookie;
+
+	for (size_t i = 0; i < headers.size(); i++)
+	{
+		const std::string& key = headers[i].first;
+		const std::string& val = headers[i].second;
+
+		if (':' == key[0])
+		{
+			if (":method" == key) method = val.c_str();
+			else if (":path" == key) path = val.c_str();
+			else if (":authority" == key) authority = val.c_str();
+			else if (":scheme" != key) return false;
+
+			continue;
+		}
+
+		/* the cookie is split into several fields to be compressed better */
+		if (0 == strcasecmp(key.c_str(), "cookie"))
+		{
+			cookie += cookie.empty() ? "" : "; ";
+			cookie += val;
+			continue;
+		}
+
+		has_host = has_host || 0 == strcasecmp(key.c_str(), "host");
+
+		if (!task->add_request_header(key.data(), key.size(), val.data(), val.size()))
+		{
+			return false;
+		}
+	}
+
+	if (0 == method || 0 == path || 0 == *path)
+	{
+		return false;
+	}
+
+	if (authority && !has_host && !task->add_request_header("Host", 4, authority, strlen(authority)))
+	{
+		return false;
+	}
+
+	if (!cookie.empty() && !task->add_request_header("cookie", 6, cookie.data(), cookie.size()))
+	{
+		return false;
+	}
+
+	task->method = BLZ_METHOD_UNDEF;
+
+	for (int m = BLZ_METHOD_GET; m <= BLZ_METHOD_OPTIONS; m++)
+	{
+		if (0 == strcmp(method, method_names[m]))
+		{
+			task->method = m;
+		}
+	}
+
+	const char *delim = strchr(path, '?');
+	size_t path_len = delim ? (size_t) (delim - path) : strlen(path);
+
+	if (0 == (task->uri_path = task->store_string(path, path_len)) || 0 == (task->uri_params = task->store_string(delim ? delim + 1 : "", delim ? strlen(delim + 1) : 0)))
+	{
+		return false;
+	}
+
+	/* the request size in stats is of the decoded headers */
+	task->in_headers.marker() = task->in_headers.get_data_size();
+
+	return true;
+}
+
+void blizzard::h2_session::dispatch(uint32_t id, stream& s)
+{
+	http *task = s.task;
+
+	if (!s.body.empty())
+	{
+		task->in_post.resize(s.body.size());
+		task->in_post.append_data(s.body.data(), s.body.size());
+
+		std::string().swap(s.body);
+	}
+
+	task->state_ = http::sReadyToHandle;
+
+	s.state = stream::sHandling;
+	handling++;
+
+	if (BLZ_METHOD_UNDEF == task->method)
+	{
+		task->set_response_status(501);
+		task->times.done_pop = monotonic_usec();
+
+		respond(task);
+		return;
+	}
+
+	srv->handle_request(task);
+}
+
+void blizzard::h2_session::respond(http *task)
+{
+	uint32_t id = task->stream_id;
+	stream& s = streams[id];
+
+	handling--;
+
+	if (closed)
+	{
+		close_stream(id, false);
+
+		/* the last stream releases the closed connection */
+		if (0 == handling)
+		{
+			srv->free_connection(con);
+		}
+
+		return;
+	}
+
+	if (s.reset)
+	{
+		close_stream(id, false);
+	}
+	else
+	{
+		write_response(id, s);
+	}
+
+	/* the connection is written to and closed if it is done from its own callback */
+	ev_feed_event(srv->loop, &con->e.watcher_send, EV_WRITE);
+}
+
+void blizzard::h2_session::write_response(uint32_t id, stream& s)
+{
+	http *task = s.task;
+
+	int status = task->response_status;
+
+	if (status >= http::http_codes_num || 0 == status)
+	{
+		status = 404;
+		task->response_status = status;
+	}
+
+	std::string block;
+	hpack_encode_status(block, status);
+
+	const char server_name[] = "blizzard/" BLZ_VERSION;
+	hpack_encode(block, "server", server_name, sizeof(server_name) - 1);
+
+	char now_str[128];
+	time_t now_time = time(NULL);
+	size_t now_len = strftime(now_str, sizeof(now_str), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&now_time));
+	hpack_encode(block, "date", now_str, now_len);
+
+	if (!task->cache)
+	{
+		hpack_encode(block, "pragma", "no-cache", 8);
+		hpack_encode(block, "cache-control", "no-cache", 8);
+	}
+
+	/* "Name: value\r\n" lines of the plugin, the names are lower case in HTTP/2 */
+	const char *p = (const char *) task->out_headers.get_data();
+	const char *end = p + task->out_headers.get_data_size();
+
+	while (p < end)
+	{
+		const char *eol = (const char *) memchr(p, '\n', end - p);
+		const char *next = eol ? eol + 1 : end;
+
+		if (0 == eol)
+		{
+			eol = end;
+		}
+
+		if (p < eol && '\r' == eol[-1])
+		{
+			eol--;
+		}
+
+		const char *colon = (const char *) memchr(p, ':', eol - p);
+
+		if (colon && colon > p)
+		{
+			std::string name(p, colon - p);
+
+			for (size_t i = 0; i < name.size(); i++)
+			{
+				name[i] = tolower(name[i]);
+			}
+
+			const char *value = colon + 1;
+
+			while (value < eol && ' ' == *value)
+			{
+				value++;
+			}
+
+			if ("connection" != name && "keep-alive" != name && "proxy-connection" != name && "transfer-encoding" != name && "upgrade" != name)
+			{
+				hpack_encode(block, name.c_str(), value, eol - value);
+			}
+		}
+
+		p = next;
+	}
+
+	size_t body_size = task->out_post.get_total_data_size();
+
+	if (body_size)
+	{
+		char len[32];
+		int len_sz = snprintf(len, sizeof(len), "%zu", body_size);
+
+		hpack_encode(block, "accept-ranges", "bytes", 5);
+		hpack_encode(block, "content-length", len, len_sz);
+	}
+
+	bool with_body = body_size && BLZ_METHOD_HEAD != task->method;
+
+	for (size_t off = 0; off < block.size() || 0 == off; )
+	{
+		size_t n = std::min<size_t>(block.size() - off, peer_frame_sz);
+
+		int flags = off + n == block.size() ? FLAG_END_HEADERS : 0;
+
+		if (0 == off && !with_body)
+		{
+			flags |= FLAG_END_STREAM;
+		}
+
+		write_frame(0 == off ? HEADERS : CONTINUATION, flags, id, block.data() + off, n);
+
+		off += n;
+	}
+
+	if (!with_body)
+	{
+		close_stream(id, true);
+		return;
+	}
+
+	task->get_response_body_parts(s.parts);
+	s.part = 0;
+	s.offset = 0;
+	s.left = body_size;
+	s.state = stream::sSending;
+
+	queue_stream(id, s);
+	pump();
+}
+
+void blizzard::h2_session::queue_stream(uint32_t id, stream& s)
+{
+	if (stream::sSending == s.state && !s.queued && 0 < s.send_window)
+	{
+		s.queued = true;
+		sending.push_back(id);
+	}
+}
+
+/* DATA frames of the streams in turn, while the windows and the output buffer allow */
+void blizzard::h2_session::pump()
+{
+	while (!sending.empty() && 0 < send_window && out.size() - out_pos < OUT_BUF_SZ)
+	{
+		uint32_t id = sending.front();
+		sending.pop_front();
+
+		streams_t::iterator it = streams.find(id);
+
+		if (streams.end() == it)
+		{
+			continue;
+		}
+
+		stream& s = it->second;
+		s.queued = false;
+
+		int64_t n = std::min<int64_t>(std::min<int64_t>(s.left, peer_frame_sz), std::min(s.send_window, send_window));
+
+		if (0 >= n)
+		{
+			continue;
+		}
+
+		bool last = (size_t) n == s.left;
+
+		write_frame(DATA, last ? FLAG_END_STREAM : 0, id, 0, 0);
+
+		/* the length of the frame is set, the payload is appended from the parts */
+		size_t hdr = out.size() - FRAME_HEADER_SZ;
+		out[hdr] = (char) (n >> 16);
+		out[hdr + 1] = (char) (n >> 8);
+		out[hdr + 2] = (char) n;
+
+		for (int64_t left = n; 0 < left; )
+		{
+			const struct iovec& v = s.parts[s.part];
+			size_t k = std::min<size_t>(left, v.iov_len - s.offset);
+
+			out.append((const char *) v.iov_base + s.offset, k);
+
+			s.offset += k;
+			left -= k;
+
+			if (s.offset == v.iov_len)
+			{
+				s.part++;
+				s.offset = 0;
+			}
+		}
+
+		s.left -= n;
+		s.send_window -= n;
+		send_window -= n;
+
+		if (last)
+		{
+			close_stream(id, true);
+		}
+		else
+		{
+			queue_stream(id, s);
+		}
+	}
+}
+
+bool blizzard::h2_session::flush()
+{
+	while (out_pos < out.size())
+	{
+		ssize_t wr = write(fd, out.data() + out_pos, out.size() - out_pos);
+
+		if (0 <= wr)
+		{
+			out_pos += wr;
+			continue;
+		}
+
+		if (EINTR == errno)
+		{
+			continue;
+		}
+
+		if (EAGAIN == errno || EWOULDBLOCK == errno)
+		{
+			break;
+		}
+
+		out.clear();
+		out_pos = 0;
+
+		return false;
+	}
+
+	if (out_pos == out.size())
+	{
+		out.clear();
+		out_pos = 0;
+
+		ev_io_stop(srv->loop, &con->e.watcher_send);
+	}
+	else
+	{
+		ev_io_start(srv->loop, &con->e.watcher_send);
+	}
+
+	return true;
+}
+
+bool blizzard::h2_session::send_frames()
+{
+	do
+	{
+		pump();
+
+		if (!flush())
+		{
+			return false;
+		}
+	}
+	while (out.empty() && !sending.empty() && 0 < send_window);
+
+	return true;
+}
+
+void blizzard::h2_session::reset_stream(uint32_t id)
+{
+	stream& s = streams[id];
+
+	if (stream::sHandling == s.state)
+	{
+		s.reset = true;
+	}
+	else
+	{
+		close_stream(id, false);
+	}
+}
+
+void blizzard::h2_session::close_stream(uint32_t id, bool finished)
+{
+	streams_t::iterator it = streams.find(id);
+	http *task = it->second.task;
+
+	if (finished)
+	{
+		srv->finish_request(task);
+	}
+
+	task->destroy();
+	srv->http_pool.free(task);
+
+	streams.erase(it);
+}
+
+void blizzard::h2_session::process()
+{
+	if (closed)
+	{
+		return;
+	}
+
+	bool ok = read_input();
+
+	if (ok)
+	{
+		ok = handle_frames();
+		ok = send_frames() && ok;
+	}
+
+	if (ok && goaway_sent && streams.empty() && out.empty())
+	{
+		ok = false;
+	}
+
+	if (!ok)
+	{
+		srv->close_connection(con);
+	}
+}
+
+void blizzard::h2_session::go_away()
+{
+	if (!goaway_sent && !closed)
+	{
+		write_goaway(NO_ERROR);
+		send_frames();
+	}
+}
+
+bool blizzard::h2_session::busy() const
+{
+	return !streams.empty();
+}
+
+void blizzard::h2_session::count_requests(int& in_plugin, int& in_network) const
+{
+	in_plugin += handling;
+	in_network += streams.size() - handling;
+}
+
+bool blizzard::h2_session::close()
+{
+	closed = true;
+
+	for (streams_t::iterator it = streams.begin(); it != streams.end(); )
+	{
+		uint32_t id = it->first;
+		stream& s = it->second;
+
+		++it;
+
+		if (stream::sHandling == s.state)
+		{
+			s.reset = true;
+		}
+		else
+		{
+			close_stream(id, false);
+		}
+	}
+
+	sending.clear();
+
+	return 0 == handling;
+}
+
+void blizzard::h2_session::abort()
+{
+	while (!streams.empty())
+	{
+		http *task = streams.begin()->second.task;
+
+		if (task->plugin)
+		{
+			plugin_factory::release(task->plugin);
+			task->plugin = 0;
+		}
+
+		close_stream(streams.begin()->first, false);
+	}
+
+	sending.clear();
+	handling = 0;
+}
@@ -0,0 +1,190 @@
+#ifndef __BLIZZARD_H2_HPP__
+#define __BLIZZARD_H2_HPP__
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "hpack.hpp"
+#include "stream_session.hpp"
+
+namespace blizzard {
+
+struct http;
+struct server;
+
+/* HTTP/2 over cleartext TCP (h2c, RFC 7540) of a connection, with prior knowledge or after
+ * "Upgrade: h2c". The event thread reads and writes the frames. Every stream is an http object
+ * of its own, it goes through the easy and hard queues like a request of HTTP/1, and its
+ * response is written back in HEADERS and DATA frames interleaved with the other streams
+ * within the flow control windows. */
+
+class h2_session : public stream_session
+{
+public:
+	enum
+	{
+		FRAME_HEADER_SZ = 9,
+		DEFAULT_WINDOW = 65535,
+		DEFAULT_FRAME_SZ = 16384,
+		MAX_HEADER_BLOCK_SZ = 65536,
+		MAX_WINDOW = 0x7fffffff,
+		OUT_BUF_SZ = 65536
+	};
+
+	enum frame_type
+	{
+		DATA = 0, HEADERS = 1, PRIORITY = 2, RST_STREAM = 3, SETTINGS = 4,
+		PUSH_PROMISE = 5, PING = 6, GOAWAY = 7, WINDOW_UPDATE = 8, CONTINUATION = 9
+	};
+
+	enum error_code
+	{
+		NO_ERROR = 0, PROTOCOL_ERROR = 1, INTERNAL_ERROR = 2, FLOW_CONTROL_ERROR = 3,
+		STREAM_CLOSED = 5, FRAME_SIZE_ERROR = 6, REFUSED_STREAM = 7, CANCEL = 8,
+		COMPRESSION_ERROR = 9, ENHANCE_YOUR_CALM = 11
+	};
+
+	enum frame_flags
+	{
+		FLAG_END_STREAM = 0x1, FLAG_ACK = 0x1, FLAG_END_HEADERS = 0x4, FLAG_PADDED = 0x8,
+		FLAG_PRIORITY = 0x20
+	};
+
+private:
+	struct stream
+	{
+		enum state_t {sReceiving, sHandling, sSending};
+
+		http *task;
+		state_t state;
+
+		/* request body until END_STREAM */
+		std::string body;
+
+		/* the client may send as much, it isn't given more than <max_body_size> */
+		int64_t recv_window;
+		int64_t send_window;
+
+		/* response body left to send, the parts are in the out_post of the task */
+		std::vector<struct iovec> parts;
+		size_t part;
+		size_t offset;
+		size_t left;
+
+		/* in the list of streams with data to send */
+		bool queued;
+
+		/* reset while in the queues, the response is dropped */
+		bool reset;
+
+		stream();
+	};
+
+	typedef std::map<uint32_t, stream> streams_t;
+
+	server *srv;
+	http *con;
+	int fd;
+
+	std::string in;
+	std::string out;
+	size_t out_pos;
+
+	/* the rest of the client preface expected */
+	std::string preface;
+
+	hpack_decoder decoder;
+
+	streams_t streams;
+	std::deque<uint32_t> sending;
+
+	/* streams in the queues or the plugin, they hold the connection after it is closed */
+	int handling;
+
+	uint32_t last_stream;
+	uint32_t max_streams;
+	uint32_t window;
+	size_t max_body_size;
+	int64_t recv_window;
+
+	/* HEADERS continued by CONTINUATION frames */
+	std::string header_block;
+	uint32_t header_stream;
+	bool header_end_stream;
+
+	int64_t send_window;
+	int64_t peer_window;
+	uint32_t peer_frame_sz;
+
+	bool goaway_sent;
+	bool closed;
+
+	void write_frame(int type, int flags, uint32_t id, const void *payload, size_t len);
+	void write_settings();
+	void write_window_update(uint32_t id, uint32_t inc);
+	void write_rst(uint32_t id, uint32_t code);
+	void write_goaway(uint32_t code);
+
+	bool read_input();
+	bool handle_frames();
+	bool handle_frame(int type, int flags, uint32_t id, const uint8_t *p, size_t len);
+	bool handle_data(int flags, uint32_t id, const uint8_t *p, size_t len);
+	bool handle_headers(int flags, uint32_t id, const uint8_t *p, size_t len);
+	bool handle_header_block();
+	bool handle_settings(int flags, const uint8_t *p, size_t len);
+	bool handle_window_update(uint32_t id, const uint8_t *p, size_t len);
+	void handle_rst(uint32_t id);
+
+	bool apply_setting(uint16_t key, uint32_t value);
+	bool fail(uint32_t code, const char *what);
+
+	stream* open_stream(uint32_t id);
+	bool set_request(http *task, const std::vector<hpack_header>& headers);
+	void dispatch(uint32_t id, stream& s);
+	void refuse_body(uint32_t id, stream& s);
+	void queue_stream(uint32_t id, stream& s);
+	void reset_stream(uint32_t id);
+	void close_stream(uint32_t id, bool finished);
+
+	void write_response(uint32_t id, stream& s);
+	void pump();
+	bool flush();
+	bool send_frames();
+
+public:
+	h2_session(server *s, http *c);
+
+	/* the connection becomes HTTP/2 after its title "PRI * HTTP/2.0", the rest of its buffer
+	 * continues the preface */
+	void start();
+
+	/* after "Upgrade: h2c" the request of the connection is stream 1 and the response is 101,
+	 * false if HTTP2-Settings can't be decoded */
+	bool upgrade(const char *settings);
+
+	/* the connection is readable or writable */
+	void process();
+
+	/* the response of a stream is ready, its frames are queued */
+	void respond(http *task);
+
+	/* GOAWAY on shutdown: the streams in progress are finished, new ones are refused */
+	void go_away();
+
+	/* there are streams in progress */
+	bool busy() const;
+	void count_requests(int& in_plugin, int& in_network) const;
+
+	/* the socket is closed, false if the streams in the queues still hold the connection */
+	bool close();
+
+	/* the streams left in the queues are freed, the connection isn't held any more */
+	void abort();
+};
+
+}
+
+#endif /* __BLIZZARD_H2_HPP__ */
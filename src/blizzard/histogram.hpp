@@ -0,0 +1,149 @@
+#ifndef __BLIZZARD_HISTOGRAM_HPP__
+#define __BLIZZARD_HISTOGRAM_HPP__
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+namespace blizzard {
+
+inline uint64_t monotonic_usec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+inline uint64_t monotonic_nsec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Log-linear histogram of values (microseconds): values below LINEAR_BUCKETS are counted exactly,
+ * every power of two above is split into SUB_BUCKETS, so the error is within 1/SUB_BUCKETS */
+
+class histogram
+{
+public:
+	enum {LINEAR_BUCKETS = 16};
+	enum {SUB_BUCKETS = 8};
+	enum {SUB_BITS = 3};
+	enum {MIN_EXPONENT = 4};
+	enum {MAX_EXPONENT = 35};
+	enum {BUCKETS = LINEAR_BUCKETS + (MAX_EXPONENT - MIN_EXPONENT + 1) * SUB_BUCKETS};
+
+	uint64_t counts[BUCKETS];
+	uint64_t sum;
+
+	histogram()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		memset(counts, 0, sizeof(counts));
+		sum = 0;
+	}
+
+	static int bucket(uint64_t v)
+	{
+		if (v < LINEAR_BUCKETS)
+		{
+			return (int) v;
+		}
+
+		int e = 63 - __builtin_clzll(v);
+
+		if (e > MAX_EXPONENT)
+		{
+			return BUCKETS - 1;
+		}
+
+		return LINEAR_BUCKETS + (e - MIN_EXPONENT) * SUB_BUCKETS + (int) ((v >> (e - SUB_BITS)) & (SUB_BUCKETS - 1));
+	}
+
+	/* the greatest value counted in the bucket */
+	static uint64_t bucket_max(int idx)
+	{
+		if (idx < LINEAR_BUCKETS)
+		{
+			return idx;
+		}
+
+		int e = MIN_EXPONENT + (idx - LINEAR_BUCKETS) / SUB_BUCKETS;
+		uint64_t m = SUB_BUCKETS + (idx - LINEAR_BUCKETS) % SUB_BUCKETS;
+
+		return ((m + 1) << (e - SUB_BITS)) - 1;
+	}
+
+	void record(uint64_t v)
+	{
+		__sync_fetch_and_add(&counts[bucket(v)], 1);
+		__sync_fetch_and_add(&sum, v);
+	}
+
+	/* for histograms which are touched by one thread only */
+	void record_local(uint64_t v)
+	{
+		counts[bucket(v)]++;
+		sum += v;
+	}
+
+	void add(const histogram& h)
+	{
+		for (int i = 0; i < BUCKETS; i++) counts[i] += h.counts[i];
+		sum += h.sum;
+	}
+
+	void sub(const histogram& h)
+	{
+		for (int i = 0; i < BUCKETS; i++) counts[i] -= h.counts[i];
+		sum -= h.sum;
+	}
+
+	uint64_t count() const
+	{
+		uint64_t n = 0;
+		for (int i = 0; i < BUCKETS; i++) n += counts[i];
+		return n;
+	}
+
+	/* q is in [0, 1], e.g. 0.99 for p99 */
+	uint64_t percentile(double q) const
+	{
+		uint64_t n = count();
+
+		if (0 == n)
+		{
+			return 0;
+		}
+
+		uint64_t rank = (uint64_t) (q * n + 0.5);
+
+		if (rank < 1) rank = 1;
+		if (rank > n) rank = n;
+
+		uint64_t seen = 0;
+
+		for (int i = 0; i < BUCKETS; i++)
+		{
+			seen += counts[i];
+
+			if (seen >= rank)
+			{
+				return bucket_max(i);
+			}
+		}
+
+		return bucket_max(BUCKETS - 1);
+	}
+};
+
+}
+
+#endif /* __BLIZZARD_HISTOGRAM_HPP__ */
@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <string.h>
+#include "hpack.hpp"
+
+struct static_entry
+{
+	const char *name;
+	const char *value;
+};
+
+/* RFC 7541 Appendix A, index 1 is the first one */
+static const static_entry static_table[] = {
+	{":authority", ""},
+	{":method", "GET"},
+	{":method", "POST"},
+	{":path", "/"},
+	{":path", "/index.html"},
+	{":scheme", "http"},
+	{":scheme", "https"},
+	{":status", "200"},
+	{":status", "204"},
+	{":status", "206"},
+	{":status", "304"},
+	{":status", "400"},
+	{":status", "404"},
+	{":status", "500"},
+	{"accept-charset", ""},
+	{"accept-encoding", "gzip, deflate"},
+	{"accept-language", ""},
+	{"accept-ranges", ""},
+	{"accept", ""},
+	{"access-control-allow-origin", ""},
+	{"age", ""},
+	{"allow", ""},
+	{"authorization", ""},
+	{"cache-control", ""},
+	{"content-disposition", ""},
+	{"content-encoding", ""},
+	{"content-language", ""},
+	{"content-length", ""},
+	{"content-location", ""},
+	{"content-range", ""},
+	{"content-type", ""},
+	{"cookie", ""},
+	{"date", ""},
+	{"etag", ""},
+	{"expect", ""},
+	{"expires", ""},
+	{"from", ""},
+	{"host", ""},
+	{"if-match", ""},
+	{"if-modified-since", ""},
+	{"if-none-match", ""},
+	{"if-range", ""},
+	{"if-unmodified-since", ""},
+	{"last-modified", ""},
+	{"link", ""},
+	{"location", ""},
+	{"max-forwards", ""},
+	{"proxy-authenticate", ""},
+	{"proxy-authorization", ""},
+	{"range", ""},
+	{"referer", ""},
+	{"refresh", ""},
+	{"retry-after", ""},
+	{"server", ""},
+	{"set-cookie", ""},
+	{"strict-transport-security", ""},
+	{"transfer-encoding", ""},
+	{"user-agent", ""},
+	{"vary", ""},
+	{"via", ""},
+	{"www-authenticate", ""}
+};
+
+#define static_table_sz (sizeof(static_table) / sizeof(static_table[0]))
+
+/* RFC 7541 Appendix B, the last one is EOS */
+static const uint32_t huffman_codes[257] = {
+	0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+	0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+	0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+	0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+	0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+	0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+	0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+	0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+	0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+	0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+	0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+	0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+	0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+	0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+	0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+	0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+	0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+	0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+	0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+	0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+	0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+	0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+	0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+	0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+	0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+	0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+	0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+	0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+	0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+	0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+	0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+	0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+	0x3fffffff
+};
+
+static const uint8_t huffman_lengths[257] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30
+};
+
+/* a node has a child per bit: an index of the next node, or -(symbol + 1) of a leaf */
+struct huffman_tree
+{
+	enum {NODES_NUM = 512};
+
+	int16_t child[NODES_NUM][2];
+
+	huffman_tree()
+	{
+		memset(child, 0, sizeof(child));
+
+		int nodes = 1;
+
+		for (int sym = 0; sym < 257; sym++)
+		{
+			int node = 0;
+
+			for (int i = huffman_lengths[sym] - 1; i >= 0; i--)
+			{
+				int bit = (huffman_codes[sym] >> i) & 1;
+
+				if (0 == i)
+				{
+					child[node][bit] = -(sym + 1);
+				}
+				else
+				{
+					if (0 == child[node][bit])
+					{
+						child[node][bit] = nodes++;
+					}
+
+					node = child[node][bit];
+				}
+			}
+		}
+	}
+};
+
+bool blizzard::huffman_decode(const uint8_t *p, size_t len, std::string& out)
+{
+	static const huffman_tree tree;
+
+	int node = 0;
+	int bits = 0;
+	bool ones = true;
+
+	for (size_t k = 0; k < len; k++)
+	{
+		for (int i = 7; i >= 0; i--)
+		{
+			int bit = (p[k] >> i) & 1;
+			int next = tree.child[node][bit];
+
+			if (0 <= next)
+			{
+				node = next;
+				bits++;
+				ones = ones && bit;
+				continue;
+			}
+
+			int sym = -next - 1;
+
+			if (256 == sym)
+			{
+				return false;
+			}
+
+			out += (char) sym;
+
+			node = 0;
+			bits = 0;
+			ones = true;
+		}
+	}
+
+	/* the padding is the most significant bits of EOS, up to 7 */
+	return bits <= 7 && ones;
+}
+
+size_t blizzard::huffman_length(const uint8_t *p, size_t len)
+{
+	size_t bits = 0;
+
+	for (size_t k = 0; k < len; k++)
+	{
+		bits += huffman_lengths[p[k]];
+	}
+
+	return (bits + 7) / 8;
+}
+
+void blizzard::huffman_encode(const uint8_t *p, size_t len, std::string& out)
+{
+	uint64_t acc = 0;
+	int bits = 0;
+
+	for (size_t k = 0; k < len; k++)
+	{
+		acc = (acc << huffman_lengths[p[k]]) | huffman_codes[p[k]];
+		bits += huffman_lengths[p[k]];
+
+		while (8 <= bits)
+		{
+			bits -= 8;
+			out += (char) (acc >> bits);
+		}
+	}
+
+	if (bits)
+	{
+		out += (char) ((acc << (8 - bits)) | (0xff >> bits));
+	}
+}
+
+static bool decode_int(const uint8_t *&p, const uint8_t *end, int prefix, uint32_t& v)
+{
+	if (p >= end)
+	{
+		return false;
+	}
+
+	uint32_t mask = (1 << prefix) - 1;
+
+	v = *p++ & mask;
+
+	if (v < mask)
+	{
+		return true;
+	}
+
+	for (int shift = 0; p < end && shift <= 21; shift += 7)
+	{
+		uint8_t b = *p++;
+
+		v += (uint32_t) (b & 0x7f) << shift;
+
+		if (0 == (b & 0x80))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void encode_int(std::string& out, uint8_t first, int prefix, uint32_t v)
+{
+	uint32_t mask = (1 << prefix) - 1;
+
+	if (v < mask)
+	{
+		out += (char) (first | v);
+		return;
+	}
+
+	out += (char) (first | mask);
+	v -= mask;
+
+	while (128 <= v)
+	{
+		out += (char) (0x80 | (v & 0x7f));
+		v >>= 7;
+	}
+
+	out += (char) v;
+}
+
+static bool decode_string(const uint8_t *&p, const uint8_t *end, std::string& s)
+{
+	if (p >= end)
+	{
+		return false;
+	}
+
+	bool huffman = *p & 0x80;
+	uint32_t len;
+
+	if (!decode_int(p, end, 7, len) || len > (size_t) (end - p))
+	{
+		return false;
+	}
+
+	s.clear();
+
+	if (huffman)
+	{
+		if (!blizzard::huffman_decode(p, len, s))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		s.assign((const char *) p, len);
+	}
+
+	p += len;
+
+	return true;
+}
+
+static void encode_string(std::string& out, const char *s, size_t len)
+{
+	size_t huffman_len = blizzard::huffman_length((const uint8_t *) s, len);
+
+	if (huffman_len < len)
+	{
+		encode_int(out, 0x80, 7, huffman_len);
+		blizzard::huffman_encode((const uint8_t *) s, len, out);
+	}
+	else
+	{
+		encode_int(out, 0, 7, len);
+		out.append(s, len);
+	}
+}
+
+blizzard::hpack_decoder::hpack_decoder()
+	: table_size(0)
+	, max_size(DEFAULT_TABLE_SIZE)
+	, settings_size(DEFAULT_TABLE_SIZE)
+{
+}
+
+bool blizzard::hpack_decoder::lookup(uint32_t idx, hpack_header& h) const
+{
+	if (0 == idx)
+	{
+		return false;
+	}
+
+	if (idx <= static_table_sz)
+	{
+		h.first = static_table[idx - 1].name;
+		h.second = static_table[idx - 1].value;
+
+		return true;
+	}
+
+	idx -= static_table_sz + 1;
+
+	if (idx >= table.size())
+	{
+		return false;
+	}
+
+	h = table[idx];
+
+	return true;
+}
+
+/* an entry takes its name and value and 32 bytes of overhead */
+void blizzard::hpack_decoder::insert(const hpack_header& h)
+{
+	size_t sz = h.first.size() + h.second.size() + 32;
+
+	evict(sz > max_size ? 0 : max_size - sz);
+
+	if (sz <= max_size)
+	{
+		table.push_front(h);
+		table_size += sz;
+	}
+}
+
+void blizzard::hpack_decoder::evict(size_t limit)
+{
+	while (table_size > limit && !table.empty())
+	{
+		const hpack_header& h = table.back();
+
+		table_size -= h.first.size() + h.second.size() + 32;
+		table.pop_back();
+	}
+}
+
+bool blizzard::hpack_decoder::decode(const uint8_t *p, size_t len, std::vector<hpack_header>& headers)
+{
+	const uint8_t *end = p + len;
+
+	while (p < end)
+	{
+		uint8_t b = *p;
+		uint32_t idx;
+
+		if (b & 0x80)
+		{
+			hpack_header h;
+
+			if (!decode_int(p, end, 7, idx) || !lookup(idx, h))
+			{
+				return false;
+			}
+
+			headers.push_back(h);
+			continue;
+		}
+
+		if (0x20 == (b & 0xe0))
+		{
+			if (!decode_int(p, end, 5, idx) || idx > settings_size)
+			{
+				return false;
+			}
+
+			max_size = idx;
+			evict(max_size);
+			continue;
+		}
+
+		/* literals: with incremental indexing, without indexing and never indexed */
+		bool indexing = 0x40 == (b & 0xc0);
+
+		if (!decode_int(p, end, indexing ? 6 : 4, idx))
+		{
+			return false;
+		}
+
+		hpack_header h;
+
+		if (idx)
+		{
+			if (!lookup(idx, h))
+			{
+				return false;
+			}
+		}
+		else if (!decode_string(p, end, h.first))
+		{
+			return false;
+		}
+
+		if (!decode_string(p, end, h.second))
+		{
+			return false;
+		}
+
+		if (indexing)
+		{
+			insert(h);
+		}
+
+		headers.push_back(h);
+	}
+
+	return true;
+}
+
+void blizzard::hpack_encode(std::string& out, const char *name, const char *value, size_t value_len)
+{
+	uint32_t idx = 0;
+
+	for (size_t i = 0; i < static_table_sz && 0 == idx; i++)
+	{
+		if (0 == strcmp(static_table[i].name, name))
+		{
+			idx = i + 1;
+		}
+	}
+
+	encode_int(out, 0, 4, idx);
+
+	if (0 == idx)
+	{
+		encode_string(out, name, strlen(name));
+	}
+
+	encode_string(out, value, value_len);
+}
+
+void blizzard::hpack_encode_status(std::string& out, int status)
+{
+	char buf[16];
+	int len = snprintf(buf, sizeof(buf), "%d", status);
+
+	/* the usual ones are indexed in the static table */
+	for (size_t i = 7; i < 14; i++)
+	{
+		if (0 == strcmp(static_table[i].value, buf))
+		{
+			encode_int(out, 0x80, 7, i + 1);
+			return;
+		}
+	}
+
+	hpack_encode(out, ":status", buf, len);
+}
@@ -0,0 +1,51 @@
+#ifndef __BLIZZARD_HPACK_HPP__
+#define __BLIZZARD_HPACK_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace blizzard {
+
+typedef std::pair<std::string, std::string> hpack_header;
+
+/* HPACK (RFC 7541) decoder of the header blocks of a connection: the dynamic table is
+ * filled by the peer, so the blocks must be decoded in the order they were received */
+
+class hpack_decoder
+{
+	std::deque<hpack_header> table;
+	size_t table_size;
+	size_t max_size;
+	size_t settings_size;
+
+	bool lookup(uint32_t idx, hpack_header& h) const;
+	void insert(const hpack_header& h);
+	void evict(size_t limit);
+
+public:
+	enum {DEFAULT_TABLE_SIZE = 4096};
+
+	hpack_decoder();
+
+	/* the headers are appended, false on a compression error of the connection */
+	bool decode(const uint8_t *p, size_t len, std::vector<hpack_header>& headers);
+};
+
+/* The encoder doesn't use the dynamic table of the peer: every field is a literal without
+ * indexing, the name refers to the static table if it is there, Huffman coding is used
+ * when it is shorter. Names are expected in lower case. */
+
+void hpack_encode(std::string& out, const char *name, const char *value, size_t value_len);
+void hpack_encode_status(std::string& out, int status);
+
+bool huffman_decode(const uint8_t *p, size_t len, std::string& out);
+void huffman_encode(const uint8_t *p, size_t len, std::string& out);
+size_t huffman_length(const uint8_t *p, size_t len);
+
+}
+
+#endif /* __BLIZZARD_HPACK_HPP__ */
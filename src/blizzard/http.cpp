@@ -1,11 +1,16 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <netdb.h>
+#include <string.h>
 #include <strings.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include "etag.hpp"
+#include "stream_session.hpp"
 #include "http.hpp"
+#include "probes.hpp"
 #include "server.hpp"
+#include "service.hpp"
 
 //TODO: Error messages support etc
 //TODO: Expect: 100-continue header support for POST requests
@@ -81,7 +86,18 @@ blizzard::http::http() :
 	cache(false),
 	uri_path(0),
 	uri_params(0),
-	response_status(0)
+	response_status(0),
+	response_encoding(0),
+	headers_dropped(false),
+	cache_ttl(-1),
+	listener(0),
+	svc(0),
+	plugin(0),
+	session(0),
+	session_conn(0),
+	stream_id(0),
+	conn_prev(0),
+	conn_next(0)
 {
 	memset(&in_ip, 0, sizeof(in_ip));
 
@@ -154,16 +170,18 @@ static void timeout_callback(EV_P_ ev_timer *w, int tev)
 	blizzard::events *e = memberof(blizzard::events, watcher_timeout, w);
 	blizzard::http *con = e->con;
 
+	/* a connection of a session isn't closed under its requests in progress */
+	if (con->session && con->session->busy())
+	{
+		ev_timer_again(loop, w);
+		return;
+	}
+
 	log_warn("timeout: is_locked=%d, state=%d, fd=%d", con->is_locked(), con->state(), con->get_fd());
 
 	if (!con->is_locked())
 	{
-		ev_io_stop(loop, &e->watcher_recv);
-		ev_io_stop(loop, &e->watcher_send);
-		ev_timer_stop(loop, &e->watcher_timeout);
-
-		con->destroy();
-		s->http_pool.free(con);
+		s->close_connection(con);
 	}
 }
 
@@ -178,11 +196,14 @@ void blizzard::http::add_watcher(struct ev_loop *loop)
 
 	ev_io_init(&e.watcher_send, send_callback, fd, EV_WRITE);
 
-	ev_timer_init(&e.watcher_timeout, timeout_callback, 0, s->config.blz.plugin.connection_timeout / (double) 1000);
+	ev_timer_init(&e.watcher_timeout, timeout_callback, 0, s->listeners[listener].connection_timeout / (double) 1000);
 	ev_timer_again(loop, &e.watcher_timeout);
 
 	server_loop = loop;
 	response_time = ev_now(loop);
+
+	times.accepted = monotonic_usec();
+	BLZ_PROBE2(accept, fd, times.accepted);
 }
 
 void blizzard::http::init(int new_fd, const struct in_addr& ip)
@@ -211,6 +232,7 @@ void blizzard::http::init(int new_fd, const struct in_addr& ip)
 
 	state_ = sUndefined;
 	header_items_num = 0;
+	method = BLZ_METHOD_UNDEF;
 	protocol_major = 0;
 	protocol_minor = 0;
 	cache = false;
@@ -218,6 +240,21 @@ void blizzard::http::init(int new_fd, const struct in_addr& ip)
 	uri_path = 0;
 	uri_params = 0;
 	response_status = 0;
+	response_encoding = 0;
+	headers_dropped = false;
+	cache_ttl = -1;
+
+	etag.clear();
+	flight_key.clear();
+
+	memset(&times, 0, sizeof(times));
+	route = 0;
+	listener = 0;
+	svc = 0;
+	plugin = 0;
+	session = 0;
+	session_conn = 0;
+	stream_id = 0;
 
 	in_headers.reset();
 	in_post.reset();
@@ -227,6 +264,8 @@ void blizzard::http::init(int new_fd, const struct in_addr& ip)
 
 	out_post.set_expand(true);
 
+	arena.reset();
+
 	state_ = sUndefined;
 }
 
@@ -234,6 +273,8 @@ void blizzard::http::destroy()
 {
 	if (-1 != fd)
 	{
+		BLZ_PROBE2(close, fd, times.accepted);
+
 		close(fd);
 		fd = -1;
 	}
@@ -244,6 +285,9 @@ void blizzard::http::destroy()
 	out_headers.reset();
 	out_post.reset();
 
+	stats.report_arena_usage(arena.bytes_used());
+	arena.reset();
+
 	state_ = sUndefined;
 }
 
@@ -299,6 +343,16 @@ int blizzard::http::get_fd()const
 	return fd;
 }
 
+size_t blizzard::http::get_request_size()
+{
+	return in_headers.marker() + in_post.size();
+}
+
+size_t blizzard::http::get_response_size() const
+{
+	return out_title.get_total_data_size() + out_headers.get_total_data_size() + out_post.get_total_data_size();
+}
+
 double blizzard::http::get_response_time() const
 {
 	return response_time;
@@ -319,11 +373,269 @@ bool blizzard::http::is_locked()const
 	return locked;
 }
 
+bool blizzard::http::is_idle() const
+{
+	return !locked && (sUndefined == state_ || sReadingHead == state_) && 0 == in_headers.get_data_size();
+}
+
 blizzard::http::http_state blizzard::http::state()const
 {
 	return state_;
 }
 
+bool blizzard::http::is_cacheable_request() const
+{
+	return method == BLZ_METHOD_GET || method == BLZ_METHOD_HEAD;
+}
+
+void blizzard::http::get_cache_key(std::string& key, const std::vector<std::string>& key_headers) const
+{
+	key.clear();
+
+	/* the same URI of different <plugin> sections is a different resource */
+	if (svc && svc->idx)
+	{
+		key += '#';
+		key += (char) ('0' + svc->idx);
+	}
+
+	key += (char) ('0' + method);
+	key += uri_path;
+	key += '?';
+	key += uri_params;
+	key += '\n';
+	key += (char) ('0' + response_encoding);
+
+	for (size_t i = 0; i < key_headers.size(); i++)
+	{
+		const char *val = get_request_header(key_headers[i].c_str());
+
+		key += '\n';
+		key += val ? val : "";
+	}
+}
+
+int blizzard::http::get_cache_ttl() const
+{
+	return cache_ttl;
+}
+
+int blizzard::http::get_response_status() const
+{
+	return response_status;
+}
+
+void blizzard::http::get_response(std::string& headers, std::string& body) const
+{
+	headers.assign((const char*) out_headers.get_data(), out_headers.get_data_size());
+
+	body.clear();
+	body.reserve(out_post.get_total_data_size());
+
+	for (const mem_chunk<WRITE_BODY_SZ> *c = &out_post; c; c = c->get_next())
+	{
+		body.append((const char*) c->get_data(), c->get_data_size());
+	}
+}
+
+void blizzard::http::set_response(int status, const std::string& headers, const std::string& body, const std::string& tag)
+{
+	response_status = status;
+	etag = tag;
+
+	out_headers.append_data(headers.data(), headers.size());
+	out_post.append_data(body.data(), body.size());
+}
+
+/* what easy() of the follower wrote before BLZ_AGAIN is replaced, not added to */
+void blizzard::http::clone_response(const http& src)
+{
+	out_headers.reset();
+	out_post.reset();
+	out_post.set_expand(true);
+
+	response_status = src.response_status;
+	cache = src.cache;
+	cache_ttl = src.cache_ttl;
+	etag = src.etag;
+
+	out_headers.append_data(src.out_headers.get_data(), src.out_headers.get_data_size());
+
+	for (const mem_chunk<WRITE_BODY_SZ> *c = &src.out_post; c; c = c->get_next())
+	{
+		out_post.append_data(c->get_data(), c->get_data_size());
+	}
+}
+
+const std::string& blizzard::http::get_response_etag() const
+{
+	return etag;
+}
+
+void blizzard::http::replace_response_etag(const std::string& tag)
+{
+	etag = tag;
+}
+
+bool blizzard::http::check_not_modified()
+{
+	if (etag.empty() || 200 != response_status || !is_cacheable_request())
+	{
+		return false;
+	}
+
+	if (!etag_matches(get_request_header("If-None-Match"), etag))
+	{
+		return false;
+	}
+
+	response_status = 304;
+
+	out_post.reset();
+	out_post.set_expand(true);
+
+	return true;
+}
+
+int blizzard::http::get_response_encoding() const
+{
+	return response_encoding;
+}
+
+void blizzard::http::set_response_encoding(int enc)
+{
+	response_encoding = enc;
+}
+
+bool blizzard::http::has_response_header(const char* name) const
+{
+	std::string value;
+	return get_response_header(name, value);
+}
+
+/* the value of a header added by the plugin, without the spaces around it */
+bool blizzard::http::get_response_header(const char* name, std::string& value) const
+{
+	size_t name_sz = strlen(name);
+
+	const char *p = (const char*) out_headers.get_data();
+	const char *end = p + out_headers.get_data_size();
+
+	while (p < end)
+	{
+		const char *eol = (const char*) memchr(p, '\n', end - p);
+
+		if (0 == eol)
+		{
+			eol = end;
+		}
+
+		if ((size_t) (eol - p) > name_sz && ':' == p[name_sz] && 0 == strncasecmp(p, name, name_sz))
+		{
+			const char *v = p + name_sz + 1;
+			const char *v_end = eol;
+
+			while (v < v_end && ' ' == *v) v++;
+			while (v < v_end && (' ' == v_end[-1] || '\r' == v_end[-1])) v_end--;
+
+			value.assign(v, v_end - v);
+			return true;
+		}
+
+		p = eol + 1;
+	}
+
+	return false;
+}
+
+void blizzard::http::remove_response_header(const char* name)
+{
+	size_t name_sz = strlen(name);
+
+	std::string kept;
+	const char *p = (const char*) out_headers.get_data();
+	const char *end = p + out_headers.get_data_size();
+
+	while (p < end)
+	{
+		const char *eol = (const char*) memchr(p, '\n', end - p);
+		const char *next = eol ? eol + 1 : end;
+
+		if (!((size_t) (next - p) > name_sz && ':' == p[name_sz] && 0 == strncasecmp(p, name, name_sz)))
+		{
+			kept.append(p, next - p);
+		}
+
+		p = next;
+	}
+
+	out_headers.reset();
+	out_headers.append_data(kept.data(), kept.size());
+}
+
+size_t blizzard::http::get_response_body_size() const
+{
+	return out_post.get_total_data_size();
+}
+
+void blizzard::http::get_response_body_parts(std::vector<struct iovec>& parts) const
+{
+	parts.clear();
+
+	for (const mem_chunk<WRITE_BODY_SZ> *c = &out_post; c; c = c->get_next())
+	{
+		if (c->get_data_size())
+		{
+			struct iovec v;
+			v.iov_base = (void*) c->get_data();
+			v.iov_len = c->get_data_size();
+
+			parts.push_back(v);
+		}
+	}
+}
+
+void blizzard::http::set_response_body(const void* data, size_t size)
+{
+	out_post.reset();
+	out_post.set_expand(true);
+	out_post.append_data(data, size);
+}
+
+const char* blizzard::http::store_string(const char* s, size_t len)
+{
+	char *p = (char *) in_headers.get_data() + in_headers.get_data_size();
+
+	if (in_headers.get_data_size() + len + 1 > in_headers.page_size())
+	{
+		return 0;
+	}
+
+	in_headers.append_data(s, len);
+	in_headers.append_data("", 1);
+
+	return p;
+}
+
+bool blizzard::http::add_request_header(const char* key, size_t key_len, const char* value, size_t value_len)
+{
+	if (header_items_num >= MAX_HEADER_ITEMS)
+	{
+		return true;
+	}
+
+	header_item& item = header_items[header_items_num];
+
+	if (0 == (item.key = store_string(key, key_len)) || 0 == (item.value = store_string(value, value_len)))
+	{
+		return false;
+	}
+
+	header_items_num++;
+
+	return true;
+}
+
 int blizzard::http::get_request_method()const
 {
 	return method;
@@ -406,13 +718,41 @@ void blizzard::http::set_cache(bool ch)
 	cache = ch;
 }
 
+void blizzard::http::set_cache_ttl(int ttl_ms)
+{
+	cache_ttl = ttl_ms < 0 ? -1 : ttl_ms;
+}
+
+void blizzard::http::set_response_etag(const char* value)
+{
+	etag_quote(etag, value, "");
+}
+
 void blizzard::http::set_response_status(int st)
 {
 	response_status = st;
 }
 
+bool blizzard::http::response_header_fits(const char* name, const char* data) const
+{
+	return out_headers.get_data_size() + strlen(name) + strlen(data) + 4 <= WRITE_HEADERS_SZ;
+}
+
+/* a header which doesn't fit is dropped whole, so the lines are never cut (HTTP/2 and RPC
+ * pass them on as they are) */
 void blizzard::http::add_response_header(const char* name, const char* data)
 {
+	if (!response_header_fits(name, data))
+	{
+		if (!headers_dropped)
+		{
+			log_warn("response header %s doesn't fit into %d bytes of headers, it is dropped", name, (int) WRITE_HEADERS_SZ);
+			headers_dropped = true;
+		}
+
+		return;
+	}
+
 	out_headers.append_data(name, strlen(name));
 	out_headers.append_data(": ", 2);
 	out_headers.append_data(data, strlen(data));
@@ -424,6 +764,11 @@ void blizzard::http::add_response_buffer(const char* data, size_t size)
 	out_post.append_data(data, size);
 }
 
+void* blizzard::http::alloc(size_t sz, size_t align)
+{
+	return arena.allocate(sz, align);
+}
+
 void blizzard::http::process()
 {
 	bool quit = false;
@@ -655,6 +1000,13 @@ int blizzard::http::parse_title()
 		return 400;
 	}
 
+	/* the preface of HTTP/2 with prior knowledge, the rest is read by h2_session */
+	if (0 == strcmp(mthd, "PRI") && 0 == strcmp(url, "*") && 0 == strcmp(version, "HTTP/2.0"))
+	{
+		state_ = sH2;
+		return -1;
+	}
+
 	version += 5;
 	char * mnr = strchr(version, '.');
 	if (!mnr)
@@ -4,12 +4,22 @@
 #include <ev.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include "histogram.hpp"
+#include "mem_arena.hpp"
 #include "mem_chunk.hpp"
 #include "plugin.hpp"
 
 namespace blizzard {
 
 struct http;
+class h2_session;
+class rpc_session;
+class stream_session;
+struct plugin_instance;
+struct service;
 
 struct events
 {
@@ -22,11 +32,16 @@ struct events
 struct http : public blz_task
 {
 public:
-	enum http_state {sUndefined, sReadingHead, sReadingHeaders, sReadingPost, sReadyToHandle, sWriting, sDone};
+	/* sH2: the title was the preface of HTTP/2, the connection is handed to h2_session */
+	enum http_state {sUndefined, sReadingHead, sReadingHeaders, sReadingPost, sReadyToHandle, sWriting, sDone, sH2};
 
 	events e;
 
 protected:
+	/* set up the requests of their streams and write their responses in frames */
+	friend class h2_session;
+	friend class rpc_session;
+
 	static int http_codes_num;
 	static const char ** http_codes;
 
@@ -58,6 +73,8 @@ protected:
 	mem_chunk<WRITE_HEADERS_SZ>   out_headers;
 	mem_chunk<WRITE_BODY_SZ>      out_post;
 
+	mem_arena                     arena;
+
 	http_state state_;
 
 	struct header_item
@@ -80,6 +97,14 @@ protected:
 	const char *uri_params;
 
 	int response_status;
+	int response_encoding;
+
+	/* a response header didn't fit into out_headers, logged once per request */
+	bool headers_dropped;
+
+	int cache_ttl;
+
+	std::string etag;
 
 	bool ready_read()const;
 	bool ready_write()const;
@@ -125,6 +150,78 @@ public:
 
 	http_state state()const;
 
+	bool is_cacheable_request() const;
+	void get_cache_key(std::string& key, const std::vector<std::string>& key_headers) const;
+
+	int get_cache_ttl() const;
+	int get_response_status() const;
+	void get_response(std::string& headers, std::string& body) const;
+	void set_response(int status, const std::string& headers, const std::string& body, const std::string& etag);
+	void clone_response(const http& src);
+
+	const std::string& get_response_etag() const;
+	void replace_response_etag(const std::string& tag);
+	bool check_not_modified();
+
+	int get_response_encoding() const;
+	void set_response_encoding(int enc);
+
+	bool has_response_header(const char* name) const;
+	bool get_response_header(const char* name, std::string& value) const;
+	void remove_response_header(const char* name);
+	bool response_header_fits(const char* name, const char* data) const;
+	size_t get_response_body_size() const;
+	void get_response_body_parts(std::vector<struct iovec>& parts) const;
+	void set_response_body(const void* data, size_t size);
+
+	/* requests of HTTP/2 and RPC: the strings are copied into the header buffer as in HTTP/1,
+	 * 0 or false if they don't fit, the headers above MAX_HEADER_ITEMS are dropped */
+	const char* store_string(const char* s, size_t len);
+	bool add_request_header(const char* key, size_t key_len, const char* value, size_t value_len);
+
+	std::string flight_key;
+
+	/* index of the route in stats */
+	int route;
+
+	/* the listen socket of the connection and the <plugin> section which the request is routed to */
+	int listener;
+	service* svc;
+
+	/* the plugin which handles the request, referenced from pushing to the easy queue until done */
+	plugin_instance* plugin;
+
+	/* HTTP/2 or RPC: the session of a connection; a request has the connection it came on and its id */
+	stream_session* session;
+	http* session_conn;
+	uint32_t stream_id;
+
+	/* list of open connections of the server or of the requests of an RPC connection, event thread only */
+	http* conn_prev;
+	http* conn_next;
+
+	/* nothing of a request is received yet */
+	bool is_idle() const;
+
+	size_t get_request_size();
+	size_t get_response_size() const;
+
+	/* monotonic timestamps (usec) of the request passing through the stages, 0 if not reached */
+	struct stage_times
+	{
+		uint64_t accepted;
+		uint64_t parsed;
+		uint64_t easy_push;
+		uint64_t easy_pop;
+		uint64_t easy_done;
+		uint64_t hard_push;
+		uint64_t hard_pop;
+		uint64_t hard_done;
+		uint64_t done_push;
+		uint64_t done_pop;
+		uint64_t written;
+	} times;
+
 	/* API */
 
 	int              get_request_method() const;
@@ -146,6 +243,11 @@ public:
 	void             set_response_status(int);
 	void             add_response_header(const char* name, const char* data);
 	void             add_response_buffer(const char* data, size_t size);
+
+	void*            alloc(size_t sz, size_t align);
+
+	void             set_cache_ttl(int ttl_ms);
+	void             set_response_etag(const char* etag);
 };
 
 }
@@ -4,6 +4,7 @@
 #include <coda/error.h>
 #include <coda/daemon.h>
 #include <coda/logger.h>
+#include "master.hpp"
 #include "server.hpp"
 
 int main(int argc, char** argv)
@@ -30,9 +31,19 @@ int main(int argc, char** argv)
 		while (0 == coda_terminate)
 		{
 			server.load_config(opt.config, opt.pid, opt.daemon);
-			server.prepare();
-			server.init_threads();
-			server.join_threads();
+
+			if (server.config.blz.workers.count)
+			{
+				blizzard::master master(server);
+				master.run();
+			}
+			else
+			{
+				server.prepare();
+				server.init_threads();
+				server.join_threads();
+			}
+
 			server.finalize();
 
 			coda_changecfg = 0; /* TODO: remove this crap */
@@ -0,0 +1,332 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <stdexcept>
+#include <coda/daemon.h>
+#include <coda/logger.h>
+#include "master.hpp"
+#include "server.hpp"
+
+blizzard::master::master(server& s)
+	: srv(s)
+{
+}
+
+/* "auto" pins the workers to a CPU each, otherwise the list has a CPU set per worker
+ * ("0-3 4-7", "0,2 1,3"), the sets are reused if there are more workers than sets */
+void blizzard::master::set_cpus(const std::string& list)
+{
+	if (list.empty())
+	{
+		return;
+	}
+
+	if ("auto" == list)
+	{
+		long cpus_num = sysconf(_SC_NPROCESSORS_ONLN);
+
+		if (0 >= cpus_num)
+		{
+			throw coda_error("can't get number of CPUs: %s", coda_strerror(errno));
+		}
+
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			CPU_ZERO(&workers[i].cpus);
+			CPU_SET(i % cpus_num, &workers[i].cpus);
+			workers[i].pinned = true;
+		}
+
+		return;
+	}
+
+	std::vector<cpu_set_t> sets;
+
+	const char *p = list.c_str();
+
+	while (*p)
+	{
+		p += strspn(p, " \t");
+
+		if (0 == *p)
+		{
+			break;
+		}
+
+		cpu_set_t set;
+		CPU_ZERO(&set);
+
+		while (*p && !strchr(" \t", *p))
+		{
+			char *end;
+			long from = strtol(p, &end, 10);
+			long to = from;
+
+			if (end != p && '-' == *end)
+			{
+				p = end + 1;
+				to = strtol(p, &end, 10);
+			}
+
+			if (end == p || from < 0 || to < from || to >= CPU_SETSIZE || (*end && !strchr(", \t", *end)))
+			{
+				throw coda_error("<workers:cpus> \"%s\" is not a list of CPU sets", list.c_str());
+			}
+
+			for (long cpu = from; cpu <= to; cpu++)
+			{
+				CPU_SET(cpu, &set);
+			}
+
+			p = ',' == *end ? end + 1 : end;
+		}
+
+		sets.push_back(set);
+	}
+
+	for (size_t i = 0; i < workers.size() && !sets.empty(); i++)
+	{
+		workers[i].cpus = sets[i % sets.size()];
+		workers[i].pinned = true;
+	}
+}
+
+void blizzard::master::run()
+{
+	const blz_config::BLZ::WORKERS& wc = srv.config.blz.workers;
+
+	workers.resize(wc.count);
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].pid = 0;
+		workers[i].pinned = false;
+		workers[i].restart_at = 0;
+	}
+
+	set_cpus(wc.cpus);
+
+	segment.create(wc.count);
+
+	/* the workers inherit them, so they accept from the same queues */
+	srv.open_listeners();
+
+	log_notice("master: starting %d workers", wc.count);
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		start_worker(i);
+	}
+
+	while (0 == coda_terminate)
+	{
+		if (0 != coda_changecfg)
+		{
+			if (!srv.hot_reload)
+			{
+				break;
+			}
+
+			coda_changecfg = 0;
+			signal_workers(SIGHUP);
+		}
+
+		if (0 != coda_rotatelog)
+		{
+			if (srv.was_daemonized)
+			{
+				log_rotate(srv.config.blz.log_file_name.c_str());
+			}
+
+			signal_workers(SIGUSR1);
+			coda_rotatelog = 0;
+		}
+
+		reap(true);
+
+		uint64_t now = monotonic_usec();
+
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			if (workers[i].restart_at && workers[i].restart_at <= now)
+			{
+				start_worker(i);
+			}
+		}
+
+		coda_msleep(POLL_MS);
+	}
+
+	stop_workers();
+
+	segment.destroy();
+}
+
+void blizzard::master::start_worker(int idx)
+{
+	worker& w = workers[idx];
+	shared_stats::slot *sl = segment.get(idx);
+
+	/* a restarted worker counts from zero */
+	segment.reset(idx);
+
+	if (w.restart_at)
+	{
+		sl->restarts++;
+	}
+
+	w.restart_at = 0;
+
+	pid_t pid = fork();
+
+	if (0 > pid)
+	{
+		log_error("master: can't fork worker %d: %s", idx, coda_strerror(errno));
+		w.restart_at = monotonic_usec() + srv.config.blz.workers.restart_delay * 1000ULL;
+		return;
+	}
+
+	if (0 == pid)
+	{
+		run_worker(idx);
+	}
+
+	w.pid = pid;
+	sl->pid = pid;
+
+	log_notice("master: worker %d started, pid %d", idx, (int) pid);
+}
+
+void blizzard::master::run_worker(int idx)
+{
+	/* the worker doesn't outlive the master */
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+	const worker& w = workers[idx];
+
+	if (w.pinned && 0 != sched_setaffinity(0, sizeof(w.cpus), &w.cpus))
+	{
+		log_warn("worker %d: can't set CPU affinity: %s", idx, coda_strerror(errno));
+	}
+
+	stats.set_shared(&segment, idx);
+
+	int status = 0;
+
+	try
+	{
+		srv.prepare();
+		srv.init_threads();
+		srv.join_threads();
+		srv.finalize();
+	}
+	catch (const std::exception& e)
+	{
+		log_crit("worker %d: exception: %s", idx, e.what());
+		status = 1;
+	}
+
+	/* destructors belong to the master */
+	_exit(status);
+}
+
+int blizzard::master::reap(bool restart)
+{
+	pid_t pid;
+	int status;
+
+	while (0 < (pid = waitpid(-1, &status, WNOHANG)))
+	{
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			worker& w = workers[i];
+
+			if (w.pid != pid)
+			{
+				continue;
+			}
+
+			w.pid = 0;
+			segment.get(i)->pid = 0;
+
+			if (WIFSIGNALED(status))
+			{
+				log_error("master: worker %d (pid %d) is killed by signal %d", (int) i, (int) pid, WTERMSIG(status));
+			}
+			else if (0 != WEXITSTATUS(status))
+			{
+				log_error("master: worker %d (pid %d) exited with status %d", (int) i, (int) pid, WEXITSTATUS(status));
+			}
+			else if (restart)
+			{
+				log_warn("master: worker %d (pid %d) exited", (int) i, (int) pid);
+			}
+
+			if (restart)
+			{
+				int delay = srv.config.blz.workers.restart_delay;
+
+				log_notice("master: worker %d is restarted in %d ms", (int) i, delay);
+				w.restart_at = monotonic_usec() + delay * 1000ULL + 1;
+			}
+		}
+	}
+
+	int running = 0;
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		if (workers[i].pid)
+		{
+			running++;
+		}
+	}
+
+	return running;
+}
+
+void blizzard::master::signal_workers(int sig)
+{
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		if (workers[i].pid)
+		{
+			kill(workers[i].pid, sig);
+		}
+	}
+}
+
+void blizzard::master::stop_workers()
+{
+	/* new connections are refused while the workers finish theirs */
+	srv.close_listeners();
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].restart_at = 0;
+	}
+
+	signal_workers(SIGTERM);
+
+	uint64_t deadline = monotonic_usec() + (srv.config.blz.shutdown_timeout + STOP_GRACE_MS) * 1000ULL;
+	bool killed = false;
+
+	while (reap(false))
+	{
+		if (!killed && monotonic_usec() > deadline)
+		{
+			log_error("master: workers don't stop, killing them");
+
+			signal_workers(SIGKILL);
+			killed = true;
+		}
+
+		coda_msleep(POLL_MS);
+	}
+
+	log_notice("master: all workers stopped");
+}
@@ -0,0 +1,53 @@
+#ifndef __BLIZZARD_MASTER_HPP__
+#define __BLIZZARD_MASTER_HPP__
+
+#include <sched.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include "shared_stats.hpp"
+
+namespace blizzard {
+
+struct server;
+
+/* Prefork mode: the master process owns the listen socket and forks <workers:count> processes,
+ * each of them loads the plugin and runs the usual threads of the server. The master restarts
+ * the workers which exit, passes SIGHUP and SIGUSR1 to them, and stops them on SIGTERM. */
+
+class master
+{
+	enum {POLL_MS = 100};
+	enum {STOP_GRACE_MS = 5000};
+
+	struct worker
+	{
+		pid_t pid;
+		bool pinned;
+		cpu_set_t cpus;
+		uint64_t restart_at;  /* monotonic usec, 0 if it's not waiting for a restart */
+	};
+
+	server& srv;
+	shared_stats segment;
+	std::vector<worker> workers;
+
+	void set_cpus(const std::string& list);
+
+	void start_worker(int idx);
+	void run_worker(int idx);
+
+	int reap(bool restart);
+	void signal_workers(int sig);
+	void stop_workers();
+
+public:
+	master(server& s);
+
+	void run();
+};
+
+}
+
+#endif /* __BLIZZARD_MASTER_HPP__ */
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "mem_arena.hpp"
+
+/* all blocks' payloads start at this offset, so that any alignment up to 16 costs no padding at the block start */
+#define BLOCK_HEADER_SZ ((sizeof(block) + 15) & ~(size_t) 15)
+
+#define block_data(b) ((uint8_t *)(b) + BLOCK_HEADER_SZ)
+
+static pthread_mutex_t blocks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void* free_blocks = 0;
+static uint32_t free_blocks_num = 0;
+static uint32_t blocks_num = 0;
+
+blizzard::mem_arena::block* blizzard::mem_arena::get_block(size_t capacity)
+{
+	block* b = 0;
+
+	if (BLOCK_SIZE == capacity)
+	{
+		pthread_mutex_lock(&blocks_mutex);
+
+		if (free_blocks)
+		{
+			b = (block*) free_blocks;
+			free_blocks = b->next;
+			free_blocks_num--;
+		}
+
+		pthread_mutex_unlock(&blocks_mutex);
+	}
+
+	if (0 == b)
+	{
+		b = (block*) malloc(BLOCK_HEADER_SZ + capacity);
+
+		if (0 == b)
+		{
+			return 0;
+		}
+
+		b->capacity = capacity;
+
+		__sync_fetch_and_add(&blocks_num, 1);
+	}
+
+	b->next = 0;
+
+	return b;
+}
+
+void blizzard::mem_arena::put_block(block* b)
+{
+	/* oversized blocks are not worth keeping around */
+	if (BLOCK_SIZE == b->capacity)
+	{
+		pthread_mutex_lock(&blocks_mutex);
+
+		if (free_blocks_num < MAX_POOLED_BLOCKS)
+		{
+			b->next = (block*) free_blocks;
+			free_blocks = b;
+			free_blocks_num++;
+			b = 0;
+		}
+
+		pthread_mutex_unlock(&blocks_mutex);
+	}
+
+	if (b)
+	{
+		free(b);
+
+		__sync_fetch_and_sub(&blocks_num, 1);
+	}
+}
+
+blizzard::mem_arena::mem_arena() : head(0), offset(0), used(0)
+{
+}
+
+blizzard::mem_arena::~mem_arena()
+{
+	reset();
+}
+
+void* blizzard::mem_arena::allocate(size_t sz, size_t align)
+{
+	if (0 == align || 0 != (align & (align - 1)))
+	{
+		align = sizeof(void*);
+	}
+
+	if (head)
+	{
+		uintptr_t begin = (uintptr_t) block_data(head);
+		uintptr_t p = (begin + offset + align - 1) & ~(uintptr_t) (align - 1);
+
+		if (p + sz <= begin + head->capacity)
+		{
+			used += p + sz - (begin + offset);
+			offset = p + sz - begin;
+
+			return (void*) p;
+		}
+	}
+
+	size_t capacity = BLOCK_SIZE;
+
+	if (sz + align > capacity)
+	{
+		capacity = sz + align;
+	}
+
+	block* b = get_block(capacity);
+
+	if (0 == b)
+	{
+		return 0;
+	}
+
+	b->next = head;
+	head = b;
+
+	uintptr_t begin = (uintptr_t) block_data(head);
+	uintptr_t p = (begin + align - 1) & ~(uintptr_t) (align - 1);
+
+	used += p + sz - begin;
+	offset = p + sz - begin;
+
+	return (void*) p;
+}
+
+void blizzard::mem_arena::reset()
+{
+	while (head)
+	{
+		block* b = head;
+		head = b->next;
+
+		put_block(b);
+	}
+
+	offset = 0;
+	used = 0;
+}
+
+size_t blizzard::mem_arena::bytes_used() const
+{
+	return used;
+}
+
+uint32_t blizzard::mem_arena::allocated_blocks()
+{
+	return blocks_num;
+}
+
+uint32_t blizzard::mem_arena::pooled_blocks()
+{
+	return free_blocks_num;
+}
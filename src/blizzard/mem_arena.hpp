@@ -0,0 +1,48 @@
+#ifndef __BLIZZARD_MEM_ARENA_HPP__
+#define __BLIZZARD_MEM_ARENA_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace blizzard {
+
+/* Bump allocator for per-request temporary objects.
+ * Memory is never freed piecemeal: the whole arena is dropped by reset(),
+ * and its blocks go back to the process-wide block pool for the next request. */
+
+class mem_arena
+{
+public:
+	enum {BLOCK_SIZE = 65536};
+	enum {MAX_POOLED_BLOCKS = 4096};
+
+private:
+	struct block
+	{
+		block* next;
+		size_t capacity;
+	};
+
+	block* head;
+	size_t offset;
+	size_t used;
+
+	static block* get_block(size_t capacity);
+	static void put_block(block* b);
+
+public:
+	mem_arena();
+	~mem_arena();
+
+	void* allocate(size_t sz, size_t align);
+	void reset();
+
+	size_t bytes_used() const;
+
+	static uint32_t allocated_blocks();
+	static uint32_t pooled_blocks();
+};
+
+}
+
+#endif /* __BLIZZARD_MEM_ARENA_HPP__ */
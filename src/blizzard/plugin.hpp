@@ -1,13 +1,19 @@
 #ifndef __BLIZZARD_PLUGIN_HPP__
 #define __BLIZZARD_PLUGIN_HPP__
 
+#include <new>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 
-#define BLZ_VERSION "0.3.3" /* major.minor.patch[.quickfix] */
-#define BLZ_VERSION_BINARY (0 << 24) + (3 << 16) + (3 << 8) + 0
+#define BLZ_VERSION "0.4.0" /* major.minor.patch[.quickfix] */
+#define BLZ_VERSION_BINARY ((0 << 24) + (4 << 16) + (0 << 8) + 0)
+
+/* plugins are called through the vtables below, a plugin built with another major.minor
+ * is refused */
+#define BLZ_VERSION_ABI(v) ((v) >> 16)
 
 #define BLZ_METHOD_UNDEF   0
 #define BLZ_METHOD_GET     1
@@ -38,12 +44,86 @@ struct blz_task
 	virtual void             set_response_status(int) = 0;
 	virtual void             add_response_header(const char* name, const char* data) = 0;
 	virtual void             add_response_buffer(const char* data, size_t sz) = 0;
+
+	/* memory from alloc() lives until the response is sent, there is no need to free it */
+	virtual void*            alloc(size_t sz, size_t align = sizeof(void*)) = 0;
+
+	/* keep the response in server's cache for ttl_ms (0 means <cache:ttl> from config) */
+	virtual void             set_cache_ttl(int ttl_ms) = 0;
+
+	/* entity tag of the response, "If-None-Match" requests are answered with 304 by server */
+	virtual void             set_response_etag(const char* etag) = 0;
+};
+
+/* STL allocator on top of blz_task::alloc(), e.g.
+ * std::vector<int, blz_allocator<int> > v(blz_allocator<int>(task)); */
+
+template <typename T>
+struct blz_allocator
+{
+	typedef T         value_type;
+	typedef T*        pointer;
+	typedef const T*  const_pointer;
+	typedef T&        reference;
+	typedef const T&  const_reference;
+	typedef size_t    size_type;
+	typedef ptrdiff_t difference_type;
+
+	template <typename U> struct rebind { typedef blz_allocator<U> other; };
+
+	blz_task* task;
+
+	explicit blz_allocator(blz_task* t) : task(t) {}
+	template <typename U> blz_allocator(const blz_allocator<U>& a) : task(a.task) {}
+
+	pointer       address(reference x) const { return &x; }
+	const_pointer address(const_reference x) const { return &x; }
+
+	pointer allocate(size_type n, const void* = 0)
+	{
+		void* p = task->alloc(n * sizeof(T), __alignof__(T));
+		if (0 == p) throw std::bad_alloc();
+		return static_cast<pointer>(p);
+	}
+
+	void deallocate(pointer, size_type) {}
+
+	size_type max_size() const { return (size_t) -1 / sizeof(T); }
+
+	void construct(pointer p, const T& v) { new ((void*) p) T(v); }
+	void destroy(pointer p) { p->~T(); }
 };
 
+template <typename T, typename U>
+inline bool operator == (const blz_allocator<T>& a, const blz_allocator<U>& b) { return a.task == b.task; }
+
+template <typename T, typename U>
+inline bool operator != (const blz_allocator<T>& a, const blz_allocator<U>& b) { return a.task != b.task; }
+
 #define BLZ_OK 0
 #define BLZ_ERROR 1
 #define BLZ_AGAIN 2
 
+/* value of a plugin metric computed at the moment of stats request (from any thread) */
+
+struct blz_metric
+{
+	virtual ~blz_metric() {}
+	virtual double value() const = 0;
+};
+
+/* registry of plugin metrics exported together with server stats (xml, json, prometheus);
+ * names are made of [a-z0-9_], registered objects must live until the plugin is deleted */
+
+struct blz_metrics
+{
+	virtual ~blz_metrics() {}
+
+	virtual void add_counter(const char* name, const char* help, const volatile uint64_t* value) = 0;
+	virtual void add_gauge(const char* name, const char* help, const volatile int64_t* value) = 0;
+	virtual void add_gauge(const char* name, const char* help, const blz_metric* value) = 0;
+};
+
 struct blz_plugin
 {
 	blz_plugin() {}
@@ -54,8 +134,28 @@ struct blz_plugin
 	virtual int hard(blz_task* tsk) = 0;
 	virtual int idle() { return BLZ_OK; }
 	virtual int rotate_custom_logs() { return BLZ_OK; }
+
+	/* called once after load() */
+	virtual void register_metrics(blz_metrics* metrics) {}
+
+	/* called in every easy and hard thread before its first request, and before the thread
+	 * exits or moves to the plugin reloaded by SIGHUP; with <plugin:per_thread> every thread
+	 * has its own instance made by get_plugin_instance() and load() */
+	virtual int thread_init() { return BLZ_OK; }
+	virtual void thread_fini() {}
+
+	/* called after load() before the plugin gets requests (and before the listen socket
+	 * is opened on start): caches could be filled, mapped data touched; an error stops
+	 * loading as for load() */
+	virtual int warmup() { return BLZ_OK; }
 };
 
 extern "C" blz_plugin* get_plugin_instance();
 
+/* the version of this header the module is built with, defined in every module including it */
+extern "C" __attribute__((weak, visibility("default"))) int blz_plugin_version()
+{
+	return BLZ_VERSION_BINARY;
+}
+
 #endif /* __BLIZZARD_PLUGIN_HPP__ */
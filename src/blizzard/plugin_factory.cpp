@@ -1,36 +1,132 @@
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <coda/daemon.h>
 #include "server.hpp"
 
+enum {DRAIN_POLL_MS = 10};
+
+blizzard::plugin_instance::plugin_instance()
+	: module(NULL)
+	, plugin(NULL)
+	, get(NULL)
+	, generation(0)
+	, refs(0)
+{
+}
+
 blizzard::plugin_factory::plugin_factory()
-	: loaded_module(NULL)
-	, plugin_handle(NULL)
+	: current(NULL)
+	, generations(0)
 {
+	pthread_mutex_init(&mutex, 0);
 }
 
 blizzard::plugin_factory::~plugin_factory()
 {
 	stop_module();
+
+	pthread_mutex_destroy(&mutex);
 }
 
-void blizzard::plugin_factory::load_module(const blz_config::BLZ::PLUGIN& pd)
+/* dlopen() returns the already loaded library for the same path even if the file is replaced,
+ * so a library which is in use is loaded from a private copy */
+static std::string copy_library(const std::string& path)
 {
-	if (0 == pd.easy_threads)
+	char name [] = "/tmp/blizzard-plugin-XXXXXX";
+
+	int out = mkstemp(name);
+
+	if (-1 == out)
 	{
-		return;
+		throw coda_error("can't create a copy of module %s: %s", path.c_str(), coda_strerror(errno));
 	}
 
-	if (NULL == loaded_module)
+	int in = open(path.c_str(), O_RDONLY);
+
+	if (-1 == in)
 	{
-		loaded_module = dlopen(pd.library.c_str(), RTLD_NOW | RTLD_LOCAL);
+		int err = errno;
+
+		close(out);
+		unlink(name);
 
-		if (NULL == loaded_module)
+		throw coda_error("can't open module %s: %s", path.c_str(), coda_strerror(err));
+	}
+
+	char buf [65536];
+	ssize_t n;
+
+	while (0 < (n = read(in, buf, sizeof(buf))))
+	{
+		if (n != write(out, buf, n))
 		{
-			throw coda_error("loading module %s failed: %s", pd.library.c_str(), dlerror());
+			n = -1;
+			break;
 		}
 	}
-	else
+
+	int err = errno;
+
+	close(in);
+	close(out);
+
+	if (0 > n)
 	{
-		throw coda_error("module already loaded");
+		unlink(name);
+		throw coda_error("can't copy module %s to %s: %s", path.c_str(), name, coda_strerror(err));
+	}
+
+	return name;
+}
+
+/* a module built with an older plugin.hpp has no blz_plugin_version() and lacks the slots of
+ * the vtables added since */
+static void check_version(void* module, const std::string& library)
+{
+	union conv_union
+	{
+		void* v;
+		int (*f)();
+	} conv;
+
+	conv.v = dlsym(module, "blz_plugin_version");
+
+	int version = conv.v ? (*conv.f)() : 0;
+
+	if (BLZ_VERSION_ABI(version) != BLZ_VERSION_ABI(BLZ_VERSION_BINARY))
+	{
+		dlclose(module);
+
+		if (0 == version)
+		{
+			throw coda_error("module %s is built with plugin.hpp older than 0.4, it must be rebuilt with blizzard %s", library.c_str(), BLZ_VERSION);
+		}
+
+		throw coda_error("module %s is built with plugin.hpp of blizzard %d.%d, it must be rebuilt with blizzard %s"
+			, library.c_str(), version >> 24, (version >> 16) & 0xff, BLZ_VERSION);
+	}
+}
+
+blizzard::plugin_instance* blizzard::plugin_factory::create(const blz_config::BLZ::PLUGIN& pd)
+{
+	pthread_mutex_lock(&mutex);
+	bool in_use = current && current->library == pd.library;
+	int generation = ++generations;
+	pthread_mutex_unlock(&mutex);
+
+	std::string path = in_use ? copy_library(pd.library) : pd.library;
+
+	void* module = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+	if (in_use)
+	{
+		/* the mapping stays */
+		unlink(path.c_str());
+	}
+
+	if (NULL == module)
+	{
+		throw coda_error("loading module %s failed: %s", pd.library.c_str(), dlerror());
 	}
 
 	dlerror();
@@ -41,57 +137,346 @@ void blizzard::plugin_factory::load_module(const blz_config::BLZ::PLUGIN& pd)
 		blz_plugin* (*f)();
 	} conv;
 
-	conv.v = dlsym(loaded_module, "get_plugin_instance");
+	conv.v = dlsym(module, "get_plugin_instance");
 	blz_plugin* (*func)() = conv.f;
 
 	const char* errmsg = dlerror();
 
 	if (NULL != errmsg)
 	{
+		dlclose(module);
 		throw coda_error("error searching 'get_plugin_instance' in module %s: %s", pd.library.c_str(), errmsg);
 	}
 
-	plugin_handle = (*func)();
+	check_version(module, pd.library);
+
+	plugin_instance* inst = new plugin_instance;
+
+	inst->module = module;
+	inst->get = func;
+	inst->params = pd.params;
+	inst->library = pd.library;
+	inst->generation = generation;
+	inst->plugin = (*func)();
 
-	if (NULL == plugin_handle)
+	if (NULL == inst->plugin)
 	{
+		destroy(inst, true);
 		throw coda_error("module %s: instance of plugin is not created", pd.library.c_str());
 	}
 
-	if (BLZ_OK != plugin_handle->load(pd.params.c_str()))
+	if (BLZ_OK != inst->plugin->load(pd.params.c_str()))
 	{
-		delete plugin_handle;
-		plugin_handle = NULL;
+		destroy(inst, true);
 		throw coda_error("module init failed");
 	}
+
+	inst->plugin->register_metrics(&inst->metrics);
+
+	if (BLZ_OK != inst->plugin->warmup())
+	{
+		destroy(inst, true);
+		throw coda_error("module %s: warmup() failed", pd.library.c_str());
+	}
+
+	return inst;
 }
 
-void blizzard::plugin_factory::stop_module()
+void blizzard::plugin_factory::destroy(plugin_instance* inst, bool unload)
 {
-	if (plugin_handle)
+	inst->metrics.clear();
+
+	delete inst->plugin;
+
+	if (unload)
 	{
-		delete plugin_handle;
-		plugin_handle = NULL;
+		dlclose(inst->module);
 	}
 
-	if (loaded_module)
+	delete inst;
+}
+
+void blizzard::plugin_factory::load_module(const blz_config::BLZ::PLUGIN& pd)
+{
+	if (0 == pd.easy_threads)
+	{
+		return;
+	}
+
+	if (NULL != current)
+	{
+		throw coda_error("module already loaded");
+	}
+
+	plugin_instance* inst = create(pd);
+
+	pthread_mutex_lock(&mutex);
+	current = inst;
+	pthread_mutex_unlock(&mutex);
+}
+
+void blizzard::plugin_factory::stop_module()
+{
+	pthread_mutex_lock(&mutex);
+	plugin_instance* inst = current;
+	current = NULL;
+	pthread_mutex_unlock(&mutex);
+
+	if (inst)
 	{
 		//FIXME: valgrind looses symbol names if we close the library
-		//dlclose(loaded_module);
-		loaded_module = NULL;
+		destroy(inst, false);
+	}
+
+	for (size_t i = 0; i < retired.size(); i++)
+	{
+		destroy(retired[i], false);
+	}
+
+	retired.clear();
+}
+
+blizzard::plugin_instance* blizzard::plugin_factory::replace(plugin_instance* inst)
+{
+	pthread_mutex_lock(&mutex);
+	plugin_instance* old = current;
+	current = inst;
+	pthread_mutex_unlock(&mutex);
+
+	return old;
+}
+
+bool blizzard::plugin_factory::drain(plugin_instance* old)
+{
+	while (old->refs && 0 == coda_terminate)
+	{
+		coda_msleep(DRAIN_POLL_MS);
+	}
+
+	if (old->refs)
+	{
+		/* worker threads could still be in the plugin */
+		pthread_mutex_lock(&mutex);
+		retired.push_back(old);
+		pthread_mutex_unlock(&mutex);
+
+		return false;
+	}
+
+	/* reloaded libraries are unloaded, or every reload would leave a copy in memory */
+	destroy(old, true);
+
+	return true;
+}
+
+blizzard::plugin_instance* blizzard::plugin_factory::acquire() const
+{
+	pthread_mutex_lock(&mutex);
+
+	plugin_instance* inst = current;
+
+	if (inst)
+	{
+		__sync_add_and_fetch(&inst->refs, 1);
 	}
+
+	pthread_mutex_unlock(&mutex);
+
+	return inst;
+}
+
+void blizzard::plugin_factory::release(plugin_instance* inst)
+{
+	__sync_sub_and_fetch(&inst->refs, 1);
+}
+
+int blizzard::plugin_factory::current_generation() const
+{
+	pthread_mutex_lock(&mutex);
+	int generation = current ? current->generation : 0;
+	pthread_mutex_unlock(&mutex);
+
+	return generation;
 }
 
+bool blizzard::plugin_factory::is_current(const plugin_instance* inst) const
+{
+	pthread_mutex_lock(&mutex);
+	bool res = current == inst;
+	pthread_mutex_unlock(&mutex);
+
+	return res;
+}
+
+/* not safe with reloads, for the code which doesn't do them */
 blz_plugin* blizzard::plugin_factory::open_plugin() const
 {
-	return plugin_handle;
+	return current ? current->plugin : NULL;
 }
 
 void blizzard::plugin_factory::idle()
 {
-	if (plugin_handle)
+	plugin_instance* inst = acquire();
+
+	if (inst)
+	{
+		inst->plugin->idle();
+		release(inst);
+	}
+}
+
+blizzard::thread_plugin::thread_plugin(bool per_thread_)
+	: inst(NULL)
+	, plugin(NULL)
+	, next_inst(NULL)
+	, next_plugin(NULL)
+	, per_thread(per_thread_)
+{
+}
+
+blizzard::thread_plugin::~thread_plugin()
+{
+	reset();
+	discard();
+}
+
+blz_plugin* blizzard::thread_plugin::make(plugin_instance* of)
+{
+	blz_plugin* p = of->plugin;
+
+	if (per_thread)
 	{
-		plugin_handle->idle();
+		p = (*of->get)();
+
+		if (NULL == p)
+		{
+			log_error("module %s: instance of plugin for thread is not created", of->library.c_str());
+			return NULL;
+		}
+
+		if (BLZ_OK != p->load(of->params.c_str()) || BLZ_OK != p->warmup())
+		{
+			log_error("module %s: init of plugin for thread failed", of->library.c_str());
+			delete p;
+			return NULL;
+		}
 	}
+
+	if (BLZ_OK != p->thread_init())
+	{
+		log_error("module %s: thread_init() failed", of->library.c_str());
+
+		if (per_thread)
+		{
+			delete p;
+		}
+
+		return NULL;
+	}
+
+	return p;
 }
 
+blz_plugin* blizzard::thread_plugin::get(plugin_instance* of)
+{
+	if (of == inst)
+	{
+		return plugin;
+	}
+
+	reset();
+
+	if (NULL == of)
+	{
+		return NULL;
+	}
+
+	/* the prepared plugin, its reference moves along */
+	if (of == next_inst)
+	{
+		inst = next_inst;
+		plugin = next_plugin;
+
+		next_inst = NULL;
+		next_plugin = NULL;
+
+		return plugin;
+	}
+
+	/* kept even if the instance fails, the thread doesn't try again until the next reload */
+	__sync_add_and_fetch(&of->refs, 1);
+	inst = of;
+
+	plugin = make(of);
+
+	return plugin;
+}
+
+const blizzard::plugin_instance* blizzard::thread_plugin::held() const
+{
+	return inst;
+}
+
+bool blizzard::thread_plugin::prepare(plugin_instance* of)
+{
+	discard();
+
+	__sync_add_and_fetch(&of->refs, 1);
+	next_inst = of;
+
+	next_plugin = make(of);
+
+	return NULL != next_plugin;
+}
+
+const blizzard::plugin_instance* blizzard::thread_plugin::prepared() const
+{
+	return next_inst;
+}
+
+blz_plugin* blizzard::thread_plugin::prepared_plugin() const
+{
+	return next_plugin;
+}
+
+void blizzard::thread_plugin::reset()
+{
+	if (plugin)
+	{
+		plugin->thread_fini();
+
+		if (per_thread)
+		{
+			delete plugin;
+		}
+
+		plugin = NULL;
+	}
+
+	if (inst)
+	{
+		plugin_factory::release(inst);
+		inst = NULL;
+	}
+}
+
+void blizzard::thread_plugin::discard()
+{
+	if (next_plugin)
+	{
+		next_plugin->thread_fini();
+
+		if (per_thread)
+		{
+			delete next_plugin;
+		}
+
+		next_plugin = NULL;
+	}
+
+	if (next_inst)
+	{
+		plugin_factory::release(next_inst);
+		next_inst = NULL;
+	}
+}
@@ -2,15 +2,84 @@
 #define __BLIZZARD_PLUGIN_FACTORY_HPP__
 
 #include <pthread.h>
+#include <string>
+#include <vector>
 #include "config.hpp"
 #include "plugin.hpp"
+#include "plugin_metrics.hpp"
 
 namespace blizzard {
 
+/* A loaded plugin: every request holds a reference to the instance which started processing
+ * it, so that after a reload the old instance finishes its requests and is deleted when the
+ * last one is done. */
+
+struct plugin_instance
+{
+	void* module;
+	blz_plugin* plugin;
+	plugin_metrics metrics;
+
+	/* get_plugin_instance() of the module and load() params, for instances of threads */
+	blz_plugin* (*get)();
+	std::string params;
+
+	std::string library;
+	int generation;
+	volatile int refs;
+
+	plugin_instance();
+};
+
+/* The plugin of an easy or hard thread: the shared instance or, with <plugin:per_thread>, an
+ * own one created in the thread, with thread_init() called. The thread holds a reference to
+ * the instance it was made of and moves to the instance of a request, so a reloaded plugin is
+ * deleted after its threads leave it. On start and reload the plugin of the next instance is
+ * prepared in the thread before the instance serves, the thread moves to it later. */
+
+class thread_plugin
+{
+	plugin_instance* inst;
+	blz_plugin* plugin;
+
+	plugin_instance* next_inst;
+	blz_plugin* next_plugin;
+
+	bool per_thread;
+
+	blz_plugin* make(plugin_instance* of);
+
+public:
+	thread_plugin(bool per_thread_);
+	~thread_plugin();
+
+	/* 0 if the instance of the thread can't be created or its thread_init() fails */
+	blz_plugin* get(plugin_instance* of);
+	const plugin_instance* held() const;
+
+	/* the plugin of an instance which isn't current yet, false if it can't be made; the
+	 * instance is kept as prepared anyway, so the thread doesn't try again */
+	bool prepare(plugin_instance* of);
+	const plugin_instance* prepared() const;
+	blz_plugin* prepared_plugin() const;
+
+	/* thread_fini(), the own instance is deleted */
+	void reset();
+
+	/* the same for the prepared plugin of a reload which failed */
+	void discard();
+};
+
 class plugin_factory
 {
-	void* loaded_module;
-	blz_plugin* plugin_handle;
+	plugin_instance* current;
+	int generations;
+	mutable pthread_mutex_t mutex;
+
+	/* replaced instances left at shutdown with requests, deleted by stop_module() */
+	std::vector<plugin_instance*> retired;
+
+	static void destroy(plugin_instance* inst, bool unload);
 
 public:
 	plugin_factory();
@@ -21,6 +90,22 @@ public:
 	void load_module(const blz_config::BLZ::PLUGIN& pd);
 	void stop_module();
 	void idle();
+
+	/* the current instance, the reference is given back by release() */
+	plugin_instance* acquire() const;
+	static void release(plugin_instance* inst);
+
+	int current_generation() const;
+	bool is_current(const plugin_instance* inst) const;
+
+	/* Start and hot reload: the new instance is loaded (and its load() is called) in the
+	 * calling thread while the current one, if any, keeps serving, then the new one becomes
+	 * current. The old one is deleted when its requests are finished, drain() waits for this
+	 * and gives up (false) on termination. create() throws coda_error. */
+
+	plugin_instance* create(const blz_config::BLZ::PLUGIN& pd);
+	plugin_instance* replace(plugin_instance* inst);
+	bool drain(plugin_instance* old);
 };
 
 }
@@ -0,0 +1,130 @@
+#include <coda/error.hpp>
+#include "plugin_metrics.hpp"
+
+blizzard::plugin_metrics::plugin_metrics()
+{
+	pthread_mutex_init(&mutex, 0);
+}
+
+blizzard::plugin_metrics::~plugin_metrics()
+{
+	pthread_mutex_destroy(&mutex);
+}
+
+void blizzard::plugin_metrics::clear()
+{
+	pthread_mutex_lock(&mutex);
+	entries.clear();
+	pthread_mutex_unlock(&mutex);
+}
+
+bool blizzard::plugin_metrics::empty() const
+{
+	pthread_mutex_lock(&mutex);
+	bool res = entries.empty();
+	pthread_mutex_unlock(&mutex);
+
+	return res;
+}
+
+void blizzard::plugin_metrics::add(const char *name, const char *help, entry &e)
+{
+	if (0 == name || 0 == *name)
+	{
+		throw coda_error("plugin metric without name");
+	}
+
+	for (const char *p = name; *p; p++)
+	{
+		if (!(('a' <= *p && *p <= 'z') || ('0' <= *p && *p <= '9') || '_' == *p))
+		{
+			throw coda_error("plugin metric '%s': name is not [a-z0-9_]", name);
+		}
+	}
+
+	e.name = name;
+	e.help = help ? help : "";
+
+	pthread_mutex_lock(&mutex);
+
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (entries[i].name == e.name)
+		{
+			pthread_mutex_unlock(&mutex);
+			throw coda_error("plugin metric '%s' is registered twice", name);
+		}
+	}
+
+	entries.push_back(e);
+
+	pthread_mutex_unlock(&mutex);
+}
+
+void blizzard::plugin_metrics::add_counter(const char *name, const char *help, const volatile uint64_t *value)
+{
+	entry e;
+	e.src = SOURCE_COUNTER;
+	e.counter = value;
+	e.gauge = 0;
+	e.metric = 0;
+
+	add(name, help, e);
+}
+
+void blizzard::plugin_metrics::add_gauge(const char *name, const char *help, const volatile int64_t *value)
+{
+	entry e;
+	e.src = SOURCE_GAUGE;
+	e.counter = 0;
+	e.gauge = value;
+	e.metric = 0;
+
+	add(name, help, e);
+}
+
+void blizzard::plugin_metrics::add_gauge(const char *name, const char *help, const blz_metric *value)
+{
+	entry e;
+	e.src = SOURCE_METRIC;
+	e.counter = 0;
+	e.gauge = 0;
+	e.metric = value;
+
+	add(name, help, e);
+}
+
+void blizzard::plugin_metrics::format(stats_formatter &f) const
+{
+	pthread_mutex_lock(&mutex);
+
+	if (!entries.empty())
+	{
+		f.open("plugin");
+
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			const entry &e = entries[i];
+			const char *help = e.help.empty() ? 0 : e.help.c_str();
+
+			switch (e.src)
+			{
+			case SOURCE_COUNTER:
+				f.integer(e.name.c_str(), stats_formatter::COUNTER, *e.counter, help);
+				break;
+
+			case SOURCE_GAUGE:
+				f.real(e.name.c_str(), stats_formatter::GAUGE, (double) *e.gauge, 0, help);
+				break;
+
+			case SOURCE_METRIC:
+				f.real(e.name.c_str(), stats_formatter::GAUGE, e.metric->value(), 6, help);
+				break;
+			}
+		}
+
+		f.close();
+	}
+
+	pthread_mutex_unlock(&mutex);
+}
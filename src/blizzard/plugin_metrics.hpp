@@ -0,0 +1,54 @@
+#ifndef __BLIZZARD_PLUGIN_METRICS_HPP__
+#define __BLIZZARD_PLUGIN_METRICS_HPP__
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "plugin.hpp"
+#include "stats_format.hpp"
+
+namespace blizzard {
+
+/* metrics registered by plugin in blz_plugin::register_metrics(), exported in the <plugin> group of stats */
+
+class plugin_metrics : public blz_metrics
+{
+	enum source
+	{
+		SOURCE_COUNTER,
+		SOURCE_GAUGE,
+		SOURCE_METRIC
+	};
+
+	struct entry
+	{
+		std::string name;
+		std::string help;
+		int src;
+		const volatile uint64_t *counter;
+		const volatile int64_t *gauge;
+		const blz_metric *metric;
+	};
+
+	std::vector<entry> entries;
+	mutable pthread_mutex_t mutex;
+
+	void add(const char *name, const char *help, entry &e);
+
+public:
+	plugin_metrics();
+	~plugin_metrics();
+
+	void clear();
+	bool empty() const;
+
+	void add_counter(const char *name, const char *help, const volatile uint64_t *value);
+	void add_gauge(const char *name, const char *help, const volatile int64_t *value);
+	void add_gauge(const char *name, const char *help, const blz_metric *value);
+
+	void format(stats_formatter &f) const;
+};
+
+}
+
+#endif /* __BLIZZARD_PLUGIN_METRICS_HPP__ */
@@ -1,6 +1,7 @@
 #ifndef __BLIZZARD_POOL_HPP__
 #define __BLIZZARD_POOL_HPP__
 
+#include <stdint.h>
 #include <sys/types.h>
 #include "pool_stack.hpp"
 
@@ -1,6 +1,9 @@
 #ifndef __BLIZZARD_POOL_STACK_HPP__
 #define __BLIZZARD_POOL_STACK_HPP__
 
+#include <stddef.h>
+#include <string.h>
+
 namespace pool_ns {
 
 template <typename _DATA>
@@ -0,0 +1,39 @@
+#ifndef __BLIZZARD_PROBES_HPP__
+#define __BLIZZARD_PROBES_HPP__
+
+/* USDT probes of the request lifecycle (provider "blizzard") for perf and bpftrace.
+ * A probe is a single nop in the code until a tracer attaches to it; without <sys/sdt.h>
+ * the macros expand to nothing. Timestamps are monotonic_usec() values of http::times.
+ *
+ *   accept       (fd, accepted)
+ *   parse_done   (fd, accepted, parsed)
+ *   easy_push    (fd, easy_push)
+ *   easy_pop     (fd, easy_push, easy_pop)
+ *   plugin_enter (fd, "easy" | "hard", enter)
+ *   plugin_exit  (fd, "easy" | "hard", enter, exit, result)
+ *   hard_push    (fd, hard_push)
+ *   hard_pop     (fd, hard_push, hard_pop)
+ *   done_push    (fd, done_push)
+ *   write_done   (fd, accepted, written, status)
+ *   close        (fd, accepted)
+ */
+
+#ifdef BLZ_WITH_USDT
+
+#include <sys/sdt.h>
+
+#define BLZ_PROBE2(name, a1, a2)                 DTRACE_PROBE2(blizzard, name, a1, a2)
+#define BLZ_PROBE3(name, a1, a2, a3)             DTRACE_PROBE3(blizzard, name, a1, a2, a3)
+#define BLZ_PROBE4(name, a1, a2, a3, a4)         DTRACE_PROBE4(blizzard, name, a1, a2, a3, a4)
+#define BLZ_PROBE5(name, a1, a2, a3, a4, a5)     DTRACE_PROBE5(blizzard, name, a1, a2, a3, a4, a5)
+
+#else
+
+#define BLZ_PROBE2(name, a1, a2)                 do {} while (0)
+#define BLZ_PROBE3(name, a1, a2, a3)             do {} while (0)
+#define BLZ_PROBE4(name, a1, a2, a3, a4)         do {} while (0)
+#define BLZ_PROBE5(name, a1, a2, a3, a4, a5)     do {} while (0)
+
+#endif
+
+#endif /* __BLIZZARD_PROBES_HPP__ */
@@ -0,0 +1,151 @@
+#include <string.h>
+#include "response_cache.hpp"
+#include "server.hpp"
+
+size_t blizzard::response_cache::entry::size() const
+{
+	/* strings are counted twice: in the list and in the index */
+	return 2 * key.size() + headers.size() + body.size() + etag.size() + sizeof(entry);
+}
+
+blizzard::response_cache::response_cache()
+	: max_size(0)
+	, cur_size(0)
+	, default_ttl(0)
+{
+}
+
+void blizzard::response_cache::init(const blz_config::BLZ::CACHE& cfg)
+{
+	clear();
+
+	max_size = (size_t) cfg.max_size << 20;
+	default_ttl = cfg.ttl / (double) 1000;
+
+	key_headers.clear();
+
+	const char *delims = " \t,;";
+	const char *p = cfg.headers.c_str();
+
+	while (*p)
+	{
+		p += strspn(p, delims);
+		size_t len = strcspn(p, delims);
+
+		if (len)
+		{
+			key_headers.push_back(std::string(p, len));
+		}
+
+		p += len;
+	}
+}
+
+void blizzard::response_cache::clear()
+{
+	entries.clear();
+	index.clear();
+
+	cur_size = 0;
+}
+
+bool blizzard::response_cache::enabled() const
+{
+	return 0 != max_size;
+}
+
+const std::vector<std::string>& blizzard::response_cache::get_key_headers() const
+{
+	return key_headers;
+}
+
+void blizzard::response_cache::erase(entries_index::iterator it)
+{
+	cur_size -= it->second->size();
+
+	entries.erase(it->second);
+	index.erase(it);
+}
+
+bool blizzard::response_cache::lookup(http* con, double now)
+{
+	if (!enabled() || !con->is_cacheable_request())
+	{
+		return false;
+	}
+
+	con->get_cache_key(key_buf, key_headers);
+
+	entries_index::iterator it = index.find(key_buf);
+
+	if (it == index.end())
+	{
+		stats.report_cache_lookup(false);
+		return false;
+	}
+
+	if (it->second->expire_time <= now)
+	{
+		erase(it);
+		stats.report_cache_size(index.size(), cur_size);
+
+		stats.report_cache_lookup(false);
+		return false;
+	}
+
+	/* move to the head of LRU list */
+	entries.splice(entries.begin(), entries, it->second);
+
+	const entry& e = *it->second;
+	con->set_response(e.status, e.headers, e.body, e.etag);
+
+	stats.report_cache_lookup(true);
+	return true;
+}
+
+void blizzard::response_cache::store(http* con, double now)
+{
+	int ttl_ms = con->get_cache_ttl();
+
+	if (!enabled() || 0 > ttl_ms || !con->is_cacheable_request() || 500 <= con->get_response_status())
+	{
+		return;
+	}
+
+	con->get_cache_key(key_buf, key_headers);
+
+	entries_index::iterator it = index.find(key_buf);
+
+	if (it != index.end())
+	{
+		erase(it);
+	}
+
+	entries.push_front(entry());
+
+	entry& e = entries.front();
+	e.key = key_buf;
+	e.status = con->get_response_status();
+	e.expire_time = now + (ttl_ms ? ttl_ms / (double) 1000 : default_ttl);
+	con->get_response(e.headers, e.body);
+	e.etag = con->get_response_etag();
+
+	size_t sz = e.size();
+
+	if (sz > max_size)
+	{
+		entries.pop_front();
+		return;
+	}
+
+	index[e.key] = entries.begin();
+	cur_size += sz;
+
+	while (cur_size > max_size)
+	{
+		erase(index.find(entries.back().key));
+		stats.report_cache_eviction();
+	}
+
+	stats.report_cache_size(index.size(), cur_size);
+}
@@ -0,0 +1,63 @@
+#ifndef __BLIZZARD_RESPONSE_CACHE_HPP__
+#define __BLIZZARD_RESPONSE_CACHE_HPP__
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include "config.hpp"
+
+namespace blizzard {
+
+struct http;
+
+/* LRU cache of plugin responses, it is touched only from the event thread, so there is no locking */
+
+class response_cache
+{
+	struct entry
+	{
+		std::string key;
+		std::string headers;
+		std::string body;
+		std::string etag;
+
+		int status;
+		double expire_time;
+
+		size_t size() const;
+	};
+
+	typedef std::list<entry> entries_list;
+	typedef std::map<std::string, entries_list::iterator> entries_index;
+
+	entries_list entries;
+	entries_index index;
+
+	std::vector<std::string> key_headers;
+
+	size_t max_size;
+	size_t cur_size;
+	double default_ttl;
+
+	std::string key_buf;
+
+	void erase(entries_index::iterator it);
+
+public:
+	response_cache();
+
+	void init(const blz_config::BLZ::CACHE& cfg);
+	void clear();
+
+	bool enabled() const;
+
+	const std::vector<std::string>& get_key_headers() const;
+
+	bool lookup(http* con, double now);
+	void store(http* con, double now);
+};
+
+}
+
+#endif /* __BLIZZARD_RESPONSE_CACHE_HPP__ */
@@ -0,0 +1,512 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <vector>
+#include <coda/logger.h>
+#include "http.hpp"
+#include "rpc.hpp"
+#include "server.hpp"
+
+static uint16_t get_u16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+blizzard::rpc_session::rpc_session(server *s, http *c)
+	: srv(s)
+	, con(c)
+	, fd(c->get_fd())
+	, out_pos(0)
+	, requests(0)
+	, handling(0)
+	, max_requests(s->config.blz.rpc.max_requests)
+	, max_request_size(s->config.blz.rpc.max_request_size)
+	, eof(false)
+	, going_away(false)
+	, closed(false)
+{
+	stats.report_rpc_connection();
+}
+
+/* a connection with as many requests in progress as it may have, or with the responses not read
+ * by the client, waits before taking new ones */
+bool blizzard::rpc_session::accepting() const
+{
+	return !going_away && handling < max_requests && out.size() - out_pos < OUT_BUF_SZ;
+}
+
+bool blizzard::rpc_session::read_input()
+{
+	char buf[READ_SZ];
+	bool got = false;
+
+	while (!eof && accepting() && in.size() <= max_request_size)
+	{
+		ssize_t rd = read(fd, buf, sizeof(buf));
+
+		if (0 < rd)
+		{
+			in.append(buf, rd);
+			got = true;
+			continue;
+		}
+
+		if (0 == rd)
+		{
+			eof = true;
+			break;
+		}
+
+		if (EINTR == errno)
+		{
+			continue;
+		}
+
+		if (EAGAIN != errno && EWOULDBLOCK != errno)
+		{
+			return false;
+		}
+
+		break;
+	}
+
+	/* a connection is closed after <connection_timeout> of silence */
+	if (got)
+	{
+		ev_timer_again(srv->loop, &con->e.watcher_timeout);
+	}
+
+	return true;
+}
+
+bool blizzard::rpc_session::handle_frames()
+{
+	size_t pos = 0;
+	bool ok = true;
+
+	while (ok && accepting() && in.size() - pos >= 4)
+	{
+		const uint8_t *p = (const uint8_t *) in.data() + pos;
+
+		size_t size = get_u32(p);
+
+		if (size < REQUEST_HEADER_SZ - 4 || size > max_request_size)
+		{
+			log_warn("rpc: bad request size %zu on fd %d, closing the connection", size, fd);
+			stats.report_rpc_error();
+
+			ok = false;
+			break;
+		}
+
+		if (in.size() - pos < 4 + size)
+		{
+			break;
+		}
+
+		ok = handle_frame(get_u32(p + 4), p + 8, size - 4);
+
+		pos += 4 + size;
+	}
+
+	in.erase(0, pos);
+
+	return ok;
+}
+
+bool blizzard::rpc_session::handle_frame(uint32_t id, const uint8_t *p, size_t len)
+{
+	int method = p[0];
+	int flags = p[1];
+	size_t path_len = get_u16(p + 2);
+	size_t params_len = get_u16(p + 4);
+	size_t headers_len = get_u16(p + 6);
+
+	len -= REQUEST_HEADER_SZ - 8;
+	p += REQUEST_HEADER_SZ - 8;
+
+	if (0 != flags || 0 == path_len || path_len + params_len + headers_len > len)
+	{
+		log_warn("rpc: bad request %u on fd %d, closing the connection", id, fd);
+		stats.report_rpc_error();
+
+		return false;
+	}
+
+	http *task = srv->http_pool.allocate();
+	task->init(-1, con->in_ip);
+
+	task->listener = con->listener;
+	task->session_conn = con;
+	task->stream_id = id;
+	task->server_loop = srv->loop;
+	task->response_time = ev_now(srv->loop);
+	task->times.accepted = monotonic_usec();
+
+	/* the plugin, the logs and the capture see a request of HTTP/1.1 */
+	task->protocol_major = 1;
+	task->protocol_minor = 1;
+
+	stats.report_rpc_request();
+
+	int status = 0;
+
+	if (!set_request(task, method, p, path_len, params_len, headers_len, len - path_len - params_len - headers_len))
+	{
+		status = 400;
+	}
+	else if (BLZ_METHOD_UNDEF == task->method)
+	{
+		status = 501;
+	}
+
+	task->state_ = http::sReadyToHandle;
+	link_request(task);
+
+	if (status)
+	{
+		task->set_response_status(status);
+		task->times.done_pop = monotonic_usec();
+
+		respond(task);
+		return true;
+	}
+
+	srv->handle_request(task);
+
+	return true;
+}
+
+bool blizzard::rpc_session::set_request(http *task, int method, const uint8_t *p, size_t path_len, size_t params_len, size_t headers_len, size_t body_len)
+{
+	const char *path = (const char *) p;
+	const char *params = path + path_len;
+	const char *h = params + params_len;
+	const char *end = h + headers_len;
+
+	task->method = BLZ_METHOD_GET <= method && method <= BLZ_METHOD_OPTIONS ? method : BLZ_METHOD_UNDEF;
+
+	if (0 == (task->uri_path = task->store_string(path, path_len)) || 0 == (task->uri_params = task->store_string(params, params_len)))
+	{
+		return false;
+	}
+
+	/* "Name: value\r\n" lines as in HTTP/1 */
+	while (h < end)
+	{
+		const char *eol = (const char *) memchr(h, '\n', end - h);
+		const char *next = eol ? eol + 1 : end;
+
+		if (0 == eol)
+		{
+			eol = end;
+		}
+
+		if (h < eol && '\r' == eol[-1])
+		{
+			eol--;
+		}
+
+		const char *colon = (const char *) memchr(h, ':', eol - h);
+
+		if (colon && colon > h)
+		{
+			const char *value = colon + 1;
+
+			while (value < eol && ' ' == *value)
+			{
+				value++;
+			}
+
+			if (!task->add_request_header(h, colon - h, value, eol - value))
+			{
+				return false;
+			}
+		}
+
+		h = next;
+	}
+
+	/* the request size in stats is of the strings kept */
+	task->in_headers.marker() = task->in_headers.get_data_size();
+
+	if (body_len)
+	{
+		task->in_post.resize(body_len);
+		task->in_post.append_data(end, body_len);
+	}
+
+	return true;
+}
+
+/* the requests in progress are listed by their conn_prev, conn_next like the connections */
+void blizzard::rpc_session::link_request(http *task)
+{
+	task->conn_prev = 0;
+	task->conn_next = requests;
+
+	if (requests)
+	{
+		requests->conn_prev = task;
+	}
+
+	requests = task;
+	handling++;
+}
+
+void blizzard::rpc_session::unlink_request(http *task)
+{
+	if (task->conn_prev)
+	{
+		task->conn_prev->conn_next = task->conn_next;
+	}
+	else
+	{
+		requests = task->conn_next;
+	}
+
+	if (task->conn_next)
+	{
+		task->conn_next->conn_prev = task->conn_prev;
+	}
+
+	handling--;
+}
+
+void blizzard::rpc_session::respond(http *task)
+{
+	unlink_request(task);
+
+	if (closed)
+	{
+		task->destroy();
+		srv->http_pool.free(task);
+
+		/* the last request releases the closed connection */
+		if (0 == handling)
+		{
+			srv->free_connection(con);
+		}
+
+		return;
+	}
+
+	write_response(task);
+
+	/* the connection is written to and takes the requests waiting from its own callback */
+	ev_feed_event(srv->loop, &con->e.watcher_send, EV_WRITE);
+}
+
+void blizzard::rpc_session::write_response(http *task)
+{
+	int status = task->response_status;
+
+	if (status >= http::http_codes_num || 0 == status)
+	{
+		status = 404;
+		task->response_status = status;
+	}
+
+	/* the header lines of the plugin are sent as they are, without those HTTP/1 adds; lines
+	 * which don't fit into the 16-bit length are dropped whole */
+	const char *headers = (const char *) task->out_headers.get_data();
+	size_t headers_len = task->out_headers.get_data_size();
+
+	if (headers_len > 0xffff)
+	{
+		headers_len = 0xffff;
+
+		while (headers_len && '\n' != headers[headers_len - 1])
+		{
+			headers_len--;
+		}
+
+		log_warn("rpc: response headers of request %u on fd %d are longer than 64 KB, %zu bytes are sent", task->stream_id, fd, headers_len);
+	}
+
+	size_t body_size = BLZ_METHOD_HEAD == task->method ? 0 : task->out_post.get_total_data_size();
+
+	uint8_t h[RESPONSE_HEADER_SZ];
+	put_u32(h, RESPONSE_HEADER_SZ - 4 + headers_len + body_size);
+	put_u32(h + 4, task->stream_id);
+	put_u16(h + 8, status);
+	put_u16(h + 10, headers_len);
+
+	out.append((const char *) h, sizeof(h));
+	out.append(headers, headers_len);
+
+	if (body_size)
+	{
+		std::vector<struct iovec> parts;
+		task->get_response_body_parts(parts);
+
+		for (size_t i = 0; i < parts.size(); i++)
+		{
+			out.append((const char *) parts[i].iov_base, parts[i].iov_len);
+		}
+	}
+
+	srv->finish_request(task);
+
+	task->destroy();
+	srv->http_pool.free(task);
+}
+
+bool blizzard::rpc_session::flush()
+{
+	while (out_pos < out.size())
+	{
+		ssize_t wr = write(fd, out.data() + out_pos, out.size() - out_pos);
+
+		if (0 <= wr)
+		{
+			out_pos += wr;
+			continue;
+		}
+
+		if (EINTR == errno)
+		{
+			continue;
+		}
+
+		if (EAGAIN == errno || EWOULDBLOCK == errno)
+		{
+			break;
+		}
+
+		out.clear();
+		out_pos = 0;
+
+		return false;
+	}
+
+	if (out_pos == out.size())
+	{
+		out.clear();
+		out_pos = 0;
+
+		ev_io_stop(srv->loop, &con->e.watcher_send);
+	}
+	else
+	{
+		ev_io_start(srv->loop, &con->e.watcher_send);
+	}
+
+	return true;
+}
+
+void blizzard::rpc_session::process()
+{
+	if (closed)
+	{
+		return;
+	}
+
+	bool ok = flush() && read_input();
+
+	/* the requests left in the buffer are taken as soon as the connection may have them */
+	while (ok)
+	{
+		size_t left = in.size();
+
+		ok = handle_frames() && flush();
+
+		if (in.size() == left || !accepting())
+		{
+			break;
+		}
+	}
+
+	if (ok && 0 == handling && out.empty() && (eof || going_away))
+	{
+		ok = false;
+	}
+
+	if (!ok)
+	{
+		srv->close_connection(con);
+		return;
+	}
+
+	if (!eof && accepting())
+	{
+		ev_io_start(srv->loop, &con->e.watcher_recv);
+	}
+	else
+	{
+		ev_io_stop(srv->loop, &con->e.watcher_recv);
+	}
+}
+
+void blizzard::rpc_session::go_away()
+{
+	/* there is no frame to tell the client, the requests not started are dropped with the connection */
+	going_away = true;
+
+	if (!closed)
+	{
+		ev_io_stop(srv->loop, &con->e.watcher_recv);
+	}
+}
+
+bool blizzard::rpc_session::busy() const
+{
+	return 0 < handling || !out.empty();
+}
+
+/* the responses in the buffer are counted as drained already, a request being read is not */
+void blizzard::rpc_session::count_requests(int& in_plugin, int& in_network) const
+{
+	in_plugin += handling;
+	in_network += in.empty() ? 0 : 1;
+}
+
+bool blizzard::rpc_session::close()
+{
+	closed = true;
+
+	in.clear();
+	out.clear();
+	out_pos = 0;
+
+	return 0 == handling;
+}
+
+void blizzard::rpc_session::abort()
+{
+	while (requests)
+	{
+		http *task = requests;
+
+		if (task->plugin)
+		{
+			plugin_factory::release(task->plugin);
+			task->plugin = 0;
+		}
+
+		unlink_request(task);
+
+		task->destroy();
+		srv->http_pool.free(task);
+	}
+}
@@ -0,0 +1,85 @@
+#ifndef __BLIZZARD_RPC_HPP__
+#define __BLIZZARD_RPC_HPP__
+
+#include <stdint.h>
+#include <string>
+#include "stream_session.hpp"
+
+namespace blizzard {
+
+struct http;
+struct server;
+
+/* Binary RPC of a <rpc_port> listener for internal callers: length-prefixed frames instead of
+ * the text of HTTP, several requests of a connection in progress at once. The integers are in
+ * network byte order, size counts the bytes after itself.
+ *
+ *   request:  size:u32 id:u32 method:u8 flags:u8 path_len:u16 params_len:u16 headers_len:u16
+ *             path params headers body
+ *   response: size:u32 id:u32 status:u16 headers_len:u16 headers body
+ *
+ * The method is BLZ_METHOD_*, flags are 0, headers are "Name: value\r\n" lines and the body is
+ * the rest of the frame. Every request goes through the queues as an http object of its own,
+ * the responses are written in the order they are ready with the id of their request. */
+
+class rpc_session : public stream_session
+{
+public:
+	enum
+	{
+		REQUEST_HEADER_SZ = 16,
+		RESPONSE_HEADER_SZ = 12,
+		READ_SZ = 16384,
+		OUT_BUF_SZ = 65536
+	};
+
+private:
+	server *srv;
+	http *con;
+	int fd;
+
+	std::string in;
+	std::string out;
+	size_t out_pos;
+
+	/* requests in the queues or the plugin, they hold the connection after it is closed */
+	http *requests;
+	int handling;
+
+	int max_requests;
+	size_t max_request_size;
+
+	/* the client sent everything, the connection is closed after the last response */
+	bool eof;
+	bool going_away;
+	bool closed;
+
+	bool accepting() const;
+	bool read_input();
+	bool handle_frames();
+	bool handle_frame(uint32_t id, const uint8_t *p, size_t len);
+	bool set_request(http *task, int method, const uint8_t *p, size_t path_len, size_t params_len, size_t headers_len, size_t body_len);
+
+	void link_request(http *task);
+	void unlink_request(http *task);
+
+	void write_response(http *task);
+	bool flush();
+
+public:
+	rpc_session(server *s, http *c);
+
+	void process();
+	void respond(http *task);
+	void go_away();
+	bool busy() const;
+	void count_requests(int& in_plugin, int& in_network) const;
+	bool close();
+
+	/* the requests left in the queues are freed, the connection isn't held any more */
+	void abort();
+};
+
+}
+
+#endif /* __BLIZZARD_RPC_HPP__ */
@@ -1,8 +1,10 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
@@ -11,7 +13,13 @@
 #include <stdexcept>
 #include <coda/daemon.h>
 #include <coda/socket.h>
+#include <coda/string.hpp>
+#include "etag.hpp"
+#include "probes.hpp"
+#include "h2.hpp"
+#include "rpc.hpp"
 #include "server.hpp"
+#include "warmup.hpp"
 
 blizzard::statistics stats;
 
@@ -21,23 +29,34 @@ namespace blizzard
 	void*  easy_loop_function(void* ptr);
 	void*  hard_loop_function(void* ptr);
 	void*  idle_loop_function(void* ptr);
+	void*  reload_loop_function(void* ptr);
 }
 
 blizzard::server::server()
-	: incoming_sock(-1)
+	: event_started(false)
+	, connections(0)
+	, draining(false)
+	, drain_start(0)
+	, drained(0)
+	, idle_closed(0)
+	, stopped(false)
+	, capture_counter(0)
+	, hot_reload(false)
+	, reload_started(false)
+	, reloading(false)
 	, wakeup_isock(-1)
 	, wakeup_osock(-1)
 	, threads_num(0)
 	, start_time(0)
 	, was_daemonized(false)
+	, loop(0)
 {
 	pthread_mutex_init(&done_mutex, 0);
 
-	pthread_mutex_init(&easy_proc_mutex, 0);
-	pthread_mutex_init(&hard_proc_mutex, 0);
-
-	pthread_cond_init(&easy_proc_cond, 0);
-	pthread_cond_init(&hard_proc_cond, 0);
+	/* finalize() stops the watchers even if prepare() didn't start them */
+	ev_init(&wakeup_watcher, 0);
+	ev_init(&silent_timer, 0);
+	ev_init(&drain_timer, 0);
 
 	start_time = time(NULL);
 }
@@ -51,14 +70,6 @@ blizzard::server::~server()
 
 	finalize();
 
-	fire_all_threads();
-
-	pthread_cond_destroy(&hard_proc_cond);
-	pthread_cond_destroy(&easy_proc_cond);
-
-	pthread_mutex_destroy(&hard_proc_mutex);
-	pthread_mutex_destroy(&easy_proc_mutex);
-
 	pthread_mutex_destroy(&done_mutex);
 
 	/* remove pid-file (if it was set from blizzard's config) */
@@ -69,67 +80,116 @@ blizzard::server::~server()
 
 void blizzard::server::init_threads()
 {
-	if (0 == pthread_create(&event_th, NULL, &event_loop_function, this))
-	{
-		log_debug("event thread created");
-		threads_num++;
-	}
-	else
-	{
-		throw coda_error("error creating event thread");
-	}
+	stopped = false;
 
-	if (0 == pthread_create(&idle_th, NULL, &idle_loop_function, this))
+	try
 	{
-		threads_num++;
-		log_debug("idle thread created");
+		start_workers();
+		prepare_services();
+		start_listeners();
+
+		if (0 != pthread_create(&event_th, NULL, &event_loop_function, this))
+		{
+			throw coda_error("error creating event thread");
+		}
 	}
-	else
+	catch (...)
 	{
-		throw coda_error("error creating idle thread");
+		/* the workers don't wait for the event thread which isn't started */
+		stopped = true;
+		fire_all_threads();
+
+		throw;
 	}
 
-	log_info("%d internal threads created", threads_num);
+	event_started = true;
+	threads_num++;
 
-	log_info("requested worker threads {easy: %d, hard: %d}", config.blz.plugin.easy_threads, config.blz.plugin.hard_threads);
+	log_info("event thread created, accepting connections");
+}
 
-	for (int i = 0; i < config.blz.plugin.easy_threads; i++)
+void blizzard::server::start_workers()
+{
+	for (size_t k = 0; k < services.size(); k++)
 	{
-		pthread_t th;
-		int r = pthread_create(&th, NULL, &easy_loop_function, this);
-		if (0 == r)
-		{
-			log_debug("easy thread created");
-			easy_th.push_back(th);
+		service* svc = services[k];
+		const blz_config::BLZ::PLUGIN& pd = svc->conf;
 
+		if (0 == pthread_create(&svc->idle_th, NULL, &idle_loop_function, svc))
+		{
+			svc->idle_started = true;
 			threads_num++;
+			log_debug("idle thread of %s created", pd.name.c_str());
 		}
 		else
 		{
-			throw coda_error("error creating easy thread #%d: %s", i, coda_strerror(r));
+			throw coda_error("error creating idle thread of %s", pd.name.c_str());
 		}
-	}
 
-	for (int i = 0; i < config.blz.plugin.hard_threads; i++)
-	{
-		pthread_t th;
-		int r = pthread_create(&th, NULL, &hard_loop_function, this);
-		if (0 == r)
+		log_info("requested worker threads of %s {easy: %d, hard: %d}", pd.name.c_str(), pd.easy_threads, pd.hard_threads);
+
+		for (int i = 0; i < pd.easy_threads; i++)
 		{
-			log_debug("hard thread created");
-			hard_th.push_back(th);
+			pthread_t th;
+			int r = pthread_create(&th, NULL, &easy_loop_function, svc);
+			if (0 == r)
+			{
+				log_debug("easy thread created");
+				svc->easy_th.push_back(th);
 
-			threads_num++;
+				threads_num++;
+			}
+			else
+			{
+				throw coda_error("error creating easy thread #%d of %s: %s", i, pd.name.c_str(), coda_strerror(r));
+			}
 		}
-		else
+
+		for (int i = 0; i < pd.hard_threads; i++)
 		{
-			throw coda_error("error creating hard thread #%d: %s", i, coda_strerror(r));
+			pthread_t th;
+			int r = pthread_create(&th, NULL, &hard_loop_function, svc);
+			if (0 == r)
+			{
+				log_debug("hard thread created");
+				svc->hard_th.push_back(th);
+
+				threads_num++;
+			}
+			else
+			{
+				throw coda_error("error creating hard thread #%d of %s: %s", i, pd.name.c_str(), coda_strerror(r));
+			}
 		}
 	}
 
 	log_info("all worker threads created");
 }
 
+/* the threads prepare their plugins before the plugins serve and the listeners are opened */
+void blizzard::server::prepare_services()
+{
+	for (size_t k = 0; k < services.size(); k++)
+	{
+		service* svc = services[k];
+
+		if (0 == svc->loaded)
+		{
+			continue;
+		}
+
+		if (!svc->prepare_threads(svc->loaded))
+		{
+			throw coda_error("plugin %s is not prepared by its threads", svc->conf.name.c_str());
+		}
+
+		svc->switch_threads();
+		svc->loaded = 0;
+	}
+
+	stats.finish_warmup(monotonic_usec() - warmup_started);
+}
+
 void blizzard::server::join_threads()
 {
 	if (0 == threads_num)
@@ -137,46 +197,180 @@ void blizzard::server::join_threads()
 		return;
 	}
 
-	pthread_join(event_th, NULL);
-	log_info("event_th joined");
-	threads_num--;
+	if (event_started)
+	{
+		pthread_join(event_th, NULL);
+		log_info("event_th joined");
+		event_started = false;
+		threads_num--;
+	}
+
+	for (size_t k = 0; k < services.size(); k++)
+	{
+		service* svc = services[k];
+
+		if (svc->idle_started)
+		{
+			pthread_join(svc->idle_th, NULL);
+			log_info("idle_th of %s joined", svc->conf.name.c_str());
+			svc->idle_started = false;
+			threads_num--;
+		}
+
+		for (size_t i = 0; i < svc->easy_th.size(); i++)
+		{
+			log_info("pthread_join(easy_th[%d], 0)", (int)i);
+			pthread_join(svc->easy_th[i], 0);
+			threads_num--;
+		}
+
+		svc->easy_th.clear();
+
+		for (size_t i = 0; i < svc->hard_th.size(); i++)
+		{
+			log_info("pthread_join(hard_th[%d], 0)", (int)i);
+			pthread_join(svc->hard_th[i], 0);
+			threads_num--;
+		}
+
+		svc->hard_th.clear();
+	}
 
-	pthread_join(idle_th, NULL);
-	log_info("idle_th joined");
-	threads_num--;
+	log_notice("%d threads left", (int)threads_num);
+}
 
-	for (size_t i = 0; i < easy_th.size(); i++)
+void blizzard::server::fire_all_threads()
+{
+	for (size_t k = 0; k < services.size(); k++)
 	{
-		log_info("pthread_join(easy_th[%d], 0)", (int)i);
-		pthread_join(easy_th[i], 0);
-		threads_num--;
+		services[k]->fire_threads();
 	}
 
-	easy_th.clear();
+	log_debug("fire_all_threads");
+}
+
+bool blizzard::server::is_running() const
+{
+	return 0 == coda_terminate && (0 == coda_changecfg || hot_reload);
+}
 
-	for (size_t i = 0; i < hard_th.size(); i++)
+void blizzard::server::start_reload()
+{
+	if (reloading)
 	{
-		log_info("pthread_join(hard_th[%d], 0)", (int)i);
-		pthread_join(hard_th[i], 0);
-		threads_num--;
+		log_warn("reload: the previous reload is not finished, SIGHUP is ignored");
+		return;
 	}
 
-	hard_th.clear();
+	if (reload_started)
+	{
+		pthread_join(reload_th, NULL);
+		reload_started = false;
+	}
 
-	log_notice("%d threads left", (int)threads_num);
+	reloading = true;
+
+	int r = pthread_create(&reload_th, NULL, &reload_loop_function, this);
+
+	if (0 != r)
+	{
+		reloading = false;
+		log_error("reload: error creating thread: %s", coda_strerror(r));
+		return;
+	}
+
+	reload_started = true;
 }
 
-void blizzard::server::fire_all_threads()
+/* runs in reload_th: the current plugins keep serving until the new ones are loaded */
+void blizzard::server::reload_plugin()
 {
-	pthread_mutex_lock(&easy_proc_mutex);
-	pthread_cond_broadcast(&easy_proc_cond);
-	pthread_mutex_unlock(&easy_proc_mutex);
+	log_notice("reload: loading plugins from %s", config_file.c_str());
+
+	try
+	{
+		blz_config next;
+		next.load_from_file(config_file.c_str());
+		next.check();
+
+		if (next.blz.plugin.size() != services.size())
+		{
+			log_warn("reload: <plugin> sections are added or removed on restart only");
+		}
 
-	pthread_mutex_lock(&hard_proc_mutex);
-	pthread_cond_broadcast(&hard_proc_cond);
-	pthread_mutex_unlock(&hard_proc_mutex);
+		stats.start_warmup();
+		uint64_t warmup_started = monotonic_usec();
 
-	log_debug("fire_all_threads");
+		/* the sections are matched by name, each one is reloaded on its own */
+		for (size_t k = 0; k < services.size(); k++)
+		{
+			service* svc = services[k];
+			const blz_config::BLZ::PLUGIN& was = svc->conf;
+			const blz_config::BLZ::PLUGIN* found = 0;
+
+			for (size_t i = 0; i < next.blz.plugin.size(); i++)
+			{
+				if (next.blz.plugin[i].name == was.name)
+				{
+					found = &next.blz.plugin[i];
+					break;
+				}
+			}
+
+			if (0 == found)
+			{
+				log_warn("reload: <plugin> %s is removed from config, it keeps serving until restart", was.name.c_str());
+				continue;
+			}
+
+			const blz_config::BLZ::PLUGIN& pd = *found;
+
+			if (pd.ip != was.ip || pd.port != was.port || pd.prefix != was.prefix || pd.easy_threads != was.easy_threads || pd.hard_threads != was.hard_threads)
+			{
+				log_warn("reload: address, port, prefix and threads of <plugin> %s are changed on restart only", was.name.c_str());
+			}
+
+			uint64_t started = monotonic_usec();
+
+			plugin_instance* inst = svc->factory.create(pd);
+
+			/* the current instance serves while the new one warms up */
+			warm_up(inst, pd);
+
+			if (!svc->prepare_threads(inst))
+			{
+				svc->factory.drain(inst);
+				throw coda_error("plugin %s is not prepared by its threads", was.name.c_str());
+			}
+
+			/* the threads move to the new instance and release the old one */
+			plugin_instance* old = svc->switch_threads();
+
+			log_notice("reload: plugin %s (generation %d) is loaded in %.3f s and serves new requests, draining generation %d"
+				, inst->library.c_str()
+				, inst->generation
+				, (monotonic_usec() - started) / 1e6
+				, old->generation);
+
+			int generation = old->generation;
+
+			if (svc->factory.drain(old))
+			{
+				log_notice("reload: generation %d of %s is released", generation, was.name.c_str());
+			}
+		}
+
+		stats.finish_warmup(monotonic_usec() - warmup_started);
+
+		log_level = log_levels(next.blz.log_level.c_str());
+	}
+	catch (const std::exception &e)
+	{
+		stats.finish_warmup(0);
+		log_error("reload failed, the running plugins keep serving: %s", e.what());
+	}
+
+	reloading = false;
 }
 
 void blizzard::server::send_wakeup()
@@ -213,158 +407,156 @@ void blizzard::server::recv_wakeup()
 	while (ret == 1024 || errno == EINTR);
 }
 
-bool blizzard::server::push_easy(http * el)
+bool blizzard::server::push_done(http * el)
 {
-	bool res = false;
+	el->times.done_push = monotonic_usec();
+	BLZ_PROBE2(done_push, el->get_fd(), el->times.done_push);
 
-	pthread_mutex_lock(&easy_proc_mutex);
-
-	size_t eq_sz = easy_queue.size();
-	stats.report_easy_queue_len(eq_sz);
+	pthread_mutex_lock(&done_mutex);
 
-	if (config.blz.plugin.easy_queue_limit == 0 || (eq_sz < (size_t)config.blz.plugin.easy_queue_limit))
-	{
-		easy_queue.push_back(el);
-		res = true;
+	done_queue.push_back(el);
+	stats.report_done_queue_len(done_queue.size());
 
-		log_debug("push_easy %d", el->get_fd());
+	log_debug("push_done %d", el->get_fd());
 
-		pthread_cond_signal(&easy_proc_cond);
-	}
+	pthread_mutex_unlock(&done_mutex);
 
-	pthread_mutex_unlock(&easy_proc_mutex);
+	send_wakeup();
 
-	return res;
+	return true;
 }
 
-bool blizzard::server::pop_easy_or_wait(http** el)
+bool blizzard::server::pop_done(http** el)
 {
 	bool ret = false;
 
-	pthread_mutex_lock(&easy_proc_mutex);
+	pthread_mutex_lock(&done_mutex);
 
-	size_t eq_sz = easy_queue.size();
-	stats.report_easy_queue_len(eq_sz);
+	size_t dq_sz = done_queue.size();
+	stats.report_done_queue_len(dq_sz);
 
-	if (eq_sz)
+	if (dq_sz)
 	{
-		*el = easy_queue.front();
+		*el = done_queue.front();
 
-		log_debug("pop_easy %d", (*el)->get_fd());
+		stats.report_response_time(ev_now(loop) - (*el)->get_response_time());
 
-		easy_queue.pop_front();
+		log_debug("pop_done %d", (*el)->get_fd());
 
-		ret = true;
-	}
-	else
-	{
-		log_debug("pop_easy : events empty");
+		done_queue.pop_front();
+
+		(*el)->times.done_pop = monotonic_usec();
+		stats.report_stage_time(statistics::STAGE_DONE_WAIT, (*el)->times.done_push, (*el)->times.done_pop);
 
-		pthread_cond_wait(&easy_proc_cond, &easy_proc_mutex);
+		ret = true;
 	}
 
-	pthread_mutex_unlock(&easy_proc_mutex);
+	pthread_mutex_unlock(&done_mutex);
 
 	return ret;
 }
 
-bool blizzard::server::push_hard(http * el)
+bool blizzard::server::compress_response(http * el)
 {
-	bool res = false;
-
-	pthread_mutex_lock(&hard_proc_mutex);
-
-	size_t hq_sz = hard_queue.size();
-	stats.report_hard_queue_len(hq_sz);
-
-	if (config.blz.plugin.hard_queue_limit == 0 || (hq_sz < (size_t)config.blz.plugin.hard_queue_limit))
+	if (!compression.enabled())
 	{
-		hard_queue.push_back(el);
-
-		res = true;
-
-		log_debug("push_hard %d", el->get_fd());
-
-		pthread_cond_signal(&hard_proc_cond);
+		return false;
 	}
 
-	pthread_mutex_unlock(&hard_proc_mutex);
+	int status = el->get_response_status();
+	size_t size = el->get_response_body_size();
 
-	return res;
-}
+	if (status < 200 || status >= 300 || 204 == status || 206 == status)
+	{
+		return false;
+	}
 
-bool blizzard::server::pop_hard_or_wait(http** el)
-{
-	bool ret = false;
+	if (size < compression.get_min_size() || 0 == size || el->has_response_header("Content-Encoding"))
+	{
+		return false;
+	}
 
-	pthread_mutex_lock(&hard_proc_mutex);
+	el->add_response_header("Vary", "Accept-Encoding");
 
-	size_t hq_sz = hard_queue.size();
-	stats.report_hard_queue_len(hq_sz);
+	int enc = el->get_response_encoding();
 
-	if (hq_sz)
+	/* a compressed body can't go without its Content-Encoding */
+	if (compressor::ENCODING_IDENTITY == enc || !el->response_header_fits("Content-Encoding", compressor::encoding_name(enc)))
 	{
-		*el = hard_queue.front();
+		return false;
+	}
 
-		log_debug("pop_hard %d", (*el)->get_fd());
+	std::vector<struct iovec> parts;
+	el->get_response_body_parts(parts);
 
-		hard_queue.pop_front();
+	std::string out;
 
-		ret = true;
-	}
-	else
+	if (compression.compress(enc, &parts[0], parts.size(), out) && out.size() < size)
 	{
-		log_debug("pop_hard : events empty");
+		el->set_response_body(out.data(), out.size());
+		el->add_response_header("Content-Encoding", compressor::encoding_name(enc));
 
-		pthread_cond_wait(&hard_proc_cond, &hard_proc_mutex);
-	}
+		stats.report_compression(size, out.size());
 
-	pthread_mutex_unlock(&hard_proc_mutex);
+		return true;
+	}
 
-	return ret;
+	return false;
 }
 
-bool blizzard::server::push_done(http * el)
+static void etag_encoding(std::string& tag, int encoding)
 {
-	pthread_mutex_lock(&done_mutex);
+	std::string plain = tag;
+	std::string suffix = "-";
+	suffix += blizzard::compressor::encoding_name(encoding);
 
-	done_queue.push_back(el);
-	stats.report_done_queue_len(done_queue.size());
-
-	log_debug("push_done %d", el->get_fd());
-
-	pthread_mutex_unlock(&done_mutex);
-
-	send_wakeup();
-
-	return true;
+	blizzard::etag_quote(tag, plain.c_str(), suffix.c_str());
 }
 
-bool blizzard::server::pop_done(http** el)
+void blizzard::server::finish_response(http * el)
 {
-	bool ret = false;
+	bool compressed = compress_response(el);
 
-	pthread_mutex_lock(&done_mutex);
-
-	size_t dq_sz = done_queue.size();
-	stats.report_done_queue_len(dq_sz);
+	std::string tag;
 
-	if (dq_sz)
+	/* an ETag header of the plugin is compared with If-None-Match, it is sent as it is unless
+	 * the body is compressed: the variants of an encoding get their own tags */
+	if (el->get_response_header("ETag", tag))
 	{
-		*el = done_queue.front();
+		if (compressed)
+		{
+			etag_encoding(tag, el->get_response_encoding());
 
-		stats.report_response_time(ev_now(loop) - (*el)->get_response_time());
+			el->remove_response_header("ETag");
+			el->add_response_header("ETag", tag.c_str());
+		}
 
-		log_debug("pop_done %d", (*el)->get_fd());
+		el->replace_response_etag(tag);
+		return;
+	}
 
-		done_queue.pop_front();
+	tag = el->get_response_etag();
 
-		ret = true;
+	if (!tag.empty())
+	{
+		if (compressed)
+		{
+			etag_encoding(tag, el->get_response_encoding());
+		}
 	}
+	else if (config.blz.etag && 200 == el->get_response_status() && el->get_response_body_size())
+	{
+		std::vector<struct iovec> parts;
+		el->get_response_body_parts(parts);
 
-	pthread_mutex_unlock(&done_mutex);
+		etag_make(tag, &parts[0], parts.size());
+	}
 
-	return ret;
+	if (!tag.empty())
+	{
+		el->replace_response_etag(tag);
+		el->add_response_header("ETag", tag.c_str());
+	}
 }
 
 /* xml_in, pid_fn, is_daemon are command line arguments */
@@ -374,6 +566,11 @@ void blizzard::server::load_config(const char* xml_in, const char *pid_fn, bool
 	config.load_from_file(xml_in);
 	config.check();
 
+	/* the reload thread reads the config again, the daemon could change the directory */
+	char path [PATH_MAX];
+	config_file = realpath(xml_in, path) ? path : xml_in;
+	hot_reload = "hot" == config.blz.reload;
+
 	if (!pid_fn)
 	{
 		coda_mkpidf(config.blz.pid_file_name.c_str());
@@ -381,6 +578,28 @@ void blizzard::server::load_config(const char* xml_in, const char *pid_fn, bool
 
 	was_daemonized = is_daemon;
 
+	stats.set_windows(config.blz.stats.windows.c_str());
+	stats.set_routes(config.blz.stats.routes.c_str());
+
+	if (config.blz.plugin.size() > (size_t) statistics::MAX_PLUGINS)
+	{
+		throw coda_error("%d <plugin> sections, at most %d are supported", (int) config.blz.plugin.size(), (int) statistics::MAX_PLUGINS);
+	}
+
+	std::vector<std::string> names;
+
+	for (size_t i = 0; i < config.blz.plugin.size(); i++)
+	{
+		names.push_back(config.blz.plugin[i].name);
+	}
+
+	stats.set_plugins(names);
+	cache.init(config.blz.cache);
+	compression.init(config.blz.compression);
+
+	const std::string& access_fmt = config.blz.access_log.format;
+	access_format.parse(access_fmt.empty() ? access_log_format::DEFAULT : access_fmt);
+
 	log_level = log_levels(config.blz.log_level.c_str());
 
 	if (!is_daemon) return;
@@ -399,7 +618,7 @@ void blizzard::server::load_config(const char* xml_in, const char *pid_fn, bool
 static void incoming_callback(EV_P_ ev_io *w, int tev)
 {
 	blizzard::server *s = (blizzard::server *) ev_userdata(loop);
-	s->accept_connection();
+	s->accept_connection((int) (intptr_t) w->data);
 }
 
 static void wakeup_callback(EV_P_ ev_io *w, int tev)
@@ -410,78 +629,404 @@ static void wakeup_callback(EV_P_ ev_io *w, int tev)
 	blizzard::http *con = 0;
 	while (s->pop_done(&con))
 	{
-		ev_io_start(loop, &con->e.watcher_send);
+		if (con->plugin)
+		{
+			blizzard::plugin_factory::release(con->plugin);
+			con->plugin = 0;
+		}
+
+		s->cache.store(con, ev_now(loop));
+
+		if (con->check_not_modified())
+		{
+			log_debug("not modified %d", con->get_fd());
+		}
 
 		con->unlock();
 
- 		if (-1 != con->get_fd())
+		if (-1 != con->get_fd() || con->session_conn)
 		{
-			s->process(con);
+			s->respond(con);
 		}
 		else
 		{
 			con->destroy();
-			s->http_pool.free(con);
+			s->free_connection(con);
 		}
 	}
 }
 
 static void silent_callback(EV_P_ ev_timer *w, int tev)
 {
-	if (0 != coda_terminate)
+	blizzard::server *s = (blizzard::server *) ev_userdata(loop);
+
+	if (0 != coda_terminate || (0 != coda_changecfg && !s->hot_reload))
 	{
-		ev_timer_stop(EV_A_ w);
-		ev_break(EV_A_ EVUNLOOP_ALL);
+		if (!s->draining)
+		{
+			s->start_drain();
+		}
+
 		return;
 	}
 
-	if (0 != coda_rotatelog)
+	if (0 != coda_changecfg)
 	{
-		blizzard::server *s = (blizzard::server *) ev_userdata(loop);
+		coda_changecfg = 0;
+		s->start_reload();
+	}
 
+	if (0 != coda_rotatelog)
+	{
 		if (s->was_daemonized)
 		{
 			log_rotate(s->config.blz.log_file_name.c_str());
 		}
 
-		blz_plugin* plugin = s->factory.open_plugin();
-		plugin->rotate_custom_logs();
+		s->slow_log.reopen();
+		s->access_log.reopen();
+		s->capture_log.reopen();
+
+		for (size_t k = 0; k < s->services.size(); k++)
+		{
+			blizzard::plugin_instance* inst = s->services[k]->factory.acquire();
+
+			if (inst)
+			{
+				inst->plugin->rotate_custom_logs();
+				blizzard::plugin_factory::release(inst);
+			}
+		}
 
 		coda_rotatelog = 0;
 	}
 
 	stats.process(ev_now(loop));
+	stats.publish(s->http_pool.allocated_pages(), s->http_pool.allocated_objects());
+}
+
+static void drain_callback(EV_P_ ev_timer *w, int tev)
+{
+	ev_break(EV_A_ EVUNLOOP_ALL);
 }
 
-void blizzard::server::accept_connection()
+void blizzard::server::accept_connection(int idx)
 {
 	int sd;
 	struct in_addr ip;
 
-	sd = coda_accept(incoming_sock, &ip, 1);
+	sd = coda_accept(listeners[idx].sock, &ip, 1);
 	if (0 > sd) return;
 
 	http *con = http_pool.allocate();
 	con->init(sd, ip);
+	con->listener = idx;
+	link_connection(con);
 	con->add_watcher(loop); /* epoll used EPOLLET here */
+
+	if (listeners[idx].rpc)
+	{
+		con->session = new rpc_session(this, con);
+	}
 }
 
-void blizzard::server::prepare()
+void blizzard::server::link_connection(http *con)
 {
-	factory.load_module(config.blz.plugin);
-
-	loop = ev_default_loop(0);
-	ev_set_userdata(loop, this); /* hack to simplify things in http.cpp, couldn't be REALLY needed, if blizzard were written more libev friendly */
-	// ev_set_io_collect_interval(loop, 0.01); [> hack to emulate old blizzard behaviour (epolling with timeout 100ms (we set it to 50ms here)) <]
-	// ev_set_timeout_collect_interval(loop, 0.01);
+	con->conn_prev = 0;
+	con->conn_next = connections;
 
-	if (0 > (incoming_sock = coda_listen(config.blz.plugin.ip.c_str(), config.blz.plugin.port.c_str(), LISTEN_QUEUE_SZ, 1)))
+	if (connections)
 	{
-		throw coda_error("can't bound plugin to %s:%s (%d: %s)", config.blz.plugin.ip.c_str(), config.blz.plugin.port.c_str(), errno, coda_strerror(errno));
+		connections->conn_prev = con;
 	}
 
-	ev_io_init(&incoming_watcher, incoming_callback, incoming_sock, EV_READ);
-	ev_io_start(loop, &incoming_watcher);
+	connections = con;
+}
+
+void blizzard::server::free_connection(http *con)
+{
+	if (con->conn_prev)
+	{
+		con->conn_prev->conn_next = con->conn_next;
+	}
+	else
+	{
+		connections = con->conn_next;
+	}
+
+	if (con->conn_next)
+	{
+		con->conn_next->conn_prev = con->conn_prev;
+	}
+
+	delete con->session;
+	con->session = 0;
+
+	http_pool.free(con);
+
+	if (draining && 0 == connections)
+	{
+		ev_break(loop, EVUNLOOP_ALL);
+	}
+}
+
+void blizzard::server::close_connection(http *con)
+{
+	ev_io_stop(loop, &con->e.watcher_recv);
+	ev_io_stop(loop, &con->e.watcher_send);
+	ev_timer_stop(loop, &con->e.watcher_timeout);
+
+	/* the requests of a session in the queues hold the connection until they are done */
+	bool held = con->session && !con->session->close();
+
+	con->destroy();
+
+	if (!held)
+	{
+		free_connection(con);
+	}
+}
+
+void blizzard::server::start_drain()
+{
+	draining = true;
+	drain_start = monotonic_usec();
+	drained = 0;
+	idle_closed = 0;
+
+	/* clients connect to other servers instead of waiting in the backlog */
+	close_listeners();
+
+	int in_progress = 0;
+
+	for (http *con = connections; con; )
+	{
+		http *next = con->conn_next;
+
+		/* clients of a session are told to send new requests elsewhere (GOAWAY of HTTP/2) */
+		if (con->session)
+		{
+			con->session->go_away();
+		}
+
+		if (con->session ? !con->session->busy() : con->is_idle())
+		{
+			close_connection(con);
+			idle_closed++;
+		}
+		else if (con->session)
+		{
+			con->session->count_requests(in_progress, in_progress);
+		}
+		else
+		{
+			in_progress++;
+		}
+
+		con = next;
+	}
+
+	int timeout = config.blz.shutdown_timeout;
+
+	log_notice("shutdown: %d requests in progress, %d idle connections closed, waiting up to %d ms", in_progress, idle_closed, timeout);
+
+	if (0 == connections || 0 == timeout)
+	{
+		ev_break(loop, EVUNLOOP_ALL);
+		return;
+	}
+
+	ev_timer_init(&drain_timer, drain_callback, timeout / (double) 1000, 0);
+	ev_timer_start(loop, &drain_timer);
+}
+
+void blizzard::server::finish_drain()
+{
+	ev_timer_stop(loop, &drain_timer);
+	ev_timer_stop(loop, &silent_timer);
+
+	int in_plugin = 0;
+	int in_network = 0;
+
+	/* a session has several requests of its own */
+	for (http *con = connections; con; con = con->conn_next)
+	{
+		if (con->session)
+		{
+			con->session->count_requests(in_plugin, in_network);
+		}
+		else
+		{
+			con->is_locked() ? in_plugin++ : in_network++;
+		}
+	}
+
+	log_notice("shutdown: %d requests drained, %d aborted (%d in queues or plugin, %d reading or writing) in %d ms"
+		, drained, in_plugin + in_network, in_plugin, in_network, (int) ((monotonic_usec() - drain_start) / 1000));
+
+	draining = false;
+}
+
+/* a socket per address, the sections on the same address share it */
+void blizzard::server::open_listeners()
+{
+	/* a prefork worker gets the sockets of the master */
+	if (!listeners.empty())
+	{
+		return;
+	}
+
+	for (size_t i = 0; i < config.blz.plugin.size(); i++)
+	{
+		const blz_config::BLZ::PLUGIN& pd = config.blz.plugin[i];
+
+		open_listener(pd, pd.port, false);
+
+		if (!pd.rpc_port.empty())
+		{
+			open_listener(pd, pd.rpc_port, true);
+		}
+	}
+}
+
+void blizzard::server::open_listener(const blz_config::BLZ::PLUGIN& pd, const std::string& port, bool rpc)
+{
+	for (size_t j = 0; j < listeners.size(); j++)
+	{
+		if (listeners[j].ip == pd.ip && listeners[j].port == port)
+		{
+			return;
+		}
+	}
+
+	listener l;
+	ev_init(&l.watcher, incoming_callback);
+	l.ip = pd.ip;
+	l.port = port;
+	l.connection_timeout = pd.connection_timeout;
+	l.rpc = rpc;
+
+	if (0 > (l.sock = coda_listen(pd.ip.c_str(), port.c_str(), LISTEN_QUEUE_SZ, 1)))
+	{
+		int err = errno;
+
+		close_listeners();
+		throw coda_error("can't bound plugin %s to %s:%s (%d: %s)", pd.name.c_str(), pd.ip.c_str(), port.c_str(), err, coda_strerror(err));
+	}
+
+	listeners.push_back(l);
+}
+
+void blizzard::server::close_listeners()
+{
+	for (size_t i = 0; i < listeners.size(); i++)
+	{
+		if (loop)
+		{
+			ev_io_stop(loop, &listeners[i].watcher);
+		}
+
+		close(listeners[i].sock);
+	}
+
+	listeners.clear();
+}
+
+blizzard::service* blizzard::server::route_service(const http *con) const
+{
+	const char *path = con->get_request_uri_path();
+	service* found = 0;
+
+	/* the longest <prefix> of the sections on the address of the connection */
+	for (size_t k = 0; k < services.size(); k++)
+	{
+		service* svc = services[k];
+		const std::string& prefix = svc->conf.prefix;
+
+		if ((svc->listener != con->listener && svc->rpc_listener != con->listener) || (found && found->conf.prefix.size() >= prefix.size()))
+		{
+			continue;
+		}
+
+		if (prefix.empty() || (path && 0 == strncmp(path, prefix.c_str(), prefix.size())))
+		{
+			found = svc;
+		}
+	}
+
+	return found;
+}
+
+/* the instances of threads are warmed up by their threads, the shared one doesn't serve then */
+void blizzard::server::warm_up(plugin_instance* inst, const blz_config::BLZ::PLUGIN& pd)
+{
+	if (pd.warmup_file.empty() || 0 == inst || pd.per_thread)
+	{
+		return;
+	}
+
+	/* the calling thread handles the requests as an easy or hard thread would */
+	if (BLZ_OK != inst->plugin->thread_init())
+	{
+		log_error("warmup: %s: thread_init() failed, the plugin starts cold", pd.name.c_str());
+		return;
+	}
+
+	uint64_t started = monotonic_usec();
+	warmup_result res;
+
+	replay_warmup(inst->plugin, pd, res);
+	stats.report_warmup(res.requests, res.errors);
+
+	inst->plugin->thread_fini();
+
+	log_notice("warmup: %s: %u requests (%u errors) from %s in %.3f s"
+		, pd.name.c_str(), res.requests, res.errors, pd.warmup_file.c_str(), (monotonic_usec() - started) / 1e6);
+}
+
+void blizzard::server::warm_up_thread(service* svc, thread_plugin& tp)
+{
+	const blz_config::BLZ::PLUGIN& pd = svc->conf;
+
+	if (pd.warmup_file.empty() || !pd.per_thread || 0 == tp.prepared_plugin())
+	{
+		return;
+	}
+
+	uint64_t started = monotonic_usec();
+	warmup_result res;
+
+	replay_warmup(tp.prepared_plugin(), pd, res);
+	stats.report_warmup(res.requests, res.errors);
+
+	log_info("warmup: %s: thread instance: %u requests (%u errors) in %.3f s"
+		, pd.name.c_str(), res.requests, res.errors, (monotonic_usec() - started) / 1e6);
+}
+
+void blizzard::server::prepare()
+{
+	loop = ev_default_loop(0);
+	ev_set_userdata(loop, this); /* hack to simplify things in http.cpp, couldn't be REALLY needed, if blizzard were written more libev friendly */
+	// ev_set_io_collect_interval(loop, 0.01); [> hack to emulate old blizzard behaviour (epolling with timeout 100ms (we set it to 50ms here)) <]
+	// ev_set_timeout_collect_interval(loop, 0.01);
+
+	stats.start_warmup();
+	warmup_started = monotonic_usec();
+
+	/* the plugins become current after the threads prepare them, see init_threads() */
+	for (size_t i = 0; i < config.blz.plugin.size(); i++)
+	{
+		const blz_config::BLZ::PLUGIN& pd = config.blz.plugin[i];
+		service* svc = new service(this, i, pd);
+
+		services.push_back(svc);
+
+		if (pd.easy_threads)
+		{
+			svc->loaded = svc->factory.create(pd);
+			warm_up(svc->loaded, pd);
+		}
+	}
 
 	int pipefd[2];
 	if (::pipe(pipefd) == -1)
@@ -496,16 +1041,68 @@ void blizzard::server::prepare()
 
 	ev_timer_init(&silent_timer, silent_callback, 0, 1);
 	ev_timer_again(loop, &silent_timer);
+
+	if (!config.blz.slow_log.file_name.empty())
+	{
+		slow_log.open(config.blz.slow_log.file_name, config.blz.slow_log.buffer_size << 20);
+		stats.add_log("slow", &slow_log);
+	}
+
+	if (!config.blz.access_log.file_name.empty())
+	{
+		access_log.open(config.blz.access_log.file_name, config.blz.access_log.buffer_size << 20);
+		stats.add_log("access", &access_log);
+	}
+
+	if (!config.blz.capture.file_name.empty())
+	{
+		capture_log.open(config.blz.capture.file_name, config.blz.capture.buffer_size << 20);
+		stats.add_log("capture", &capture_log);
+	}
+}
+
+/* clients wait in the backlog of another server while the plugins warm up */
+void blizzard::server::start_listeners()
+{
+	open_listeners();
+
+	for (size_t k = 0; k < services.size(); k++)
+	{
+		service* svc = services[k];
+
+		for (size_t j = 0; j < listeners.size(); j++)
+		{
+			if (listeners[j].ip == svc->conf.ip && listeners[j].port == svc->conf.port)
+			{
+				svc->listener = j;
+			}
+
+			if (listeners[j].ip == svc->conf.ip && listeners[j].port == svc->conf.rpc_port)
+			{
+				svc->rpc_listener = j;
+			}
+		}
+	}
+
+	for (size_t j = 0; j < listeners.size(); j++)
+	{
+		ev_io_init(&listeners[j].watcher, incoming_callback, listeners[j].sock, EV_READ);
+		listeners[j].watcher.data = (void *) (intptr_t) j;
+		ev_io_start(loop, &listeners[j].watcher);
+	}
 }
 
 void blizzard::server::finalize()
 {
-	if (-1 != incoming_sock)
+	/* the default loop is used again after a restart by SIGHUP */
+	if (loop)
 	{
-		close(incoming_sock);
-		incoming_sock = -1;
+		ev_io_stop(loop, &wakeup_watcher);
+		ev_timer_stop(loop, &silent_timer);
 	}
 
+	close_listeners();
+
 	if (-1 != wakeup_isock)
 	{
 		close(wakeup_isock);
@@ -518,128 +1115,612 @@ void blizzard::server::finalize()
 		wakeup_osock = -1;
 	}
 
-	factory.stop_module();
+	if (reload_started)
+	{
+		pthread_join(reload_th, NULL);
+		reload_started = false;
+	}
+
+	/* aborted by the shutdown timeout, the threads are joined and don't hold them */
+	while (connections)
+	{
+		http *con = connections;
+
+		if (con->plugin)
+		{
+			plugin_factory::release(con->plugin);
+			con->plugin = 0;
+		}
+
+		/* the requests of a session left in the queues don't hold the connection any more */
+		if (con->session)
+		{
+			con->session->abort();
+		}
+
+		close_connection(con);
+	}
+
+	done_queue.clear();
+
+	stats.clear_logs();
+
+	slow_log.close();
+	access_log.close();
+	capture_log.close();
+
+	for (size_t k = 0; k < services.size(); k++)
+	{
+		services[k]->clear_queues();
+		delete services[k];
+	}
+
+	services.clear();
 }
 
 void blizzard::server::event_processing_loop()
 {
 	ev_run(loop, 0);
+
+	if (draining)
+	{
+		finish_drain();
+	}
 }
 
 bool blizzard::server::process(http * con)
 {
+	if (con->session)
+	{
+		con->session->process();
+		return true;
+	}
+
 	if (!con->is_locked())
 	{
 		con->process();
 
 		if (con->state() == http::sReadyToHandle)
 		{
-			log_debug("push_easy(%d)", con->get_fd());
-
-			con->lock();
-
-			if (false == push_easy(con))
+			if (!upgrade_h2(con))
 			{
-				log_error("easy queue full: easy_queue_size == %d", config.blz.plugin.easy_queue_limit);
-				con->set_response_status(503);
-				con->add_response_header("Content-type", "text/plain");
-				con->add_response_buffer("easy queue filled!", strlen("easy queue filled!"));
-				push_done(con);
+				handle_request(con);
 			}
 		}
+		else if (con->state() == http::sH2)
+		{
+			start_h2(con);
+		}
 		else if (con->state() == http::sDone || con->state() == http::sUndefined)
 		{
-			ev_io_stop(loop, &con->e.watcher_recv);
-			ev_io_stop(loop, &con->e.watcher_send);
-			ev_timer_stop(loop, &con->e.watcher_timeout);
+			finish_request(con);
+			close_connection(con);
+		}
+	}
 
-			con->destroy();
-			http_pool.free(con);
+	return true;
+}
+
+void blizzard::server::handle_request(http * con)
+{
+	con->times.parsed = monotonic_usec();
+	BLZ_PROBE3(parse_done, con->get_fd(), con->times.accepted, con->times.parsed);
+	stats.report_stage_time(statistics::STAGE_PARSE, con->times.accepted, con->times.parsed);
+
+	con->route = stats.match_route(con->get_request_uri_path());
+
+	if (compression.enabled())
+	{
+		con->set_response_encoding(compression.negotiate(con->get_request_header("Accept-Encoding")));
+	}
+
+	if (serve_stats(con) || serve_health(con))
+	{
+		con->times.done_pop = monotonic_usec();
+
+		respond(con);
+		return;
+	}
+
+	if (capture_log.is_open())
+	{
+		capture(con);
+	}
+
+	if (0 == (con->svc = route_service(con)))
+	{
+		con->set_response_status(404);
+		con->add_response_header("Content-type", "text/plain");
+		con->add_response_buffer("no plugin for the path", strlen("no plugin for the path"));
+		con->times.done_pop = monotonic_usec();
+
+		respond(con);
+		return;
+	}
+
+	if (cache.lookup(con, ev_now(loop)))
+	{
+		log_debug("cache hit %d", con->get_fd());
+
+		con->check_not_modified();
+		con->times.done_pop = monotonic_usec();
+
+		respond(con);
+		return;
+	}
+
+	log_debug("push_easy(%d)", con->get_fd());
+
+	con->lock();
+	con->plugin = con->svc->factory.acquire();
+
+	if (false == con->svc->push_easy(con))
+	{
+		log_error("easy queue of %s full: easy_queue_size == %d", con->svc->conf.name.c_str(), con->svc->conf.easy_queue_limit);
+		con->set_response_status(503);
+		con->add_response_header("Content-type", "text/plain");
+		con->add_response_buffer("easy queue filled!", strlen("easy queue filled!"));
+		push_done(con);
+	}
+}
+
+/* HTTP/1 writes the response on the connection, a request of a session is written by its one */
+void blizzard::server::respond(http * con)
+{
+	if (con->session_conn)
+	{
+		con->session_conn->session->respond(con);
+		return;
+	}
+
+	ev_io_start(loop, &con->e.watcher_send);
+	process(con);
+}
+
+void blizzard::server::finish_request(http * con)
+{
+	if (0 == con->times.done_pop)
+	{
+		return;
+	}
+
+	con->times.written = monotonic_usec();
+	BLZ_PROBE4(write_done, con->get_fd(), con->times.accepted, con->times.written, con->get_response_status());
+	stats.report_stage_time(statistics::STAGE_WRITE, con->times.done_pop, con->times.written);
+	stats.report_stage_time(statistics::STAGE_TOTAL, con->times.accepted, con->times.written);
+
+	report_route(con);
+
+	if (slow_log.is_open() && con->times.written - con->times.accepted >= (uint64_t) config.blz.slow_log.threshold * 1000)
+	{
+		log_slow_request(con);
+	}
+
+	if (access_log.is_open())
+	{
+		log_access(con);
+	}
+
+	if (draining)
+	{
+		drained++;
+	}
+}
+
+/* "PRI * HTTP/2.0" is the title, the frames follow */
+void blizzard::server::start_h2(http * con)
+{
+	if (!config.blz.http2.enabled || draining)
+	{
+		close_connection(con);
+		return;
+	}
+
+	h2_session *h2 = new h2_session(this, con);
+	con->session = h2;
+
+	h2->start();
+	h2->process();
+}
+
+/* "Upgrade: h2c" of a request with HTTP2-Settings, the request itself is answered on stream 1 */
+bool blizzard::server::upgrade_h2(http * con)
+{
+	const char *upgrade = con->get_request_header("Upgrade");
+	const char *settings = con->get_request_header("HTTP2-Settings");
+
+	if (!config.blz.http2.enabled || draining || 0 == upgrade || 0 == settings)
+	{
+		return false;
+	}
+
+	bool h2c = false;
+
+	for (const char *p = upgrade; *p && !h2c; )
+	{
+		p += strspn(p, " \t,");
+
+		size_t len = strcspn(p, " \t,");
+
+		h2c = 3 == len && 0 == strncasecmp(p, "h2c", 3);
+		p += len;
+	}
+
+	if (!h2c)
+	{
+		return false;
+	}
+
+	h2_session *h2 = new h2_session(this, con);
+	con->session = h2;
+
+	if (!h2->upgrade(settings))
+	{
+		log_warn("h2: bad HTTP2-Settings on fd %d, the request is served by HTTP/1", con->get_fd());
+
+		delete h2;
+		con->session = 0;
+
+		return false;
+	}
+
+	h2->process();
+
+	return true;
+}
+
+int blizzard::server::get_stats_format(const http *task) const
+{
+	const std::string& uri = config.blz.stats.uri;
+	const char *path = task->get_request_uri_path();
+
+	if (0 == path || 0 != strncmp(path, uri.c_str(), uri.size()))
+	{
+		return -1;
+	}
+
+	return stats_formatter::negotiate(path + uri.size(), task->get_request_header("Accept"));
+}
+
+void blizzard::server::report_route(http *con)
+{
+	const http::stage_times& t = con->times;
+
+	bool handled = 0 != t.easy_done;
+	uint64_t queue_wait = 0;
+	uint64_t handler = 0;
+
+	if (handled)
+	{
+		queue_wait = t.easy_pop - t.easy_push;
+		handler = t.easy_done - t.easy_pop;
+
+		if (t.hard_done)
+		{
+			queue_wait += t.hard_pop - t.hard_push;
+			handler += t.hard_done - t.hard_pop;
 		}
 	}
 
+	stats.report_route(con->route, con->get_response_status(), con->get_request_size(), con->get_response_size(), handled, queue_wait, handler);
+
+	if (con->svc)
+	{
+		stats.report_plugin(con->svc->idx, con->get_response_status(), con->get_request_size(), con->get_response_size(), handled, queue_wait, handler);
+	}
+}
+
+static void append_stage(std::string& line, const char *name, uint64_t base, uint64_t t)
+{
+	if (t)
+	{
+		coda_strappend(line, " %s=+%llu", name, (unsigned long long) (t - base));
+	}
+	else
+	{
+		coda_strappend(line, " %s=-", name);
+	}
+}
+
+void blizzard::server::log_slow_request(http *con)
+{
+	static const char *methods[] = {"UNDEF", "GET", "POST", "HEAD", "OPTIONS"};
+
+	const http::stage_times& t = con->times;
+
+	int method = con->get_request_method();
+	const char *path = con->get_request_uri_path();
+	const char *params = con->get_request_uri_params();
+
+	char ip [INET_ADDRSTRLEN];
+	struct in_addr in_ip = con->get_request_ip();
+	inet_ntop(AF_INET, &in_ip, ip, sizeof(ip));
+
+	char now [64];
+	time_t now_time = (time_t) ev_now(loop);
+	strftime(now, sizeof(now), "%Y-%m-%d %H:%M:%S", localtime(&now_time));
+
+	std::string line;
+
+	coda_strappend(line, "%s slow total_us=%llu ip=%s method=%s uri=%s%s%s status=%d path=%s"
+		, now
+		, (unsigned long long) (t.written - t.accepted)
+		, ip
+		, (0 <= method && method <= BLZ_METHOD_OPTIONS) ? methods[method] : methods[0]
+		, path ? path : "-"
+		, params && *params ? "?" : ""
+		, params && *params ? params : ""
+		, con->get_response_status()
+		, t.hard_push ? "easy+hard" : (t.easy_push ? "easy" : "event")
+	);
+
+	/* offsets from accept in usec, "-" for stages the request didn't pass */
+	append_stage(line, "accepted", t.accepted, t.accepted);
+	append_stage(line, "parsed", t.accepted, t.parsed);
+	append_stage(line, "easy_push", t.accepted, t.easy_push);
+	append_stage(line, "easy_pop", t.accepted, t.easy_pop);
+	append_stage(line, "easy_done", t.accepted, t.easy_done);
+	append_stage(line, "hard_push", t.accepted, t.hard_push);
+	append_stage(line, "hard_pop", t.accepted, t.hard_pop);
+	append_stage(line, "hard_done", t.accepted, t.hard_done);
+	append_stage(line, "done_push", t.accepted, t.done_push);
+	append_stage(line, "done_pop", t.accepted, t.done_pop);
+	append_stage(line, "written", t.accepted, t.written);
+
+	line += '\n';
+
+	slow_log.write(line.data(), line.size());
+}
+
+void blizzard::server::log_access(http *con)
+{
+	access_line.clear();
+	access_format.format(access_line, con, ev_now(loop));
+
+	access_log.write(access_line.data(), access_line.size());
+}
+
+void blizzard::server::capture(http *con)
+{
+	uint32_t sample = config.blz.capture.sample;
+
+	if (0 != capture_counter++ % sample)
+	{
+		return;
+	}
+
+	capture_buf.clear();
+	capture_request(capture_buf, con, sample);
+
+	capture_log.write(capture_buf.data(), capture_buf.size());
+}
+
+bool blizzard::server::serve_stats(http *con)
+{
+	int stats_format = get_stats_format(con);
+
+	if (0 > stats_format)
+	{
+		return false;
+	}
+
+	std::string out;
+	const char *params = con->get_request_uri_params();
+
+	stats_formatter *f = stats_formatter::create(stats_format, out);
+
+	std::vector<plugin_instance*> insts;
+	std::vector<const plugin_metrics*> metrics;
+
+	for (size_t k = 0; k < services.size(); k++)
+	{
+		insts.push_back(services[k]->factory.acquire());
+		metrics.push_back(&insts.back()->metrics);
+	}
+
+	stats.generate(*f, start_time, http_pool.allocated_pages(), http_pool.allocated_objects(), params && strstr(params, "buckets"), metrics);
+
+	for (size_t k = 0; k < insts.size(); k++)
+	{
+		plugin_factory::release(insts[k]);
+	}
+
+	con->set_response_status(200);
+	con->add_response_header("Content-type", f->content_type());
+	con->add_response_buffer(out.c_str(), out.size());
+
+	delete f;
+
+	return true;
+}
+
+bool blizzard::server::is_ready(std::string& state)
+{
+	const blz_config::BLZ::HEALTH& health = config.blz.health;
+
+	bool ready = !draining;
+	std::string queues;
+
+	/* the server is overloaded if any of the sections is */
+	for (size_t k = 0; k < services.size(); k++)
+	{
+		const service* svc = services[k];
+		const blz_config::BLZ::PLUGIN& plugin = svc->conf;
+
+		/* by default not ready at 80% of the queue limit, so balancers move traffic away before 503s */
+		size_t max_easy = health.max_easy_queue ? health.max_easy_queue : plugin.easy_queue_limit * 4 / 5;
+		size_t max_hard = health.max_hard_queue ? health.max_hard_queue : plugin.hard_queue_limit * 4 / 5;
+
+		size_t easy_len = svc->easy_queue_size();
+		size_t hard_len = svc->hard_queue_size();
+
+		ready = ready && (0 == max_easy || easy_len < max_easy) && (0 == max_hard || hard_len < max_hard);
+
+		const char *sep = 1 == services.size() ? "" : " ";
+		const char *name = 1 == services.size() ? "" : plugin.name.c_str();
+
+		coda_strappend(queues, "easy_queue%s%s %zu/%zu\nhard_queue%s%s %zu/%zu\n", sep, name, easy_len, max_easy, sep, name, hard_len, max_hard);
+	}
+
+	state.clear();
+	coda_strappend(state, "%s\n", draining ? "draining" : ready ? "ready" : "overloaded");
+	state += queues;
+
+	return ready;
+}
+
+bool blizzard::server::serve_health(http *con)
+{
+	const std::string& uri = config.blz.health.uri;
+	const char *path = con->get_request_uri_path();
+
+	if (uri.empty() || 0 == path || uri != path)
+	{
+		return false;
+	}
+
+	std::string state;
+	bool ready = is_ready(state);
+
+	con->set_response_status(ready ? 200 : 503);
+	con->add_response_header("Content-type", "text/plain");
+	con->add_response_buffer(state.c_str(), state.size());
+
 	return true;
 }
 
-void blizzard::server::easy_processing_loop()
+/* an idle thread prepares the plugin of the next instance and moves to the current one, so
+ * the replaced one isn't held */
+void blizzard::server::move_thread_plugin(service* svc, thread_plugin& tp)
 {
-	blz_plugin* plugin = factory.open_plugin();
+	plugin_instance* next = svc->next;
+
+	if (next && next != tp.prepared())
+	{
+		bool ok = tp.prepare(next);
+
+		warm_up_thread(svc, tp);
+		svc->report_prepared(ok);
+
+		return;
+	}
+
+	/* the reload failed */
+	if (tp.prepared() && tp.prepared() != next && !svc->factory.is_current(tp.prepared()))
+	{
+		tp.discard();
+	}
+
+	if (svc->factory.is_current(tp.held()))
+	{
+		return;
+	}
+
+	plugin_instance* inst = svc->factory.acquire();
+
+	tp.get(inst);
+
+	if (inst)
+	{
+		plugin_factory::release(inst);
+	}
+}
 
+void blizzard::server::easy_processing_loop(service* svc, thread_plugin& tp)
+{
 	http* task = 0;
 
-	if (pop_easy_or_wait(&task))
+	if (svc->pop_easy_or_wait(&task, tp))
 	{
+		blz_plugin* plugin = tp.get(task->plugin);
+
 		log_debug("blizzard::easy_loop_function.fd = %d", task->get_fd());
 
-		if (task->get_request_uri_path() == config.blz.stats.uri)
+		BLZ_PROBE3(plugin_enter, task->get_fd(), "easy", task->times.easy_pop);
+
+		int res = plugin ? plugin->easy(task) : BLZ_ERROR;
+
+		task->times.easy_done = monotonic_usec();
+		BLZ_PROBE5(plugin_exit, task->get_fd(), "easy", task->times.easy_pop, task->times.easy_done, res);
+		stats.report_stage_time(statistics::STAGE_EASY_RUN, task->times.easy_pop, task->times.easy_done);
+
+		switch (res)
 		{
-			std::string xml;
-			stats.generate_xml(xml, start_time, http_pool.allocated_pages(), http_pool.allocated_objects());
+		case BLZ_OK:
+			log_debug("easy_loop: processed %d", task->get_fd());
+			finish_response(task);
+			push_done(task);
+			break;
 
-			task->set_response_status(200);
+		case BLZ_ERROR:
+			log_error("easy thread reports error");
+			task->set_response_status(503);
 			task->add_response_header("Content-type", "text/plain");
-			task->add_response_buffer(xml.c_str(), xml.size());
+			task->add_response_buffer("easy loop error", strlen("easy loop error"));
 			push_done(task);
-		}
-		else
-		{
-			switch (plugin->easy(task))
-			{
-			case BLZ_OK:
-				log_debug("easy_loop: processed %d", task->get_fd());
-				push_done(task);
-				break;
-
-			case BLZ_ERROR:
-				log_error("easy thread reports error");
-				task->set_response_status(503);
-				task->add_response_header("Content-type", "text/plain");
-				task->add_response_buffer("easy loop error", strlen("easy loop error"));
-				push_done(task);
-				break;
+			break;
 
-			case BLZ_AGAIN:
-				log_debug("easy thread -> hard thread");
-				if (config.blz.plugin.hard_threads)
+		case BLZ_AGAIN:
+			log_debug("easy thread -> hard thread");
+			if (svc->conf.hard_threads)
+			{
+				if (svc->join_hard_flight(task))
 				{
-					bool ret = push_hard(task);
-					if (false == ret)
-					{
-						log_error("hard queue full: hard_queue_size == %d", config.blz.plugin.hard_queue_limit);
-						task->set_response_status(503);
-						task->add_response_header("Content-type", "text/plain");
-						task->add_response_buffer("hard queue filled!", strlen("hard queue filled!"));
-						push_done(task);
-					}
+					break;
 				}
-				else
+
+				bool ret = svc->push_hard(task);
+				if (false == ret)
 				{
-					log_error("easy-thread tried to enqueue hard-thread, but config::plugin::hard_threads = 0");
+					log_error("hard queue of %s full: hard_queue_size == %d", svc->conf.name.c_str(), svc->conf.hard_queue_limit);
 					task->set_response_status(503);
 					task->add_response_header("Content-type", "text/plain");
-					task->add_response_buffer("easy loop error", strlen("easy loop error"));
+					task->add_response_buffer("hard queue filled!", strlen("hard queue filled!"));
+					svc->finish_hard_flight(task);
 					push_done(task);
 				}
-				break;
 			}
+			else
+			{
+				log_error("easy-thread tried to enqueue hard-thread, but config::plugin::hard_threads = 0");
+				task->set_response_status(503);
+				task->add_response_header("Content-type", "text/plain");
+				task->add_response_buffer("easy loop error", strlen("easy loop error"));
+				push_done(task);
+			}
+			break;
 		}
 	}
+	else
+	{
+		move_thread_plugin(svc, tp);
+	}
 }
 
-void blizzard::server::hard_processing_loop()
+void blizzard::server::hard_processing_loop(service* svc, thread_plugin& tp)
 {
-	blz_plugin* plugin = factory.open_plugin();
-
 	http* task = 0;
 
-	if (pop_hard_or_wait(&task))
+	if (svc->pop_hard_or_wait(&task, tp))
 	{
+		blz_plugin* plugin = tp.get(task->plugin);
+
 		log_debug("blizzard::hard_loop_function.fd = %d", task->get_fd());
 
-		switch (plugin->hard(task))
+		BLZ_PROBE3(plugin_enter, task->get_fd(), "hard", task->times.hard_pop);
+
+		int res = plugin ? plugin->hard(task) : BLZ_ERROR;
+
+		task->times.hard_done = monotonic_usec();
+		BLZ_PROBE5(plugin_exit, task->get_fd(), "hard", task->times.hard_pop, task->times.hard_done, res);
+		stats.report_stage_time(statistics::STAGE_HARD_RUN, task->times.hard_pop, task->times.hard_done);
+
+		switch (res)
 		{
 		case BLZ_OK:
 			log_debug("hard_loop: processed %d", task->get_fd());
+			finish_response(task);
+			svc->finish_hard_flight(task);
 			push_done(task);
 			break;
 
@@ -649,29 +1730,39 @@ void blizzard::server::hard_processing_loop()
 			task->set_response_status(503);
 			task->add_response_header("Content-type", "text/plain");
 			task->add_response_buffer("hard loop error", strlen("hard loop error"));
+			svc->finish_hard_flight(task);
 			push_done(task);
 			break;
 		}
 	}
+	else
+	{
+		move_thread_plugin(svc, tp);
+	}
 }
 
-void blizzard::server::idle_processing_loop()
+void blizzard::server::idle_processing_loop(service* svc)
 {
-	if (0 > config.blz.plugin.idle_timeout)
+	plugin_factory& factory = svc->factory;
+
+	if (0 > svc->conf.idle_timeout)
 	{
+		int generation = factory.current_generation();
+
 		factory.idle();
 
-		while (0 == coda_terminate && 0 == coda_changecfg)
+		/* the plugin reloaded by SIGHUP gets its idle() too */
+		while (is_running() && generation == factory.current_generation())
 		{
 			sleep(1);
 		}
 	}
 	else
 	{
-		while (0 == coda_terminate && 0 == coda_changecfg)
+		while (is_running())
 		{
 			factory.idle();
-			coda_msleep(config.blz.plugin.idle_timeout);
+			coda_msleep(svc->conf.idle_timeout);
 		}
 	}
 }
@@ -683,7 +1774,7 @@ void *blizzard::event_loop_function(void *ptr)
 
 	try
 	{
-		while (0 == coda_terminate && 0 == coda_changecfg)
+		while (srv->is_running())
 		{
 			srv->event_processing_loop();
 		}
@@ -694,19 +1785,24 @@ void *blizzard::event_loop_function(void *ptr)
 		log_crit("event_loop: exception: %s", e.what());
 	}
 
+	/* the workers finish the queues while the event thread drains */
+	srv->stopped = true;
+
 	srv->fire_all_threads();
 	pthread_exit(NULL);
 }
 
 void *blizzard::easy_loop_function(void *ptr)
 {
-	blizzard::server *srv = (blizzard::server *) ptr;
+	blizzard::service *svc = (blizzard::service *) ptr;
+	blizzard::server *srv = svc->srv;
+	blizzard::thread_plugin tp(0 != svc->conf.per_thread);
 
 	try
 	{
-		while (0 == coda_terminate && 0 == coda_changecfg)
+		while (!srv->stopped)
 		{
-			srv->easy_processing_loop();
+			srv->easy_processing_loop(svc, tp);
 		}
 	}
 	catch (const std::exception &e)
@@ -715,19 +1811,23 @@ void *blizzard::easy_loop_function(void *ptr)
 		log_crit("easy_loop: exception: %s", e.what());
 	}
 
+	tp.reset();
+
 	srv->fire_all_threads();
 	pthread_exit(NULL);
 }
 
 void *blizzard::hard_loop_function(void *ptr)
 {
-	blizzard::server *srv = (blizzard::server *) ptr;
+	blizzard::service *svc = (blizzard::service *) ptr;
+	blizzard::server *srv = svc->srv;
+	blizzard::thread_plugin tp(0 != svc->conf.per_thread);
 
 	try
 	{
-		while (0 == coda_terminate && 0 == coda_changecfg)
+		while (!srv->stopped)
 		{
-			 srv->hard_processing_loop();
+			 srv->hard_processing_loop(svc, tp);
 		}
 	}
 	catch (const std::exception &e)
@@ -736,19 +1836,32 @@ void *blizzard::hard_loop_function(void *ptr)
 		log_crit("hard_loop: exception: %s", e.what());
 	}
 
+	tp.reset();
+
 	srv->fire_all_threads();
 	pthread_exit(NULL);
 }
 
-void *blizzard::idle_loop_function(void *ptr)
+void *blizzard::reload_loop_function(void *ptr)
 {
+	log_thread_name_set("BLZ_RELOAD");
 	blizzard::server *srv = (blizzard::server *) ptr;
 
+	srv->reload_plugin();
+
+	pthread_exit(NULL);
+}
+
+void *blizzard::idle_loop_function(void *ptr)
+{
+	blizzard::service *svc = (blizzard::service *) ptr;
+	blizzard::server *srv = svc->srv;
+
 	try
 	{
-		while (0 == coda_terminate && 0 == coda_changecfg)
+		while (srv->is_running())
 		{
-			srv->idle_processing_loop();
+			srv->idle_processing_loop(svc);
 		}
 	}
 	catch (const std::exception &e)
@@ -5,10 +5,18 @@
 #include <stdarg.h>
 #include <stdexcept>
 #include <deque>
+#include <string>
+#include <vector>
+#include "access_log.hpp"
+#include "async_log.hpp"
+#include "capture.hpp"
+#include "compressor.hpp"
 #include "config.hpp"
 #include "http.hpp"
 #include "pool.hpp"
 #include "plugin_factory.hpp"
+#include "response_cache.hpp"
+#include "service.hpp"
 #include "statistics.hpp"
 
 namespace blizzard {
@@ -19,78 +27,154 @@ struct server
 	enum {HINT_EPOLL_SIZE = 10000};
 	enum {EPOLL_EVENTS = 2000};
 
+	/* a listen socket, shared by the <plugin> sections with the same address */
+	struct listener
+	{
+		std::string ip;
+		std::string port;
+		int sock;
+		int connection_timeout;
+		/* <rpc_port>: the connections speak the binary framing of rpc_session */
+		bool rpc;
+		ev_io watcher;
+	};
+
 	pthread_t event_th;
-	std::vector<pthread_t> easy_th;
-	std::vector<pthread_t> hard_th;
-	pthread_t idle_th;
-
-	mutable pthread_mutex_t easy_proc_mutex;
-	mutable pthread_cond_t  easy_proc_cond;
-	mutable pthread_mutex_t hard_proc_mutex;
-	mutable pthread_cond_t  hard_proc_cond;
+	pthread_t reload_th;
+	bool event_started;
+
 	mutable pthread_mutex_t	done_mutex;
 
-	std::deque<http*> easy_queue;
-	std::deque<http*> hard_queue;
 	std::deque<http*> done_queue;
 
+	/* <plugin> sections in the order of the config */
+	std::vector<service*> services;
+	std::vector<listener> listeners;
+
 	pool_ns::pool<http, 5000> http_pool;
 
-	plugin_factory factory;
+	/* open connections, event thread only */
+	http* connections;
+
+	/* Graceful shutdown: the listen socket is closed, idle connections too, the requests in
+	 * progress are finished until <shutdown_timeout>, then the threads stop. */
+	bool draining;
+	ev_timer drain_timer;
+	uint64_t drain_start;
+	int drained;
+	int idle_closed;
+	volatile bool stopped;
+
+	response_cache cache;
+	compressor compression;
+	async_log slow_log;
+	async_log access_log;
+	access_log_format access_format;
+
+	/* the line is formatted here to avoid allocations per request, event thread only */
+	std::string access_line;
+
+	/* sampled raw requests for replay, event thread only */
+	async_log capture_log;
+	std::string capture_buf;
+	uint32_t capture_counter;
+
 	blz_config config;
+	std::string config_file;
+
+	/* <reload> is "hot": SIGHUP reloads the plugin in reload_th, the threads keep running */
+	bool hot_reload;
+	bool reload_started;
+	volatile bool reloading;
 
-	int incoming_sock;
 	int wakeup_isock;
 	int wakeup_osock;
 	int threads_num;
 	time_t start_time;
+	uint64_t warmup_started;
 
 	bool was_daemonized;
 
 	struct ev_loop *loop;
-	ev_io incoming_watcher;
 	ev_io wakeup_watcher;
 	ev_timer silent_timer;
 
-	void accept_connection();
+	void open_listener(const blz_config::BLZ::PLUGIN&, const std::string& port, bool rpc);
+	void accept_connection(int idx);
+	void link_connection(http*);
+	void free_connection(http*);
+	void close_connection(http*);
+
+	void start_drain();
+	void finish_drain();
 
 	/* network part */
 
 	void timeouts_kill_oldest();
 
 	void event_processing_loop();
-	void  easy_processing_loop();
-	void  hard_processing_loop();
-	void  idle_processing_loop();
+	void  easy_processing_loop(service*, thread_plugin&);
+	void  hard_processing_loop(service*, thread_plugin&);
+	void  move_thread_plugin(service*, thread_plugin&);
+	void  idle_processing_loop(service*);
 
 	/* pthreads part */
 
 	bool process(http *);
 
+	/* a parsed request of HTTP/1 or of an HTTP/2 stream: served at once or pushed to the queues */
+	void handle_request(http *);
+	void respond(http *);
+	void finish_request(http *);
+
+	void start_h2(http *);
+	bool upgrade_h2(http *);
+
 	void send_wakeup();
 	void recv_wakeup();
 
-	bool push_easy(http*);
-	bool pop_easy_or_wait(http**);
-
-	bool push_hard(http*);
-	bool pop_hard_or_wait(http**);
+	service* route_service(const http*) const;
 
 	bool push_done(http*);
 	bool pop_done(http**);
 
+	bool compress_response(http*);
+	void finish_response(http*);
+	int get_stats_format(const http*) const;
+
+	void warm_up(plugin_instance*, const blz_config::BLZ::PLUGIN&);
+	void warm_up_thread(service*, thread_plugin&);
+	void start_workers();
+	void prepare_services();
+	void start_listeners();
+
+	void report_route(http*);
+	void log_slow_request(http*);
+	void log_access(http*);
+	void capture(http*);
+	bool serve_stats(http*);
+	bool serve_health(http*);
+	bool is_ready(std::string& state);
+
 	void fire_all_threads();
 
+	bool is_running() const;
+	void start_reload();
+	void reload_plugin();
+
 	friend void* event_loop_function(void* ptr);
 	friend void*  easy_loop_function(void* ptr);
 	friend void*  hard_loop_function(void* ptr);
 	friend void*  idle_loop_function(void* ptr);
+	friend void*  reload_loop_function(void* ptr);
 
 public:
 	server();
 	~server();
 
 	void load_config(const char* xml_in, const char *pid_fn, bool is_daemon);
+	void open_listeners();
+	void close_listeners();
 	void prepare();
 	void finalize();
 
@@ -0,0 +1,325 @@
+#include <coda/daemon.h>
+#include <coda/logger.h>
+#include "probes.hpp"
+#include "server.hpp"
+#include "service.hpp"
+
+enum {PREPARE_POLL_MS = 10};
+
+blizzard::service::service(server* s, int i, const blz_config::BLZ::PLUGIN& pd)
+	: srv(s)
+	, idx(i)
+	, listener(-1)
+	, rpc_listener(-1)
+	, conf(pd)
+	, idle_started(false)
+	, loaded(0)
+	, next(0)
+	, prepared(0)
+	, failed(0)
+{
+	pthread_mutex_init(&flights_mutex, 0);
+
+	pthread_mutex_init(&easy_proc_mutex, 0);
+	pthread_mutex_init(&hard_proc_mutex, 0);
+
+	pthread_cond_init(&easy_proc_cond, 0);
+	pthread_cond_init(&hard_proc_cond, 0);
+}
+
+blizzard::service::~service()
+{
+	/* the start failed before the instance became current */
+	if (loaded)
+	{
+		factory.replace(loaded);
+	}
+
+	factory.stop_module();
+
+	pthread_cond_destroy(&hard_proc_cond);
+	pthread_cond_destroy(&easy_proc_cond);
+
+	pthread_mutex_destroy(&hard_proc_mutex);
+	pthread_mutex_destroy(&easy_proc_mutex);
+
+	pthread_mutex_destroy(&flights_mutex);
+}
+
+bool blizzard::service::push_easy(http * el)
+{
+	bool res = false;
+
+	pthread_mutex_lock(&easy_proc_mutex);
+
+	size_t eq_sz = easy_queue.size();
+	stats.report_easy_queue_len(idx, eq_sz);
+
+	if (conf.easy_queue_limit == 0 || (eq_sz < (size_t)conf.easy_queue_limit))
+	{
+		el->times.easy_push = monotonic_usec();
+		BLZ_PROBE2(easy_push, el->get_fd(), el->times.easy_push);
+
+		easy_queue.push_back(el);
+		res = true;
+
+		log_debug("push_easy %d", el->get_fd());
+
+		pthread_cond_signal(&easy_proc_cond);
+	}
+
+	pthread_mutex_unlock(&easy_proc_mutex);
+
+	return res;
+}
+
+bool blizzard::service::pop_easy_or_wait(http** el, const thread_plugin& tp)
+{
+	bool ret = false;
+
+	pthread_mutex_lock(&easy_proc_mutex);
+
+	size_t eq_sz = easy_queue.size();
+	stats.report_easy_queue_len(idx, eq_sz);
+
+	if (eq_sz)
+	{
+		*el = easy_queue.front();
+
+		log_debug("pop_easy %d", (*el)->get_fd());
+
+		easy_queue.pop_front();
+
+		(*el)->times.easy_pop = monotonic_usec();
+		BLZ_PROBE3(easy_pop, (*el)->get_fd(), (*el)->times.easy_push, (*el)->times.easy_pop);
+		stats.report_stage_time(statistics::STAGE_EASY_WAIT, (*el)->times.easy_push, (*el)->times.easy_pop);
+
+		ret = true;
+	}
+	else
+	{
+		log_debug("pop_easy : events empty");
+
+		if (!srv->stopped && factory.is_current(tp.held()) && next == tp.prepared())
+		{
+			pthread_cond_wait(&easy_proc_cond, &easy_proc_mutex);
+		}
+	}
+
+	pthread_mutex_unlock(&easy_proc_mutex);
+
+	return ret;
+}
+
+bool blizzard::service::push_hard(http * el)
+{
+	bool res = false;
+
+	pthread_mutex_lock(&hard_proc_mutex);
+
+	size_t hq_sz = hard_queue.size();
+	stats.report_hard_queue_len(idx, hq_sz);
+
+	if (conf.hard_queue_limit == 0 || (hq_sz < (size_t)conf.hard_queue_limit))
+	{
+		el->times.hard_push = monotonic_usec();
+		BLZ_PROBE2(hard_push, el->get_fd(), el->times.hard_push);
+
+		hard_queue.push_back(el);
+
+		res = true;
+
+		log_debug("push_hard %d", el->get_fd());
+
+		pthread_cond_signal(&hard_proc_cond);
+	}
+
+	pthread_mutex_unlock(&hard_proc_mutex);
+
+	return res;
+}
+
+bool blizzard::service::pop_hard_or_wait(http** el, const thread_plugin& tp)
+{
+	bool ret = false;
+
+	pthread_mutex_lock(&hard_proc_mutex);
+
+	size_t hq_sz = hard_queue.size();
+	stats.report_hard_queue_len(idx, hq_sz);
+
+	if (hq_sz)
+	{
+		*el = hard_queue.front();
+
+		log_debug("pop_hard %d", (*el)->get_fd());
+
+		hard_queue.pop_front();
+
+		(*el)->times.hard_pop = monotonic_usec();
+		BLZ_PROBE3(hard_pop, (*el)->get_fd(), (*el)->times.hard_push, (*el)->times.hard_pop);
+		stats.report_stage_time(statistics::STAGE_HARD_WAIT, (*el)->times.hard_push, (*el)->times.hard_pop);
+
+		ret = true;
+	}
+	else
+	{
+		log_debug("pop_hard : events empty");
+
+		if (!srv->stopped && factory.is_current(tp.held()) && next == tp.prepared())
+		{
+			pthread_cond_wait(&hard_proc_cond, &hard_proc_mutex);
+		}
+	}
+
+	pthread_mutex_unlock(&hard_proc_mutex);
+
+	return ret;
+}
+
+bool blizzard::service::join_hard_flight(http * el)
+{
+	if (0 == conf.hard_coalescing || !el->is_cacheable_request())
+	{
+		return false;
+	}
+
+	std::string key;
+	el->get_cache_key(key, srv->cache.get_key_headers());
+
+	bool follower = false;
+
+	pthread_mutex_lock(&flights_mutex);
+
+	std::map<std::string, std::vector<http*> >::iterator it = hard_flights.find(key);
+
+	if (it != hard_flights.end())
+	{
+		it->second.push_back(el);
+		follower = true;
+
+		log_debug("join_hard_flight %d", el->get_fd());
+	}
+	else
+	{
+		hard_flights[key];
+		el->flight_key.swap(key);
+	}
+
+	pthread_mutex_unlock(&flights_mutex);
+
+	stats.report_hard_flight(follower);
+
+	return follower;
+}
+
+void blizzard::service::finish_hard_flight(http * el)
+{
+	if (el->flight_key.empty())
+	{
+		return;
+	}
+
+	std::vector<http*> followers;
+
+	pthread_mutex_lock(&flights_mutex);
+
+	std::map<std::string, std::vector<http*> >::iterator it = hard_flights.find(el->flight_key);
+
+	if (it != hard_flights.end())
+	{
+		followers.swap(it->second);
+		hard_flights.erase(it);
+	}
+
+	pthread_mutex_unlock(&flights_mutex);
+
+	el->flight_key.clear();
+
+	for (size_t i = 0; i < followers.size(); i++)
+	{
+		followers[i]->clone_response(*el);
+		srv->push_done(followers[i]);
+	}
+}
+
+size_t blizzard::service::easy_queue_size() const
+{
+	pthread_mutex_lock(&easy_proc_mutex);
+	size_t len = easy_queue.size();
+	pthread_mutex_unlock(&easy_proc_mutex);
+
+	return len;
+}
+
+size_t blizzard::service::hard_queue_size() const
+{
+	pthread_mutex_lock(&hard_proc_mutex);
+	size_t len = hard_queue.size();
+	pthread_mutex_unlock(&hard_proc_mutex);
+
+	return len;
+}
+
+void blizzard::service::fire_threads()
+{
+	pthread_mutex_lock(&easy_proc_mutex);
+	pthread_cond_broadcast(&easy_proc_cond);
+	pthread_mutex_unlock(&easy_proc_mutex);
+
+	pthread_mutex_lock(&hard_proc_mutex);
+	pthread_cond_broadcast(&hard_proc_cond);
+	pthread_mutex_unlock(&hard_proc_mutex);
+}
+
+bool blizzard::service::prepare_threads(plugin_instance* inst)
+{
+	int threads = easy_th.size() + hard_th.size();
+
+	prepared = 0;
+	failed = 0;
+	__sync_synchronize();
+
+	next = inst;
+	fire_threads();
+
+	while (prepared + failed < threads && 0 == coda_terminate)
+	{
+		coda_msleep(PREPARE_POLL_MS);
+	}
+
+	if (prepared == threads)
+	{
+		return true;
+	}
+
+	/* the threads leave the prepared plugins */
+	next = 0;
+	fire_threads();
+
+	return false;
+}
+
+void blizzard::service::report_prepared(bool ok)
+{
+	__sync_add_and_fetch(ok ? &prepared : &failed, 1);
+}
+
+/* the threads which see no next instance keep the prepared plugin of the current one */
+blizzard::plugin_instance* blizzard::service::switch_threads()
+{
+	plugin_instance* old = factory.replace(next);
+
+	next = 0;
+	fire_threads();
+
+	return old;
+}
+
+/* the threads are joined, the connections are closed by the server */
+void blizzard::service::clear_queues()
+{
+	easy_queue.clear();
+	hard_queue.clear();
+	hard_flights.clear();
+}
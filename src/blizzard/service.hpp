@@ -0,0 +1,87 @@
+#ifndef __BLIZZARD_SERVICE_HPP__
+#define __BLIZZARD_SERVICE_HPP__
+
+#include <pthread.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "config.hpp"
+#include "plugin_factory.hpp"
+
+namespace blizzard {
+
+struct http;
+struct server;
+
+/* A <plugin> section: the plugin with its own easy and hard threads and queues. The event
+ * thread, connections, http pool, cache and logs belong to the server and are shared by
+ * all the sections. */
+
+struct service
+{
+	server* srv;
+	int idx;
+	int listener;
+	/* the listener of <rpc_port>, -1 if there is none */
+	int rpc_listener;
+
+	blz_config::BLZ::PLUGIN conf;
+	plugin_factory factory;
+
+	std::vector<pthread_t> easy_th;
+	std::vector<pthread_t> hard_th;
+	pthread_t idle_th;
+	bool idle_started;
+
+	mutable pthread_mutex_t easy_proc_mutex;
+	mutable pthread_cond_t  easy_proc_cond;
+	mutable pthread_mutex_t hard_proc_mutex;
+	mutable pthread_cond_t  hard_proc_cond;
+	mutable pthread_mutex_t flights_mutex;
+
+	std::deque<http*> easy_queue;
+	std::deque<http*> hard_queue;
+
+	/* hard requests in progress with the same key wait for their leader's response */
+	std::map<std::string, std::vector<http*> > hard_flights;
+
+	/* loaded on start, current after the threads prepare it */
+	plugin_instance* loaded;
+
+	/* the instance the threads prepare their plugins of, with the number of those done */
+	plugin_instance* volatile next;
+	volatile int prepared;
+	volatile int failed;
+
+	service(server* s, int i, const blz_config::BLZ::PLUGIN& pd);
+	~service();
+
+	/* a thread doesn't wait while the plugin it holds is not the current one or it has to
+	 * prepare the next one */
+	bool push_easy(http*);
+	bool pop_easy_or_wait(http**, const thread_plugin& tp);
+
+	bool push_hard(http*);
+	bool pop_hard_or_wait(http**, const thread_plugin& tp);
+
+	bool join_hard_flight(http*);
+	void finish_hard_flight(http*);
+
+	size_t easy_queue_size() const;
+	size_t hard_queue_size() const;
+
+	/* Start and hot reload: every easy and hard thread prepares its plugin of the instance in
+	 * itself before the instance serves. false if a thread fails or on termination, the
+	 * prepared plugins are discarded then; switch_threads() makes the instance current. */
+	bool prepare_threads(plugin_instance* inst);
+	void report_prepared(bool ok);
+	plugin_instance* switch_threads();
+
+	void fire_threads();
+	void clear_queues();
+};
+
+}
+
+#endif /* __BLIZZARD_SERVICE_HPP__ */
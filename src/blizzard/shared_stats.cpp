@@ -0,0 +1,127 @@
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <coda/error.hpp>
+#include "shared_stats.hpp"
+
+enum {READ_TRIES = 1000};
+
+blizzard::shared_stats::shared_stats()
+	: slots(0)
+	, slots_num(0)
+{
+}
+
+blizzard::shared_stats::~shared_stats()
+{
+	destroy();
+}
+
+void blizzard::shared_stats::create(int workers)
+{
+	destroy();
+
+	if (workers > MAX_WORKERS)
+	{
+		throw coda_error("%d workers, at most %d are supported", workers, (int) MAX_WORKERS);
+	}
+
+	/* anonymous shared mapping is inherited by fork(), pages are zeroed and touched by their workers only */
+	void *mem = mmap(NULL, workers * sizeof(slot), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (MAP_FAILED == mem)
+	{
+		throw coda_error("can't map shared stats of %d workers: %s", workers, coda_strerror(errno));
+	}
+
+	slots = (slot *) mem;
+	slots_num = workers;
+}
+
+void blizzard::shared_stats::destroy()
+{
+	if (slots)
+	{
+		munmap(slots, slots_num * sizeof(slot));
+
+		slots = 0;
+		slots_num = 0;
+	}
+}
+
+int blizzard::shared_stats::size() const
+{
+	return slots_num;
+}
+
+blizzard::shared_stats::slot *blizzard::shared_stats::get(int idx) const
+{
+	return slots + idx;
+}
+
+void blizzard::shared_stats::reset(int idx)
+{
+	slot *s = slots + idx;
+
+	/* a worker killed in publish() leaves seq odd, the slot is made even again here */
+	s->seq |= 1;
+	__sync_synchronize();
+
+	memset(&s->sum, 0, sizeof(s->sum));
+	s->warmed = 0;
+
+	for (int i = 0; i < statistics::STAGES_NUM; i++)
+	{
+		s->stages[i].reset();
+	}
+
+	for (int i = 0; i <= statistics::MAX_ROUTES; i++)
+	{
+		s->routes[i] = statistics::route_counters();
+	}
+
+	for (int i = 0; i < statistics::MAX_PLUGINS; i++)
+	{
+		s->plugins[i] = statistics::route_counters();
+	}
+
+	end_write(s);
+}
+
+void blizzard::shared_stats::begin_write(slot *s)
+{
+	s->seq++;
+	__sync_synchronize();
+}
+
+void blizzard::shared_stats::end_write(slot *s)
+{
+	__sync_synchronize();
+	s->seq++;
+}
+
+bool blizzard::shared_stats::begin_read(const slot *s, uint32_t& seq)
+{
+	/* the writer could die with seq odd, its slot is skipped until the master resets it */
+	for (int i = 0; (seq = s->seq) & 1; i++)
+	{
+		if (READ_TRIES == i || 0 == s->pid)
+		{
+			return false;
+		}
+
+		sched_yield();
+	}
+
+	__sync_synchronize();
+
+	return true;
+}
+
+bool blizzard::shared_stats::retry_read(const slot *s, uint32_t seq)
+{
+	__sync_synchronize();
+
+	return seq != s->seq;
+}
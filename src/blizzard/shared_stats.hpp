@@ -0,0 +1,65 @@
+#ifndef __BLIZZARD_SHARED_STATS_HPP__
+#define __BLIZZARD_SHARED_STATS_HPP__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "statistics.hpp"
+
+namespace blizzard {
+
+/* Stats of prefork workers: the master maps the segment before forking, every worker publishes
+ * its sums into its own slot once a second, and /stats of any worker adds up the slots of the
+ * others. A slot is written by one process only, readers copy it under a sequence counter. */
+
+class shared_stats
+{
+public:
+	enum {MAX_WORKERS = 64};
+
+	struct slot
+	{
+		/* odd while the worker writes the slot */
+		volatile uint32_t seq;
+
+		/* set by the master, pid is 0 while the worker isn't running */
+		volatile pid_t pid;
+		volatile uint32_t restarts;
+
+		/* set by the worker when the warm-up of its plugins is done */
+		volatile uint32_t warmed;
+
+		statistics::summary sum;
+		histogram stages[statistics::STAGES_NUM];
+		statistics::route_counters routes[statistics::MAX_ROUTES + 1];
+		statistics::route_counters plugins[statistics::MAX_PLUGINS];
+	};
+
+private:
+	slot *slots;
+	int slots_num;
+
+public:
+	shared_stats();
+	~shared_stats();
+
+	void create(int workers);
+	void destroy();
+
+	int size() const;
+	slot *get(int idx) const;
+
+	/* the sums of the slot are zeroed, its worker must not run */
+	void reset(int idx);
+
+	static void begin_write(slot *s);
+	static void end_write(slot *s);
+
+	/* the copy is consistent if it was taken between the same even values of seq; false if
+	 * the slot stays odd for too long or its worker is gone */
+	static bool begin_read(const slot *s, uint32_t& seq);
+	static bool retry_read(const slot *s, uint32_t seq);
+};
+
+}
+
+#endif /* __BLIZZARD_SHARED_STATS_HPP__ */
@@ -1,27 +1,113 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
+#include <new>
+#include <algorithm>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <coda/logger.h>
 #include <coda/string.hpp>
 #include "plugin.hpp"
+#include "mem_arena.hpp"
 #include "statistics.hpp"
+#include "plugin_metrics.hpp"
+#include "async_log.hpp"
+#include "shared_stats.hpp"
 
 #define MAX_TIME 1e10
 
+static const char *stage_names[blizzard::statistics::STAGES_NUM] = {
+	"parse",
+	"easy_wait",
+	"easy_run",
+	"hard_wait",
+	"hard_run",
+	"done_wait",
+	"write",
+	"total"
+};
+
+namespace {
+
+/* locks the shard only if it's shared by several threads */
+class shard_guard
+{
+	blizzard::statistics::shard *s;
+
+public:
+	shard_guard(blizzard::statistics::shard *sh) : s(sh)
+	{
+		if (s->shared) pthread_mutex_lock(&s->mutex);
+	}
+
+	~shard_guard()
+	{
+		if (s->shared) pthread_mutex_unlock(&s->mutex);
+	}
+};
+
+}
+
+blizzard::statistics::route_counters::route_counters()
+	: requests(0)
+	, bytes_in(0)
+	, bytes_out(0)
+{
+	memset(status, 0, sizeof(status));
+}
+
+void blizzard::statistics::route_counters::add(const route_counters &r)
+{
+	requests += r.requests;
+
+	for (int i = 0; i < 5; i++)
+	{
+		status[i] += r.status[i];
+	}
+
+	bytes_in += r.bytes_in;
+	bytes_out += r.bytes_out;
+
+	queue_wait.add(r.queue_wait);
+	handler.add(r.handler);
+}
+
+/* the period is 0 while the extremes are reset and is written after them, so a reader which
+ * sees the same period before and after reading them doesn't get the values of the reset */
+void blizzard::statistics::shard::start_period(uint32_t p)
+{
+	period = 0;
+	__sync_synchronize();
+
+	resp_time_min = MAX_TIME;
+	resp_time_max = 0;
+	easy_queue_max_len = 0;
+	hard_queue_max_len = 0;
+	done_queue_max_len = 0;
+	arena_max_used = 0;
+
+	__sync_synchronize();
+	period = p;
+}
+
 blizzard::statistics::statistics()
 {
+	memset(shards, 0, sizeof(shards));
+	shards_num = 0;
+	pthread_mutex_init(&shards_mutex, 0);
+	pthread_key_create(&shard_key, release_shard);
+
+	period = 1;
 	last_processed_time = time(0);
+	last_reqs_count = 0;
+	last_resp_time_total = 0;
 
-	c_reqs_count = 0;
-	c_resp_time_total = 0;
-	c_resp_time_min = MAX_TIME;
-	c_resp_time_max = 0;
-	c_easy_queue_max_len = 0;
-	c_hard_queue_max_len = 0;
-	c_done_queue_max_len = 0;
-	c_easy_queue_len = 0;
-	c_hard_queue_len = 0;
-	c_done_queue_len = 0;
+	memset((void *) easy_queue_len, 0, sizeof(easy_queue_len));
+	memset((void *) hard_queue_len, 0, sizeof(hard_queue_len));
+	done_queue_len = 0;
+	cache_entries = 0;
+	cache_bytes = 0;
 
 	p_resp_time_min = 0;
 	p_resp_time_avg = 0;
@@ -30,38 +116,376 @@ blizzard::statistics::statistics()
 	p_easy_queue_max_len = 0;
 	p_hard_queue_max_len = 0;
 	p_done_queue_max_len = 0;
+	p_arena_max_used = 0;
+
+	fine_snapshots.init(0);
+	coarse_snapshots.init(0);
+	ticks = 0;
+	pthread_mutex_init(&snapshots_mutex, 0);
+
+	shared = 0;
+	worker = 0;
+
+	warming = 0;
+	warmed = 0;
+	warmup_requests = 0;
+	warmup_errors = 0;
+	warmup_usec = 0;
+
+	set_windows("10 60");
+}
+
+blizzard::statistics::~statistics()
+{
+	pthread_key_delete(shard_key);
+
+	for (int i = 0; i < shards_num; i++)
+	{
+		pthread_mutex_destroy(&shards[i]->mutex);
+		delete [] shards[i]->routes;
+		delete [] shards[i]->plugins;
+		shards[i]->~shard();
+		free(shards[i]);
+	}
+
+	pthread_mutex_destroy(&shards_mutex);
+	pthread_mutex_destroy(&snapshots_mutex);
+}
+
+void blizzard::statistics::release_shard(void *ptr)
+{
+	shard *sh = (shard *) ptr;
+
+	if (!sh->shared)
+	{
+		/* the counters stay in place, the next thread taking the shard continues them */
+		__sync_synchronize();
+		sh->owned = false;
+	}
+}
+
+blizzard::statistics::shard *blizzard::statistics::get_shard()
+{
+	shard *sh = (shard *) pthread_getspecific(shard_key);
+
+	if (sh)
+	{
+		return sh;
+	}
+
+	pthread_mutex_lock(&shards_mutex);
+
+	for (int i = 0; i < shards_num; i++)
+	{
+		if (!shards[i]->owned && !shards[i]->shared)
+		{
+			sh = shards[i];
+			sh->owned = true;
+			break;
+		}
+	}
+
+	/* the threads which don't fit write the last shard under its mutex */
+	if (0 == sh && MAX_SHARDS == shards_num)
+	{
+		sh = shards[MAX_SHARDS - 1];
+	}
+
+	if (0 == sh)
+	{
+		void *mem = 0;
+
+		if (0 != posix_memalign(&mem, CACHE_LINE, sizeof(shard)))
+		{
+			throw std::bad_alloc();
+		}
+
+		/* the counters are zeroed, the histograms are constructed over them */
+		memset(mem, 0, sizeof(shard));
+		sh = new (mem) shard;
+
+		sh->start_period(0);
+		sh->owned = true;
+
+		/* the last one is left for all the threads which don't fit */
+		sh->shared = (MAX_SHARDS - 1 == shards_num);
+		pthread_mutex_init(&sh->mutex, 0);
+
+		shards[shards_num] = sh;
+		__sync_synchronize();
+		shards_num++;
+	}
+
+	pthread_mutex_unlock(&shards_mutex);
+
+	pthread_setspecific(shard_key, sh);
+
+	return sh;
+}
+
+void blizzard::statistics::sum_up(totals &t, uint32_t extremes_period)
+{
+	memset(&t, 0, sizeof(t));
+	t.resp_time_min = MAX_TIME;
+
+	int num = shards_num;
+
+	for (int i = 0; i < num; i++)
+	{
+		shard *sh = shards[i];
+
+		t.reqs_count += sh->reqs_count;
+		t.resp_time_total += sh->resp_time_total;
+		t.cache_hits += sh->cache_hits;
+		t.cache_misses += sh->cache_misses;
+		t.cache_evictions += sh->cache_evictions;
+		t.hard_flights += sh->hard_flights;
+		t.hard_coalesced += sh->hard_coalesced;
+		t.compressed_responses += sh->compressed_responses;
+		t.compressed_bytes_in += sh->compressed_bytes_in;
+		t.compressed_bytes_out += sh->compressed_bytes_out;
+		t.h2_connections += sh->h2_connections;
+		t.h2_upgrades += sh->h2_upgrades;
+		t.h2_streams += sh->h2_streams;
+		t.h2_resets += sh->h2_resets;
+		t.rpc_connections += sh->rpc_connections;
+		t.rpc_requests += sh->rpc_requests;
+		t.rpc_errors += sh->rpc_errors;
+
+		if (sh->arena_peak_used > t.arena_peak_used) t.arena_peak_used = sh->arena_peak_used;
+
+		if (sh->period != extremes_period)
+		{
+			continue;
+		}
+
+		__sync_synchronize();
+
+		double resp_time_min = sh->resp_time_min;
+		double resp_time_max = sh->resp_time_max;
+		size_t easy_queue_max_len = sh->easy_queue_max_len;
+		size_t hard_queue_max_len = sh->hard_queue_max_len;
+		size_t done_queue_max_len = sh->done_queue_max_len;
+		size_t arena_max_used = sh->arena_max_used;
+
+		/* the owner started the next period meanwhile */
+		__sync_synchronize();
+
+		if (sh->period != extremes_period)
+		{
+			continue;
+		}
+
+		if (resp_time_min < t.resp_time_min) t.resp_time_min = resp_time_min;
+		if (resp_time_max > t.resp_time_max) t.resp_time_max = resp_time_max;
+		if (easy_queue_max_len > t.easy_queue_max_len) t.easy_queue_max_len = easy_queue_max_len;
+		if (hard_queue_max_len > t.hard_queue_max_len) t.hard_queue_max_len = hard_queue_max_len;
+		if (done_queue_max_len > t.done_queue_max_len) t.done_queue_max_len = done_queue_max_len;
+		if (arena_max_used > t.arena_max_used) t.arena_max_used = arena_max_used;
+	}
+}
+
+void blizzard::statistics::sum_up_stages(histogram *h)
+{
+	for (int j = 0; j < STAGES_NUM; j++)
+	{
+		h[j].reset();
+	}
+
+	int num = shards_num;
+
+	for (int i = 0; i < num; i++)
+	{
+		for (int j = 0; j < STAGES_NUM; j++)
+		{
+			h[j].add(shards[i]->stages[j]);
+		}
+	}
+}
+
+/* the snapshot of the start of the longest window and the latest one are both kept */
+void blizzard::statistics::snapshot_ring::init(int longest)
+{
+	step = longest / MAX_SNAPSHOTS + 1;
+	stages.assign(longest ? (size_t) (longest / step + 2) * STAGES_NUM : 0, histogram());
+}
+
+/* the snapshot taken last by the tick, 0 without windows */
+blizzard::histogram *blizzard::statistics::snapshot_ring::at(uint64_t tick)
+{
+	size_t ring = stages.size() / STAGES_NUM;
+
+	return ring ? &stages[(tick / step % ring) * STAGES_NUM] : 0;
+}
+
+void blizzard::statistics::set_windows(const char *list)
+{
+	std::vector<int> w;
+	int max_fine = 0;
+	int max_coarse = 0;
+
+	const char *p = list;
+
+	while (*p)
+	{
+		char *end;
+		long v = strtol(p, &end, 10);
+
+		if (end == p)
+		{
+			p++;
+			continue;
+		}
+
+		p = end;
+
+		if (0 < v && v <= MAX_WINDOW)
+		{
+			w.push_back((int) v);
+
+			int& longest = v <= MAX_SNAPSHOTS ? max_fine : max_coarse;
+			if (v > longest) longest = v;
+		}
+	}
+
+	pthread_mutex_lock(&snapshots_mutex);
+
+	windows.swap(w);
+	fine_snapshots.init(max_fine);
+	coarse_snapshots.init(max_coarse);
+	ticks = 0;
+
+	pthread_mutex_unlock(&snapshots_mutex);
+}
+
+void blizzard::statistics::set_routes(const char *list)
+{
+	if (routes.empty())
+	{
+		routes.push_back("other");
+	}
+
+	const char *delims = " \t,;";
+	const char *p = list;
+
+	while (*p)
+	{
+		p += strspn(p, delims);
+		size_t len = strcspn(p, delims);
+
+		if (0 == len)
+		{
+			break;
+		}
+
+		std::string route (p, len);
+		p += len;
+
+		if (std::find(routes.begin() + 1, routes.end(), route) != routes.end())
+		{
+			continue;
+		}
+
+		if (routes.size() > MAX_ROUTES)
+		{
+			log_warn("too many routes in <stats:routes>, '%s' is counted as other", route.c_str());
+			continue;
+		}
+
+		routes.push_back(route);
+	}
+}
+
+int blizzard::statistics::match_route(const char *path) const
+{
+	int route = 0;
+	size_t route_len = 0;
+
+	if (0 == path)
+	{
+		return route;
+	}
+
+	/* the longest matching prefix */
+	for (size_t i = 1; i < routes.size(); i++)
+	{
+		const std::string &r = routes[i];
+
+		if (r.size() > route_len && 0 == strncmp(path, r.c_str(), r.size()))
+		{
+			route = i;
+			route_len = r.size();
+		}
+	}
+
+	return route;
+}
+
+void blizzard::statistics::take_snapshot()
+{
+	pthread_mutex_lock(&snapshots_mutex);
+
+	if (!fine_snapshots.stages.empty() || !coarse_snapshots.stages.empty())
+	{
+		histogram *fine = fine_snapshots.at(ticks);
+		histogram *coarse = 0 == ticks % coarse_snapshots.step ? coarse_snapshots.at(ticks) : 0;
+		histogram *h = fine ? fine : coarse;
+
+		if (h)
+		{
+			sum_up_stages(h);
+			add_workers_stages(h);
+		}
+
+		if (fine && coarse)
+		{
+			std::copy(fine, fine + STAGES_NUM, coarse);
+		}
+
+		ticks++;
+	}
+
+	pthread_mutex_unlock(&snapshots_mutex);
 }
 
 void blizzard::statistics::process(double now)
 {
+	take_snapshot();
+
 	if (TIME_DELTA < now - last_processed_time)
 	{
-		if (c_reqs_count)
+		/* shards notice the new period on their next report, the finished one is read meanwhile */
+		uint32_t finished = period;
+		period = finished + 1;
+
+		totals t;
+		sum_up(t, finished);
+
+		uint64_t reqs_count = t.reqs_count - last_reqs_count;
+
+		/* the requests of the period could be counted by shards which didn't report extremes */
+		if (reqs_count && MAX_TIME != t.resp_time_min)
 		{
-			p_resp_time_min = c_resp_time_min;
-			p_resp_time_avg = c_resp_time_total / c_reqs_count;
-			p_resp_time_max = c_resp_time_max;
+			p_resp_time_min = t.resp_time_min;
+			p_resp_time_avg = (t.resp_time_total - last_resp_time_total) / reqs_count;
+			p_resp_time_max = t.resp_time_max;
 		}
 		else
 		{
 			p_resp_time_min = 0;
 			p_resp_time_avg = 0;
-			p_resp_time_avg = 0;
+			p_resp_time_max = 0;
 		}
 
-		p_avg_rps = (double) c_reqs_count / TIME_DELTA;
+		p_avg_rps = (double) reqs_count / TIME_DELTA;
 
-		p_easy_queue_max_len = c_easy_queue_max_len;
-		p_hard_queue_max_len = c_hard_queue_max_len;
-		p_done_queue_max_len = c_done_queue_max_len;
+		p_easy_queue_max_len = t.easy_queue_max_len;
+		p_hard_queue_max_len = t.hard_queue_max_len;
+		p_done_queue_max_len = t.done_queue_max_len;
+		p_arena_max_used = t.arena_max_used;
 
-		c_reqs_count = 0;
-		c_resp_time_total = 0;
-		c_resp_time_min = MAX_TIME;
-		c_resp_time_max = 0;
-		c_easy_queue_max_len = 0;
-		c_hard_queue_max_len = 0;
-		c_done_queue_max_len = 0;
+		last_reqs_count = t.reqs_count;
+		last_resp_time_total = t.resp_time_total;
 
 		last_processed_time = now;
 	}
@@ -69,80 +493,848 @@ void blizzard::statistics::process(double now)
 
 void blizzard::statistics::report_response_time(double t)
 {
-	c_resp_time_total += t;
-	if (t > c_resp_time_max) c_resp_time_max = t;
-	if (t < c_resp_time_min) c_resp_time_min = t;
-	c_reqs_count++;
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	if (sh->period != period) sh->start_period(period);
+
+	sh->resp_time_total += t;
+	if (t > sh->resp_time_max) sh->resp_time_max = t;
+	if (t < sh->resp_time_min) sh->resp_time_min = t;
+	sh->reqs_count++;
 }
 
-void blizzard::statistics::report_easy_queue_len(size_t len)
+void blizzard::statistics::report_easy_queue_len(int plugin, size_t len)
 {
-	c_easy_queue_len = len;
-	if (len > c_easy_queue_max_len) c_easy_queue_max_len = len;
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	if (sh->period != period) sh->start_period(period);
+
+	easy_queue_len[plugin] = len;
+	if (len > sh->easy_queue_max_len) sh->easy_queue_max_len = len;
 }
 
-void blizzard::statistics::report_hard_queue_len(size_t len)
+void blizzard::statistics::report_hard_queue_len(int plugin, size_t len)
 {
-	c_hard_queue_len = len;
-	if (len > c_hard_queue_max_len) c_hard_queue_max_len = len;
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	if (sh->period != period) sh->start_period(period);
+
+	hard_queue_len[plugin] = len;
+	if (len > sh->hard_queue_max_len) sh->hard_queue_max_len = len;
 }
 
 void blizzard::statistics::report_done_queue_len(size_t len)
 {
-	c_done_queue_len = len;
-	if (len > c_done_queue_max_len) c_done_queue_max_len = len;
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	if (sh->period != period) sh->start_period(period);
+
+	done_queue_len = len;
+	if (len > sh->done_queue_max_len) sh->done_queue_max_len = len;
 }
 
-void blizzard::statistics::generate_xml(std::string &xml, time_t start_time, uint32_t pages_in_http_pool, uint32_t objects_in_http_pool)
+void blizzard::statistics::report_arena_usage(size_t used)
 {
-	time_t uptime = time(NULL) - start_time;
+	shard *sh = get_shard();
+	shard_guard guard(sh);
 
-	struct rusage usage;
-	::getrusage(RUSAGE_SELF, &usage);
+	if (sh->period != period) sh->start_period(period);
 
-	coda_strappend(xml,
-		"<blizzard_stats>\n"
-		"	<blizzard_version>" BLZ_VERSION "</blizzard_version>\n"
-		"	<uptime>%d</uptime>\n"
-		"	<rps>%.3f</rps>\n"
-		"	<queues>\n"
-		"		<easy>%" PRIuMAX "</easy>\n"
-		"		<max_easy>%" PRIuMAX "</max_easy>\n"
-		"		<hard>%" PRIuMAX "</hard>\n"
-		"		<max_hard>%" PRIuMAX "</max_hard>\n"
-		"		<done>%" PRIuMAX "</done>\n"
-		"		<max_done>%" PRIuMAX "</max_done>\n"
-		"	</queues>\n"
-		"	<response_time>\n"
-		"		<min>%.6f</min>\n"
-		"		<avg>%.6f</avg>\n"
-		"		<max>%.6f</max>\n"
-		"	</response_time>\n"
-		"	<mem_allocator>\n"
-		"		<pages>%" PRIu32 "</pages>\n"
-		"		<objects>%" PRIu32 "</objects>\n"
-		"	</mem_allocator>\n"
-		"	<rusage>\n"
-		"		<utime>%d</utime>\n"
-		"		<stime>%d</stime>\n"
-		"	</rusage>\n"
-		"</blizzard_stats>\n"
-
-		, (int) uptime
-		, p_avg_rps
-		, (uintmax_t) c_easy_queue_len
-		, (uintmax_t) p_easy_queue_max_len
-		, (uintmax_t) c_hard_queue_len
-		, (uintmax_t) p_hard_queue_max_len
-		, (uintmax_t) c_done_queue_len
-		, (uintmax_t) p_done_queue_max_len
-		, p_resp_time_min
-		, p_resp_time_avg
-		, p_resp_time_max
-		, pages_in_http_pool
-		, objects_in_http_pool
-		, (int) usage.ru_utime.tv_sec
-		, (int) usage.ru_stime.tv_sec
-	);
+	if (used > sh->arena_max_used) sh->arena_max_used = used;
+	if (used > sh->arena_peak_used) sh->arena_peak_used = used;
 }
 
+void blizzard::statistics::report_cache_lookup(bool hit)
+{
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	if (hit) sh->cache_hits++;
+	else sh->cache_misses++;
+}
+
+void blizzard::statistics::report_cache_eviction()
+{
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	sh->cache_evictions++;
+}
+
+void blizzard::statistics::report_cache_size(size_t entries, size_t bytes)
+{
+	cache_entries = entries;
+	cache_bytes = bytes;
+}
+
+void blizzard::statistics::report_hard_flight(bool coalesced)
+{
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	if (coalesced) sh->hard_coalesced++;
+	else sh->hard_flights++;
+}
+
+void blizzard::statistics::report_compression(size_t bytes_in, size_t bytes_out)
+{
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	sh->compressed_responses++;
+	sh->compressed_bytes_in += bytes_in;
+	sh->compressed_bytes_out += bytes_out;
+}
+
+void blizzard::statistics::report_h2_connection(bool upgraded)
+{
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	sh->h2_connections++;
+	if (upgraded) sh->h2_upgrades++;
+}
+
+void blizzard::statistics::report_h2_stream()
+{
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	sh->h2_streams++;
+}
+
+void blizzard::statistics::report_h2_reset()
+{
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	sh->h2_resets++;
+}
+
+void blizzard::statistics::report_rpc_connection()
+{
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	sh->rpc_connections++;
+}
+
+void blizzard::statistics::report_rpc_request()
+{
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	sh->rpc_requests++;
+}
+
+void blizzard::statistics::report_rpc_error()
+{
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	sh->rpc_errors++;
+}
+
+void blizzard::statistics::report_stage_time(int stage, uint64_t from, uint64_t to)
+{
+	if (from && to >= from)
+	{
+		shard *sh = get_shard();
+		shard_guard guard(sh);
+
+		sh->stages[stage].record_local(to - from);
+	}
+}
+
+void blizzard::statistics::generate_latency(stats_formatter &f, bool with_buckets)
+{
+	std::vector<histogram> current (STAGES_NUM);
+	sum_up_stages(&current[0]);
+	add_workers_stages(&current[0]);
+
+	f.open("latency", "usec");
+
+	pthread_mutex_lock(&snapshots_mutex);
+
+	for (int i = 0; i < STAGES_NUM; i++)
+	{
+		f.open(stage_names[i]);
+
+		for (size_t w = 0; w < windows.size(); w++)
+		{
+			histogram h = current[i];
+
+			/* the latest snapshot is (ticks - 1), the window starts (windows[w]) ticks before it */
+			if (ticks > (uint64_t) windows[w])
+			{
+				snapshot_ring& snapshots = windows[w] <= MAX_SNAPSHOTS ? fine_snapshots : coarse_snapshots;
+				h.sub(snapshots.at(ticks - 1 - windows[w])[i]);
+			}
+
+			f.percentiles(windows[w], h);
+		}
+
+		f.percentiles(0, current[i]);
+
+		f.close();
+	}
+
+	pthread_mutex_unlock(&snapshots_mutex);
+
+	f.close();
+
+	if (!with_buckets && !f.needs_buckets())
+	{
+		return;
+	}
+
+	/* cumulative form: number of values less or equal to bucket's upper bound, empty buckets are skipped */
+
+	f.open("latency_buckets", "usec");
+
+	for (int i = 0; i < STAGES_NUM; i++)
+	{
+		f.buckets(stage_names[i], current[i]);
+	}
+
+	f.close();
+}
+
+void blizzard::statistics::count_request(bool of_plugins, int idx, int status, size_t bytes_in, size_t bytes_out, bool handled, uint64_t queue_wait, uint64_t handler)
+{
+	shard *sh = get_shard();
+	shard_guard guard(sh);
+
+	route_counters *&counters = of_plugins ? sh->plugins : sh->routes;
+
+	/* the reader of stats sees the array only after it is constructed */
+	if (0 == counters)
+	{
+		route_counters *created = new route_counters [of_plugins ? (int) MAX_PLUGINS : MAX_ROUTES + 1];
+
+		__sync_synchronize();
+		counters = created;
+	}
+
+	route_counters &r = counters[idx];
+
+	r.requests++;
+
+	if (100 <= status && status < 600)
+	{
+		r.status[status / 100 - 1]++;
+	}
+
+	r.bytes_in += bytes_in;
+	r.bytes_out += bytes_out;
+
+	if (handled)
+	{
+		r.queue_wait.record_local(queue_wait);
+		r.handler.record_local(handler);
+	}
+}
+
+void blizzard::statistics::report_route(int route, int status, size_t bytes_in, size_t bytes_out, bool handled, uint64_t queue_wait, uint64_t handler)
+{
+	if (routes.size() < 2)
+	{
+		return;
+	}
+
+	count_request(false, route, status, bytes_in, bytes_out, handled, queue_wait, handler);
+}
+
+void blizzard::statistics::report_plugin(int plugin, int status, size_t bytes_in, size_t bytes_out, bool handled, uint64_t queue_wait, uint64_t handler)
+{
+	if (plugins.size() < 2)
+	{
+		return;
+	}
+
+	count_request(true, plugin, status, bytes_in, bytes_out, handled, queue_wait, handler);
+}
+
+void blizzard::statistics::sum_up_counters(std::vector<route_counters> &sums, bool of_plugins)
+{
+	int num = shards_num;
+
+	for (int i = 0; i < num; i++)
+	{
+		const route_counters *counters = of_plugins ? shards[i]->plugins : shards[i]->routes;
+
+		if (0 == counters)
+		{
+			continue;
+		}
+
+		for (size_t j = 0; j < sums.size(); j++)
+		{
+			sums[j].add(counters[j]);
+		}
+	}
+}
+
+void blizzard::statistics::generate_counters(stats_formatter &f, const route_counters &r, bool with_buckets)
+{
+	f.integer("requests", stats_formatter::COUNTER, r.requests);
+	f.integer("status_1xx", stats_formatter::COUNTER, r.status[0]);
+	f.integer("status_2xx", stats_formatter::COUNTER, r.status[1]);
+	f.integer("status_3xx", stats_formatter::COUNTER, r.status[2]);
+	f.integer("status_4xx", stats_formatter::COUNTER, r.status[3]);
+	f.integer("status_5xx", stats_formatter::COUNTER, r.status[4]);
+	f.integer("bytes_in", stats_formatter::COUNTER, r.bytes_in);
+	f.integer("bytes_out", stats_formatter::COUNTER, r.bytes_out);
+
+	f.open("queue_wait", "usec");
+	f.percentiles(0, r.queue_wait);
+	if (with_buckets || f.needs_buckets()) f.buckets("buckets", r.queue_wait);
+	f.close();
+
+	f.open("handler", "usec");
+	f.percentiles(0, r.handler);
+	if (with_buckets || f.needs_buckets()) f.buckets("buckets", r.handler);
+	f.close();
+}
+
+void blizzard::statistics::generate_routes(stats_formatter &f, bool with_buckets)
+{
+	if (routes.size() < 2)
+	{
+		return;
+	}
+
+	std::vector<route_counters> sums (routes.size());
+
+	sum_up_counters(sums, false);
+	add_workers_counters(sums, false);
+
+	f.open("routes");
+
+	for (size_t j = 0; j < sums.size(); j++)
+	{
+		f.open_item("route", "path", routes[j].c_str());
+		generate_counters(f, sums[j], with_buckets);
+		f.close();
+	}
+
+	f.close();
+}
+
+void blizzard::statistics::generate_plugins(stats_formatter &f, const summary &s, bool with_buckets, const std::vector<const plugin_metrics*> &metrics)
+{
+	if (plugins.size() < 2)
+	{
+		if (!metrics.empty())
+		{
+			metrics[0]->format(f);
+		}
+
+		return;
+	}
+
+	std::vector<route_counters> sums (plugins.size());
+
+	sum_up_counters(sums, true);
+	add_workers_counters(sums, true);
+
+	f.open("plugins");
+
+	for (size_t j = 0; j < sums.size(); j++)
+	{
+		f.open_item("plugin", "name", plugins[j].c_str());
+
+		f.open("queues");
+		f.integer("easy", stats_formatter::GAUGE, s.plugin_easy_queue_len[j]);
+		f.integer("hard", stats_formatter::GAUGE, s.plugin_hard_queue_len[j]);
+		f.close();
+
+		generate_counters(f, sums[j], with_buckets);
+
+		if (j < metrics.size())
+		{
+			metrics[j]->format(f);
+		}
+
+		f.close();
+	}
+
+	f.close();
+}
+
+void blizzard::statistics::set_plugins(const std::vector<std::string> &names)
+{
+	plugins = names;
+}
+
+void blizzard::statistics::add_log(const char *name, const async_log *log)
+{
+	logs.push_back(std::make_pair(std::string(name), log));
+}
+
+void blizzard::statistics::clear_logs()
+{
+	logs.clear();
+}
+
+void blizzard::statistics::generate_logs(stats_formatter &f)
+{
+	if (logs.empty())
+	{
+		return;
+	}
+
+	f.open("logs");
+
+	for (size_t i = 0; i < logs.size(); i++)
+	{
+		const async_log *log = logs[i].second;
+
+		f.open_item("log", "name", logs[i].first.c_str());
+		f.integer("written", stats_formatter::COUNTER, log->get_written());
+		f.integer("dropped", stats_formatter::COUNTER, log->get_drops());
+		f.integer("sampled_out", stats_formatter::COUNTER, log->get_sampled_out());
+		f.close();
+	}
+
+	f.close();
+}
+
+void blizzard::statistics::generate_warmup(stats_formatter &f)
+{
+	f.open("warmup");
+	f.integer("warming", stats_formatter::GAUGE, warming);
+	f.integer("warmed", stats_formatter::GAUGE, warmed);
+	f.integer("requests", stats_formatter::GAUGE, warmup_requests);
+	f.integer("errors", stats_formatter::GAUGE, warmup_errors);
+	f.integer("time_ms", stats_formatter::GAUGE, warmup_usec / 1000);
+	f.close();
+}
+
+void blizzard::statistics::summary::add(const summary &s)
+{
+	if (s.rps)
+	{
+		if (0 == rps || s.t.resp_time_min < t.resp_time_min) t.resp_time_min = s.t.resp_time_min;
+		if (s.t.resp_time_max > t.resp_time_max) t.resp_time_max = s.t.resp_time_max;
+
+		resp_time_avg = (resp_time_avg * rps + s.resp_time_avg * s.rps) / (rps + s.rps);
+		rps += s.rps;
+	}
+
+	t.reqs_count += s.t.reqs_count;
+	t.cache_hits += s.t.cache_hits;
+	t.cache_misses += s.t.cache_misses;
+	t.cache_evictions += s.t.cache_evictions;
+	t.hard_flights += s.t.hard_flights;
+	t.hard_coalesced += s.t.hard_coalesced;
+	t.compressed_responses += s.t.compressed_responses;
+	t.compressed_bytes_in += s.t.compressed_bytes_in;
+	t.compressed_bytes_out += s.t.compressed_bytes_out;
+	t.h2_connections += s.t.h2_connections;
+	t.h2_upgrades += s.t.h2_upgrades;
+	t.h2_streams += s.t.h2_streams;
+	t.h2_resets += s.t.h2_resets;
+	t.rpc_connections += s.t.rpc_connections;
+	t.rpc_requests += s.t.rpc_requests;
+	t.rpc_errors += s.t.rpc_errors;
+
+	if (s.t.arena_peak_used > t.arena_peak_used) t.arena_peak_used = s.t.arena_peak_used;
+	if (s.t.easy_queue_max_len > t.easy_queue_max_len) t.easy_queue_max_len = s.t.easy_queue_max_len;
+	if (s.t.hard_queue_max_len > t.hard_queue_max_len) t.hard_queue_max_len = s.t.hard_queue_max_len;
+	if (s.t.done_queue_max_len > t.done_queue_max_len) t.done_queue_max_len = s.t.done_queue_max_len;
+	if (s.t.arena_max_used > t.arena_max_used) t.arena_max_used = s.t.arena_max_used;
+
+	easy_queue_len += s.easy_queue_len;
+	hard_queue_len += s.hard_queue_len;
+	done_queue_len += s.done_queue_len;
+
+	for (int i = 0; i < MAX_PLUGINS; i++)
+	{
+		plugin_easy_queue_len[i] += s.plugin_easy_queue_len[i];
+		plugin_hard_queue_len[i] += s.plugin_hard_queue_len[i];
+	}
+
+	cache_entries += s.cache_entries;
+	cache_bytes += s.cache_bytes;
+	pool_pages += s.pool_pages;
+	pool_objects += s.pool_objects;
+	arena_blocks += s.arena_blocks;
+	arena_free_blocks += s.arena_free_blocks;
+	utime += s.utime;
+	stime += s.stime;
+}
+
+void blizzard::statistics::summarize(summary &s, uint32_t pool_pages, uint32_t pool_objects)
+{
+	struct rusage usage;
+	::getrusage(RUSAGE_SELF, &usage);
+
+	sum_up(s.t, 0);
+
+	s.t.resp_time_min = p_resp_time_min;
+	s.t.resp_time_max = p_resp_time_max;
+	s.t.easy_queue_max_len = p_easy_queue_max_len;
+	s.t.hard_queue_max_len = p_hard_queue_max_len;
+	s.t.done_queue_max_len = p_done_queue_max_len;
+	s.t.arena_max_used = p_arena_max_used;
+
+	s.rps = p_avg_rps;
+	s.resp_time_avg = p_resp_time_avg;
+	s.easy_queue_len = 0;
+	s.hard_queue_len = 0;
+
+	for (int i = 0; i < MAX_PLUGINS; i++)
+	{
+		s.plugin_easy_queue_len[i] = easy_queue_len[i];
+		s.plugin_hard_queue_len[i] = hard_queue_len[i];
+
+		s.easy_queue_len += easy_queue_len[i];
+		s.hard_queue_len += hard_queue_len[i];
+	}
+
+	s.done_queue_len = done_queue_len;
+	s.cache_entries = cache_entries;
+	s.cache_bytes = cache_bytes;
+	s.pool_pages = pool_pages;
+	s.pool_objects = pool_objects;
+	s.arena_blocks = mem_arena::allocated_blocks();
+	s.arena_free_blocks = mem_arena::pooled_blocks();
+	s.utime = usage.ru_utime.tv_sec;
+	s.stime = usage.ru_stime.tv_sec;
+}
+
+void blizzard::statistics::set_shared(const shared_stats *segment, int worker_idx)
+{
+	shared = segment;
+	worker = worker_idx;
+}
+
+void blizzard::statistics::start_warmup()
+{
+	warming = 1;
+	warmup_requests = 0;
+	warmup_errors = 0;
+	warmup_usec = 0;
+}
+
+/* the threads of <plugin:per_thread> warm up their instances at once */
+void blizzard::statistics::report_warmup(uint32_t requests, uint32_t errors)
+{
+	__sync_fetch_and_add(&warmup_requests, requests);
+	__sync_fetch_and_add(&warmup_errors, errors);
+}
+
+void blizzard::statistics::finish_warmup(uint64_t usec)
+{
+	warmup_usec = usec;
+	warmed = 1;
+	warming = 0;
+
+	/* the master and the other workers see that the worker is ready */
+	if (shared)
+	{
+		shared->get(worker)->warmed = 1;
+	}
+}
+
+void blizzard::statistics::publish(uint32_t pool_pages, uint32_t pool_objects)
+{
+	if (0 == shared)
+	{
+		return;
+	}
+
+	summary s;
+	summarize(s, pool_pages, pool_objects);
+
+	std::vector<histogram> stages (STAGES_NUM);
+	sum_up_stages(&stages[0]);
+
+	shared_stats::slot *sl = shared->get(worker);
+
+	shared_stats::begin_write(sl);
+
+	sl->sum = s;
+
+	for (int i = 0; i < STAGES_NUM; i++)
+	{
+		sl->stages[i] = stages[i];
+	}
+
+	std::vector<route_counters> sums (routes.size());
+	sum_up_counters(sums, false);
+	std::copy(sums.begin(), sums.end(), sl->routes);
+
+	sums.assign(plugins.size(), route_counters());
+	sum_up_counters(sums, true);
+	std::copy(sums.begin(), sums.end(), sl->plugins);
+
+	shared_stats::end_write(sl);
+}
+
+void blizzard::statistics::add_workers(summary &s)
+{
+	if (0 == shared)
+	{
+		return;
+	}
+
+	for (int i = 0; i < shared->size(); i++)
+	{
+		const shared_stats::slot *sl = shared->get(i);
+
+		if (i == worker || 0 == sl->pid)
+		{
+			continue;
+		}
+
+		summary copy;
+		uint32_t seq;
+		bool read = false;
+
+		while (!read && shared_stats::begin_read(sl, seq))
+		{
+			copy = sl->sum;
+			read = !shared_stats::retry_read(sl, seq);
+		}
+
+		if (read)
+		{
+			s.add(copy);
+		}
+	}
+}
+
+void blizzard::statistics::add_workers_stages(histogram *h)
+{
+	if (0 == shared)
+	{
+		return;
+	}
+
+	std::vector<histogram> copy (STAGES_NUM);
+
+	for (int i = 0; i < shared->size(); i++)
+	{
+		const shared_stats::slot *sl = shared->get(i);
+
+		if (i == worker || 0 == sl->pid)
+		{
+			continue;
+		}
+
+		uint32_t seq;
+		bool read = false;
+
+		while (!read && shared_stats::begin_read(sl, seq))
+		{
+			for (int j = 0; j < STAGES_NUM; j++)
+			{
+				copy[j] = sl->stages[j];
+			}
+
+			read = !shared_stats::retry_read(sl, seq);
+		}
+
+		if (!read)
+		{
+			continue;
+		}
+
+		for (int j = 0; j < STAGES_NUM; j++)
+		{
+			h[j].add(copy[j]);
+		}
+	}
+}
+
+void blizzard::statistics::add_workers_counters(std::vector<route_counters> &sums, bool of_plugins)
+{
+	if (0 == shared)
+	{
+		return;
+	}
+
+	std::vector<route_counters> copy (sums.size());
+
+	for (int i = 0; i < shared->size(); i++)
+	{
+		const shared_stats::slot *sl = shared->get(i);
+
+		if (i == worker || 0 == sl->pid)
+		{
+			continue;
+		}
+
+		uint32_t seq;
+		bool read = false;
+
+		while (!read && shared_stats::begin_read(sl, seq))
+		{
+			const route_counters *counters = of_plugins ? sl->plugins : sl->routes;
+
+			for (size_t j = 0; j < copy.size(); j++)
+			{
+				copy[j] = counters[j];
+			}
+
+			read = !shared_stats::retry_read(sl, seq);
+		}
+
+		if (!read)
+		{
+			continue;
+		}
+
+		for (size_t j = 0; j < sums.size(); j++)
+		{
+			sums[j].add(copy[j]);
+		}
+	}
+}
+
+void blizzard::statistics::generate_workers(stats_formatter &f)
+{
+	if (0 == shared)
+	{
+		return;
+	}
+
+	f.open("workers");
+
+	for (int i = 0; i < shared->size(); i++)
+	{
+		const shared_stats::slot *sl = shared->get(i);
+
+		/* a slot left in the middle of a write by a dead worker shows zeros */
+		uint64_t requests = 0;
+		double rps = 0;
+		uint32_t seq;
+		bool read = false;
+
+		while (!read && shared_stats::begin_read(sl, seq))
+		{
+			requests = sl->sum.t.reqs_count;
+			rps = sl->sum.rps;
+
+			read = !shared_stats::retry_read(sl, seq);
+		}
+
+		if (!read)
+		{
+			requests = 0;
+			rps = 0;
+		}
+
+		char id [16];
+		snprintf(id, sizeof(id), "%d", i);
+
+		f.open_item("worker", "id", id);
+		f.integer("pid", stats_formatter::GAUGE, sl->pid);
+		f.integer("restarts", stats_formatter::COUNTER, sl->restarts);
+		f.integer("warmed", stats_formatter::GAUGE, sl->warmed);
+		f.integer("requests", stats_formatter::COUNTER, requests);
+		f.real("rps", stats_formatter::GAUGE, rps, 3);
+		f.close();
+	}
+
+	f.close();
+}
+
+void blizzard::statistics::generate(stats_formatter &f, time_t start_time, uint32_t pages_in_http_pool, uint32_t objects_in_http_pool, bool with_buckets, const std::vector<const plugin_metrics*> &metrics)
+{
+	time_t uptime = time(NULL) - start_time;
+
+	summary s;
+	summarize(s, pages_in_http_pool, objects_in_http_pool);
+	add_workers(s);
+
+	const totals &t = s.t;
+
+	double coalescing_ratio = t.hard_flights + t.hard_coalesced ? t.hard_coalesced / (double) (t.hard_flights + t.hard_coalesced) : 0;
+
+	f.begin("blizzard_stats");
+
+	f.info("blizzard_version", BLZ_VERSION);
+	f.integer("uptime", stats_formatter::GAUGE, uptime, "uptime in seconds");
+	f.real("rps", stats_formatter::GAUGE, s.rps, 3, "requests per second");
+
+	f.open("queues");
+	f.integer("easy", stats_formatter::GAUGE, s.easy_queue_len);
+	f.integer("max_easy", stats_formatter::GAUGE, t.easy_queue_max_len);
+	f.integer("hard", stats_formatter::GAUGE, s.hard_queue_len);
+	f.integer("max_hard", stats_formatter::GAUGE, t.hard_queue_max_len);
+	f.integer("done", stats_formatter::GAUGE, s.done_queue_len);
+	f.integer("max_done", stats_formatter::GAUGE, t.done_queue_max_len);
+	f.close();
+
+	f.open("response_time");
+	f.real("min", stats_formatter::GAUGE, t.resp_time_min, 6);
+	f.real("avg", stats_formatter::GAUGE, s.resp_time_avg, 6);
+	f.real("max", stats_formatter::GAUGE, t.resp_time_max, 6);
+	f.close();
+
+	f.open("mem_allocator");
+	f.integer("pages", stats_formatter::GAUGE, s.pool_pages);
+	f.integer("objects", stats_formatter::GAUGE, s.pool_objects);
+	f.close();
+
+	f.open("arena");
+	f.integer("max_used", stats_formatter::GAUGE, t.arena_max_used);
+	f.integer("peak_used", stats_formatter::GAUGE, t.arena_peak_used);
+	f.integer("blocks", stats_formatter::GAUGE, s.arena_blocks);
+	f.integer("free_blocks", stats_formatter::GAUGE, s.arena_free_blocks);
+	f.close();
+
+	f.open("cache");
+	f.integer("hits", stats_formatter::COUNTER, t.cache_hits);
+	f.integer("misses", stats_formatter::COUNTER, t.cache_misses);
+	f.integer("evictions", stats_formatter::COUNTER, t.cache_evictions);
+	f.integer("entries", stats_formatter::GAUGE, s.cache_entries);
+	f.integer("bytes", stats_formatter::GAUGE, s.cache_bytes);
+	f.close();
+
+	f.open("coalescing");
+	f.integer("leaders", stats_formatter::COUNTER, t.hard_flights);
+	f.integer("followers", stats_formatter::COUNTER, t.hard_coalesced);
+	f.real("ratio", stats_formatter::GAUGE, coalescing_ratio, 3);
+	f.close();
+
+	f.open("compression");
+	f.integer("responses", stats_formatter::COUNTER, t.compressed_responses);
+	f.integer("bytes_in", stats_formatter::COUNTER, t.compressed_bytes_in);
+	f.integer("bytes_out", stats_formatter::COUNTER, t.compressed_bytes_out);
+	f.close();
+
+	f.open("http2");
+	f.integer("connections", stats_formatter::COUNTER, t.h2_connections);
+	f.integer("upgrades", stats_formatter::COUNTER, t.h2_upgrades);
+	f.integer("streams", stats_formatter::COUNTER, t.h2_streams);
+	f.integer("resets", stats_formatter::COUNTER, t.h2_resets);
+	f.close();
+
+	f.open("rpc");
+	f.integer("connections", stats_formatter::COUNTER, t.rpc_connections);
+	f.integer("requests", stats_formatter::COUNTER, t.rpc_requests);
+	f.integer("errors", stats_formatter::COUNTER, t.rpc_errors);
+	f.close();
+
+	f.open("rusage");
+	f.integer("utime", stats_formatter::COUNTER, s.utime);
+	f.integer("stime", stats_formatter::COUNTER, s.stime);
+	f.close();
+
+	generate_latency(f, with_buckets);
+	generate_routes(f, with_buckets);
+	generate_logs(f);
+	generate_warmup(f);
+	generate_workers(f);
+	generate_plugins(f, s, with_buckets, metrics);
+
+	f.end();
+}
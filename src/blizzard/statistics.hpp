@@ -3,45 +3,296 @@
 
 #include <stdint.h>
 #include <time.h>
+#include <pthread.h>
 #include <string>
+#include <utility>
+#include <vector>
+#include "histogram.hpp"
+#include "stats_format.hpp"
 
 namespace blizzard {
 
+class plugin_metrics;
+class async_log;
+class shared_stats;
+
 struct statistics
 {
 	enum {TIME_DELTA = 4};
+	enum {MAX_WINDOW = 3600};
+
+	/* windows up to this are exact, longer ones share snapshots taken every
+	 * longest / MAX_SNAPSHOTS + 1 seconds */
+	enum {MAX_SNAPSHOTS = 120};
+	enum {MAX_SHARDS = 1024};
+	enum {CACHE_LINE = 64};
+	enum {MAX_ROUTES = 64};
+	enum {MAX_PLUGINS = 16};
+
+	enum stage
+	{
+		STAGE_PARSE,
+		STAGE_EASY_WAIT,
+		STAGE_EASY_RUN,
+		STAGE_HARD_WAIT,
+		STAGE_HARD_RUN,
+		STAGE_DONE_WAIT,
+		STAGE_WRITE,
+		STAGE_TOTAL,
+		STAGES_NUM
+	};
+
+	/* counters of a route (prefix of URI path), route 0 is for all the other requests;
+	 * also of a plugin if there are several */
+	struct route_counters
+	{
+		uint64_t requests;
+		uint64_t status[5];
+		uint64_t bytes_in;
+		uint64_t bytes_out;
+		histogram queue_wait;
+		histogram handler;
+
+		route_counters();
+		void add(const route_counters &r);
+	};
+
+	/* Counters of one thread: only the owner writes them, so no atomics are needed on the hot path,
+	 * and shards don't share cache lines. Readers sum the shards up. */
+
+	struct shard
+	{
+		/* monotonic counters, values of a period are their deltas */
+		volatile uint64_t reqs_count;
+		volatile double resp_time_total;
+		volatile uint64_t cache_hits;
+		volatile uint64_t cache_misses;
+		volatile uint64_t cache_evictions;
+		volatile uint64_t hard_flights;
+		volatile uint64_t hard_coalesced;
+		volatile uint64_t compressed_responses;
+		volatile uint64_t compressed_bytes_in;
+		volatile uint64_t compressed_bytes_out;
+		volatile uint64_t h2_connections;
+		volatile uint64_t h2_upgrades;
+		volatile uint64_t h2_streams;
+		volatile uint64_t h2_resets;
+		volatile uint64_t rpc_connections;
+		volatile uint64_t rpc_requests;
+		volatile uint64_t rpc_errors;
+		volatile size_t arena_peak_used;
+
+		/* extremes of the period, the owner resets them when it notices the next period */
+		volatile uint32_t period;
+		volatile double resp_time_min;
+		volatile double resp_time_max;
+		volatile size_t easy_queue_max_len;
+		volatile size_t hard_queue_max_len;
+		volatile size_t done_queue_max_len;
+		volatile size_t arena_max_used;
+
+		histogram stages[STAGES_NUM];
+
+		/* MAX_ROUTES + 1, allocated by the first report of a route */
+		route_counters *routes;
+
+		/* MAX_PLUGINS, allocated by the first report of a plugin */
+		route_counters *plugins;
+
+		/* a shard is shared under the mutex only if there are more than MAX_SHARDS threads */
+		bool shared;
+		bool owned;
+		pthread_mutex_t mutex;
+
+		void start_period(uint32_t p);
+	};
+
+	/* sums of all shards */
+	struct totals
+	{
+		uint64_t reqs_count;
+		double resp_time_total;
+		double resp_time_min;
+		double resp_time_max;
+		uint64_t cache_hits;
+		uint64_t cache_misses;
+		uint64_t cache_evictions;
+		uint64_t hard_flights;
+		uint64_t hard_coalesced;
+		uint64_t compressed_responses;
+		uint64_t compressed_bytes_in;
+		uint64_t compressed_bytes_out;
+		uint64_t h2_connections;
+		uint64_t h2_upgrades;
+		uint64_t h2_streams;
+		uint64_t h2_resets;
+		uint64_t rpc_connections;
+		uint64_t rpc_requests;
+		uint64_t rpc_errors;
+		size_t arena_peak_used;
+		size_t easy_queue_max_len;
+		size_t hard_queue_max_len;
+		size_t done_queue_max_len;
+		size_t arena_max_used;
+	};
+
+	/* values of /stats besides latency and routes, a prefork worker publishes its own for the others */
+	struct summary
+	{
+		totals t;  /* extremes are of the last finished period */
+		double rps;
+		double resp_time_avg;
+		uint64_t easy_queue_len;
+		uint64_t hard_queue_len;
+		uint64_t done_queue_len;
+		uint64_t plugin_easy_queue_len[MAX_PLUGINS];
+		uint64_t plugin_hard_queue_len[MAX_PLUGINS];
+		uint64_t cache_entries;
+		uint64_t cache_bytes;
+		uint64_t pool_pages;
+		uint64_t pool_objects;
+		uint64_t arena_blocks;
+		uint64_t arena_free_blocks;
+		uint64_t utime;
+		uint64_t stime;
+
+		void add(const summary &s);
+	};
+
+	/* cumulative stage histograms of every step-th second, STAGES_NUM per snapshot */
+	struct snapshot_ring
+	{
+		int step;
+		std::vector<histogram> stages;
+
+		void init(int longest);
+		histogram *at(uint64_t tick);
+	};
 
+	shard *shards [MAX_SHARDS];
+	volatile int shards_num;
+	pthread_mutex_t shards_mutex;
+	pthread_key_t shard_key;
+
+	volatile uint32_t period;
 	double last_processed_time;
+	uint64_t last_reqs_count;
+	double last_resp_time_total;
 
-	volatile int c_reqs_count;
-	volatile double c_resp_time_total;
-	volatile double c_resp_time_min;
-	volatile double c_resp_time_max;
-	volatile size_t c_easy_queue_max_len;
-	volatile size_t c_hard_queue_max_len;
-	volatile size_t c_done_queue_max_len;
-	volatile size_t c_easy_queue_len;
-	volatile size_t c_hard_queue_len;
-	volatile size_t c_done_queue_len;
+	/* last values set under the queue locks or in the event thread */
+	volatile size_t easy_queue_len[MAX_PLUGINS];
+	volatile size_t hard_queue_len[MAX_PLUGINS];
+	volatile size_t done_queue_len;
+	volatile size_t cache_entries;
+	volatile size_t cache_bytes;
 
+	/* values of the last finished period, written by the event thread */
 	volatile double p_resp_time_min;
 	volatile double p_resp_time_avg;
 	volatile double p_resp_time_max;
 	volatile double p_avg_rps;
-	volatile size_t p_easy_queue_max_len; 
-	volatile size_t p_hard_queue_max_len; 
-	volatile size_t p_done_queue_max_len;  
+	volatile size_t p_easy_queue_max_len;
+	volatile size_t p_hard_queue_max_len;
+	volatile size_t p_done_queue_max_len;
+	volatile size_t p_arena_max_used;
+
+	/* prefixes of routes, only added by reconfiguration, so the indices stay valid;
+	 * used in the event thread only */
+	std::vector<std::string> routes;
+
+	/* names of <plugin> sections, counted separately if there are several */
+	std::vector<std::string> plugins;
+
+	/* snapshots for windowed percentiles: every second for the windows up to MAX_SNAPSHOTS,
+	 * coarser for the longer ones, which start up to a step earlier */
+	snapshot_ring fine_snapshots;
+	snapshot_ring coarse_snapshots;
+	std::vector<int> windows;
+	uint64_t ticks;
+	pthread_mutex_t snapshots_mutex;
+
+	/* logs written in background, registered while the event thread doesn't run */
+	std::vector<std::pair<std::string, const async_log*> > logs;
+
+	/* prefork: slots of all the workers and the index of this one */
+	const shared_stats *shared;
+	int worker;
+
+	/* warm-up of the plugins before start or reload, 1 while it runs */
+	volatile int warming;
+	volatile int warmed;
+	volatile uint32_t warmup_requests;
+	volatile uint32_t warmup_errors;
+	volatile uint64_t warmup_usec;
+
+	shard *get_shard();
+	static void release_shard(void *ptr);
+
+	void sum_up(totals &t, uint32_t extremes_period);
+	void sum_up_stages(histogram *h);
+	void summarize(summary &s, uint32_t pool_pages, uint32_t pool_objects);
+
+	/* sums of the other workers are added, nothing is done without prefork */
+	void add_workers(summary &s);
+	void add_workers_stages(histogram *h);
+	void add_workers_counters(std::vector<route_counters> &sums, bool of_plugins);
+
+	void sum_up_counters(std::vector<route_counters> &sums, bool of_plugins);
+	void count_request(bool of_plugins, int idx, int status, size_t bytes_in, size_t bytes_out, bool handled, uint64_t queue_wait, uint64_t handler);
+
+	void take_snapshot();
+	void generate_latency(stats_formatter &f, bool with_buckets);
+	void generate_counters(stats_formatter &f, const route_counters &r, bool with_buckets);
+	void generate_routes(stats_formatter &f, bool with_buckets);
+	void generate_plugins(stats_formatter &f, const summary &s, bool with_buckets, const std::vector<const plugin_metrics*> &metrics);
+	void generate_logs(stats_formatter &f);
+	void generate_workers(stats_formatter &f);
+	void generate_warmup(stats_formatter &f);
 
 public:
 	statistics();
+	~statistics();
+
+	void set_windows(const char *list);
+	void set_routes(const char *list);
+	void set_plugins(const std::vector<std::string> &names);
+
+	void add_log(const char *name, const async_log *log);
+	void clear_logs();
+
+	void set_shared(const shared_stats *segment, int worker_idx);
+	void publish(uint32_t pool_pages, uint32_t pool_objects);
+
+	int match_route(const char *path) const;
+
+	/* the results of the sections are added up between start and finish */
+	void start_warmup();
+	void report_warmup(uint32_t requests, uint32_t errors);
+	void finish_warmup(uint64_t usec);
 
 	void process(double now);
 	void report_response_time(double t);
-	void report_easy_queue_len(size_t len);
-	void report_hard_queue_len(size_t len);
-	void report_done_queue_len(size_t len); 
+	void report_easy_queue_len(int plugin, size_t len);
+	void report_hard_queue_len(int plugin, size_t len);
+	void report_done_queue_len(size_t len);
+	void report_arena_usage(size_t used);
+	void report_cache_lookup(bool hit);
+	void report_cache_eviction();
+	void report_cache_size(size_t entries, size_t bytes);
+	void report_hard_flight(bool coalesced);
+	void report_compression(size_t bytes_in, size_t bytes_out);
+	void report_h2_connection(bool upgraded);
+	void report_h2_stream();
+	void report_h2_reset();
+	void report_rpc_connection();
+	void report_rpc_request();
+	void report_rpc_error();
+	void report_stage_time(int stage, uint64_t from, uint64_t to);
+	void report_route(int route, int status, size_t bytes_in, size_t bytes_out, bool handled, uint64_t queue_wait, uint64_t handler);
+	void report_plugin(int plugin, int status, size_t bytes_in, size_t bytes_out, bool handled, uint64_t queue_wait, uint64_t handler);
 
-	void generate_xml(std::string &xml, time_t start_time, uint32_t pages_in_http_pool, uint32_t objects_in_http_pool);
+	/* metrics of every plugin */
+	void generate(stats_formatter &f, time_t start_time, uint32_t pages_in_http_pool, uint32_t objects_in_http_pool, bool with_buckets, const std::vector<const plugin_metrics*> &metrics);
 };
 
 } /* namespace blizzard */
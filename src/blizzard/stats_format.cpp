@@ -0,0 +1,678 @@
+#include <string.h>
+#include <inttypes.h>
+#include <coda/string.hpp>
+#include "stats_format.hpp"
+
+namespace {
+
+const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+const char *quantile_names[] = {"p50", "p90", "p99", "p999"};
+const int quantiles_num = sizeof(quantiles) / sizeof(quantiles[0]);
+
+void window_name(char *buf, size_t sz, int window)
+{
+	if (window)
+	{
+		snprintf(buf, sz, "last_%ds", window);
+	}
+	else
+	{
+		snprintf(buf, sz, "total");
+	}
+}
+
+class xml_formatter : public blizzard::stats_formatter
+{
+	std::vector<std::string> path;
+
+	void indent()
+	{
+		out.append(path.size(), '\t');
+	}
+
+	void escape(const char *value)
+	{
+		for (const char *p = value; *p; p++)
+		{
+			switch (*p)
+			{
+			case '<': out += "&lt;"; break;
+			case '>': out += "&gt;"; break;
+			case '&': out += "&amp;"; break;
+			case '"': out += "&quot;"; break;
+			default: out += *p;
+			}
+		}
+	}
+
+public:
+	xml_formatter(std::string &o) : stats_formatter(o) {}
+
+	const char *content_type() const
+	{
+		return "text/plain";
+	}
+
+	void begin(const char *root)
+	{
+		coda_strappend(out, "<%s>\n", root);
+		path.push_back(root);
+	}
+
+	void end()
+	{
+		while (!path.empty())
+		{
+			close();
+		}
+	}
+
+	void open(const char *group, const char *unit)
+	{
+		indent();
+
+		if (unit)
+		{
+			coda_strappend(out, "<%s unit=\"%s\">\n", group, unit);
+		}
+		else
+		{
+			coda_strappend(out, "<%s>\n", group);
+		}
+
+		path.push_back(group);
+	}
+
+	void open_item(const char *group, const char *label, const char *value)
+	{
+		indent();
+
+		coda_strappend(out, "<%s %s=\"", group, label);
+		escape(value);
+		out += "\">\n";
+
+		path.push_back(group);
+	}
+
+	void close()
+	{
+		std::string group = path.back();
+		path.pop_back();
+
+		indent();
+		coda_strappend(out, "</%s>\n", group.c_str());
+	}
+
+	void info(const char *name, const char *value)
+	{
+		indent();
+		coda_strappend(out, "<%s>%s</%s>\n", name, value, name);
+	}
+
+	void integer(const char *name, int, uint64_t value, const char *)
+	{
+		indent();
+		coda_strappend(out, "<%s>%" PRIu64 "</%s>\n", name, value, name);
+	}
+
+	void real(const char *name, int, double value, int precision, const char *)
+	{
+		indent();
+		coda_strappend(out, "<%s>%.*f</%s>\n", name, precision, value, name);
+	}
+
+	void percentiles(int window, const blizzard::histogram &h)
+	{
+		char name [32];
+		window_name(name, sizeof(name), window);
+
+		indent();
+		coda_strappend(out, "<%s count=\"%" PRIu64 "\"", name, h.count());
+
+		for (int i = 0; i < quantiles_num; i++)
+		{
+			coda_strappend(out, " %s=\"%" PRIu64 "\"", quantile_names[i], h.percentile(quantiles[i]));
+		}
+
+		out += "/>\n";
+	}
+
+	void buckets(const char *name, const blizzard::histogram &h)
+	{
+		open(name, 0);
+
+		uint64_t n = 0;
+
+		for (int b = 0; b < blizzard::histogram::BUCKETS; b++)
+		{
+			if (h.counts[b])
+			{
+				n += h.counts[b];
+
+				indent();
+				coda_strappend(out, "<bucket le=\"%" PRIu64 "\">%" PRIu64 "</bucket>\n", blizzard::histogram::bucket_max(b), n);
+			}
+		}
+
+		close();
+	}
+};
+
+class json_formatter : public blizzard::stats_formatter
+{
+	std::vector<bool> first;
+
+	void separate()
+	{
+		if (!first.back())
+		{
+			out += ',';
+		}
+
+		first.back() = false;
+
+		out += '\n';
+		out.append(first.size(), '\t');
+	}
+
+	void key(const char *name)
+	{
+		separate();
+
+		out += '"';
+		out += name;
+		out += "\": ";
+	}
+
+	void string(const char *value)
+	{
+		out += '"';
+
+		for (const char *p = value; *p; p++)
+		{
+			if ('"' == *p || '\\' == *p)
+			{
+				out += '\\';
+				out += *p;
+			}
+			else if ((unsigned char) *p < 0x20)
+			{
+				coda_strappend(out, "\\u%04x", (unsigned char) *p);
+			}
+			else
+			{
+				out += *p;
+			}
+		}
+
+		out += '"';
+	}
+
+public:
+	json_formatter(std::string &o) : stats_formatter(o) {}
+
+	const char *content_type() const
+	{
+		return "application/json";
+	}
+
+	void begin(const char *)
+	{
+		out += '{';
+		first.push_back(true);
+	}
+
+	void end()
+	{
+		while (!first.empty())
+		{
+			close();
+		}
+
+		out += '\n';
+	}
+
+	void open(const char *group, const char *unit)
+	{
+		key(group);
+		out += '{';
+		first.push_back(true);
+
+		if (unit)
+		{
+			info("unit", unit);
+		}
+	}
+
+	/* items are keyed by the label value: "routes": {"/api": {...}} */
+	void open_item(const char *, const char *, const char *value)
+	{
+		separate();
+
+		string(value);
+		out += ": {";
+		first.push_back(true);
+	}
+
+	void close()
+	{
+		first.pop_back();
+
+		out += '\n';
+		out.append(first.size(), '\t');
+		out += '}';
+	}
+
+	void info(const char *name, const char *value)
+	{
+		key(name);
+		string(value);
+	}
+
+	void integer(const char *name, int, uint64_t value, const char *)
+	{
+		key(name);
+		coda_strappend(out, "%" PRIu64, value);
+	}
+
+	void real(const char *name, int, double value, int precision, const char *)
+	{
+		key(name);
+		coda_strappend(out, "%.*f", precision, value);
+	}
+
+	void percentiles(int window, const blizzard::histogram &h)
+	{
+		char name [32];
+		window_name(name, sizeof(name), window);
+
+		key(name);
+		coda_strappend(out, "{\"count\": %" PRIu64 ", \"sum\": %" PRIu64, h.count(), h.sum);
+
+		for (int i = 0; i < quantiles_num; i++)
+		{
+			coda_strappend(out, ", \"%s\": %" PRIu64, quantile_names[i], h.percentile(quantiles[i]));
+		}
+
+		out += '}';
+	}
+
+	void buckets(const char *name, const blizzard::histogram &h)
+	{
+		key(name);
+		out += '[';
+
+		uint64_t n = 0;
+
+		for (int b = 0; b < blizzard::histogram::BUCKETS; b++)
+		{
+			if (h.counts[b])
+			{
+				coda_strappend(out, "%s[%" PRIu64 ", %" PRIu64 "]", n ? ", " : "", blizzard::histogram::bucket_max(b), n + h.counts[b]);
+				n += h.counts[b];
+			}
+		}
+
+		out += ']';
+	}
+};
+
+/* groups make the prefix of the metric name, unit of the group makes the suffix:
+ * <latency unit="usec"><parse> -> blizzard_latency_parse_usec;
+ * items make labels, and as samples of a family must go together, samples inside
+ * items are collected per family and written when the group of the items is closed */
+
+class prometheus_formatter : public blizzard::stats_formatter
+{
+	struct level
+	{
+		std::string name;
+		std::string unit;
+		std::string labels;
+		bool item;
+	};
+
+	struct family_lines
+	{
+		std::string name;
+		std::string header;
+		std::string lines;
+	};
+
+	std::vector<level> path;
+	std::vector<family_lines> families;
+	std::string last_family;
+
+	/* where samples of the current family go */
+	std::string *dst;
+
+	int items_depth() const
+	{
+		int n = 0;
+
+		for (size_t i = 0; i < path.size(); i++)
+		{
+			if (path[i].item) n++;
+		}
+
+		return n;
+	}
+
+	std::string metric_name(const char *name, const char *suffix = 0) const
+	{
+		std::string res;
+
+		for (size_t i = 0; i < path.size(); i++)
+		{
+			if (path[i].item) continue;
+
+			if (!res.empty()) res += '_';
+			res += path[i].name;
+		}
+
+		if (name)
+		{
+			/* don't repeat the prefix: blizzard_version, not blizzard_blizzard_version */
+			if (0 != strncmp(name, res.c_str(), res.size()) || '_' != name[res.size()])
+			{
+				res += '_';
+			}
+			else
+			{
+				res.clear();
+			}
+
+			res += name;
+		}
+
+		for (size_t i = 0; i < path.size(); i++)
+		{
+			if (!path[i].unit.empty())
+			{
+				res += '_';
+				res += path[i].unit;
+			}
+		}
+
+		if (suffix)
+		{
+			res += suffix;
+		}
+
+		return res;
+	}
+
+	/* labels of the items with the extra ones, e.g. {path="/api",window="10s"} */
+	std::string labels(const char *extra = 0) const
+	{
+		std::string res;
+
+		for (size_t i = 0; i < path.size(); i++)
+		{
+			if (path[i].item)
+			{
+				if (!res.empty()) res += ',';
+				res += path[i].labels;
+			}
+		}
+
+		if (extra && *extra)
+		{
+			if (!res.empty()) res += ',';
+			res += extra;
+		}
+
+		return res.empty() ? res : "{" + res + "}";
+	}
+
+	void family(const std::string &name, const char *type, const char *help)
+	{
+		std::string header;
+
+		if (help)
+		{
+			coda_strappend(header, "# HELP %s %s\n", name.c_str(), help);
+		}
+
+		coda_strappend(header, "# TYPE %s %s\n", name.c_str(), type);
+
+		if (0 == items_depth())
+		{
+			if (name != last_family)
+			{
+				out += header;
+				last_family = name;
+			}
+
+			dst = &out;
+			return;
+		}
+
+		for (size_t i = 0; i < families.size(); i++)
+		{
+			if (families[i].name == name)
+			{
+				dst = &families[i].lines;
+				return;
+			}
+		}
+
+		families.push_back(family_lines());
+		families.back().name = name;
+		families.back().header = header;
+
+		dst = &families.back().lines;
+	}
+
+	static void escape(std::string &res, const char *value)
+	{
+		for (const char *p = value; *p; p++)
+		{
+			if ('"' == *p || '\\' == *p)
+			{
+				res += '\\';
+				res += *p;
+			}
+			else if ('\n' == *p)
+			{
+				res += "\\n";
+			}
+			else
+			{
+				res += *p;
+			}
+		}
+	}
+
+	void flush()
+	{
+		for (size_t i = 0; i < families.size(); i++)
+		{
+			out += families[i].header;
+			out += families[i].lines;
+		}
+
+		families.clear();
+	}
+
+	void push(const char *name, const char *unit, bool item)
+	{
+		path.push_back(level());
+		path.back().name = name;
+		path.back().unit = unit ? unit : "";
+		path.back().item = item;
+	}
+
+public:
+	prometheus_formatter(std::string &o) : stats_formatter(o), dst(&o) {}
+
+	const char *content_type() const
+	{
+		return "text/plain; version=0.0.4";
+	}
+
+	void begin(const char *)
+	{
+		push("blizzard", 0, false);
+	}
+
+	void end()
+	{
+		while (!path.empty())
+		{
+			close();
+		}
+	}
+
+	void open(const char *group, const char *unit)
+	{
+		push(group, unit, false);
+	}
+
+	void open_item(const char *group, const char *label, const char *value)
+	{
+		push(group, 0, true);
+
+		path.back().labels = label;
+		path.back().labels += "=\"";
+		escape(path.back().labels, value);
+		path.back().labels += '"';
+	}
+
+	void close()
+	{
+		bool item = path.back().item;
+		path.pop_back();
+
+		/* the group of the items is closed */
+		if (!item && 0 == items_depth())
+		{
+			flush();
+		}
+	}
+
+	void info(const char *name, const char *value)
+	{
+		std::string metric = metric_name(name, "_info");
+
+		std::string extra = name;
+		extra += "=\"";
+		escape(extra, value);
+		extra += '"';
+
+		family(metric, "gauge", 0);
+		coda_strappend(*dst, "%s%s 1\n", metric.c_str(), labels(extra.c_str()).c_str());
+	}
+
+	void integer(const char *name, int kind, uint64_t value, const char *help)
+	{
+		std::string metric = metric_name(name, COUNTER == kind ? "_total" : 0);
+
+		family(metric, COUNTER == kind ? "counter" : "gauge", help);
+		coda_strappend(*dst, "%s%s %" PRIu64 "\n", metric.c_str(), labels().c_str(), value);
+	}
+
+	void real(const char *name, int kind, double value, int precision, const char *help)
+	{
+		std::string metric = metric_name(name, COUNTER == kind ? "_total" : 0);
+
+		family(metric, COUNTER == kind ? "counter" : "gauge", help);
+		coda_strappend(*dst, "%s%s %.*f\n", metric.c_str(), labels().c_str(), precision, value);
+	}
+
+	void percentiles(int window, const blizzard::histogram &h)
+	{
+		std::string metric = metric_name(0);
+
+		char wnd [64];
+
+		if (window)
+		{
+			snprintf(wnd, sizeof(wnd), "window=\"%ds\"", window);
+		}
+		else
+		{
+			snprintf(wnd, sizeof(wnd), "window=\"total\"");
+		}
+
+		family(metric, "summary", 0);
+
+		for (int i = 0; i < quantiles_num; i++)
+		{
+			char q [128];
+			snprintf(q, sizeof(q), "%s,quantile=\"%g\"", wnd, quantiles[i]);
+
+			coda_strappend(*dst, "%s%s %" PRIu64 "\n", metric.c_str(), labels(q).c_str(), h.percentile(quantiles[i]));
+		}
+
+		coda_strappend(*dst, "%s_sum%s %" PRIu64 "\n", metric.c_str(), labels(wnd).c_str(), h.sum);
+		coda_strappend(*dst, "%s_count%s %" PRIu64 "\n", metric.c_str(), labels(wnd).c_str(), h.count());
+	}
+
+	void buckets(const char *name, const blizzard::histogram &h)
+	{
+		std::string metric = metric_name(name);
+
+		family(metric, "histogram", 0);
+
+		uint64_t n = 0;
+
+		for (int b = 0; b < blizzard::histogram::BUCKETS; b++)
+		{
+			if (h.counts[b])
+			{
+				char le [64];
+				snprintf(le, sizeof(le), "le=\"%" PRIu64 "\"", blizzard::histogram::bucket_max(b));
+
+				n += h.counts[b];
+				coda_strappend(*dst, "%s_bucket%s %" PRIu64 "\n", metric.c_str(), labels(le).c_str(), n);
+			}
+		}
+
+		coda_strappend(*dst, "%s_bucket%s %" PRIu64 "\n", metric.c_str(), labels("le=\"+Inf\"").c_str(), n);
+		coda_strappend(*dst, "%s_sum%s %" PRIu64 "\n", metric.c_str(), labels().c_str(), h.sum);
+		coda_strappend(*dst, "%s_count%s %" PRIu64 "\n", metric.c_str(), labels().c_str(), n);
+	}
+
+	bool needs_buckets() const
+	{
+		return true;
+	}
+};
+
+}
+
+blizzard::stats_formatter *blizzard::stats_formatter::create(int fmt, std::string &out)
+{
+	switch (fmt)
+	{
+	case FORMAT_JSON:
+		return new json_formatter(out);
+
+	case FORMAT_PROMETHEUS:
+		return new prometheus_formatter(out);
+
+	default:
+		return new xml_formatter(out);
+	}
+}
+
+int blizzard::stats_formatter::negotiate(const char *suffix, const char *accept)
+{
+	if (suffix && *suffix)
+	{
+		if (0 == strcmp(suffix, ".xml")) return FORMAT_XML;
+		if (0 == strcmp(suffix, ".json")) return FORMAT_JSON;
+		if (0 == strcmp(suffix, ".prom")) return FORMAT_PROMETHEUS;
+
+		return -1;
+	}
+
+	if (accept)
+	{
+		if (strstr(accept, "application/json")) return FORMAT_JSON;
+		if (strstr(accept, "application/openmetrics-text") || strstr(accept, "version=0.0.4")) return FORMAT_PROMETHEUS;
+	}
+
+	return FORMAT_XML;
+}
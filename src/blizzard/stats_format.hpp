@@ -0,0 +1,73 @@
+#ifndef __BLIZZARD_STATS_FORMAT_HPP__
+#define __BLIZZARD_STATS_FORMAT_HPP__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "histogram.hpp"
+
+namespace blizzard {
+
+/* Stats are emitted as a tree of groups with named values, formatters render it
+ * as XML (default), JSON or Prometheus text exposition format */
+
+class stats_formatter
+{
+public:
+	enum format
+	{
+		FORMAT_XML = 0,
+		FORMAT_JSON,
+		FORMAT_PROMETHEUS
+	};
+
+	enum kind
+	{
+		COUNTER = 0,
+		GAUGE
+	};
+
+protected:
+	std::string &out;
+
+	stats_formatter(std::string &o) : out(o) {}
+
+public:
+	virtual ~stats_formatter() {}
+
+	static stats_formatter *create(int fmt, std::string &out);
+
+	/* by suffix of the path after stats URI (".xml", ".json", ".prom") or by "Accept" header
+	 * if there is no suffix, -1 if the suffix is unknown */
+	static int negotiate(const char *suffix, const char *accept);
+
+	virtual const char *content_type() const = 0;
+
+	virtual void begin(const char *root) = 0;
+	virtual void end() = 0;
+
+	/* unit (e.g. "usec") applies to all values of the group */
+	virtual void open(const char *group, const char *unit = 0) = 0;
+
+	/* one of the same groups distinguished by a label, e.g. <route path="/api"> */
+	virtual void open_item(const char *group, const char *label, const char *value) = 0;
+
+	virtual void close() = 0;
+
+	virtual void info(const char *name, const char *value) = 0;
+	virtual void integer(const char *name, int kind, uint64_t value, const char *help = 0) = 0;
+	virtual void real(const char *name, int kind, double value, int precision, const char *help = 0) = 0;
+
+	/* count and percentiles of the histogram for the last (window) seconds, 0 means since start */
+	virtual void percentiles(int window, const histogram &h) = 0;
+
+	/* all non-empty buckets of the histogram */
+	virtual void buckets(const char *name, const histogram &h) = 0;
+
+	/* e.g. prometheus has no other way to aggregate percentiles of several servers */
+	virtual bool needs_buckets() const { return false; }
+};
+
+}
+
+#endif /* __BLIZZARD_STATS_FORMAT_HPP__ */
@@ -0,0 +1,41 @@
+#ifndef __BLIZZARD_STREAM_SESSION_HPP__
+#define __BLIZZARD_STREAM_SESSION_HPP__
+
+namespace blizzard {
+
+struct http;
+
+/* A connection carrying several requests at once (HTTP/2, binary RPC). Every request is an http
+ * object of its own with the connection in session_conn, it goes through the queues like a
+ * request of HTTP/1 and its response is handed back to the session of the connection. */
+
+class stream_session
+{
+public:
+	virtual ~stream_session() {}
+
+	/* the connection is readable or writable */
+	virtual void process() = 0;
+
+	/* the response of a request is ready */
+	virtual void respond(http *task) = 0;
+
+	/* shutdown: the requests in progress are finished, new ones are refused */
+	virtual void go_away() = 0;
+
+	/* there are requests in progress */
+	virtual bool busy() const = 0;
+
+	/* shutdown report: the requests in the queues or the plugin and those being read or written */
+	virtual void count_requests(int& in_plugin, int& in_network) const = 0;
+
+	/* the socket is closed, false if the requests in the queues still hold the connection */
+	virtual bool close() = 0;
+
+	/* finalize: the threads are joined, the requests still held are freed with the connection */
+	virtual void abort() = 0;
+};
+
+}
+
+#endif /* __BLIZZARD_STREAM_SESSION_HPP__ */
@@ -0,0 +1,175 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+#include <coda/error.hpp>
+#include <coda/logger.h>
+#include "capture.hpp"
+#include "http.hpp"
+#include "warmup.hpp"
+
+namespace {
+
+enum {MAX_REQUEST_SIZE = 1 << 20};
+
+/* parses a request from the socket of the replay without owning it */
+struct warmup_http : public blizzard::http
+{
+	void attach(struct ev_loop *loop)
+	{
+		ev_now_update(loop);
+
+		server_loop = loop;
+		response_time = ev_now(loop);
+	}
+
+	void detach()
+	{
+		fd = -1;
+	}
+};
+
+struct warmup_request
+{
+	struct in_addr ip;
+	std::string bytes;
+};
+
+bool read_requests(const std::string& file_name, std::vector<warmup_request>& requests)
+{
+	FILE *f = fopen(file_name.c_str(), "rb");
+
+	if (0 == f)
+	{
+		log_error("warmup: can't open %s: %s", file_name.c_str(), coda_strerror(errno));
+		return false;
+	}
+
+	bool ok = true;
+	blizzard::capture_record rec;
+
+	while (1 == fread(&rec, sizeof(rec), 1, f))
+	{
+		if (blizzard::capture_record::MAGIC != rec.magic || MAX_REQUEST_SIZE < rec.length)
+		{
+			log_error("warmup: %s is not a capture file or is damaged after %d requests", file_name.c_str(), (int) requests.size());
+			ok = false;
+			break;
+		}
+
+		warmup_request r;
+		r.ip.s_addr = rec.ip;
+		r.bytes.resize(rec.length);
+
+		if (rec.length && 1 != fread(&r.bytes[0], rec.length, 1, f))
+		{
+			log_error("warmup: %s is truncated after %d requests", file_name.c_str(), (int) requests.size());
+			ok = false;
+			break;
+		}
+
+		requests.push_back(r);
+	}
+
+	fclose(f);
+
+	return ok;
+}
+
+}
+
+void blizzard::replay_warmup(blz_plugin *plugin, const blz_config::BLZ::PLUGIN& pd, warmup_result& res)
+{
+	std::vector<warmup_request> requests;
+
+	/* the requests read before an error are replayed anyway */
+	read_requests(pd.warmup_file, requests);
+
+	if (requests.empty())
+	{
+		return;
+	}
+
+	int sv[2];
+
+	if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+	{
+		log_error("warmup: socketpair failed: %s", coda_strerror(errno));
+		return;
+	}
+
+	fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+
+	int sz = MAX_REQUEST_SIZE + 4096;
+	setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+	setsockopt(sv[0], SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+
+	/* the loop of the event thread runs meanwhile, it isn't touched here */
+	struct ev_loop *loop = ev_loop_new(EVFLAG_AUTO);
+
+	if (0 == loop)
+	{
+		log_error("warmup: can't create an event loop");
+
+		close(sv[0]);
+		close(sv[1]);
+		return;
+	}
+
+	warmup_http *con = new warmup_http;
+	char buf [65536];
+
+	for (int n = 0; n < pd.warmup_repeat; n++)
+	{
+		for (size_t i = 0; i < requests.size(); i++)
+		{
+			const warmup_request& r = requests[i];
+
+			res.requests++;
+
+			if ((ssize_t) r.bytes.size() != write(sv[1], r.bytes.data(), r.bytes.size()))
+			{
+				res.errors++;
+			}
+			else
+			{
+				con->init(sv[0], r.ip);
+				con->attach(loop);
+				con->allow_read();
+				con->process();
+
+				int rc = BLZ_ERROR;
+
+				if (http::sReadyToHandle == con->state())
+				{
+					rc = plugin->easy(con);
+
+					if (BLZ_AGAIN == rc && pd.hard_threads)
+					{
+						rc = plugin->hard(con);
+					}
+				}
+
+				if (BLZ_OK != rc)
+				{
+					res.errors++;
+				}
+
+				con->detach();
+			}
+
+			/* the rest of a request which wasn't parsed */
+			while (0 < read(sv[0], buf, sizeof(buf)));
+		}
+	}
+
+	delete con;
+	ev_loop_destroy(loop);
+
+	close(sv[0]);
+	close(sv[1]);
+}
@@ -0,0 +1,30 @@
+#ifndef __BLIZZARD_WARMUP_HPP__
+#define __BLIZZARD_WARMUP_HPP__
+
+#include <ev.h>
+#include <stdint.h>
+#include "config.hpp"
+#include "plugin.hpp"
+
+namespace blizzard {
+
+/* Warm-up replay: the requests of <plugin:warmup_file> (a capture file, see capture.hpp) are
+ * parsed as if they came from their clients and passed to easy() and, if it returns BLZ_AGAIN
+ * and the section has hard threads, to hard() of the plugin, the responses are dropped.
+ * The plugin doesn't serve yet, so everything runs in the calling thread, which has called
+ * thread_init() of the plugin, with an event loop of its own for the time of requests. */
+
+struct warmup_result
+{
+	uint32_t requests;
+	uint32_t errors;  /* not parsed or not BLZ_OK */
+
+	warmup_result() : requests(0), errors(0) {}
+};
+
+/* a file which can't be read is logged and the plugin starts cold */
+void replay_warmup(blz_plugin *plugin, const blz_config::BLZ::PLUGIN& pd, warmup_result& res);
+
+}
+
+#endif /* __BLIZZARD_WARMUP_HPP__ */
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""Compares two results of `blizzard-microbench -f json`.
+
+    blizzard-microbench -f json -l old > old.json
+    blizzard-microbench -f json -l new > new.json
+    tools/microbench_compare.py old.json new.json [--threshold 5]
+
+Prints ns/op of both builds and the change; a change greater than the threshold (percent)
+which is also outside of the min..max range of the old build is marked. Exit status is 1
+if something got slower, so it could be used in CI.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(name):
+    with open(name) as f:
+        data = json.load(f)
+    return data.get("context", {}), dict((b["name"], b) for b in data["benchmarks"])
+
+
+def main():
+    parser = argparse.ArgumentParser(description="compare two blizzard-microbench json results")
+    parser.add_argument("old")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=5.0, help="percent of change to report (5)")
+    args = parser.parse_args()
+
+    old_ctx, old = load(args.old)
+    new_ctx, new = load(args.new)
+
+    print("old: %s %s" % (old_ctx.get("label", ""), old_ctx.get("date", "")))
+    print("new: %s %s" % (new_ctx.get("label", ""), new_ctx.get("date", "")))
+    print()
+    print("%-36s %12s %12s %9s" % ("benchmark", "old ns/op", "new ns/op", "change"))
+
+    slower = False
+
+    for name in list(old) + [n for n in new if n not in old]:
+        if name not in old or name not in new:
+            print("%-36s %12s %12s" % (name, "%.1f" % old[name]["ns_per_op"] if name in old else "-",
+                                       "%.1f" % new[name]["ns_per_op"] if name in new else "-"))
+            continue
+
+        o = old[name]
+        n = new[name]
+        change = (n["ns_per_op"] - o["ns_per_op"]) / o["ns_per_op"] * 100
+
+        mark = ""
+        if abs(change) >= args.threshold and not (o["ns_per_op_min"] <= n["ns_per_op"] <= o["ns_per_op_max"]):
+            mark = "  slower" if change > 0 else "  faster"
+            slower = slower or change > 0
+
+        print("%-36s %12.1f %12.1f %+8.1f%%%s" % (name, o["ns_per_op"], n["ns_per_op"], change, mark))
+
+    return 1 if slower else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Checks that blizzard exits on SIGTERM with requests of HTTP/2 and RPC still in progress.
+
+    tools/shutdown_test.py --pid-file /var/run/blizzard.pid --h2 127.0.0.1:80 \\
+        --rpc 127.0.0.1:8081 --path /slow --requests 8 --timeout 10
+
+The path should keep the easy threads of the plugin busy for longer than <shutdown_timeout>,
+so that some requests are in the plugin and some in the queues when the drain ends. Every
+connection gets all of its requests at once, then the server gets SIGTERM. Exit status is 1
+if the process is still running after the timeout.
+"""
+
+import argparse
+import os
+import signal
+import socket
+import struct
+import sys
+import time
+
+
+def address(s):
+    host, port = s.rsplit(":", 1)
+    return host, int(port)
+
+
+def h2_frame(type_, flags, stream_id, payload):
+    return struct.pack(">I", len(payload))[1:] + struct.pack(">BBI", type_, flags, stream_id) + payload
+
+
+def h2_literal(name, value):
+    """literal header field without indexing, new name, no huffman"""
+    return b"\x00" + bytes([len(name)]) + name + bytes([len(value)]) + value
+
+
+def h2_requests(addr, path, n):
+    s = socket.create_connection(addr)
+    data = b"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" + h2_frame(4, 0, 0, b"")
+
+    for i in range(n):
+        block = h2_literal(b":method", b"GET") + h2_literal(b":scheme", b"http") \
+            + h2_literal(b":path", path.encode()) + h2_literal(b":authority", addr[0].encode())
+        data += h2_frame(1, 0x1 | 0x4, 1 + 2 * i, block)
+
+    s.sendall(data)
+    return s
+
+
+def rpc_requests(addr, path, n):
+    s = socket.create_connection(addr)
+    p = path.encode()
+    data = b""
+
+    for i in range(n):
+        rest = struct.pack(">IBBHHH", i + 1, 1, 0, len(p), 0, 0) + p
+        data += struct.pack(">I", len(rest)) + rest
+
+    s.sendall(data)
+    return s
+
+
+def running(pid):
+    try:
+        os.kill(pid, 0)
+    except ProcessLookupError:
+        return False
+
+    # a zombie of our own child isn't running
+    try:
+        with open("/proc/%d/stat" % pid) as f:
+            return f.read().split(")")[-1].split()[0] != "Z"
+    except OSError:
+        return True
+
+
+def main():
+    parser = argparse.ArgumentParser(description="blizzard shutdown with requests in progress")
+    parser.add_argument("--pid-file", required=True)
+    parser.add_argument("--h2", help="host:port of a listener with <http2 enabled=\"1\"/>")
+    parser.add_argument("--rpc", help="host:port of an <rpc_port> listener")
+    parser.add_argument("--path", default="/", help="path of a slow request (/)")
+    parser.add_argument("--requests", type=int, default=8, help="requests per connection (8)")
+    parser.add_argument("--timeout", type=float, default=10.0, help="seconds to wait for the exit (10)")
+    args = parser.parse_args()
+
+    if not args.h2 and not args.rpc:
+        parser.error("--h2 or --rpc is required")
+
+    with open(args.pid_file) as f:
+        pid = int(f.read())
+
+    conns = []
+
+    if args.h2:
+        conns.append(h2_requests(address(args.h2), args.path, args.requests))
+
+    if args.rpc:
+        conns.append(rpc_requests(address(args.rpc), args.path, args.requests))
+
+    # the requests reach the queues and the plugin
+    time.sleep(0.2)
+    os.kill(pid, signal.SIGTERM)
+
+    started = time.time()
+
+    while running(pid) and time.time() - started < args.timeout:
+        time.sleep(0.05)
+
+    for s in conns:
+        s.close()
+
+    if running(pid):
+        print("FAIL: pid %d is running %.1f s after SIGTERM" % (pid, args.timeout))
+        return 1
+
+    print("OK: pid %d exited in %.3f s" % (pid, time.time() - started))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())